@@ -0,0 +1,86 @@
+#include "../common/colorsearch.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <vector>
+
+// Times every nearest-colour strategy (index build + queries) for several palette sizes, query
+// counts and component widths. The thresholds in common/colorsearch.hpp come from these numbers.
+
+namespace {
+  constexpr size_t CLUSTER_COUNT = 8;
+  constexpr unsigned int CLUSTER_SPREAD_DIVISOR = 16; // Cluster width as a fraction of the component range
+
+  // Uniform colours, or colours packed around a few centres like the palette of a real photograph.
+  template <typename C>
+  auto randomColors(size_t count, unsigned int seed, bool clustered) -> std::vector<RGBColor<C>> {
+    std::mt19937 generator(seed);
+    unsigned int const max_value = std::numeric_limits<C>::max();
+    std::uniform_int_distribution<unsigned int> distribution(0, max_value);
+    std::uniform_int_distribution<unsigned int> offset(0, max_value / CLUSTER_SPREAD_DIVISOR);
+    std::vector<RGBColor<C>> centres(CLUSTER_COUNT);
+    for (auto &centre : centres) {
+      centre = {.red=static_cast<C>(distribution(generator)), .green=static_cast<C>(distribution(generator)),
+                .blue=static_cast<C>(distribution(generator))};
+    }
+    auto const component = [&](C centre) {
+      return clustered ? static_cast<C>(std::min(max_value, centre + offset(generator)))
+                       : static_cast<C>(distribution(generator));
+    };
+    std::vector<RGBColor<C>> colors(count);
+    for (size_t i = 0; i < count; ++i) {
+      const auto &centre = centres[i % CLUSTER_COUNT];
+      colors[i].red = component(centre.red);
+      colors[i].green = component(centre.green);
+      colors[i].blue = component(centre.blue);
+    }
+    return colors;
+  }
+
+  // Milliseconds spent building the index and answering every query.
+  template <typename C>
+  auto timeStrategy(const std::vector<RGBColor<C>> &palette, const std::vector<RGBColor<C>> &queries,
+                    NearestStrategy strategy) -> double {
+    auto const start = std::chrono::steady_clock::now();
+    auto const index = buildColorIndex(palette, strategy, queries.size());
+    size_t checksum = 0;
+    for (const auto &query : queries) { checksum += nearestColor(index, query, 0.0).position; }
+    auto const end = std::chrono::steady_clock::now();
+    if (checksum == std::numeric_limits<size_t>::max()) { std::cout << checksum; } // Keep the loop alive
+    return std::chrono::duration<double, std::milli>(end - start).count();
+  }
+
+  template <typename C>
+  void benchWidth(bool clustered) {
+    std::cout << "\n" << componentBits<RGBColor<C>>() << "-bit components, "
+              << (clustered ? "clustered" : "uniform") << " palette\n";
+    std::cout << std::setw(9) << "palette" << std::setw(9) << "queries" << std::setw(11) << "linear"
+              << std::setw(11) << "kdtree" << std::setw(11) << "grid" << std::setw(9) << "auto\n";
+    for (size_t const palette_size : {16UL, 64UL, 256UL, 1024UL, 4096UL, 16384UL, 65536UL}) {
+      for (size_t const query_count : {16UL, 256UL, 4096UL, 65536UL}) {
+        auto const palette = randomColors<C>(palette_size, 1, clustered);
+        auto const queries = randomColors<C>(query_count, 2, false);
+        std::cout << std::setw(9) << palette_size << std::setw(9) << query_count << std::fixed << std::setprecision(2);
+        for (NearestStrategy const strategy : {NearestStrategy::linear, NearestStrategy::kdtree, NearestStrategy::grid}) {
+          std::cout << std::setw(11) << timeStrategy(palette, queries, strategy);
+        }
+        std::cout << std::setw(9)
+                  << nearestStrategyName(chooseNearestStrategy(query_count, palette_size, componentBits<RGBColor<C>>()))
+                  << "\n";
+      }
+    }
+  }
+}
+
+auto main() -> int {
+  std::cout << "Nearest-colour search, build + queries in ms\n";
+  for (bool const clustered : {false, true}) {
+    benchWidth<uint8_t>(clustered);
+    benchWidth<uint16_t>(clustered);
+  }
+  return 0;
+}
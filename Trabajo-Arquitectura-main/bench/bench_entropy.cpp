@@ -0,0 +1,74 @@
+#include "../common/bitpack.hpp"
+#include "../common/entropycoder.hpp"
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <vector>
+
+// Throughput of the CPPM index codings (bit packing, run-length + rANS) on synthetic index streams: a flat
+// "screenshot" with long runs, and noise where runs do not help. MB/s are of 4-byte input indices.
+
+namespace {
+  constexpr size_t PIXELS = size_t{1} << 24;
+  constexpr size_t TABLE_SIZE = 300;
+  constexpr double BYTES_PER_MB = 1e6;
+
+  auto flatIndices(std::mt19937 &generator) -> std::vector<uint32_t> {
+    std::vector<uint32_t> indices;
+    std::uniform_int_distribution<uint32_t> run(1, 400);
+    std::uniform_int_distribution<uint32_t> color(0, TABLE_SIZE - 1);
+    while (indices.size() < PIXELS) { indices.insert(indices.end(), run(generator), color(generator)); }
+    indices.resize(PIXELS);
+    return indices;
+  }
+
+  auto noiseIndices(std::mt19937 &generator) -> std::vector<uint32_t> {
+    std::vector<uint32_t> indices(PIXELS);
+    std::geometric_distribution<uint32_t> color(0.05); // Skewed, like a real palette
+    for (auto &index : indices) { index = std::min<uint32_t>(color(generator), TABLE_SIZE - 1); }
+    return indices;
+  }
+
+  template<typename Function>
+  auto megabytesPerSecond(const Function &function) -> double {
+    auto const start = std::chrono::steady_clock::now();
+    function();
+    auto const end = std::chrono::steady_clock::now();
+    return static_cast<double>(PIXELS * sizeof(uint32_t)) / BYTES_PER_MB /
+           std::chrono::duration<double>(end - start).count();
+  }
+
+  void bench(const char *name, const std::vector<uint32_t> &indices) {
+    unsigned const index_bytes = 2;
+    std::vector<uint64_t> words;
+    std::vector<uint8_t> runs;
+    RansFrequencies frequencies{};
+    std::vector<uint8_t> coded;
+    double const pack = megabytesPerSecond([&] { words = packBits(indices, bitWidthFor(TABLE_SIZE)); });
+    double const unpack = megabytesPerSecond([&] {
+      if (unpackBits(words, bitWidthFor(TABLE_SIZE), PIXELS) != indices) { std::cout << "unpack mismatch\n"; }
+    });
+    double const encode = megabytesPerSecond([&] {
+      runs = encodeRuns(indices, index_bytes);
+      frequencies = normalizeFrequencies(runs);
+      coded = ransEncode(runs, frequencies);
+    });
+    double const decode = megabytesPerSecond([&] {
+      if (decodeRuns(ransDecode(coded, frequencies, runs.size()), index_bytes, PIXELS) != indices) {
+        std::cout << "decode mismatch\n";
+      }
+    });
+    std::cout << std::fixed << std::setprecision(0) << name << ": bitpack " << words.size() * sizeof(uint64_t)
+              << " bytes, pack " << pack << " MB/s, unpack " << unpack << " MB/s; entropy " << coded.size()
+              << " bytes (runs " << runs.size() << "), encode " << encode << " MB/s, decode " << decode << " MB/s\n";
+  }
+}
+
+auto main() -> int {
+  std::mt19937 generator(1);
+  bench("flat", flatIndices(generator));
+  bench("noise", noiseIndices(generator));
+  return 0;
+}
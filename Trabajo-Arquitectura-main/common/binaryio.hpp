@@ -3,6 +3,7 @@
 
 #include <stdexcept>
 #include <iostream>
+#include <vector>
 
 template<typename T>
 auto read_binary(std::istream &input) -> T {
@@ -22,4 +23,24 @@ void write_binary(std::ostream &output, T const &value) {
     }
 }
 
+// Writes a whole buffer of values with a single call.
+template<typename T>
+void write_binary_buffer(std::ostream &output, const std::vector<T> &values) {
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+    if (!output.write(reinterpret_cast<const char*>(values.data()), static_cast<std::streamsize>(values.size() * sizeof(T)))) {
+      throw std::runtime_error("Failed to write binary data.");
+    }
+}
+
+// Reads 'count' values with a single call.
+template<typename T>
+auto read_binary_buffer(std::istream &input, size_t count) -> std::vector<T> {
+    std::vector<T> values(count);
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+    if (!input.read(reinterpret_cast<char*>(values.data()), static_cast<std::streamsize>(count * sizeof(T)))) {
+      throw std::runtime_error("Error reading binary data");
+    }
+    return values;
+}
+
 #endif // BINARY_IO_HPP
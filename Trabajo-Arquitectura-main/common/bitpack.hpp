@@ -0,0 +1,107 @@
+#ifndef BITPACK_HPP
+#define BITPACK_HPP
+
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+// Fixed-width bit packing of unsigned values (CPPM pixel indices). Value i takes bits [i * bits, (i + 1) * bits)
+// of a stream of 64-bit words, lowest bits first. Packing fills one whole word at a time. Unpacking reads each
+// value with two word loads and no branch; with AVX2, values up to 25 bits wide are extracted 8 at a time by one
+// gather of unaligned 32-bit loads.
+
+constexpr unsigned BITPACK_WORD_BITS = 64;
+constexpr unsigned BITPACK_MAX_BITS = 32;
+constexpr unsigned BITPACK_GATHER_MAX_BITS = 25; // Value plus its bit offset in a byte fit in 32 bits.
+constexpr size_t BITPACK_GATHER_LANES = 8;
+
+// Bits needed to store any index of a table with table_size entries (0 for a single entry).
+inline auto bitWidthFor(size_t table_size) -> unsigned {
+  return table_size <= 1 ? 0 : static_cast<unsigned>(std::bit_width(table_size - 1));
+}
+
+// Words used by 'count' values of 'bits' bits.
+inline auto packedWordCount(size_t count, unsigned bits) -> size_t {
+  return (count * bits + BITPACK_WORD_BITS - 1) / BITPACK_WORD_BITS;
+}
+
+// Packs values (each below 2^bits) into words.
+inline auto packBits(const std::vector<uint32_t> &values, unsigned bits) -> std::vector<uint64_t> {
+  std::vector<uint64_t> words(packedWordCount(values.size(), bits), 0);
+  if (bits == 0) { return words; }
+  uint64_t word = 0;
+  unsigned filled = 0; // Bits of 'word' in use
+  size_t next = 0;
+  for (uint32_t const value : values) {
+    word |= static_cast<uint64_t>(value) << filled;
+    filled += bits;
+    if (filled >= BITPACK_WORD_BITS) { // Word full, the bits that did not fit start the next one
+      words[next++] = word;
+      filled -= BITPACK_WORD_BITS;
+      word = filled == 0 ? 0 : static_cast<uint64_t>(value) >> (bits - filled);
+    }
+  }
+  if (filled > 0) { words[next] = word; }
+  return words;
+}
+
+// Values [begin, end) out of words padded with one extra zero word.
+inline void unpackBitsScalar(const std::vector<uint64_t> &words, unsigned bits, size_t begin, size_t end,
+                             std::vector<uint32_t> &values) {
+  uint64_t const mask = (uint64_t{1} << bits) - 1;
+  for (size_t i = begin; i < end; ++i) {
+    size_t const position = i * bits;
+    size_t const word = position / BITPACK_WORD_BITS;
+    unsigned const offset = static_cast<unsigned>(position % BITPACK_WORD_BITS);
+    uint64_t const low = words[word] >> offset;
+    uint64_t const high = (words[word + 1] << 1) << (BITPACK_WORD_BITS - 1 - offset); // 0 when offset is 0
+    values[i] = static_cast<uint32_t>((low | high) & mask);
+  }
+}
+
+#ifdef __AVX2__
+// Values [0, end) with end a multiple of 8, for bits <= BITPACK_GATHER_MAX_BITS. Every lane loads the 32 bits
+// starting at the byte that holds the first bit of its value (x86 is little-endian, so bytes follow stream order).
+// NOLINTBEGIN(cppcoreguidelines-pro-type-reinterpret-cast,cppcoreguidelines-pro-bounds-pointer-arithmetic)
+inline void unpackBitsGather(const std::vector<uint64_t> &words, unsigned bits, size_t end,
+                             std::vector<uint32_t> &values) {
+  auto const *bytes = reinterpret_cast<const char *>(words.data());
+  __m256i const mask = _mm256_set1_epi32(static_cast<int32_t>((uint32_t{1} << bits) - 1));
+  __m256i const lane_bits = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7),
+                                               _mm256_set1_epi32(static_cast<int32_t>(bits)));
+  __m256i const byte_bits = _mm256_set1_epi32(7);
+  for (size_t i = 0; i < end; i += BITPACK_GATHER_LANES) {
+    size_t const position = i * bits; // Offsets stay small relative to the block's first byte
+    __m256i const bit = _mm256_add_epi32(_mm256_set1_epi32(static_cast<int32_t>(position % 8)), lane_bits);
+    __m256i const loaded = _mm256_i32gather_epi32(reinterpret_cast<const int *>(bytes + (position / 8)),
+                                                  _mm256_srli_epi32(bit, 3), 1);
+    __m256i const unpacked = _mm256_and_si256(_mm256_srlv_epi32(loaded, _mm256_and_si256(bit, byte_bits)), mask);
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(&values[i]), unpacked);
+  }
+}
+// NOLINTEND(cppcoreguidelines-pro-type-reinterpret-cast,cppcoreguidelines-pro-bounds-pointer-arithmetic)
+#endif
+
+// Unpacks 'count' values of 'bits' bits. 'words' gets one zero word appended, so every read stays inside it.
+inline auto unpackBits(std::vector<uint64_t> &words, unsigned bits, size_t count) -> std::vector<uint32_t> {
+  std::vector<uint32_t> values(count, 0);
+  if (bits == 0) { return values; }
+  words.push_back(0);
+  size_t begin = 0;
+#ifdef __AVX2__
+  if (bits <= BITPACK_GATHER_MAX_BITS) {
+    begin = count / BITPACK_GATHER_LANES * BITPACK_GATHER_LANES;
+    unpackBitsGather(words, bits, begin, values);
+  }
+#endif
+  unpackBitsScalar(words, bits, begin, count, values);
+  words.pop_back();
+  return values;
+}
+
+#endif // BITPACK_HPP
@@ -0,0 +1,213 @@
+#ifndef COLORKERNEL_HPP
+#define COLORKERNEL_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+// Batched squared-distance kernel for linear nearest-colour scans.
+// The palette is kept as three aligned integer planes (one per component). With AVX2 every instruction
+// evaluates a whole vector of candidates (8 for 8-bit colours, 4 for 16-bit ones, whose squared distances
+// need 64 bits); without it a scalar loop over the same planes is used. Both give the same answer: the
+// smallest squared distance and, among equal distances, the lowest palette position.
+
+constexpr size_t PLANE_ALIGNMENT = 64; // Bytes, one cache line.
+constexpr size_t PLANE_VECTOR_BYTES = 32; // Bytes per AVX2 register.
+constexpr size_t PLANE_BLOCK = 64; // Candidates scanned between two early-exit checks.
+// Padding colour (red only), farther from any real colour than any other real colour.
+constexpr int32_t PLANE_PAD_8BIT = 30000;
+constexpr int64_t PLANE_PAD_16BIT = 1 << 20;
+
+// Minimal allocator handing out PLANE_ALIGNMENT aligned storage, so the planes can be loaded aligned.
+template<typename T>
+struct AlignedAllocator {
+    using value_type = T;
+
+    AlignedAllocator() = default;
+    template<typename U>
+    explicit AlignedAllocator(const AlignedAllocator<U> & /*other*/) {}
+
+    auto allocate(size_t count) -> T * {
+      return static_cast<T *>(::operator new(count * sizeof(T), std::align_val_t{PLANE_ALIGNMENT}));
+    }
+
+    void deallocate(T *pointer, size_t /*count*/) { ::operator delete(pointer, std::align_val_t{PLANE_ALIGNMENT}); }
+
+    template<typename U>
+    auto operator==(const AlignedAllocator<U> & /*other*/) const -> bool { return true; }
+};
+
+template<typename T>
+using AlignedVector = std::vector<T, AlignedAllocator<T>>;
+
+// Palette split by component. Lane is int32_t for 8-bit colours and int64_t for 16-bit ones.
+template<typename Lane>
+struct PalettePlanes {
+    AlignedVector<Lane> red; // Padded up to a whole number of blocks.
+    AlignedVector<Lane> green;
+    AlignedVector<Lane> blue;
+    size_t size = 0; // Real palette colours.
+};
+
+// Closest plane entry found by a scan.
+struct PlaneMatch {
+    size_t position = 0; // Palette position of the closest colour.
+    uint64_t distance = std::numeric_limits<uint64_t>::max(); // Its squared distance.
+    size_t scanned = 0; // Palette colours scanned before stopping.
+};
+
+template<typename Lane>
+constexpr auto planePad() -> Lane {
+  if constexpr (std::is_same_v<Lane, int32_t>) { return PLANE_PAD_8BIT; }
+  return static_cast<Lane>(PLANE_PAD_16BIT);
+}
+
+// Copies any colour list (members red, green and blue) into planes.
+template<typename Lane, typename ColorType>
+auto makePalettePlanes(const std::vector<ColorType> &colors) -> PalettePlanes<Lane> {
+  static_assert(std::is_same_v<Lane, int32_t> || std::is_same_v<Lane, int64_t>, "Lane must be int32_t or int64_t");
+  PalettePlanes<Lane> planes;
+  planes.size = colors.size();
+  size_t const padded = (colors.size() + PLANE_BLOCK - 1) / PLANE_BLOCK * PLANE_BLOCK;
+  planes.red.assign(padded, planePad<Lane>());
+  planes.green.assign(padded, 0);
+  planes.blue.assign(padded, 0);
+  for (size_t i = 0; i < colors.size(); ++i) {
+    planes.red[i] = static_cast<Lane>(colors[i].red);
+    planes.green[i] = static_cast<Lane>(colors[i].green);
+    planes.blue[i] = static_cast<Lane>(colors[i].blue);
+  }
+  return planes;
+}
+
+// Scalar kernel: closest entry among [begin, end) into match.
+template<typename Lane>
+void scanPlanesScalar(const PalettePlanes<Lane> &planes, const Lane (&target)[3], size_t begin, size_t end,
+                      PlaneMatch &match) {
+  for (size_t i = begin; i < end; ++i) {
+    Lane const distr = planes.red[i] - target[0];
+    Lane const distg = planes.green[i] - target[1];
+    Lane const distb = planes.blue[i] - target[2];
+    auto const dist = static_cast<uint64_t>((distr * distr) + (distg * distg) + (distb * distb));
+    if (dist < match.distance) { // Strict, so the lower position keeps the tie
+      match.distance = dist;
+      match.position = i;
+    }
+  }
+}
+
+#ifdef __AVX2__
+// Reduces per-lane bests to the overall best, lowest position first on equal distances.
+template<typename Lane, size_t Lanes>
+void reduceLanes(const Lane (&dist)[Lanes], const Lane (&position)[Lanes], PlaneMatch &match) {
+  for (size_t lane = 0; lane < Lanes; ++lane) {
+    auto const lane_dist = static_cast<uint64_t>(dist[lane]);
+    auto const lane_position = static_cast<size_t>(position[lane]);
+    if (lane_dist < match.distance || (lane_dist == match.distance && lane_position < match.position)) {
+      match.distance = lane_dist;
+      match.position = lane_position;
+    }
+  }
+}
+
+// AVX2 kernel, 8-bit colours: 8 int32 candidates per vector. [begin, end) must be whole blocks.
+// NOLINTBEGIN(cppcoreguidelines-pro-type-reinterpret-cast,cppcoreguidelines-pro-bounds-pointer-arithmetic)
+inline void scanPlanesVector(const PalettePlanes<int32_t> &planes, const int32_t (&target)[3], size_t begin,
+                             size_t end, PlaneMatch &match) {
+  constexpr size_t lanes = PLANE_VECTOR_BYTES / sizeof(int32_t);
+  __m256i const red = _mm256_set1_epi32(target[0]);
+  __m256i const green = _mm256_set1_epi32(target[1]);
+  __m256i const blue = _mm256_set1_epi32(target[2]);
+  __m256i const step = _mm256_set1_epi32(static_cast<int32_t>(lanes));
+  __m256i position = _mm256_add_epi32(_mm256_set1_epi32(static_cast<int32_t>(begin)),
+                                      _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+  auto const distances = [&](size_t i) {
+    __m256i const distr = _mm256_sub_epi32(_mm256_load_si256(reinterpret_cast<const __m256i *>(&planes.red[i])), red);
+    __m256i const distg = _mm256_sub_epi32(_mm256_load_si256(reinterpret_cast<const __m256i *>(&planes.green[i])), green);
+    __m256i const distb = _mm256_sub_epi32(_mm256_load_si256(reinterpret_cast<const __m256i *>(&planes.blue[i])), blue);
+    return _mm256_add_epi32(_mm256_add_epi32(_mm256_mullo_epi32(distr, distr), _mm256_mullo_epi32(distg, distg)),
+                            _mm256_mullo_epi32(distb, distb));
+  };
+  // The first vector seeds the bests (a constant "infinity" seed gets miscompiled by some GCC versions)
+  __m256i best_dist = distances(begin);
+  __m256i best_position = position;
+  position = _mm256_add_epi32(position, step);
+  for (size_t i = begin + lanes; i < end; i += lanes) {
+    __m256i const dist = distances(i);
+    __m256i const better = _mm256_cmpgt_epi32(best_dist, dist); // Strict: earlier positions keep ties per lane
+    best_dist = _mm256_blendv_epi8(best_dist, dist, better);
+    best_position = _mm256_blendv_epi8(best_position, position, better);
+    position = _mm256_add_epi32(position, step);
+  }
+  alignas(PLANE_VECTOR_BYTES) int32_t dist_lanes[lanes]; // NOLINT(cppcoreguidelines-avoid-c-arrays)
+  alignas(PLANE_VECTOR_BYTES) int32_t position_lanes[lanes]; // NOLINT(cppcoreguidelines-avoid-c-arrays)
+  _mm256_store_si256(reinterpret_cast<__m256i *>(dist_lanes), best_dist);
+  _mm256_store_si256(reinterpret_cast<__m256i *>(position_lanes), best_position);
+  reduceLanes(dist_lanes, position_lanes, match);
+}
+
+// AVX2 kernel, 16-bit colours: 4 int64 candidates per vector, squares computed by _mm256_mul_epi32.
+inline void scanPlanesVector(const PalettePlanes<int64_t> &planes, const int64_t (&target)[3], size_t begin,
+                             size_t end, PlaneMatch &match) {
+  constexpr size_t lanes = PLANE_VECTOR_BYTES / sizeof(int64_t);
+  __m256i const red = _mm256_set1_epi64x(target[0]);
+  __m256i const green = _mm256_set1_epi64x(target[1]);
+  __m256i const blue = _mm256_set1_epi64x(target[2]);
+  __m256i const step = _mm256_set1_epi64x(static_cast<int64_t>(lanes));
+  __m256i position = _mm256_add_epi64(_mm256_set1_epi64x(static_cast<int64_t>(begin)),
+                                      _mm256_setr_epi64x(0, 1, 2, 3));
+  auto const distances = [&](size_t i) {
+    __m256i const distr = _mm256_sub_epi64(_mm256_load_si256(reinterpret_cast<const __m256i *>(&planes.red[i])), red);
+    __m256i const distg = _mm256_sub_epi64(_mm256_load_si256(reinterpret_cast<const __m256i *>(&planes.green[i])), green);
+    __m256i const distb = _mm256_sub_epi64(_mm256_load_si256(reinterpret_cast<const __m256i *>(&planes.blue[i])), blue);
+    return _mm256_add_epi64(_mm256_add_epi64(_mm256_mul_epi32(distr, distr), _mm256_mul_epi32(distg, distg)),
+                            _mm256_mul_epi32(distb, distb));
+  };
+  // The first vector seeds the bests (a constant "infinity" seed gets miscompiled by some GCC versions)
+  __m256i best_dist = distances(begin);
+  __m256i best_position = position;
+  position = _mm256_add_epi64(position, step);
+  for (size_t i = begin + lanes; i < end; i += lanes) {
+    __m256i const dist = distances(i);
+    __m256i const better = _mm256_cmpgt_epi64(best_dist, dist);
+    best_dist = _mm256_blendv_epi8(best_dist, dist, better);
+    best_position = _mm256_blendv_epi8(best_position, position, better);
+    position = _mm256_add_epi64(position, step);
+  }
+  alignas(PLANE_VECTOR_BYTES) int64_t dist_lanes[lanes]; // NOLINT(cppcoreguidelines-avoid-c-arrays)
+  alignas(PLANE_VECTOR_BYTES) int64_t position_lanes[lanes]; // NOLINT(cppcoreguidelines-avoid-c-arrays)
+  _mm256_store_si256(reinterpret_cast<__m256i *>(dist_lanes), best_dist);
+  _mm256_store_si256(reinterpret_cast<__m256i *>(position_lanes), best_position);
+  reduceLanes(dist_lanes, position_lanes, match);
+}
+// NOLINTEND(cppcoreguidelines-pro-type-reinterpret-cast,cppcoreguidelines-pro-bounds-pointer-arithmetic)
+#endif
+
+// Closest palette entry to (red, green, blue). The scan goes block by block and stops after the first
+// block whose best distance is stop_distance or less (pass 0 to only stop on an exact match).
+template<typename Lane>
+auto nearestInPlanes(const PalettePlanes<Lane> &planes, Lane red, Lane green, Lane blue,
+                     uint64_t stop_distance) -> PlaneMatch {
+  Lane const target[3] = {red, green, blue}; // NOLINT(cppcoreguidelines-avoid-c-arrays)
+  PlaneMatch match;
+  for (size_t begin = 0; begin < planes.size; begin += PLANE_BLOCK) {
+#ifdef __AVX2__
+    scanPlanesVector(planes, target, begin, begin + PLANE_BLOCK, match);
+#else
+    scanPlanesScalar(planes, target, begin, begin + PLANE_BLOCK, match);
+#endif
+    match.scanned = std::min(begin + PLANE_BLOCK, planes.size);
+    if (match.distance <= stop_distance) { break; }
+  }
+  return match;
+}
+
+#endif // COLORKERNEL_HPP
@@ -0,0 +1,380 @@
+#ifndef COLORSEARCH_HPP
+#define COLORSEARCH_HPP
+
+#include "colorkernel.hpp"
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Nearest-colour search shared by the AOS and SOA cutfreq implementations.
+// Any colour type with red, green and blue members can be searched (SmallPixel, LargePixel, RGBColor).
+// Every strategy returns the same colour for an exact search: the closest one and, on equal distance,
+// the one that comes first in the palette.
+
+constexpr int KDTREE_DIMENSION = 3;
+constexpr int BITS_PER_BYTE = 8;
+
+// Strategy thresholds, calibrated with bench-colorsearch (see bench/bench_colorsearch.cpp) on a Release build.
+constexpr size_t LINEAR_SCAN_MAX_PALETTE = 256; // Up to this palette size a scan beats any index.
+constexpr size_t LINEAR_SCAN_MAX_WORK = 1ULL << 18; // Queries x palette under which building an index does not pay off.
+constexpr int GRID_MAX_BITS = 16; // The grid beat the k-d tree for 8 and 16-bit, uniform and clustered palettes.
+constexpr size_t GRID_COLORS_PER_CELL = 4; // Average palette colours per grid cell.
+constexpr int GRID_MAX_CELLS_PER_AXIS = 64;
+constexpr double MAX_STOP_DISTANCE = 1e15; // Above any squared distance between 16-bit colours.
+
+enum class NearestStrategy { automatic, linear, kdtree, grid };
+
+// Plain RGB triple, used by layouts that do not store pixels as structures (SOA).
+template<typename ComponentType>
+struct RGBColor {
+    ComponentType red;
+    ComponentType green;
+    ComponentType blue;
+};
+
+// Options of a nearest-colour search.
+struct NearestSearchOptions {
+    double tolerance = 0.0; // Accepted squared-distance error, 0 means exact search.
+    NearestStrategy strategy = NearestStrategy::automatic; // automatic picks one from the problem size.
+};
+
+// Summary of the searches done for one operation.
+struct NearestSearchStats {
+    NearestStrategy strategy = NearestStrategy::linear; // Strategy actually used.
+    size_t queries = 0; // Colours searched.
+    size_t palette_size = 0; // Colours searched into.
+    double max_error = 0.0; // Largest error bound incurred (0 for exact searches).
+};
+
+// Result of a nearest-colour query.
+template<typename ColorType>
+struct NearestColorResult {
+    ColorType color; // Closest colour found.
+    size_t position; // Position of that colour in the palette.
+    double distance; // Squared distance between the query and the returned colour.
+    double error_bound; // Upper bound of (distance - exact nearest distance), 0 for an exact search.
+};
+
+// Integer lane wide enough for the squared distances of ColorType.
+template<typename ColorType>
+using PlaneLane = std::conditional_t<sizeof(ColorType::red) == 1, int32_t, int64_t>;
+
+// Palette plus the acceleration structure of the chosen strategy.
+template<typename ColorType>
+struct ColorIndex {
+    std::vector<ColorType> colors; // Palette, earlier colours win ties.
+    NearestStrategy strategy = NearestStrategy::linear;
+    PalettePlanes<PlaneLane<ColorType>> planes; // linear: palette split by component for the batched kernel.
+    std::vector<uint32_t> kd_nodes; // kdtree: palette positions stored as an implicit tree.
+    std::vector<uint32_t> cell_start; // grid: first entry of each cell in cell_colors (size cells + 1).
+    std::vector<uint32_t> cell_colors; // grid: palette positions grouped by cell.
+    int cells_per_axis = 0; // grid: cells along each component axis.
+    int cell_width = 0; // grid: component values covered by a cell.
+};
+
+// Running state of one query.
+template<typename ColorType>
+struct SearchState {
+    const ColorIndex<ColorType> &index;
+    ColorType target;
+    double tolerance;
+    double min_dist;
+    size_t best;
+    double skipped_bound; // Lowest distance bound among the candidates skipped thanks to the tolerance.
+};
+
+inline auto nearestStrategyName(NearestStrategy strategy) -> std::string {
+  switch (strategy) {
+    case NearestStrategy::linear: return "linear";
+    case NearestStrategy::kdtree: return "kdtree";
+    case NearestStrategy::grid: return "grid";
+    default: return "auto";
+  }
+}
+
+inline auto nearestStrategyFromName(const std::string &name) -> NearestStrategy {
+  if (name == "auto") { return NearestStrategy::automatic; }
+  if (name == "linear") { return NearestStrategy::linear; }
+  if (name == "kdtree") { return NearestStrategy::kdtree; }
+  if (name == "grid") { return NearestStrategy::grid; }
+  throw std::invalid_argument("Unknown nearest-colour strategy: " + name);
+}
+
+// Picks the cheapest strategy for 'queries' searches into a palette of 'palette_size' colours.
+inline auto chooseNearestStrategy(size_t queries, size_t palette_size, int component_bits) -> NearestStrategy {
+  if (palette_size <= LINEAR_SCAN_MAX_PALETTE || queries * palette_size <= LINEAR_SCAN_MAX_WORK) {
+    return NearestStrategy::linear;
+  }
+  if (component_bits <= GRID_MAX_BITS) { return NearestStrategy::grid; }
+  return NearestStrategy::kdtree;
+}
+
+template<typename ColorType>
+constexpr auto componentBits() -> int {
+  return static_cast<int>(sizeof(ColorType::red)) * BITS_PER_BYTE;
+}
+
+// Helper function to compute squared distance
+template<typename ColorType>
+auto squaredDistance(const ColorType &pix_a, const ColorType &pix_b) -> double {
+  double const distr = static_cast<double>(pix_a.red) - static_cast<double>(pix_b.red);
+  double const distg = static_cast<double>(pix_a.green) - static_cast<double>(pix_b.green);
+  double const distb = static_cast<double>(pix_a.blue) - static_cast<double>(pix_b.blue);
+  return (distr * distr) + (distg * distg) + (distb * distb);
+}
+
+template<typename ColorType>
+auto axisValue(const ColorType &color, int axis) -> int {
+  if (axis == 0) { return color.red; }
+  if (axis == 1) { return color.green; }
+  return color.blue;
+}
+
+// Considers palette entry 'position' as the answer of the query.
+template<typename ColorType>
+void visitCandidate(SearchState<ColorType> &state, size_t position) {
+  double const dist = squaredDistance(state.target, state.index.colors[position]);
+  if (dist < state.min_dist || (dist == state.min_dist && position < state.best)) {
+    state.min_dist = dist;
+    state.best = position;
+  }
+}
+
+// True if candidates at squared distance 'bound' or more can still change the answer. Otherwise, when only
+// the tolerance rules them out, the bound is kept to certify the error.
+template<typename ColorType>
+auto worthVisiting(SearchState<ColorType> &state, double bound) -> bool {
+  if (state.tolerance <= 0.0) { return bound <= state.min_dist; } // Exact: equal distances may win the tie
+  if (bound < state.min_dist - state.tolerance) { return true; }
+  if (bound < state.min_dist) { state.skipped_bound = std::min(state.skipped_bound, bound); }
+  return false;
+}
+
+// Linear scan over the whole palette with the batched kernel, stops early once a colour within the
+// tolerance is found.
+template<typename ColorType>
+void linearNearestNeighbor(SearchState<ColorType> &state) {
+  using Lane = PlaneLane<ColorType>;
+  PlaneMatch const match = nearestInPlanes(state.index.planes, static_cast<Lane>(state.target.red),
+                                           static_cast<Lane>(state.target.green),
+                                           static_cast<Lane>(state.target.blue),
+                                           static_cast<uint64_t>(std::min(state.tolerance, MAX_STOP_DISTANCE)));
+  state.min_dist = static_cast<double>(match.distance);
+  state.best = match.position;
+  // Colours left unscanned can only lose ties, or improve by at most min_dist
+  if (match.scanned < state.index.planes.size) { state.skipped_bound = 0.0; }
+}
+
+// Function to build the k-d tree recursively over palette positions
+// NOLINTBEGIN(misc-no-recursion)
+template<typename ColorType>
+void buildKdTree(ColorIndex<ColorType> &index, size_t left, size_t right, int depth) {
+  if (left >= right) { return;}
+  int const axis = depth % KDTREE_DIMENSION;
+  size_t mid = left + ((right - left) / 2);
+
+  // Partial sort based on the axis
+  std::nth_element(index.kd_nodes.begin() + static_cast<std::ptrdiff_t>(left),
+                   index.kd_nodes.begin() + static_cast<std::ptrdiff_t>(mid),
+                   index.kd_nodes.begin() + static_cast<std::ptrdiff_t>(right),
+                   [&index, axis](uint32_t pos_a, uint32_t pos_b) {
+                     return axisValue(index.colors[pos_a], axis) < axisValue(index.colors[pos_b], axis);
+                   });
+
+  // Recursively build left and right subtrees
+  buildKdTree(index, left, mid, depth + 1);
+  buildKdTree(index, mid + 1, right, depth + 1);
+}
+
+// Function to search nearest neighbor recursively.
+// With a tolerance, a far subtree is only visited when it could improve the best distance by more than the
+// tolerance, and the search stops as soon as a colour within the tolerance is found.
+template<typename ColorType>
+void kdTreeNearestNeighbor(SearchState<ColorType> &state, size_t left, size_t right, int depth) {
+  if (left >= right) { return; }
+  if (state.tolerance > 0.0 && state.min_dist <= state.tolerance) { // The unvisited colours may be at distance 0
+    state.skipped_bound = 0.0;
+    return;
+  }
+
+  int const axis = depth % KDTREE_DIMENSION;
+  size_t mid = left + ((right - left) / 2);
+  uint32_t const pivot = state.index.kd_nodes[mid];
+  visitCandidate(state, pivot);
+
+  double const diff = static_cast<double>(axisValue(state.target, axis)) -
+                      static_cast<double>(axisValue(state.index.colors[pivot], axis));
+  size_t const near_left = (diff <= 0) ? left : mid + 1; // Subtree on the same side of the plane as the target
+  size_t const near_right = (diff <= 0) ? mid : right;
+  size_t const far_left = (diff <= 0) ? mid + 1 : left; // Subtree on the other side of the plane
+  size_t const far_right = (diff <= 0) ? right : mid;
+
+  kdTreeNearestNeighbor(state, near_left, near_right, depth + 1);
+  // No colour of the far subtree is closer than the splitting plane
+  if (far_left < far_right && worthVisiting(state, diff * diff)) {
+    kdTreeNearestNeighbor(state, far_left, far_right, depth + 1);
+  }
+}
+// NOLINTEND(misc-no-recursion)
+
+// Squared distance from value to the interval [low, high] along one axis.
+inline auto gapToRange(int value, int low, int high) -> double {
+  int gap = 0;
+  if (value < low) { gap = low - value; }
+  if (value > high) { gap = value - high; }
+  return static_cast<double>(gap) * static_cast<double>(gap);
+}
+
+template<typename ColorType>
+void buildGrid(ColorIndex<ColorType> &index) {
+  int const domain = 1 << componentBits<ColorType>();
+  int cells = 1;
+  while (cells < GRID_MAX_CELLS_PER_AXIS &&
+         static_cast<size_t>(cells + 1) * static_cast<size_t>(cells + 1) * static_cast<size_t>(cells + 1) *
+         GRID_COLORS_PER_CELL <= index.colors.size()) {
+    ++cells;
+  }
+  index.cells_per_axis = cells;
+  index.cell_width = (domain + cells - 1) / cells;
+  auto const cell_of = [&index](const ColorType &color) {
+    auto const axis_cell = [&index](int value) { return static_cast<size_t>(value / index.cell_width); };
+    auto const size = static_cast<size_t>(index.cells_per_axis);
+    return (((axis_cell(color.red) * size) + axis_cell(color.green)) * size) + axis_cell(color.blue);
+  };
+  size_t const total_cells = static_cast<size_t>(cells) * static_cast<size_t>(cells) * static_cast<size_t>(cells);
+  index.cell_start.assign(total_cells + 1, 0);
+  for (const auto &color : index.colors) { ++index.cell_start[cell_of(color) + 1]; } // Counting sort by cell
+  for (size_t cell = 0; cell < total_cells; ++cell) { index.cell_start[cell + 1] += index.cell_start[cell]; }
+  index.cell_colors.resize(index.colors.size());
+  std::vector<uint32_t> fill(index.cell_start.begin(), index.cell_start.end() - 1);
+  for (size_t position = 0; position < index.colors.size(); ++position) {
+    index.cell_colors[fill[cell_of(index.colors[position])]++] = static_cast<uint32_t>(position);
+  }
+}
+
+// Visits one grid cell if it may hold a better candidate.
+template<typename ColorType>
+void visitGridCell(SearchState<ColorType> &state, int cell_r, int cell_g, int cell_b) {
+  const ColorIndex<ColorType> &index = state.index;
+  int const width = index.cell_width;
+  double const bound = gapToRange(state.target.red, cell_r * width, ((cell_r + 1) * width) - 1) +
+                       gapToRange(state.target.green, cell_g * width, ((cell_g + 1) * width) - 1) +
+                       gapToRange(state.target.blue, cell_b * width, ((cell_b + 1) * width) - 1);
+  auto const size = static_cast<size_t>(index.cells_per_axis);
+  size_t const cell = (((static_cast<size_t>(cell_r) * size) + static_cast<size_t>(cell_g)) * size) +
+                      static_cast<size_t>(cell_b);
+  if (index.cell_start[cell] == index.cell_start[cell + 1] || !worthVisiting(state, bound)) { return; }
+  for (uint32_t entry = index.cell_start[cell]; entry < index.cell_start[cell + 1]; ++entry) {
+    visitCandidate(state, index.cell_colors[entry]);
+  }
+}
+
+// Lowest squared distance from the target to any colour outside the cube of cells at ring distance < ring.
+// Returns a negative value when that cube already covers the whole colour space.
+template<typename ColorType>
+auto gridRingBound(const SearchState<ColorType> &state, const std::array<int, KDTREE_DIMENSION> &center,
+                   int ring) -> double {
+  int const width = state.index.cell_width;
+  int const last_cell = state.index.cells_per_axis - 1;
+  double bound = -1.0;
+  for (int axis = 0; axis < KDTREE_DIMENSION; ++axis) {
+    int const value = axisValue(state.target, axis);
+    auto const cell = center[static_cast<size_t>(axis)];
+    if (cell - ring + 1 > 0) { // Something below the cube on this axis
+      double const gap = value - ((cell - ring + 1) * width) + 1;
+      bound = (bound < 0.0) ? gap * gap : std::min(bound, gap * gap);
+    }
+    if (cell + ring - 1 < last_cell) { // Something above the cube on this axis
+      double const gap = ((cell + ring) * width) - value;
+      bound = (bound < 0.0) ? gap * gap : std::min(bound, gap * gap);
+    }
+  }
+  return bound;
+}
+
+// Grid search: visits the cells around the target ring by ring until no farther ring can help.
+template<typename ColorType>
+void gridNearestNeighbor(SearchState<ColorType> &state) {
+  const ColorIndex<ColorType> &index = state.index;
+  std::array<int, KDTREE_DIMENSION> const center = {state.target.red / index.cell_width,
+                                                    state.target.green / index.cell_width,
+                                                    state.target.blue / index.cell_width};
+  int const last_cell = index.cells_per_axis - 1;
+  for (int ring = 0; ring <= last_cell; ++ring) {
+    if (ring > 0) {
+      double const bound = gridRingBound(state, center, ring);
+      if (bound < 0.0 || !worthVisiting(state, bound)) { return; }
+    }
+    for (int d_r = -ring; d_r <= ring; ++d_r) {
+      int const cell_r = center[0] + d_r;
+      if (cell_r < 0 || cell_r > last_cell) { continue; }
+      for (int d_g = -ring; d_g <= ring; ++d_g) {
+        int const cell_g = center[1] + d_g;
+        if (cell_g < 0 || cell_g > last_cell) { continue; }
+        bool const on_surface = (d_r == -ring || d_r == ring || d_g == -ring || d_g == ring);
+        int const step = (on_surface || ring == 0) ? 1 : 2 * ring; // Inner columns only touch the two faces
+        for (int d_b = -ring; d_b <= ring; d_b += step) {
+          int const cell_b = center[2] + d_b;
+          if (cell_b >= 0 && cell_b <= last_cell) { visitGridCell(state, cell_r, cell_g, cell_b); }
+        }
+      }
+    }
+    if (state.tolerance > 0.0 && state.min_dist <= state.tolerance) {
+      if (ring < last_cell) { state.skipped_bound = 0.0; }
+      return;
+    }
+  }
+}
+
+// Builds the search structure of the requested strategy (automatic picks one from the expected query count).
+template<typename ColorType>
+auto buildColorIndex(std::vector<ColorType> colors, NearestStrategy strategy,
+                     size_t expected_queries) -> ColorIndex<ColorType> {
+  ColorIndex<ColorType> index;
+  index.colors = std::move(colors);
+  if (strategy == NearestStrategy::automatic) {
+    strategy = chooseNearestStrategy(expected_queries, index.colors.size(), componentBits<ColorType>());
+  }
+  index.strategy = strategy;
+  if (strategy == NearestStrategy::kdtree) {
+    index.kd_nodes.resize(index.colors.size());
+    for (size_t position = 0; position < index.colors.size(); ++position) {
+      index.kd_nodes[position] = static_cast<uint32_t>(position);
+    }
+    buildKdTree(index, 0, index.kd_nodes.size(), 0);
+  } else if (strategy == NearestStrategy::grid) {
+    buildGrid(index);
+  } else {
+    index.planes = makePalettePlanes<PlaneLane<ColorType>>(index.colors);
+  }
+  return index;
+}
+
+// Searches the palette colour closest to target.
+template<typename ColorType>
+auto nearestColor(const ColorIndex<ColorType> &index, const ColorType &target,
+                  double tolerance) -> NearestColorResult<ColorType> {
+  SearchState<ColorType> state{.index=index, .target=target, .tolerance=tolerance,
+                               .min_dist=std::numeric_limits<double>::max(), .best=0,
+                               .skipped_bound=std::numeric_limits<double>::max()};
+  if (index.colors.empty()) { return {.color=target, .position=0, .distance=0.0, .error_bound=0.0}; }
+  if (index.strategy == NearestStrategy::kdtree) {
+    kdTreeNearestNeighbor(state, 0, index.kd_nodes.size(), 0);
+  } else if (index.strategy == NearestStrategy::grid) {
+    gridNearestNeighbor(state);
+  } else {
+    linearNearestNeighbor(state);
+  }
+  double const error_bound = std::max(0.0, state.min_dist - state.skipped_bound);
+  return NearestColorResult<ColorType>{.color=index.colors[state.best], .position=state.best,
+                                       .distance=state.min_dist, .error_bound=error_bound};
+}
+
+#endif // COLORSEARCH_HPP
@@ -0,0 +1,560 @@
+#ifndef CPPMFORMAT_HPP
+#define CPPMFORMAT_HPP
+
+#include "binaryio.hpp"
+#include "bitpack.hpp"
+#include "entropycoder.hpp"
+#include "paletteorder.hpp"
+#include "parallel.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <istream>
+#include <map>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Layout of a CPPM file, shared by the AOS and SOA readers:
+// "C6 <width> <height> <max color value> <color table size>\n", the color table (3 components per color,
+// 1 or 2 bytes each), then one index per pixel (1, 2 or 4 bytes, depending on the color table size).
+// A file may add a flags field after the table size ("... <color table size> <flags>\n"); it is only written
+// when a flag is set, so plain files keep the original layout. With CPPM_FLAG_BITPACKED the indices take
+// bitWidthFor(color table size) bits each, packed into 64-bit words (see bitpack.hpp). With CPPM_FLAG_ENTROPY
+// they are run-length and rANS coded (see entropycoder.hpp). The two flags are exclusive.
+// With CPPM_FLAG_CHUNKED the header line also gives a row group height ("... <flags> <group rows>\n"). The
+// index stream is then split into row groups of that many rows (the last one may be shorter), each stored
+// with the coding of the other flags as if it were a whole image, followed by a trailing offset index: one
+// uint64 per group giving its first byte relative to the first group, plus the end of the last group. Groups
+// decode independently, so a row range needs one seek and a full decode runs one group per thread.
+// Images where a color table does not pay off are stored without one (color table size 0): CPPM_FLAG_RAW keeps
+// the samples as in P6 (red, green, blue per pixel, 1 or 2 bytes each), CPPM_FLAG_DELTA stores each sample minus
+// the same component of the previous pixel (wrapping), rANS coded as a block of bytes. These exclude every
+// other flag.
+
+const std::string CPPM_MAGIC = "C6";
+const int CPPM_MAX_COLOR_VALUE = 65535;
+const size_t CPPM_MAX_TABLE_1B = 256;
+const size_t CPPM_MAX_TABLE_2B = 65536;
+const unsigned CPPM_FLAG_BITPACKED = 1;
+const unsigned CPPM_FLAG_ENTROPY = 2;
+const unsigned CPPM_FLAG_CHUNKED = 4;
+const unsigned CPPM_FLAG_RAW = 8;
+const unsigned CPPM_FLAG_DELTA = 16;
+const unsigned CPPM_KNOWN_FLAGS = CPPM_FLAG_BITPACKED | CPPM_FLAG_ENTROPY | CPPM_FLAG_CHUNKED | CPPM_FLAG_RAW |
+                                  CPPM_FLAG_DELTA;
+const unsigned CPPM_SAMPLE_LAYOUT_FLAGS = CPPM_FLAG_RAW | CPPM_FLAG_DELTA; // Pixels stored without a color table
+const unsigned CPPM_CODED_INDEX_FLAGS = CPPM_FLAG_BITPACKED | CPPM_FLAG_ENTROPY; // Indices not stored 1, 2 or 4 bytes each
+const unsigned CPPM_INDEX_LAYOUT_FLAGS = CPPM_CODED_INDEX_FLAGS | CPPM_FLAG_CHUNKED; // Indices not one flat array
+const size_t CPPM_MAX_RUN_BYTES = 5; // Largest varint run length of one pixel count (beyond the index bytes)
+const size_t CPPM_COMPONENTS = 3;
+const int CPPM_MAX_COLOR_VALUE_1B = 255;
+
+// How write_cppm writes an image: the CPPM_FLAG_* bits of the index stream, the row group height with
+// CPPM_FLAG_CHUNKED, the color table order, and whether to store the pixels without a color table
+// (CPPM_FLAG_RAW or CPPM_FLAG_DELTA) when the table and indices would take more room than the pixels.
+struct CPPMWriteOptions {
+    unsigned flags = 0;
+    int group_rows = 0;
+    PaletteOrder order = PaletteOrder::first_seen;
+    bool raw_fallback = false;
+};
+
+struct CPPMHeader {
+    int width;
+    int height;
+    int max_color_value;
+    size_t color_table_size;
+    unsigned flags = 0; // CPPM_FLAG_* bits
+    int group_rows = 0; // Rows per group with CPPM_FLAG_CHUNKED, 0 otherwise
+};
+
+// Reads and validates the header, leaving the stream at the first byte of the color table
+inline auto read_cppm_header(std::istream &input) -> CPPMHeader {
+  std::string magic_number;
+  input >> magic_number;
+  if (magic_number != CPPM_MAGIC) { throw std::runtime_error("Unsupported CPPM format."); }
+  CPPMHeader header{.width=0, .height=0, .max_color_value=0, .color_table_size=0};
+  input >> header.width >> header.height >> header.max_color_value >> header.color_table_size;
+  if (!input || header.width < 1 || header.height < 1 || header.max_color_value < 1 ||
+      header.max_color_value > CPPM_MAX_COLOR_VALUE) {
+    throw std::runtime_error("Invalid CPPM header.");
+  }
+  if (input.peek() == ' ') { // Optional flags field
+    input >> header.flags;
+    bool const sample_layout = (header.flags & CPPM_SAMPLE_LAYOUT_FLAGS) != 0;
+    if (!input || (header.flags & ~CPPM_KNOWN_FLAGS) != 0 ||
+        (header.flags & CPPM_CODED_INDEX_FLAGS) == CPPM_CODED_INDEX_FLAGS ||
+        (sample_layout && header.flags != CPPM_FLAG_RAW && header.flags != CPPM_FLAG_DELTA)) {
+      throw std::runtime_error("Unsupported CPPM flags.");
+    }
+    if ((header.flags & CPPM_FLAG_CHUNKED) != 0 && (!(input >> header.group_rows) || header.group_rows < 1)) {
+      throw std::runtime_error("Invalid CPPM row group height.");
+    }
+  }
+  if ((header.color_table_size == 0) != ((header.flags & CPPM_SAMPLE_LAYOUT_FLAGS) != 0)) {
+    throw std::runtime_error("Invalid CPPM header."); // Only raw and delta files have no color table
+  }
+  input.get(); // Skip the newline character
+  return header;
+}
+
+inline auto cppm_pixel_count(const CPPMHeader &header) -> size_t {
+  return static_cast<size_t>(header.width) * static_cast<size_t>(header.height);
+}
+
+// Bytes per index of the byte-aligned layouts
+inline auto cppm_index_bytes(size_t table_size) -> unsigned {
+  if (table_size <= CPPM_MAX_TABLE_1B) { return sizeof(uint8_t); }
+  if (table_size <= CPPM_MAX_TABLE_2B) { return sizeof(uint16_t); }
+  return sizeof(uint32_t);
+}
+
+// Checks the indices against the color table, then calls store(pixel, index) for each pixel
+template<typename IndexType, typename Store>
+void store_cppm_indices(const std::vector<IndexType> &indices, const CPPMHeader &header, const Store &store) {
+  if (!indices.empty() && *std::max_element(indices.begin(), indices.end()) >= header.color_table_size) {
+    throw std::runtime_error("Invalid color index in CPPM file.");
+  }
+  for (size_t i = 0; i < indices.size(); ++i) { store(i, static_cast<size_t>(indices[i])); }
+}
+
+// Reads every index in one call, checks them, then calls store(pixel, index) for each pixel
+template<typename IndexType, typename Store>
+void gather_cppm_indices(std::istream &input, const CPPMHeader &header, const Store &store) {
+  store_cppm_indices(read_binary_buffer<IndexType>(input, cppm_pixel_count(header)), header, store);
+}
+
+// Same for a bit-packed index stream
+template<typename Store>
+void gather_packed_cppm_indices(std::istream &input, const CPPMHeader &header, const Store &store) {
+  unsigned const bits = bitWidthFor(header.color_table_size);
+  std::vector<uint64_t> words = read_binary_buffer<uint64_t>(input, packedWordCount(cppm_pixel_count(header), bits));
+  store_cppm_indices(unpackBits(words, bits, cppm_pixel_count(header)), header, store);
+}
+
+// Reads a block written by write_rans_block: byte count (uint64), the 256 normalised frequencies (uint16 each),
+// coded byte count (uint64), coded data. The sizes are checked against max_bytes before anything is allocated, and
+// the table is checked even for an empty block.
+inline auto read_rans_block(std::istream &input, size_t max_bytes) -> std::vector<uint8_t> {
+  auto const byte_count = read_binary<uint64_t>(input);
+  std::vector<uint16_t> const table = read_binary_buffer<uint16_t>(input, RANS_SYMBOLS);
+  auto const coded_bytes = read_binary<uint64_t>(input);
+  RansFrequencies frequencies{};
+  std::copy(table.begin(), table.end(), frequencies.begin());
+  if (byte_count > max_bytes || coded_bytes > 2 * byte_count + 2 * RANS_STATES * sizeof(uint32_t) ||
+      !validFrequencies(frequencies)) {
+    throw std::runtime_error("Invalid CPPM entropy-coded data.");
+  }
+  std::vector<uint8_t> const coded = read_binary_buffer<uint8_t>(input, coded_bytes);
+  return ransDecode(coded, frequencies, byte_count);
+}
+
+// Same for a run-length and rANS coded index stream
+template<typename Store>
+void gather_entropy_cppm_indices(std::istream &input, const CPPMHeader &header, const Store &store) {
+  size_t const count = cppm_pixel_count(header);
+  unsigned const index_bytes = cppm_index_bytes(header.color_table_size);
+  std::vector<uint8_t> const runs = read_rans_block(input, count * (index_bytes + CPPM_MAX_RUN_BYTES));
+  store_cppm_indices(decodeRuns(runs, index_bytes, count), header, store);
+}
+
+// Number of row groups of a chunked file
+inline auto cppm_group_count(const CPPMHeader &header) -> size_t {
+  auto const rows = static_cast<size_t>(header.group_rows);
+  return (static_cast<size_t>(header.height) + rows - 1) / rows;
+}
+
+// Header describing one row group on its own: its rows, and the coding of the file without the chunking
+inline auto cppm_group_header(const CPPMHeader &header, size_t group) -> CPPMHeader {
+  CPPMHeader group_header = header;
+  size_t const first_row = group * static_cast<size_t>(header.group_rows);
+  group_header.height = static_cast<int>(std::min<size_t>(static_cast<size_t>(header.group_rows),
+                                                          static_cast<size_t>(header.height) - first_row));
+  group_header.flags &= ~CPPM_FLAG_CHUNKED;
+  group_header.group_rows = 0;
+  return group_header;
+}
+
+// Reads the trailing offset index of a chunked file whose index stream starts at the current position, and
+// checks it against the file size. The stream is left where it was.
+inline auto read_cppm_group_offsets(std::istream &input, const CPPMHeader &header) -> std::vector<uint64_t> {
+  size_t const groups = cppm_group_count(header);
+  std::streamoff const data_start = input.tellg();
+  input.seekg(0, std::ios::end);
+  std::streamoff const file_end = input.tellg();
+  auto const data_bytes = static_cast<uint64_t>(file_end - data_start);
+  if (data_start < 0 || file_end < data_start || data_bytes / sizeof(uint64_t) < groups + 1) {
+    throw std::runtime_error("Invalid CPPM row group index.");
+  }
+  input.seekg(file_end - static_cast<std::streamoff>((groups + 1) * sizeof(uint64_t)));
+  std::vector<uint64_t> const offsets = read_binary_buffer<uint64_t>(input, groups + 1);
+  if (offsets.front() != 0 || !std::is_sorted(offsets.begin(), offsets.end()) ||
+      offsets.back() != data_bytes - (groups + 1) * sizeof(uint64_t)) {
+    throw std::runtime_error("Invalid CPPM row group index.");
+  }
+  input.seekg(data_start);
+  return offsets;
+}
+
+// Same as gather_cppm_indices for a stream that is not split in row groups (a whole file, or one group)
+template<typename Store>
+void read_flat_cppm_indices(std::istream &input, const CPPMHeader &header, const Store &store) {
+  if ((header.flags & CPPM_FLAG_BITPACKED) != 0) {
+    gather_packed_cppm_indices(input, header, store);
+  } else if ((header.flags & CPPM_FLAG_ENTROPY) != 0) {
+    gather_entropy_cppm_indices(input, header, store);
+  } else if (header.color_table_size <= CPPM_MAX_TABLE_1B) {
+    gather_cppm_indices<uint8_t>(input, header, store);
+  } else if (header.color_table_size <= CPPM_MAX_TABLE_2B) {
+    gather_cppm_indices<uint16_t>(input, header, store);
+  } else {
+    gather_cppm_indices<uint32_t>(input, header, store);
+  }
+}
+
+// Reads row groups [group_begin, group_end) of a chunked file with one seek and one read, then decodes them in
+// parallel, one group per task; store(pixel, index) gets pixels numbered from the start of the image
+template<typename Store>
+void read_cppm_groups(std::istream &input, const CPPMHeader &header, size_t group_begin, size_t group_end,
+                      const Store &store) {
+  std::vector<uint64_t> const offsets = read_cppm_group_offsets(input, header);
+  input.seekg(static_cast<std::streamoff>(offsets[group_begin]), std::ios::cur);
+  std::string bytes(offsets[group_end] - offsets[group_begin], '\0');
+  if (!input.read(bytes.data(), static_cast<std::streamsize>(bytes.size()))) {
+    throw std::runtime_error("Error reading binary data");
+  }
+  size_t const groups = group_end - group_begin;
+  std::vector<std::exception_ptr> errors(groups); // Rethrown on this thread once every group is done
+  forEachStripe(groups, stripeCount(groups, 1), [&](size_t /*stripe*/, size_t begin, size_t end) {
+    for (size_t local = begin; local < end; ++local) {
+      size_t const group = group_begin + local;
+      try {
+        std::istringstream group_input(bytes.substr(offsets[group] - offsets[group_begin],
+                                                     offsets[group + 1] - offsets[group]));
+        size_t const first_pixel = group * static_cast<size_t>(header.group_rows) * static_cast<size_t>(header.width);
+        read_flat_cppm_indices(group_input, cppm_group_header(header, group),
+                               [&store, first_pixel](size_t pixel, size_t index) { store(first_pixel + pixel, index); });
+      } catch (...) {
+        errors[local] = std::current_exception();
+      }
+    }
+  });
+  for (std::exception_ptr const &error : errors) {
+    if (error) { std::rethrow_exception(error); }
+  }
+}
+
+// Same as gather_cppm_indices, with the index size given by the color table size and the flags
+template<typename Store>
+void read_cppm_indices(std::istream &input, const CPPMHeader &header, const Store &store) {
+  if ((header.flags & CPPM_FLAG_CHUNKED) != 0) {
+    read_cppm_groups(input, header, 0, cppm_group_count(header), store);
+  } else {
+    read_flat_cppm_indices(input, header, store);
+  }
+}
+
+// Throws unless rows [first_row, first_row + rows) are a non-empty range of the image
+inline void check_cppm_row_range(const CPPMHeader &header, int first_row, int rows) {
+  if (first_row < 0 || rows < 1 || first_row >= header.height || rows > header.height - first_row) {
+    throw std::runtime_error("Row range outside the CPPM image.");
+  }
+}
+
+// Reads the indices of rows [first_row, first_row + rows) only; store(pixel, index) gets pixels numbered from the
+// start of the range. Chunked files decode just the groups holding the range, plain files seek straight to it,
+// and bit-packed or entropy-coded files without groups have to be decoded whole.
+template<typename Store>
+void read_cppm_row_indices(std::istream &input, const CPPMHeader &header, int first_row, int rows, const Store &store) {
+  check_cppm_row_range(header, first_row, rows);
+  auto const width = static_cast<size_t>(header.width);
+  size_t const begin = static_cast<size_t>(first_row) * width;
+  size_t const end = begin + static_cast<size_t>(rows) * width;
+  auto const in_range = [&store, begin, end](size_t pixel, size_t index) {
+    if (pixel >= begin && pixel < end) { store(pixel - begin, index); }
+  };
+  CPPMHeader range_header = header;
+  range_header.height = rows;
+  if ((header.flags & CPPM_FLAG_CHUNKED) != 0) {
+    auto const group_rows = static_cast<size_t>(header.group_rows);
+    read_cppm_groups(input, header, static_cast<size_t>(first_row) / group_rows,
+                     (static_cast<size_t>(first_row + rows) + group_rows - 1) / group_rows, in_range);
+  } else if ((header.flags & CPPM_CODED_INDEX_FLAGS) != 0) {
+    read_flat_cppm_indices(input, header, in_range);
+  } else {
+    input.seekg(static_cast<std::streamoff>(begin * cppm_index_bytes(header.color_table_size)), std::ios::cur);
+    read_flat_cppm_indices(input, range_header, store);
+  }
+}
+
+// True if the file starts with the CPPM magic number
+inline auto is_cppm_file(const std::string &filename) -> bool {
+  std::ifstream file(filename, std::ios::binary);
+  std::string magic_number;
+  file >> magic_number;
+  return magic_number == CPPM_MAGIC;
+}
+
+inline auto has_cppm_extension(const std::string &filename) -> bool {
+  std::string const extension = ".cppm";
+  return filename.size() >= extension.size() &&
+         filename.compare(filename.size() - extension.size(), extension.size(), extension) == 0;
+}
+
+// Writes the flags field of the header line (nothing when no flag is set), the row group height of a chunked
+// file, and ends the line
+inline void write_cppm_flags(std::ostream &output, unsigned flags, int group_rows = 0) {
+  if (flags != 0) { output << " " << flags; }
+  if ((flags & CPPM_FLAG_CHUNKED) != 0) { output << " " << group_rows; }
+  output << "\n";
+}
+
+inline void write_cppm_header(std::ostream &output, const CPPMHeader &header) {
+  output << CPPM_MAGIC << " " << header.width << " " << header.height << " " << header.max_color_value << " "
+         << header.color_table_size;
+  write_cppm_flags(output, header.flags, header.group_rows);
+}
+
+// Writes the indices bit-packed at the width given by the color table size
+inline void write_packed_cppm_indices(std::ostream &output, const std::vector<uint32_t> &indices, size_t table_size) {
+  write_binary_buffer(output, packBits(indices, bitWidthFor(table_size)));
+}
+
+// A block of bytes with its rANS coding, ready to be written
+struct RansBlock {
+    uint64_t byte_count = 0;
+    RansFrequencies frequencies{};
+    std::vector<uint8_t> coded;
+};
+
+inline auto encode_rans_block(const std::vector<uint8_t> &bytes) -> RansBlock {
+  RansFrequencies const frequencies = normalizeFrequencies(bytes);
+  return {.byte_count = bytes.size(), .frequencies = frequencies, .coded = ransEncode(bytes, frequencies)};
+}
+
+// Bytes the block takes in a file
+inline auto rans_block_size(const RansBlock &block) -> uint64_t {
+  return 2 * sizeof(uint64_t) + RANS_SYMBOLS * sizeof(uint16_t) + block.coded.size();
+}
+
+inline void write_rans_block(std::ostream &output, const RansBlock &block) {
+  write_binary(output, block.byte_count);
+  std::vector<uint16_t> const table(block.frequencies.begin(), block.frequencies.end());
+  write_binary_buffer(output, table);
+  write_binary(output, static_cast<uint64_t>(block.coded.size()));
+  write_binary_buffer(output, block.coded);
+}
+
+// Writes the indices run-length and rANS coded
+inline void write_entropy_cppm_indices(std::ostream &output, const std::vector<uint32_t> &indices, size_t table_size) {
+  write_rans_block(output, encode_rans_block(encodeRuns(indices, cppm_index_bytes(table_size))));
+}
+
+// Writes the indices with the coding selected by flags (CPPM_FLAG_BITPACKED or CPPM_FLAG_ENTROPY)
+inline void write_coded_cppm_indices(std::ostream &output, const std::vector<uint32_t> &indices, size_t table_size,
+                                     unsigned flags) {
+  if ((flags & CPPM_FLAG_ENTROPY) != 0) {
+    write_entropy_cppm_indices(output, indices, table_size);
+  } else {
+    write_packed_cppm_indices(output, indices, table_size);
+  }
+}
+
+// Reads every pixel index, widened to 32 bits
+inline auto read_cppm_index_stream(std::istream &input, const CPPMHeader &header) -> std::vector<uint32_t> {
+  std::vector<uint32_t> indices(cppm_pixel_count(header));
+  read_cppm_indices(input, header, [&indices](size_t pixel, size_t index) { indices[pixel] = static_cast<uint32_t>(index); });
+  return indices;
+}
+
+template<typename IndexType>
+void write_cppm_index_buffer(std::ostream &output, const std::vector<uint32_t> &indices) {
+  std::vector<IndexType> narrow(indices.size());
+  for (size_t i = 0; i < indices.size(); ++i) { narrow[i] = static_cast<IndexType>(indices[i]); }
+  write_binary_buffer(output, narrow);
+}
+
+inline void write_cppm_index_stream(std::ostream &output, const std::vector<uint32_t> &indices,
+                                    const CPPMHeader &header);
+
+// Writes the indices as row groups followed by their offset index. The groups are encoded in parallel, each
+// into its own buffer, then written in order.
+inline void write_chunked_cppm_indices(std::ostream &output, const std::vector<uint32_t> &indices,
+                                       const CPPMHeader &header) {
+  size_t const groups = cppm_group_count(header);
+  size_t const group_pixels = static_cast<size_t>(header.group_rows) * static_cast<size_t>(header.width);
+  std::vector<std::string> encoded(groups);
+  forEachStripe(groups, stripeCount(groups, 1), [&](size_t /*stripe*/, size_t begin, size_t end) {
+    for (size_t group = begin; group < end; ++group) {
+      auto const first = indices.begin() + static_cast<std::ptrdiff_t>(group * group_pixels);
+      auto const last = indices.begin() + static_cast<std::ptrdiff_t>(std::min(indices.size(), (group + 1) * group_pixels));
+      std::ostringstream group_output;
+      write_cppm_index_stream(group_output, std::vector<uint32_t>(first, last), cppm_group_header(header, group));
+      encoded[group] = std::move(group_output).str();
+    }
+  });
+  std::vector<uint64_t> offsets{0};
+  for (std::string const &group : encoded) {
+    output.write(group.data(), static_cast<std::streamsize>(group.size()));
+    offsets.push_back(offsets.back() + group.size());
+  }
+  write_binary_buffer(output, offsets);
+}
+
+// Writes the indices with the size given by the color table size and the flags of the header
+inline void write_cppm_index_stream(std::ostream &output, const std::vector<uint32_t> &indices,
+                                    const CPPMHeader &header) {
+  size_t const table_size = header.color_table_size;
+  if ((header.flags & CPPM_FLAG_CHUNKED) != 0) {
+    write_chunked_cppm_indices(output, indices, header);
+  } else if ((header.flags & CPPM_CODED_INDEX_FLAGS) != 0) {
+    write_coded_cppm_indices(output, indices, table_size, header.flags);
+  } else if (table_size <= CPPM_MAX_TABLE_1B) {
+    write_cppm_index_buffer<uint8_t>(output, indices);
+  } else if (table_size <= CPPM_MAX_TABLE_2B) {
+    write_cppm_index_buffer<uint16_t>(output, indices);
+  } else {
+    write_binary_buffer(output, indices);
+  }
+}
+
+// Number of pixels using each color table entry
+inline auto count_cppm_indices(const std::vector<uint32_t> &indices, size_t table_size) -> std::vector<size_t> {
+  std::vector<size_t> counts(table_size, 0);
+  for (uint32_t const index : indices) { ++counts[index]; }
+  return counts;
+}
+
+// Compacts a color table whose colors were changed in place: an entry whose key repeats an earlier entry is
+// merged into it, and entries no pixel uses are dropped. 'kept' receives the surviving old positions (still in
+// table order, which keeps a first-seen table in first-seen order) and the returned remap gives the new
+// position of every old one.
+template<typename Key>
+auto compact_cppm_table(const std::vector<Key> &keys, const std::vector<size_t> &counts,
+                        std::vector<size_t> &kept) -> std::vector<uint32_t> {
+  std::map<Key, uint32_t> new_position;
+  std::vector<uint32_t> remap(keys.size(), 0);
+  for (size_t old_position = 0; old_position < keys.size(); ++old_position) {
+    if (counts[old_position] == 0) { continue; }
+    auto const [entry, inserted] = new_position.try_emplace(keys[old_position], static_cast<uint32_t>(kept.size()));
+    if (inserted) { kept.push_back(old_position); }
+    remap[old_position] = entry->second;
+  }
+  return remap;
+}
+
+// Counts of the table left by compact_cppm_table, from the counts of the old one
+inline auto remap_cppm_counts(const std::vector<size_t> &counts, const std::vector<uint32_t> &remap,
+                              size_t table_size) -> std::vector<size_t> {
+  std::vector<size_t> merged(table_size, 0);
+  for (size_t old_position = 0; old_position < counts.size(); ++old_position) {
+    merged[remap[old_position]] += counts[old_position];
+  }
+  return merged;
+}
+
+// Applies a table remap to every index
+inline void remap_cppm_indices(std::vector<uint32_t> &indices, const std::vector<uint32_t> &remap) {
+  for (uint32_t &index : indices) { index = remap[index]; }
+}
+
+// --- Files without a color table ---
+
+// Bytes of one color component
+inline auto cppm_component_bytes(int max_color_value) -> size_t {
+  return max_color_value <= CPPM_MAX_COLOR_VALUE_1B ? sizeof(uint8_t) : sizeof(uint16_t);
+}
+
+// Bytes of the pixels stored as samples, as in P6
+inline auto cppm_raw_size(size_t pixels, int max_color_value) -> uint64_t {
+  return pixels * CPPM_COMPONENTS * cppm_component_bytes(max_color_value);
+}
+
+// Bytes of the color table and index stream for a table of 'table_size' colors. Entropy-coded sizes depend on
+// the data, so they are estimated as plain indices, which they rarely exceed.
+inline auto cppm_estimated_size(size_t pixels, int max_color_value, size_t table_size, unsigned flags) -> uint64_t {
+  uint64_t const table_bytes = table_size * CPPM_COMPONENTS * cppm_component_bytes(max_color_value);
+  if ((flags & CPPM_FLAG_BITPACKED) != 0) {
+    return table_bytes + packedWordCount(pixels, bitWidthFor(table_size)) * sizeof(uint64_t);
+  }
+  return table_bytes + pixels * cppm_index_bytes(table_size);
+}
+
+// True if the pixels take less room than a color table of 'table_size' colors and its indices
+inline auto cppm_table_loses(size_t pixels, int max_color_value, size_t table_size, unsigned flags) -> bool {
+  return cppm_estimated_size(pixels, max_color_value, table_size, flags) > cppm_raw_size(pixels, max_color_value);
+}
+
+// Each sample minus the same component of the previous pixel, wrapping, as bytes in native order
+template<typename Sample>
+auto delta_encode_samples(const std::vector<Sample> &samples) -> std::vector<uint8_t> {
+  std::vector<Sample> residuals(samples.size());
+  for (size_t i = 0; i < samples.size(); ++i) {
+    residuals[i] = i < CPPM_COMPONENTS ? samples[i] : static_cast<Sample>(samples[i] - samples[i - CPPM_COMPONENTS]);
+  }
+  std::vector<uint8_t> bytes(residuals.size() * sizeof(Sample));
+  std::memcpy(bytes.data(), residuals.data(), bytes.size());
+  return bytes;
+}
+
+// Inverse of delta_encode_samples
+template<typename Sample>
+auto delta_decode_samples(const std::vector<uint8_t> &bytes) -> std::vector<Sample> {
+  std::vector<Sample> samples(bytes.size() / sizeof(Sample));
+  std::memcpy(samples.data(), bytes.data(), samples.size() * sizeof(Sample));
+  for (size_t i = CPPM_COMPONENTS; i < samples.size(); ++i) {
+    samples[i] = static_cast<Sample>(samples[i] + samples[i - CPPM_COMPONENTS]);
+  }
+  return samples;
+}
+
+// Writes interleaved RGB samples without a color table: delta coded if that is smaller, raw otherwise.
+// 'header' gives the image size; its table size and flags are replaced.
+template<typename Sample>
+void write_cppm_samples(std::ostream &output, CPPMHeader header, const std::vector<Sample> &samples) {
+  RansBlock const delta = encode_rans_block(delta_encode_samples(samples));
+  header.color_table_size = 0;
+  header.flags = rans_block_size(delta) < samples.size() * sizeof(Sample) ? CPPM_FLAG_DELTA : CPPM_FLAG_RAW;
+  header.group_rows = 0;
+  write_cppm_header(output, header);
+  if (header.flags == CPPM_FLAG_DELTA) {
+    write_rans_block(output, delta);
+  } else {
+    write_binary_buffer(output, samples);
+  }
+}
+
+// Reads the interleaved RGB samples of a file without a color table
+template<typename Sample>
+auto read_cppm_samples(std::istream &input, const CPPMHeader &header) -> std::vector<Sample> {
+  size_t const count = cppm_pixel_count(header) * CPPM_COMPONENTS;
+  if ((header.flags & CPPM_FLAG_RAW) != 0) { return read_binary_buffer<Sample>(input, count); }
+  std::vector<uint8_t> const bytes = read_rans_block(input, count * sizeof(Sample));
+  if (bytes.size() != count * sizeof(Sample)) { throw std::runtime_error("Invalid CPPM entropy-coded data."); }
+  return delta_decode_samples<Sample>(bytes);
+}
+
+// Samples of rows [first_row, first_row + rows) only. Raw files seek straight to them, delta files are
+// decoded up to the end of the range.
+template<typename Sample>
+auto read_cppm_row_samples(std::istream &input, const CPPMHeader &header, int first_row,
+                           int rows) -> std::vector<Sample> {
+  check_cppm_row_range(header, first_row, rows);
+  size_t const row_samples = static_cast<size_t>(header.width) * CPPM_COMPONENTS;
+  auto const first = static_cast<std::ptrdiff_t>(static_cast<size_t>(first_row) * row_samples);
+  auto const count = static_cast<std::ptrdiff_t>(static_cast<size_t>(rows) * row_samples);
+  if ((header.flags & CPPM_FLAG_RAW) != 0) {
+    input.seekg(first * static_cast<std::streamoff>(sizeof(Sample)), std::ios::cur);
+    return read_binary_buffer<Sample>(input, static_cast<size_t>(count));
+  }
+  std::vector<Sample> const samples = read_cppm_samples<Sample>(input, header);
+  return {samples.begin() + first, samples.begin() + first + count};
+}
+
+#endif // CPPMFORMAT_HPP
@@ -0,0 +1,52 @@
+#ifndef DENSECOLORTABLE_HPP
+#define DENSECOLORTABLE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Colour -> palette index table for 8-bit colours, indexed directly by the 24-bit colour code.
+// Replaces a tree map lookup by one array access. Only the 'seen' bitset is cleared, the index array is
+// left uninitialised, so the pages of colours that never appear are never touched.
+
+constexpr size_t DENSE_COLOR_COUNT = size_t{1} << 24; // Every 8-bit RGB colour.
+constexpr size_t DENSE_WORD_BITS = 64;
+constexpr int DENSE_RED_SHIFT = 16;
+constexpr int DENSE_GREEN_SHIFT = 8;
+
+// One bit per colour code.
+using DenseColorSet = std::vector<uint64_t>;
+
+inline auto makeDenseColorSet() -> DenseColorSet { return DenseColorSet(DENSE_COLOR_COUNT / DENSE_WORD_BITS, 0); }
+
+struct DenseColorTable {
+    DenseColorSet seen = makeDenseColorSet();
+    std::unique_ptr<uint32_t[]> index = std::make_unique_for_overwrite<uint32_t[]>(DENSE_COLOR_COUNT); // NOLINT(cppcoreguidelines-avoid-c-arrays)
+    size_t size = 0; // Colours inserted so far.
+};
+
+inline auto denseColorCode(uint8_t red, uint8_t green, uint8_t blue) -> uint32_t {
+  return (static_cast<uint32_t>(red) << DENSE_RED_SHIFT) | (static_cast<uint32_t>(green) << DENSE_GREEN_SHIFT) | blue;
+}
+
+// Adds 'code' to the set. Returns true if it was not there yet.
+inline auto markDenseColor(DenseColorSet &seen, uint32_t code) -> bool {
+  uint64_t &word = seen[code / DENSE_WORD_BITS];
+  uint64_t const bit = uint64_t{1} << (code % DENSE_WORD_BITS);
+  if ((word & bit) != 0) { return false; }
+  word |= bit;
+  return true;
+}
+
+// Gives 'code' the next index if it is new. Returns true in that case.
+inline auto insertDenseColor(DenseColorTable &table, uint32_t code) -> bool {
+  if (!markDenseColor(table.seen, code)) { return false; }
+  table.index[code] = static_cast<uint32_t>(table.size++);
+  return true;
+}
+
+// Index of a colour already inserted.
+inline auto denseColorIndex(const DenseColorTable &table, uint32_t code) -> uint32_t { return table.index[code]; }
+
+#endif // DENSECOLORTABLE_HPP
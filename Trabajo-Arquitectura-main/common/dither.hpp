@@ -0,0 +1,145 @@
+#ifndef DITHER_HPP
+#define DITHER_HPP
+
+#include "parallel.hpp"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Dithered maxlevel. When the maximum level drops, plain rounding turns smooth gradients into bands; dithering
+// spreads the rounding error so the average level of every area is kept. The kernels see the image through
+// load(pixel, channel) and store(pixel, channel, level), with Channels components per pixel, so each layout
+// passes its own accessors. A component is always loaded before it is stored, so the image can be rewritten in
+// its own buffer.
+//  - Floyd-Steinberg diffuses the error of each component to the next pixel and to the three below it (7, 3, 5
+//    and 1 sixteenths). The rows run on several threads as a wavefront: a row may process a pixel once the row
+//    above is past the pixel below-right of it, which is the order of the sequential scan, so the result does not
+//    depend on the number of threads.
+//  - Ordered dithering adds the threshold of an 8x8 Bayer matrix before truncating. Every pixel is independent,
+//    so the rows are split in stripes and the inner loop is a plain multiply-add.
+
+enum class DitherMethod { none, floyd_steinberg, bayer };
+
+constexpr size_t DITHER_SYNC_PIXELS = 64; // Pixels a row processes between two progress updates
+constexpr int64_t FS_DENOMINATOR = 16; // Floyd-Steinberg weights are sixteenths
+constexpr int64_t FS_RIGHT = 7;
+constexpr int64_t FS_BELOW_LEFT = 3;
+constexpr int64_t FS_BELOW = 5;
+constexpr int64_t FS_BELOW_RIGHT = 1;
+constexpr size_t BAYER_SIZE = 8;
+
+inline auto ditherMethodFromName(const std::string &name) -> DitherMethod {
+  if (name == "none") { return DitherMethod::none; }
+  if (name == "fs") { return DitherMethod::floyd_steinberg; }
+  if (name == "bayer") { return DitherMethod::bayer; }
+  throw std::invalid_argument("Unknown dither method: " + name);
+}
+
+// Threshold in (0, 1) of every position of the 8x8 Bayer matrix, (2 * rank + 1) / 128
+inline constexpr std::array<std::array<double, BAYER_SIZE>, BAYER_SIZE> BAYER_THRESHOLDS = [] {
+  constexpr std::array<std::array<int, BAYER_SIZE>, BAYER_SIZE> ranks{{
+      {0, 32, 8, 40, 2, 34, 10, 42},
+      {48, 16, 56, 24, 50, 18, 58, 26},
+      {12, 44, 4, 36, 14, 46, 6, 38},
+      {60, 28, 52, 20, 62, 30, 54, 22},
+      {3, 35, 11, 43, 1, 33, 9, 41},
+      {51, 19, 59, 27, 49, 17, 57, 25},
+      {15, 47, 7, 39, 13, 45, 5, 37},
+      {63, 31, 55, 23, 61, 29, 53, 21},
+  }};
+  std::array<std::array<double, BAYER_SIZE>, BAYER_SIZE> thresholds{};
+  for (size_t row = 0; row < BAYER_SIZE; ++row) {
+    for (size_t column = 0; column < BAYER_SIZE; ++column) {
+      thresholds[row][column] = ((2.0 * ranks[row][column]) + 1.0) / (2.0 * BAYER_SIZE * BAYER_SIZE);
+    }
+  }
+  return thresholds;
+}();
+
+// Floyd-Steinberg from [0, old_max] to [0, new_max], on 'threads' threads (0 picks them from the image size).
+// Levels are kept in units of 1 / (16 * old_max) output levels, so the diffusion is integer and exact up to the
+// truncation of each share.
+template<size_t Channels, typename Load, typename Store>
+void floydSteinbergDither(size_t width, size_t height, int old_max, int new_max, const Load &load, const Store &store,
+                          size_t threads = 0) {
+  if (threads == 0) { threads = stripeCount(width * height); }
+  threads = std::clamp<size_t>(threads, 1, std::max<size_t>(height, 1));
+  // A ring of error rows: a row reads its own and fills the next one. Row y reuses the ring slot of row
+  // y - threads, which ran on the same thread and is finished, as is the row that filled it.
+  size_t const slots = threads + 1;
+  size_t const stride = (width + 2) * Channels; // One padding pixel at each end
+  std::vector<int64_t> errors(slots * stride, 0);
+  std::vector<std::atomic<size_t>> progress(height); // Pixels finished in every row
+  int64_t const level_unit = FS_DENOMINATOR * old_max;
+  forEachStripe(threads, threads, [&](size_t thread, size_t /*begin*/, size_t /*end*/) {
+    for (size_t row = thread; row < height; row += threads) {
+      int64_t *current = errors.data() + ((row % slots) * stride); // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+      int64_t *below = errors.data() + (((row + 1) % slots) * stride); // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+      std::fill(below, below + stride, 0); // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+      std::array<int64_t, Channels> right{}; // Error carried to the next pixel of the row
+      for (size_t begin = 0; begin < width; begin += DITHER_SYNC_PIXELS) {
+        size_t const end = std::min(begin + DITHER_SYNC_PIXELS, width);
+        if (row > 0) { // Wait until the row above has diffused into every pixel of this block
+          size_t const needed = std::min(end + 1, width);
+          while (progress[row - 1].load(std::memory_order_acquire) < needed) { std::this_thread::yield(); }
+        }
+        for (size_t column = begin; column < end; ++column) {
+          size_t const pixel = (row * width) + column;
+          for (size_t channel = 0; channel < Channels; ++channel) {
+            size_t const slot = ((column + 1) * Channels) + channel;
+            // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+            int64_t const total = (FS_DENOMINATOR * load(pixel, channel) * int64_t{new_max}) + current[slot] + right[channel];
+            int64_t const level = std::clamp<int64_t>(((2 * total) + level_unit) / (2 * level_unit), 0, new_max);
+            store(pixel, channel, static_cast<int>(level));
+            int64_t const error = total - (level * level_unit);
+            right[channel] = error * FS_RIGHT / FS_DENOMINATOR;
+            below[slot - Channels] += error * FS_BELOW_LEFT / FS_DENOMINATOR; // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+            below[slot] += error * FS_BELOW / FS_DENOMINATOR; // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+            below[slot + Channels] += error * FS_BELOW_RIGHT / FS_DENOMINATOR; // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+          }
+        }
+        progress[row].store(end, std::memory_order_release);
+      }
+    }
+  });
+}
+
+// Ordered dithering from [0, old_max] to [0, new_max], in row stripes (0 picks their number from the image size)
+template<size_t Channels, typename Load, typename Store>
+void orderedDither(size_t width, size_t height, int old_max, int new_max, const Load &load, const Store &store,
+                   size_t stripes = 0) {
+  if (stripes == 0) { stripes = stripeCount(width * height); }
+  stripes = std::clamp<size_t>(stripes, 1, std::max<size_t>(height, 1));
+  double const scale = static_cast<double>(new_max) / old_max;
+  forEachStripe(height, stripes, [&](size_t /*stripe*/, size_t first_row, size_t last_row) {
+    for (size_t row = first_row; row < last_row; ++row) {
+      const std::array<double, BAYER_SIZE> &thresholds = BAYER_THRESHOLDS[row % BAYER_SIZE];
+      for (size_t column = 0; column < width; ++column) {
+        size_t const pixel = (row * width) + column;
+        for (size_t channel = 0; channel < Channels; ++channel) {
+          auto const level = static_cast<int>((load(pixel, channel) * scale) + thresholds[column % BAYER_SIZE]);
+          store(pixel, channel, std::min(level, new_max));
+        }
+      }
+    }
+  });
+}
+
+// Runs 'method' (not none) over a width x height image
+template<size_t Channels, typename Load, typename Store>
+void ditherLevels(DitherMethod method, size_t width, size_t height, int old_max, int new_max, const Load &load,
+                  const Store &store, size_t threads = 0) {
+  if (method == DitherMethod::floyd_steinberg) {
+    floydSteinbergDither<Channels>(width, height, old_max, new_max, load, store, threads);
+  } else {
+    orderedDither<Channels>(width, height, old_max, new_max, load, store, threads);
+  }
+}
+
+#endif // DITHER_HPP
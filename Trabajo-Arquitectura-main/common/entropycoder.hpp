@@ -0,0 +1,280 @@
+#ifndef ENTROPYCODER_HPP
+#define ENTROPYCODER_HPP
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+// Dependency-free compression of a CPPM index stream, in two stages:
+//  1. Run-length: the indices become (index, run length) pairs, each index in 1, 2 or 4 bytes and each run
+//     length - 1 as a LEB128 varint, so flat regions shrink to a few bytes.
+//  2. Order-0 rANS over the resulting bytes (byte-wise renormalisation, 12-bit probabilities, four interleaved
+//     states so consecutive symbols do not wait on each other). Encoding multiplies by per-symbol reciprocals
+//     instead of dividing; decoding is one table lookup per byte.
+// Encoded block: run bytes (uint64), the 256 normalised frequencies (uint16 each), coded bytes (uint64), coded data.
+
+constexpr unsigned RANS_PROB_BITS = 12;
+constexpr uint32_t RANS_PROB_SCALE = uint32_t{1} << RANS_PROB_BITS;
+constexpr uint32_t RANS_LOWER_BOUND = uint32_t{1} << 23; // States stay in [L, 256 L).
+constexpr size_t RANS_SYMBOLS = 256;
+constexpr size_t RANS_STATES = 4;
+constexpr unsigned RUN_VARINT_BITS = 7;
+constexpr uint8_t RUN_VARINT_MORE = 0x80;
+constexpr unsigned BYTE_BITS = 8;
+
+using RansFrequencies = std::array<uint32_t, RANS_SYMBOLS>;
+
+// --- Run-length stage ---
+
+// NOLINTBEGIN(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+inline void appendRunIndex(uint8_t *&out, uint32_t index, unsigned index_bytes) {
+  for (unsigned byte = 0; byte < index_bytes; ++byte) { *out++ = static_cast<uint8_t>(index >> (byte * BYTE_BITS)); }
+}
+
+inline void appendRunLength(uint8_t *&out, size_t value) {
+  while (value >= RUN_VARINT_MORE) {
+    *out++ = static_cast<uint8_t>(value | RUN_VARINT_MORE);
+    value >>= RUN_VARINT_BITS;
+  }
+  *out++ = static_cast<uint8_t>(value);
+}
+
+// (index, run length - 1) pairs of the whole index sequence. A run never takes more bytes than
+// index_bytes + 1 per index it covers, so the output goes to an uninitialised buffer of that size first.
+inline auto encodeRuns(const std::vector<uint32_t> &indices, unsigned index_bytes) -> std::vector<uint8_t> {
+  auto const buffer = std::make_unique_for_overwrite<uint8_t[]>(indices.size() * (index_bytes + 1)); // NOLINT(cppcoreguidelines-avoid-c-arrays)
+  uint8_t *out = buffer.get();
+  size_t begin = 0;
+  while (begin < indices.size()) {
+    size_t end = begin + 1;
+    while (end < indices.size() && indices[end] == indices[begin]) { ++end; }
+    appendRunIndex(out, indices[begin], index_bytes);
+    appendRunLength(out, end - begin - 1);
+    begin = end;
+  }
+  return {buffer.get(), out};
+}
+// NOLINTEND(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+
+// Inverse of encodeRuns; throws if the runs do not cover exactly 'count' indices.
+inline auto decodeRuns(const std::vector<uint8_t> &bytes, unsigned index_bytes, size_t count) -> std::vector<uint32_t> {
+  std::vector<uint32_t> indices(count);
+  size_t position = 0;
+  size_t filled = 0;
+  while (position < bytes.size()) {
+    if (bytes.size() - position < index_bytes) { throw std::runtime_error("Truncated CPPM run."); }
+    uint32_t index = 0;
+    for (unsigned byte = 0; byte < index_bytes; ++byte) {
+      index |= static_cast<uint32_t>(bytes[position++]) << (byte * BYTE_BITS);
+    }
+    size_t length = 0;
+    unsigned shift = 0;
+    uint8_t byte = RUN_VARINT_MORE;
+    while ((byte & RUN_VARINT_MORE) != 0) {
+      if (position == bytes.size() || shift >= sizeof(size_t) * BYTE_BITS) { throw std::runtime_error("Invalid CPPM run."); }
+      byte = bytes[position++];
+      length |= static_cast<size_t>(byte & (RUN_VARINT_MORE - 1)) << shift;
+      shift += RUN_VARINT_BITS;
+    }
+    if (length >= count - filled) { throw std::runtime_error("CPPM runs exceed the image size."); }
+    auto const first = indices.begin() + static_cast<std::ptrdiff_t>(filled);
+    std::fill(first, first + static_cast<std::ptrdiff_t>(length + 1), index);
+    filled += length + 1;
+  }
+  if (filled != count) { throw std::runtime_error("CPPM runs do not cover the image."); }
+  return indices;
+}
+
+// --- rANS stage ---
+
+// Scales byte counts to frequencies summing to RANS_PROB_SCALE, every present byte keeping at least 1.
+inline auto normalizeFrequencies(const std::vector<uint8_t> &bytes) -> RansFrequencies {
+  // Four partial histograms, so runs of equal bytes do not serialise on one counter
+  std::array<std::array<uint64_t, RANS_SYMBOLS>, RANS_STATES> partial{};
+  for (size_t i = 0; i < bytes.size(); ++i) { ++partial[i % RANS_STATES][bytes[i]]; }
+  std::array<uint64_t, RANS_SYMBOLS> counts{};
+  for (auto const &histogram : partial) {
+    for (size_t symbol = 0; symbol < RANS_SYMBOLS; ++symbol) { counts[symbol] += histogram[symbol]; }
+  }
+  RansFrequencies frequencies{};
+  if (bytes.empty()) { // Still a valid table, so every table a decoder reads sums to the scale
+    frequencies[0] = RANS_PROB_SCALE;
+    return frequencies;
+  }
+  uint32_t total = 0;
+  size_t largest = 0;
+  for (size_t symbol = 0; symbol < RANS_SYMBOLS; ++symbol) {
+    if (counts[symbol] == 0) { continue; }
+    frequencies[symbol] = std::max<uint32_t>(1, static_cast<uint32_t>(counts[symbol] * RANS_PROB_SCALE / bytes.size()));
+    total += frequencies[symbol];
+    if (counts[symbol] > counts[largest]) { largest = symbol; }
+  }
+  // Rounding error goes to (or comes from) the most frequent bytes, largest first
+  while (total > RANS_PROB_SCALE) {
+    size_t victim = largest;
+    for (size_t symbol = 0; symbol < RANS_SYMBOLS; ++symbol) {
+      if (frequencies[symbol] > frequencies[victim]) { victim = symbol; }
+    }
+    uint32_t const excess = std::min(total - RANS_PROB_SCALE, frequencies[victim] - 1);
+    frequencies[victim] -= excess;
+    total -= excess;
+  }
+  frequencies[largest] += RANS_PROB_SCALE - total;
+  return frequencies;
+}
+
+inline auto cumulativeFrequencies(const RansFrequencies &frequencies) -> RansFrequencies {
+  RansFrequencies starts{};
+  uint32_t start = 0;
+  for (size_t symbol = 0; symbol < RANS_SYMBOLS; ++symbol) {
+    starts[symbol] = start;
+    start += frequencies[symbol];
+  }
+  return starts;
+}
+
+// Per-symbol encoder constants: state / frequency becomes a multiply-high and a shift (exact for every state
+// below 2^31), so the encoder never divides.
+struct RansEncodeSymbol {
+    uint32_t state_max = 0;  // Renormalise while the state is at or above this
+    uint32_t reciprocal = 0;
+    uint32_t shift = 0;
+    uint32_t bias = 0;       // Start of the symbol's slots (adjusted for frequency 1)
+    uint32_t complement = 0; // RANS_PROB_SCALE - frequency
+};
+
+inline auto makeEncodeSymbol(uint32_t start, uint32_t frequency) -> RansEncodeSymbol {
+  RansEncodeSymbol symbol{.state_max = ((RANS_LOWER_BOUND >> RANS_PROB_BITS) << BYTE_BITS) * frequency,
+                          .complement = RANS_PROB_SCALE - frequency};
+  if (frequency < 2) { // Quotient is the state itself: reciprocal ~0 with shift 0 gives state - 1, bias adds it back
+    symbol.reciprocal = ~uint32_t{0};
+    symbol.bias = start + RANS_PROB_SCALE - 1;
+    return symbol;
+  }
+  uint32_t const shift = static_cast<uint32_t>(std::bit_width(frequency - 1));
+  symbol.reciprocal = static_cast<uint32_t>(((uint64_t{1} << (shift + 31)) + frequency - 1) / frequency);
+  symbol.shift = shift - 1;
+  symbol.bias = start;
+  return symbol;
+}
+
+// Codes 'bytes' with the given frequencies. The encoder runs backwards, writing from the end of a buffer, so the
+// decoder reads forwards; byte i goes to state i % RANS_STATES and the states are independent chains.
+// NOLINTBEGIN(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+inline auto ransEncode(const std::vector<uint8_t> &bytes, const RansFrequencies &frequencies) -> std::vector<uint8_t> {
+  RansFrequencies const starts = cumulativeFrequencies(frequencies);
+  std::array<RansEncodeSymbol, RANS_SYMBOLS> symbols{};
+  for (size_t symbol = 0; symbol < RANS_SYMBOLS; ++symbol) {
+    if (frequencies[symbol] != 0) { symbols[symbol] = makeEncodeSymbol(starts[symbol], frequencies[symbol]); }
+  }
+  // A byte costs at most 2 output bytes (frequency 1 shifts a state below 2^31 down to 2^19), plus the final states
+  std::vector<uint8_t> buffer(bytes.size() * 2 + RANS_STATES * sizeof(uint32_t));
+  uint8_t *const end = buffer.data() + buffer.size();
+  uint8_t *out = end;
+  auto const encode = [&symbols, &out](uint32_t &state, uint8_t byte) {
+    RansEncodeSymbol const &symbol = symbols[byte];
+    for (int write = 0; write < 2; ++write) { // Renormalise: move up to two low bytes out, without branches
+      uint32_t const flush = static_cast<uint32_t>(state >= symbol.state_max);
+      *(out - 1) = static_cast<uint8_t>(state); // Always room: the buffer keeps 2 bytes per byte still to code
+      out -= flush;
+      state >>= flush * BYTE_BITS;
+    }
+    uint32_t const quotient =
+        static_cast<uint32_t>((static_cast<uint64_t>(state) * symbol.reciprocal) >> 32) >> symbol.shift;
+    state += symbol.bias + quotient * symbol.complement;
+  };
+  std::array<uint32_t, RANS_STATES> states{};
+  states.fill(RANS_LOWER_BOUND);
+  uint8_t const *data = bytes.data();
+  size_t i = bytes.size();
+  while (i % RANS_STATES != 0) { // Incomplete last group
+    --i;
+    encode(states[i % RANS_STATES], data[i]);
+  }
+  for (; i > 0; i -= RANS_STATES) {
+    for (size_t state = RANS_STATES; state > 0; --state) { encode(states[state - 1], data[i - RANS_STATES + state - 1]); }
+  }
+  for (size_t state = RANS_STATES; state > 0; --state) { // Final states, first state first, most significant byte first
+    for (unsigned byte = 0; byte < sizeof(uint32_t); ++byte) {
+      *--out = static_cast<uint8_t>(states[state - 1] >> (byte * BYTE_BITS));
+    }
+  }
+  return {out, end};
+}
+
+// Per-slot decoder entry: the byte owning the slot, its frequency and the slot's offset inside the byte's range.
+struct RansDecodeSlot {
+    uint16_t frequency = 0;
+    uint16_t offset = 0;
+    uint8_t symbol = 0;
+};
+
+inline auto validFrequencies(const RansFrequencies &frequencies) -> bool {
+  uint64_t total = 0;
+  for (uint32_t const frequency : frequencies) { total += frequency; }
+  return total == RANS_PROB_SCALE;
+}
+
+// Decodes 'count' bytes. One table lookup per byte gives the symbol and everything needed to advance the state.
+// A table that does not sum to RANS_PROB_SCALE is rejected before the slots are filled from it.
+inline auto ransDecode(const std::vector<uint8_t> &coded, const RansFrequencies &frequencies,
+                       size_t count) -> std::vector<uint8_t> {
+  if (!validFrequencies(frequencies)) { throw std::runtime_error("Invalid CPPM entropy-coded frequencies."); }
+  std::vector<RansDecodeSlot> slots(RANS_PROB_SCALE);
+  uint32_t start = 0;
+  for (size_t symbol = 0; symbol < RANS_SYMBOLS; ++symbol) {
+    for (uint32_t offset = 0; offset < frequencies[symbol]; ++offset) {
+      slots[start + offset] = {.frequency = static_cast<uint16_t>(frequencies[symbol]),
+                               .offset = static_cast<uint16_t>(offset), .symbol = static_cast<uint8_t>(symbol)};
+    }
+    start += frequencies[symbol];
+  }
+  uint8_t const *in = coded.data();
+  uint8_t const *const in_end = in + coded.size();
+  auto const next_byte = [&in, in_end]() -> uint32_t {
+    if (in == in_end) { throw std::runtime_error("Truncated CPPM entropy-coded data."); }
+    return *in++;
+  };
+  auto const initial_state = [&next_byte]() -> uint32_t {
+    uint32_t state = 0;
+    for (unsigned byte = 0; byte < sizeof(uint32_t); ++byte) { state = (state << BYTE_BITS) | next_byte(); }
+    return state;
+  };
+  RansDecodeSlot const *const table = slots.data();
+  auto const decode = [table, &next_byte](uint32_t &state) -> uint8_t {
+    RansDecodeSlot const slot = table[state & (RANS_PROB_SCALE - 1)];
+    state = slot.frequency * (state >> RANS_PROB_BITS) + slot.offset;
+    while (state < RANS_LOWER_BOUND) { state = (state << BYTE_BITS) | next_byte(); }
+    return slot.symbol;
+  };
+  // Fast path while a group of symbols cannot run out of input (each takes at most 2 bytes): the renormalisation
+  // counts the bytes it needs and shifts them in at once, instead of an unpredictable loop
+  auto const decode_fast = [table, &in](uint32_t &state) -> uint8_t {
+    RansDecodeSlot const slot = table[state & (RANS_PROB_SCALE - 1)];
+    state = slot.frequency * (state >> RANS_PROB_BITS) + slot.offset;
+    uint32_t const reads = static_cast<uint32_t>(state < RANS_LOWER_BOUND) +
+                           static_cast<uint32_t>(state < (RANS_LOWER_BOUND >> BYTE_BITS));
+    uint32_t const next = (static_cast<uint32_t>(in[0]) << BYTE_BITS) | in[1]; // Next two bytes, in reading order
+    state = (state << (reads * BYTE_BITS)) | (next >> ((2 - reads) * BYTE_BITS));
+    in += reads;
+    return slot.symbol;
+  };
+  std::array<uint32_t, RANS_STATES> states{};
+  for (uint32_t &state : states) { state = initial_state(); }
+  std::vector<uint8_t> bytes(count);
+  uint8_t *const out = bytes.data();
+  size_t i = 0;
+  for (; count - i >= RANS_STATES && in_end - in >= static_cast<std::ptrdiff_t>(2 * RANS_STATES); i += RANS_STATES) {
+    for (size_t state = 0; state < RANS_STATES; ++state) { out[i + state] = decode_fast(states[state]); }
+  }
+  for (; i < count; ++i) { out[i] = decode(states[i % RANS_STATES]); }
+  return bytes;
+}
+// NOLINTEND(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+
+#endif // ENTROPYCODER_HPP
@@ -0,0 +1,66 @@
+#ifndef MAPPEDFILE_HPP
+#define MAPPEDFILE_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Read-only memory mapping of a whole file. Pages are read in by the kernel when first touched, so a file is
+// scanned without copying it into the process, and release() hands back the pages of a range already used so
+// the resident size stays bounded however large the file is.
+class MappedFile {
+  public:
+    explicit MappedFile(const std::string &filename) {
+      int const descriptor = ::open(filename.c_str(), O_RDONLY); // NOLINT(cppcoreguidelines-pro-type-vararg)
+      if (descriptor < 0) { throw std::runtime_error("Error opening file for reading: " + filename); }
+      struct stat info{};
+      if (::fstat(descriptor, &info) != 0) {
+        ::close(descriptor);
+        throw std::runtime_error("Error reading the size of: " + filename);
+      }
+      size_ = static_cast<size_t>(info.st_size);
+      if (size_ > 0) {
+        void *address = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, descriptor, 0);
+        if (address == MAP_FAILED) { // NOLINT(cppcoreguidelines-pro-type-cstyle-cast)
+          ::close(descriptor);
+          throw std::runtime_error("Error mapping file: " + filename);
+        }
+        data_ = static_cast<const uint8_t *>(address);
+        ::madvise(address, size_, MADV_SEQUENTIAL); // Read ahead, drop behind
+      }
+      ::close(descriptor); // The mapping keeps the file open
+    }
+
+    MappedFile(const MappedFile &) = delete;
+    auto operator=(const MappedFile &) -> MappedFile & = delete;
+    MappedFile(MappedFile &&) = delete;
+    auto operator=(MappedFile &&) -> MappedFile & = delete;
+
+    ~MappedFile() {
+      if (data_ != nullptr) { ::munmap(const_cast<uint8_t *>(data_), size_); } // NOLINT(cppcoreguidelines-pro-type-const-cast)
+    }
+
+    [[nodiscard]] auto data() const -> const uint8_t * { return data_; }
+    [[nodiscard]] auto size() const -> size_t { return size_; }
+
+    // Drops the pages wholly inside [begin, end) from the mapping; reading them again faults them back in
+    void release(size_t begin, size_t end) const {
+      auto const page = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+      size_t const first = (begin + page - 1) / page * page;
+      size_t const last = std::min(end, size_) / page * page;
+      if (data_ == nullptr || first >= last) { return; }
+      ::madvise(const_cast<uint8_t *>(data_) + first, last - first, MADV_DONTNEED); // NOLINT
+    }
+
+  private:
+    const uint8_t *data_ = nullptr;
+    size_t size_ = 0;
+};
+
+#endif // MAPPEDFILE_HPP
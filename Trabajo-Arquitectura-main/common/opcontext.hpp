@@ -0,0 +1,148 @@
+#ifndef OPCONTEXT_HPP
+#define OPCONTEXT_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <memory_resource>
+#include <new>
+#include <vector>
+
+// Scratch memory of the operations. The temporaries of an operation (the colour maps and sets of cutfreq and
+// compress, the lists its stripes build) are pmr containers drawing from the arenas of an OperationContext: a
+// bump pointer through blocks taken from the global heap. Nothing is freed one by one; reset() rewinds the
+// arenas once the operation is done and keeps their blocks, so once the first image has grown them, the next
+// operations and images of the same size take nothing from the global heap.
+// An arena is not synchronized: the calling thread uses memory() and stripe s of a forEachStripe uses
+// stripe_memory(s), after prepare_stripes().
+
+constexpr size_t SCRATCH_FIRST_BLOCK = size_t{64} << 10; // Bytes of the first block of an arena
+
+class ScratchArena final : public std::pmr::memory_resource {
+  public:
+    ScratchArena() = default;
+    ScratchArena(const ScratchArena &) = delete;
+    ScratchArena(ScratchArena &&) = delete;
+    auto operator=(const ScratchArena &) -> ScratchArena & = delete;
+    auto operator=(ScratchArena &&) -> ScratchArena & = delete;
+    ~ScratchArena() override {
+      for (const Block &block : blocks_) { ::operator delete(block.data); }
+    }
+
+    // Makes every block available again; whatever was allocated must be gone
+    void reset() {
+      current_ = 0;
+      offset_ = 0;
+    }
+
+    [[nodiscard]] auto heap_blocks() const -> size_t { return blocks_.size(); } // Taken from the global heap so far
+    [[nodiscard]] auto reserved_bytes() const -> size_t {
+      size_t bytes = 0;
+      for (const Block &block : blocks_) { bytes += block.size; }
+      return bytes;
+    }
+
+  private:
+    struct Block {
+        std::byte *data;
+        size_t size;
+    };
+    std::vector<Block> blocks_;
+    size_t current_ = 0; // Block being filled
+    size_t offset_ = 0; // Bytes used in it
+
+    auto do_allocate(size_t bytes, size_t alignment) -> void * override {
+      for (; current_ < blocks_.size(); ++current_, offset_ = 0) { // A block too full is skipped until reset()
+        void *pointer = blocks_[current_].data + offset_; // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+        size_t space = blocks_[current_].size - offset_;
+        if (std::align(alignment, bytes, pointer, space) != nullptr) {
+          offset_ = blocks_[current_].size - space + bytes;
+          return pointer;
+        }
+      }
+      size_t const last = blocks_.empty() ? SCRATCH_FIRST_BLOCK / 2 : blocks_.back().size;
+      size_t const size = std::max(2 * last, bytes + alignment); // Doubling, so the blocks stay few
+      blocks_.push_back({.data=static_cast<std::byte *>(::operator new(size)), .size=size});
+      current_ = blocks_.size() - 1;
+      offset_ = 0;
+      return do_allocate(bytes, alignment); // NOLINT(misc-no-recursion): fits in the new block
+    }
+
+    void do_deallocate(void * /*pointer*/, size_t /*bytes*/, size_t /*alignment*/) override {}
+
+    [[nodiscard]] auto do_is_equal(const std::pmr::memory_resource &other) const noexcept -> bool override {
+      return this == &other;
+    }
+};
+
+// A vector in the arena of one stripe. It is not allocator-aware, so it can be stored in a pmr container of the
+// calling thread without taking that container's arena.
+template<typename T>
+struct StripeVector {
+    std::pmr::vector<T> items;
+};
+
+class OperationContext {
+  public:
+    OperationContext() = default;
+
+    // Shared context whose memory is the global heap, for the calls made without a context of their own
+    static auto heap() -> OperationContext & {
+      static OperationContext context(true);
+      return context;
+    }
+
+    auto memory() -> std::pmr::memory_resource * {
+      return heap_ ? std::pmr::new_delete_resource() : &arena_;
+    }
+
+    // Gives each of 'stripes' stripes an arena of its own (they are kept, like the blocks)
+    void prepare_stripes(size_t stripes) {
+      if (heap_) { return; }
+      while (stripe_arenas_.size() < stripes) { stripe_arenas_.emplace_back(); }
+    }
+
+    auto stripe_memory(size_t stripe) -> std::pmr::memory_resource * {
+      return heap_ ? std::pmr::new_delete_resource() : &stripe_arenas_[stripe];
+    }
+
+    // One vector per stripe, each in its stripe's arena
+    template<typename T>
+    auto stripe_vectors(size_t stripes) -> std::pmr::vector<StripeVector<T>> {
+      prepare_stripes(stripes);
+      std::pmr::vector<StripeVector<T>> vectors(memory());
+      vectors.reserve(stripes);
+      for (size_t stripe = 0; stripe < stripes; ++stripe) {
+        vectors.push_back({.items=std::pmr::vector<T>(stripe_memory(stripe))});
+      }
+      return vectors;
+    }
+
+    // Between operations and between images: every temporary of the last operation must be gone
+    void reset() {
+      arena_.reset();
+      for (ScratchArena &arena : stripe_arenas_) { arena.reset(); }
+    }
+
+    [[nodiscard]] auto heap_blocks() const -> size_t {
+      size_t blocks = arena_.heap_blocks();
+      for (const ScratchArena &arena : stripe_arenas_) { blocks += arena.heap_blocks(); }
+      return blocks;
+    }
+
+    [[nodiscard]] auto reserved_bytes() const -> size_t {
+      size_t bytes = arena_.reserved_bytes();
+      for (const ScratchArena &arena : stripe_arenas_) { bytes += arena.reserved_bytes(); }
+      return bytes;
+    }
+
+  private:
+    explicit OperationContext(bool heap) : heap_(heap) {}
+
+    bool heap_ = false;
+    ScratchArena arena_;
+    std::deque<ScratchArena> stripe_arenas_; // A deque, so growing it does not move the arenas in use
+};
+
+#endif // OPCONTEXT_HPP
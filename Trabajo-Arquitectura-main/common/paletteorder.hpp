@@ -0,0 +1,79 @@
+#ifndef PALETTEORDER_HPP
+#define PALETTEORDER_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Order of the entries of a CPPM color table. The decoder does not care, but the encoded size does:
+//  - first_seen: order of first appearance in the image (the original layout).
+//  - frequency: most used colors first, so the common pixels get the smallest indices. Entropy-coded runs
+//    then see mostly-zero high index bytes, and the low byte concentrates on few values.
+//  - morton: colors sorted along a Z-order curve of RGB, so similar colors get nearby indices.
+
+enum class PaletteOrder { first_seen, frequency, morton };
+
+inline auto paletteOrderName(PaletteOrder order) -> std::string {
+  switch (order) {
+    case PaletteOrder::first_seen: return "first";
+    case PaletteOrder::frequency: return "freq";
+    case PaletteOrder::morton: return "morton";
+  }
+  return "first";
+}
+
+inline auto paletteOrderFromName(const std::string &name) -> PaletteOrder {
+  if (name == "first") { return PaletteOrder::first_seen; }
+  if (name == "freq") { return PaletteOrder::frequency; }
+  if (name == "morton") { return PaletteOrder::morton; }
+  throw std::invalid_argument("Unknown palette order: " + name);
+}
+
+// Spreads the 16 bits of 'value' to every third bit.
+inline auto mortonSpread(uint64_t value) -> uint64_t {
+  // NOLINTBEGIN(readability-magic-numbers,cppcoreguidelines-avoid-magic-numbers)
+  value &= 0xFFFFULL;
+  value = (value | (value << 32)) & 0x001F'0000'0000'FFFFULL;
+  value = (value | (value << 16)) & 0x001F'0000'FF00'00FFULL;
+  value = (value | (value << 8)) & 0x100F'00F0'0F00'F00FULL;
+  value = (value | (value << 4)) & 0x10C3'0C30'C30C'30C3ULL;
+  value = (value | (value << 2)) & 0x1249'2492'4924'9249ULL;
+  // NOLINTEND(readability-magic-numbers,cppcoreguidelines-avoid-magic-numbers)
+  return value;
+}
+
+// Z-order code of a color: bits of red, green and blue interleaved, most significant first.
+inline auto mortonCode(uint16_t red, uint16_t green, uint16_t blue) -> uint64_t {
+  return (mortonSpread(red) << 2) | (mortonSpread(green) << 1) | mortonSpread(blue);
+}
+
+// Old table positions in their new order. 'counts' are the pixels using each entry, 'codes' their Morton
+// codes (only read for PaletteOrder::morton). Ties keep first-seen order, so the result is deterministic.
+inline auto paletteOrderPositions(PaletteOrder order, const std::vector<size_t> &counts,
+                                  const std::vector<uint64_t> &codes) -> std::vector<size_t> {
+  std::vector<size_t> positions(counts.size());
+  std::iota(positions.begin(), positions.end(), size_t{0});
+  if (order == PaletteOrder::frequency) {
+    std::stable_sort(positions.begin(), positions.end(),
+                     [&counts](size_t left, size_t right) { return counts[left] > counts[right]; });
+  } else if (order == PaletteOrder::morton) {
+    std::stable_sort(positions.begin(), positions.end(),
+                     [&codes](size_t left, size_t right) { return codes[left] < codes[right]; });
+  }
+  return positions;
+}
+
+// Inverse of a position list: the new position of every old one.
+inline auto paletteRemap(const std::vector<size_t> &positions) -> std::vector<uint32_t> {
+  std::vector<uint32_t> remap(positions.size());
+  for (size_t position = 0; position < positions.size(); ++position) {
+    remap[positions[position]] = static_cast<uint32_t>(position);
+  }
+  return remap;
+}
+
+#endif // PALETTEORDER_HPP
@@ -0,0 +1,38 @@
+#ifndef PARALLEL_HPP
+#define PARALLEL_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+// Splits a range of items (pixels, in row-major order) into contiguous stripes processed by separate threads.
+// Stripes are numbered in image order, so results kept per stripe can be merged deterministically.
+
+constexpr size_t MIN_ITEMS_PER_STRIPE = size_t{1} << 16; // Below this, a thread costs more than it saves.
+
+// Number of stripes worth using for 'items' items: one per hardware thread, but never fewer than
+// 'min_items' items each (pass 1 when every item is a large piece of work, such as a row group).
+inline auto stripeCount(size_t items, size_t min_items = MIN_ITEMS_PER_STRIPE) -> size_t {
+  size_t const threads = std::max<size_t>(1, std::thread::hardware_concurrency());
+  return std::clamp<size_t>(items / min_items, 1, threads);
+}
+
+// First item of stripe 'stripe' out of 'stripes'.
+inline auto stripeBegin(size_t items, size_t stripes, size_t stripe) -> size_t {
+  return items / stripes * stripe + std::min(stripe, items % stripes);
+}
+
+// Calls function(stripe, begin, end) for every stripe; the last stripe runs on the calling thread.
+template<typename Function>
+void forEachStripe(size_t items, size_t stripes, const Function &function) {
+  stripes = std::max<size_t>(1, stripes);
+  std::vector<std::jthread> threads;
+  threads.reserve(stripes - 1);
+  for (size_t stripe = 0; stripe + 1 < stripes; ++stripe) {
+    threads.emplace_back(function, stripe, stripeBegin(items, stripes, stripe), stripeBegin(items, stripes, stripe + 1));
+  }
+  function(stripes - 1, stripeBegin(items, stripes, stripes - 1), items);
+} // jthread joins every stripe here
+
+#endif // PARALLEL_HPP
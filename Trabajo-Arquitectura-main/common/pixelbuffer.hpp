@@ -0,0 +1,192 @@
+#ifndef PIXELBUFFER_HPP
+#define PIXELBUFFER_HPP
+
+#include "parallel.hpp"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <limits>
+#include <new>
+#include <utility>
+#include <vector>
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Storage of the pixel rasters (the AOS pixel vectors and the SOA component planes). It is a std::vector, so
+// every kernel keeps its interface, with an allocator that
+//  - aligns the buffer to a cache line, so a plane starts where an aligned SIMD load can read it,
+//  - rounds the allocation up to whole cache lines, so a vector loop may read its last block past size(),
+//  - default-initializes the elements resize() adds: a raster is always filled right after it is sized, so the
+//    zero-fill of std::vector is a second write of every byte. Code that needs zeros passes a value.
+// The rows stay packed: the file formats, the streaming passes and the pixel indices all assume that pixel
+// y * width + x is element y * width + x.
+//
+// Large buffers are also placed for the threads that use them. They are aligned and sized to whole huge pages,
+// advised for transparent huge pages, and their pages are first touched by the same stripes (stripeCount over
+// the elements) the parallel kernels later work on, so on a NUMA host every stripe's pages sit on the node of
+// the thread that processes it instead of all on the allocating thread's node.
+
+constexpr size_t PIXEL_BUFFER_ALIGNMENT = 64; // One cache line, and one AVX-512 register
+constexpr size_t PIXEL_BUFFER_PAGE = 4096; // Base page, the first-touch step
+constexpr size_t MEBIBYTE = size_t{1} << 20;
+constexpr size_t PIXEL_BUFFER_HUGE_PAGE = 2 * MEBIBYTE; // x86-64 and AArch64 transparent huge page
+constexpr size_t PIXEL_BUFFER_LARGE = 4 * PIXEL_BUFFER_HUGE_PAGE; // Smallest buffer worth placing
+constexpr size_t PIXEL_BUFFER_MAX_NODES = 8; // NUMA nodes counted one by one; the rest share the last counter
+
+// What is done with large buffers; set once, before the rasters are allocated
+struct PixelBufferPlacement {
+    bool huge_pages = true; // madvise(MADV_HUGEPAGE)
+    bool first_touch = true; // Touch the pages from the kernels' stripes
+    bool count_nodes = false; // Sample the node of every huge page after the first touch (one system call)
+};
+
+// Totals since the start of the program
+struct PixelBufferStats {
+    size_t allocations = 0; // Buffers allocated, of any size
+    size_t allocated_bytes = 0; // Bytes of elements they were asked for
+    size_t large_buffers = 0;
+    size_t large_bytes = 0;
+    size_t advised_bytes = 0; // Accepted by madvise(MADV_HUGEPAGE)
+    size_t touched_pages = 0; // Base pages first touched by the stripes
+    size_t touch_stripes = 0; // Largest number of stripes a buffer was touched by
+    std::array<size_t, PIXEL_BUFFER_MAX_NODES> node_samples{}; // Huge pages found on each node
+    size_t unknown_samples = 0; // Huge pages whose node could not be read (no NUMA support)
+};
+
+namespace pixel_buffer_detail {
+  struct Counters {
+      std::atomic<size_t> allocations{0};
+      std::atomic<size_t> allocated_bytes{0};
+      std::atomic<size_t> large_buffers{0};
+      std::atomic<size_t> large_bytes{0};
+      std::atomic<size_t> advised_bytes{0};
+      std::atomic<size_t> touched_pages{0};
+      std::atomic<size_t> touch_stripes{0};
+      std::array<std::atomic<size_t>, PIXEL_BUFFER_MAX_NODES> node_samples{};
+      std::atomic<size_t> unknown_samples{0};
+  };
+
+  inline PixelBufferPlacement placement; // NOLINT(cppcoreguidelines-avoid-non-const-global-variables)
+  inline Counters counters; // NOLINT(cppcoreguidelines-avoid-non-const-global-variables)
+
+  // Bytes actually allocated for 'bytes' bytes of elements, and their alignment
+  inline auto allocationBytes(size_t bytes) -> size_t {
+    size_t const unit = bytes >= PIXEL_BUFFER_LARGE ? PIXEL_BUFFER_HUGE_PAGE : PIXEL_BUFFER_ALIGNMENT;
+    return (bytes + unit - 1) / unit * unit;
+  }
+  inline auto allocationAlignment(size_t bytes) -> std::align_val_t {
+    return std::align_val_t{bytes >= PIXEL_BUFFER_LARGE ? PIXEL_BUFFER_HUGE_PAGE : PIXEL_BUFFER_ALIGNMENT};
+  }
+
+  // Counts the node of the first base page of every huge page of the buffer
+  inline void countNodes([[maybe_unused]] unsigned char *buffer, size_t bytes) {
+    size_t const samples = bytes / PIXEL_BUFFER_HUGE_PAGE;
+#ifdef __linux__
+    std::vector<void *> pages(samples);
+    std::vector<int> nodes(samples, -1);
+    for (size_t sample = 0; sample < samples; ++sample) {
+      pages[sample] = buffer + (sample * PIXEL_BUFFER_HUGE_PAGE); // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+    }
+    // move_pages without target nodes only reports where each page is
+    if (syscall(SYS_move_pages, 0, samples, pages.data(), nullptr, nodes.data(), 0) == 0) {
+      for (int const node : nodes) {
+        if (node < 0) {
+          ++counters.unknown_samples;
+        } else {
+          ++counters.node_samples[std::min(static_cast<size_t>(node), PIXEL_BUFFER_MAX_NODES - 1)];
+        }
+      }
+      return;
+    }
+#endif
+    counters.unknown_samples += samples;
+  }
+
+  // Huge-page advice and first touch of a new large buffer of 'count' elements of 'size' bytes
+  inline void place(void *pointer, size_t count, size_t size, size_t bytes) {
+    ++counters.large_buffers;
+    counters.large_bytes += bytes;
+    auto *buffer = static_cast<unsigned char *>(pointer);
+#ifdef __linux__
+    if (placement.huge_pages && madvise(buffer, bytes, MADV_HUGEPAGE) == 0) { counters.advised_bytes += bytes; }
+#endif
+    if (placement.first_touch) {
+      size_t const stripes = stripeCount(count);
+      forEachStripe(count, stripes, [buffer, count, size, bytes](size_t /*stripe*/, size_t begin, size_t end) {
+        // A page belongs to the stripe of its first byte; the last stripe also takes the padding at the end
+        size_t const first = (begin * size + PIXEL_BUFFER_PAGE - 1) / PIXEL_BUFFER_PAGE * PIXEL_BUFFER_PAGE;
+        size_t const last = end == count ? bytes : end * size;
+        for (size_t offset = first; offset < last; offset += PIXEL_BUFFER_PAGE) {
+          // A volatile store, so the touch is not dropped as a dead write
+          *static_cast<volatile unsigned char *>(buffer + offset) = 0; // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+        }
+      });
+      counters.touched_pages += bytes / PIXEL_BUFFER_PAGE;
+      size_t seen = counters.touch_stripes.load();
+      while (seen < stripes && !counters.touch_stripes.compare_exchange_weak(seen, stripes)) {}
+    }
+    if (placement.count_nodes) { countNodes(buffer, bytes); }
+  }
+}
+
+inline void setPixelBufferPlacement(const PixelBufferPlacement &placement) {
+  pixel_buffer_detail::placement = placement;
+}
+
+inline auto pixelBufferStats() -> PixelBufferStats {
+  const pixel_buffer_detail::Counters &counters = pixel_buffer_detail::counters;
+  PixelBufferStats stats{.allocations=counters.allocations, .allocated_bytes=counters.allocated_bytes,
+                         .large_buffers=counters.large_buffers, .large_bytes=counters.large_bytes,
+                         .advised_bytes=counters.advised_bytes, .touched_pages=counters.touched_pages,
+                         .touch_stripes=counters.touch_stripes, .unknown_samples=counters.unknown_samples};
+  for (size_t node = 0; node < PIXEL_BUFFER_MAX_NODES; ++node) { stats.node_samples[node] = counters.node_samples[node]; }
+  return stats;
+}
+
+template<typename T>
+class PixelAllocator {
+  public:
+    using value_type = T;
+
+    PixelAllocator() = default;
+    template<typename U>
+    explicit(false) PixelAllocator(const PixelAllocator<U> & /*other*/) noexcept {}
+
+    [[nodiscard]] auto allocate(size_t count) -> T * {
+      if (count > (static_cast<size_t>(std::numeric_limits<ptrdiff_t>::max()) - PIXEL_BUFFER_HUGE_PAGE) / sizeof(T)) {
+        throw std::bad_array_new_length(); // As std::allocator, and the rounding up cannot overflow
+      }
+      ++pixel_buffer_detail::counters.allocations;
+      pixel_buffer_detail::counters.allocated_bytes += count * sizeof(T);
+      size_t const bytes = pixel_buffer_detail::allocationBytes(count * sizeof(T));
+      void *pointer = ::operator new(bytes, pixel_buffer_detail::allocationAlignment(count * sizeof(T)));
+      if (count * sizeof(T) >= PIXEL_BUFFER_LARGE) { pixel_buffer_detail::place(pointer, count, sizeof(T), bytes); }
+      return static_cast<T *>(pointer);
+    }
+
+    void deallocate(T *pointer, size_t count) noexcept {
+      ::operator delete(pointer, pixel_buffer_detail::allocationAlignment(count * sizeof(T)));
+    }
+
+    // Elements added without a value are left uninitialized; the others are constructed as usual
+    template<typename U>
+    void construct(U *pointer) noexcept {
+      ::new (static_cast<void *>(pointer)) U; // NOLINT(cppcoreguidelines-owning-memory)
+    }
+    template<typename U, typename... Args>
+    void construct(U *pointer, Args &&...args) {
+      ::new (static_cast<void *>(pointer)) U(std::forward<Args>(args)...); // NOLINT(cppcoreguidelines-owning-memory)
+    }
+
+    template<typename U>
+    auto operator==(const PixelAllocator<U> & /*other*/) const noexcept -> bool { return true; }
+};
+
+template<typename T>
+using PixelBuffer = std::vector<T, PixelAllocator<T>>;
+
+#endif // PIXELBUFFER_HPP
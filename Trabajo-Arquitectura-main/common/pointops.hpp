@@ -0,0 +1,161 @@
+#ifndef POINTOPS_HPP
+#define POINTOPS_HPP
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Point operations: each output component depends only on the same input component and the current maximum
+// level (maxlevel, gamma, levels and contrast). A pipeline does not run them one by one over the image; it
+// records consecutive ones in a PointOpChain and table() folds the whole chain into one lookup table. The table
+// is applied in a single gather pass, right before the next operation that needs the real pixels or before the
+// image is written. Every step rounds to an integer level as it would on its own, so a folded chain gives the
+// same image as its steps run one after the other.
+
+constexpr int POINT_OP_MAX_1B = 255; // Largest component value stored in one byte
+
+// value * newMaxLevel / oldMaxLevel rounded to the nearest integer (halves up), computed in 64 bits so 16-bit
+// values cannot overflow
+inline auto scaleLevel(int value, int newMaxLevel, int oldMaxLevel) -> int {
+  int64_t const oldMax = oldMaxLevel;
+  return static_cast<int>(((static_cast<int64_t>(value) * newMaxLevel * 2) + oldMax) / (2 * oldMax));
+}
+
+// max * (value / max) ^ (1 / gamma): a gamma above 1 brightens the midtones, below 1 darkens them
+inline auto gammaLevel(int value, double gamma, int maxLevel) -> int {
+  double const normalized = std::min(static_cast<double>(value) / maxLevel, 1.0);
+  return static_cast<int>(std::lround(maxLevel * std::pow(normalized, 1.0 / gamma)));
+}
+
+// Stretches [black, white] to [0, max] and clips what is outside, rounding as scaleLevel does
+inline auto levelsLevel(int value, int black, int white, int maxLevel) -> int {
+  if (value <= black) { return 0; }
+  if (value >= white) { return maxLevel; }
+  return scaleLevel(value - black, maxLevel, white - black);
+}
+
+// Moves value away from (factor > 1) or towards (factor < 1) the middle level, clipped to [0, max]
+inline auto contrastLevel(int value, double factor, int maxLevel) -> int {
+  double const middle = maxLevel / 2.0;
+  long const level = std::lround(((value - middle) * factor) + middle);
+  return static_cast<int>(std::clamp(level, 0L, static_cast<long>(maxLevel)));
+}
+
+// One recorded point operation and its parameters
+struct PointOp {
+    enum class Kind { maxlevel, gamma, levels, contrast };
+    Kind kind;
+    int first = 0; // New maximum level (maxlevel) or black level (levels)
+    int second = 0; // White level (levels)
+    double factor = 0.0; // Gamma or contrast factor
+};
+
+class PointOpChain {
+  public:
+    // Each records one step; nothing is computed until table() is called
+    void add_maxlevel(int new_max) { ops_.push_back({.kind=PointOp::Kind::maxlevel, .first=new_max}); }
+    void add_gamma(double gamma) { ops_.push_back({.kind=PointOp::Kind::gamma, .factor=gamma}); }
+    void add_levels(int black, int white) {
+      ops_.push_back({.kind=PointOp::Kind::levels, .first=black, .second=white});
+    }
+    void add_contrast(double factor) { ops_.push_back({.kind=PointOp::Kind::contrast, .factor=factor}); }
+
+    [[nodiscard]] auto empty() const -> bool { return ops_.empty(); }
+    [[nodiscard]] auto size() const -> size_t { return ops_.size(); }
+
+    // True for a lone maxlevel, which may have a specialised kernel
+    [[nodiscard]] auto single_maxlevel() const -> bool {
+      return ops_.size() == 1 && ops_.front().kind == PointOp::Kind::maxlevel;
+    }
+
+    // Maximum level of the result: the last maxlevel's, since the other operations keep it
+    [[nodiscard]] auto output_max(int input_max) const -> int {
+      int max_level = input_max;
+      for (const PointOp &op : ops_) {
+        if (op.kind == PointOp::Kind::maxlevel) { max_level = op.first; }
+      }
+      return max_level;
+    }
+
+    // Composed transform of every value of the input component type (values above input_max included, so a
+    // malformed image cannot index past the table)
+    [[nodiscard]] auto table(int input_max) const -> std::vector<uint16_t> {
+      size_t const size = input_max <= POINT_OP_MAX_1B ? size_t{POINT_OP_MAX_1B} + 1 : size_t{UINT16_MAX} + 1;
+      std::vector<uint16_t> lut(size);
+      for (size_t value = 0; value < size; ++value) {
+        int level = static_cast<int>(value);
+        int max_level = input_max;
+        for (const PointOp &op : ops_) { level = apply(op, level, max_level); }
+        lut[value] = static_cast<uint16_t>(level);
+      }
+      return lut;
+    }
+
+  private:
+    std::vector<PointOp> ops_;
+
+    static auto apply(const PointOp &op, int level, int &max_level) -> int {
+      switch (op.kind) {
+        case PointOp::Kind::maxlevel: {
+          int const scaled = scaleLevel(level, op.first, max_level);
+          max_level = op.first;
+          return scaled;
+        }
+        case PointOp::Kind::gamma: return gammaLevel(level, op.factor, max_level);
+        case PointOp::Kind::levels: return levelsLevel(level, op.first, op.second, max_level);
+        case PointOp::Kind::contrast: return contrastLevel(level, op.factor, max_level);
+      }
+      return level;
+    }
+};
+
+// Table of a single maxlevel step, built once per call so the pixels only need a lookup
+inline auto maxLevelTable(int oldMaxLevel, int newMaxLevel) -> std::vector<uint16_t> {
+  PointOpChain chain;
+  chain.add_maxlevel(newMaxLevel);
+  return chain.table(oldMaxLevel);
+}
+
+// Conversions frequent enough to get their own kernel. For every value 0..from, (value * multiplier + addend)
+// >> shift equals scaleLevel(value, to, from) (the tests check it exhaustively), so neither a table nor a
+// division is needed and the loops vectorize as plain 32-bit multiplies and shifts.
+struct FastLevelConversion {
+    int from;
+    int to;
+    uint32_t multiplier;
+    uint32_t addend;
+    unsigned shift;
+};
+
+inline constexpr std::array<FastLevelConversion, 4> FAST_LEVEL_CONVERSIONS{{
+    {.from=255, .to=65535, .multiplier=257, .addend=0, .shift=0}, // Exactly x257
+    {.from=65535, .to=255, .multiplier=255, .addend=32895, .shift=16}, // Rounded /257
+    {.from=255, .to=1023, .multiplier=1027, .addend=129, .shift=8},
+    {.from=4095, .to=65535, .multiplier=65551, .addend=2055, .shift=12},
+}};
+
+template<size_t Index>
+constexpr auto fastScaleLevel(uint32_t value) -> uint32_t {
+  constexpr FastLevelConversion conversion = FAST_LEVEL_CONVERSIONS[Index];
+  return ((value * conversion.multiplier) + conversion.addend) >> conversion.shift;
+}
+
+template<typename Kernel, size_t... Index>
+auto dispatchFastLevel(int from, int to, Kernel &kernel, std::index_sequence<Index...> /*indices*/) -> bool {
+  return ((FAST_LEVEL_CONVERSIONS[Index].from == from && FAST_LEVEL_CONVERSIONS[Index].to == to &&
+           (kernel(std::integral_constant<size_t, Index>{}), true)) || ...);
+}
+
+// Calls kernel(std::integral_constant<size_t, Index>) for the fast conversion from -> to, so the kernel can use
+// fastScaleLevel<Index> with its constants known at compile time. Returns false when there is none.
+template<typename Kernel>
+auto withFastLevelConversion(int from, int to, Kernel &&kernel) -> bool {
+  return dispatchFastLevel(from, to, kernel, std::make_index_sequence<FAST_LEVEL_CONVERSIONS.size()>{});
+}
+
+#endif // POINTOPS_HPP
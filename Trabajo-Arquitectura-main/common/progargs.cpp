@@ -1,4 +1,6 @@
 #include "progargs.hpp"
+#include "cppmformat.hpp"
+#include <cmath>
 #include <iostream>
 #include <string>
 #include <vector>
@@ -8,37 +10,217 @@
 static const int ERROR_CODE = -1;                   // Error code for general errors
 static const int MIN_ARGS_REQUIRED = 4;             // Minimum number of arguments required
 static const int MAX_LEVEL_CUT_FREQ_WIDTH_INDEX = 4; // Maxlevel/cutfreq/width argument index
-static const int HEIGHT_INDEX = 4;                   // Height argument index
+static const int HEIGHT_INDEX = 5;                   // Height argument index
 static const int ARGS_REQUIRED_MAXLEVEL_CUTFREQ = 5;        // Arguments required for "maxlevel" and "cutfreq"
 static const int ARGS_REQUIRED_RESIZE = 6;          // Arguments required for "resize"
+static const int ARGS_REQUIRED_FACTOR = 5;          // Arguments required for "gamma" and "contrast"
+static const int ARGS_REQUIRED_LEVELS = 6;          // Arguments required for "levels"
 static const int MAX_LEVEL_UPPER_LIMIT = 65535;     // Upper limit for max level validation
+static const std::string OPTION_PREFIX = "--";      // Prefix of optional "--name=value" arguments
+static const std::string TOLERANCE_OPTION = "--tolerance="; // Approximate cutfreq search tolerance
+static const std::string SEARCH_OPTION = "--search=";       // Forced cutfreq nearest-color strategy
+static const std::string VERBOSE_OPTION = "--verbose";      // Verbose output
+static const std::string BITPACK_OPTION = "--bitpack";      // Bit-packed CPPM indices
+static const std::string ENTROPY_OPTION = "--entropy";      // Entropy-coded CPPM indices
+static const std::string CHUNK_ROWS_OPTION = "--chunk-rows="; // CPPM row group height
+static const std::string PALETTE_ORDER_OPTION = "--palette-order="; // CPPM color table order
+static const std::string STREAM_OPTION = "--stream";        // Streaming compress
+static const std::string DITHER_OPTION = "--dither=";       // Dithered maxlevel
+static const std::string NO_PAGE_PLACEMENT_OPTION = "--no-page-placement"; // Plain pages for the rasters
 
 
 
-auto parseArgs(const std::vector <std::string> &argsVector) -> ProgramArgs {
+auto parseArgs(const std::vector <std::string> &arguments) -> ProgramArgs {
+    ProgramArgs args;
+    std::vector <std::string> const argsVector = extractOptions(arguments, args); // Options are validated apart
     if (argsVector.size() < MIN_ARGS_REQUIRED) { // Check if args are fewer than required
         printErrorAndExit("Invalid number of arguments: " + std::to_string(argsVector.size() - 1));
     }
-    ProgramArgs args;
     args.input_file = argsVector[1]; // Set input file
     args.output_file = argsVector[2]; // Set output file
-    args.operation = argsVector[3]; // Set operation type
+
+    // Each operation name starts a step; its parameters run up to the next operation name
+    for (size_t index = MIN_ARGS_REQUIRED - 1; index < argsVector.size();) {
+        size_t next = index + 1;
+        while (next < argsVector.size() && !isOperationName(argsVector[next])) { ++next; }
+        std::vector <std::string> stageVector(argsVector.begin(), argsVector.begin() + MIN_ARGS_REQUIRED - 1);
+        stageVector.insert(stageVector.end(), argsVector.begin() + static_cast<std::ptrdiff_t>(index),
+                           argsVector.begin() + static_cast<std::ptrdiff_t>(next));
+        args.steps.push_back(parseStep(stageVector));
+        index = next;
+    }
+    for (size_t i = 0; i + 1 < args.steps.size(); ++i) {
+        if (args.steps[i].operation == "info" || args.steps[i].operation == "compress") {
+            printErrorAndExit("Operation " + args.steps[i].operation + " must be the last one");
+        }
+    }
+    if (args.steps.size() > 1 && args.steps.back().operation == "info") {
+        printErrorAndExit("Operation info cannot be chained");
+    }
+    args.operation = args.steps.front().operation; // The first step, as for a single operation
+    args.max_level = args.steps.front().max_level;
+    args.width = args.steps.front().width;
+    args.height = args.steps.front().height;
+    validateOptions(args);
+
+    return args; // Return parsed arguments
+}
+
+auto isOperationName(const std::string &argument) -> bool {
+    return argument == "info" || argument == "compress" || argument == "maxlevel" || argument == "resize" ||
+           argument == "cutfreq" || argument == "gamma" || argument == "levels" || argument == "contrast";
+}
+
+auto pipelineSteps(const ProgramArgs &args) -> std::vector<PipelineStep> {
+    if (!args.steps.empty()) { return args.steps; }
+    return {{.operation=args.operation, .max_level=args.max_level, .width=args.width, .height=args.height}};
+}
+
+auto parseStep(const std::vector <std::string> &stageVector) -> PipelineStep {
+    ProgramArgs args;
+    args.operation = stageVector[MIN_ARGS_REQUIRED - 1]; // Set operation type
 
     // Validate based on operation
     if (args.operation == "info" || args.operation == "compress") {
-        OperationData const data = {.operation=args.operation, .argsvector=argsVector, .index=MIN_ARGS_REQUIRED};
+        OperationData const data = {.operation=args.operation, .argsvector=stageVector, .index=MIN_ARGS_REQUIRED};
         validateArgsExtra(data); // For info or compress
     } else if (args.operation == "maxlevel") {
-        validateMaxLevel(argsVector, args); // For maxlevel operation
+        validateMaxLevel(stageVector, args); // For maxlevel operation
     } else if (args.operation == "resize") {
-        validateResize(argsVector, args); // For resize operation
+        validateResize(stageVector, args); // For resize operation
     } else if (args.operation == "cutfreq") {
-        validateCutFreq(argsVector, args); // For cutfreq operation
-    } else {
+        validateCutFreq(stageVector, args); // For cutfreq operation
+    } else if (args.operation != "gamma" && args.operation != "levels" && args.operation != "contrast") {
         printErrorAndExit("Unsupported operation: " + args.operation); // Unsupported operation
     }
+    PipelineStep step{.operation=args.operation, .max_level=args.max_level, .width=args.width, .height=args.height};
+    if (step.operation == "gamma") {
+        validateGamma(stageVector, step); // For gamma operation
+    } else if (step.operation == "levels") {
+        validateLevels(stageVector, step); // For levels operation
+    } else if (step.operation == "contrast") {
+        validateContrast(stageVector, step); // For contrast operation
+    }
+    return step;
+}
 
-    return args; // Return parsed arguments
+auto extractOptions(const std::vector <std::string> &argsVector, ProgramArgs &args) -> std::vector <std::string> {
+  std::vector <std::string> positional;
+  for (size_t i = 0; i < argsVector.size(); ++i) {
+    const std::string &argument = argsVector[i];
+    if (i == 0 || !argument.starts_with(OPTION_PREFIX)) { // Program name and regular arguments are kept
+      positional.push_back(argument);
+      continue;
+    }
+    if (argument.starts_with(TOLERANCE_OPTION)) {
+      std::string const value = argument.substr(TOLERANCE_OPTION.size());
+      try {
+        args.tolerance = std::stod(value);
+      } catch (const std::exception &) {
+        printErrorAndExit("Invalid tolerance: " + value); // Not a number or out of range
+      }
+      if (!(args.tolerance >= 0.0)) {
+        printErrorAndExit("Invalid tolerance: " + value); // Negative (or NaN) tolerance
+      }
+    } else if (argument.starts_with(SEARCH_OPTION)) {
+      args.search = argument.substr(SEARCH_OPTION.size());
+      if (args.search != "auto" && args.search != "linear" && args.search != "kdtree" && args.search != "grid") {
+        printErrorAndExit("Invalid search strategy: " + args.search);
+      }
+    } else if (argument == VERBOSE_OPTION) {
+      args.verbose = true;
+    } else if (argument == BITPACK_OPTION) {
+      args.bitpack = true;
+    } else if (argument == ENTROPY_OPTION) {
+      args.entropy = true;
+    } else if (argument.starts_with(CHUNK_ROWS_OPTION)) {
+      std::string const value = argument.substr(CHUNK_ROWS_OPTION.size());
+      try {
+        args.chunk_rows = std::stoi(value);
+      } catch (const std::exception &) {
+        printErrorAndExit("Invalid chunk rows: " + value); // Not a number or out of range
+      }
+      if (args.chunk_rows <= 0) {
+        printErrorAndExit("Invalid chunk rows: " + value);
+      }
+    } else if (argument.starts_with(PALETTE_ORDER_OPTION)) {
+      args.palette_order = argument.substr(PALETTE_ORDER_OPTION.size());
+      if (args.palette_order != "first" && args.palette_order != "freq" && args.palette_order != "morton") {
+        printErrorAndExit("Invalid palette order: " + args.palette_order);
+      }
+    } else if (argument == STREAM_OPTION) {
+      args.stream = true;
+    } else if (argument.starts_with(DITHER_OPTION)) {
+      args.dither = argument.substr(DITHER_OPTION.size());
+      if (args.dither != "none" && args.dither != "fs" && args.dither != "bayer") {
+        printErrorAndExit("Invalid dither method: " + args.dither);
+      }
+    } else if (argument == NO_PAGE_PLACEMENT_OPTION) {
+      args.page_placement = false;
+    } else {
+      printErrorAndExit("Unsupported option: " + argument);
+    }
+  }
+  return positional;
+}
+
+// maxlevel and cutfreq alone, without dithering, from a C-PPM file to a .cppm file only rewrite the color table,
+// so they write C-PPM with the coding options; on any other path they write P6 and the options would be dropped
+auto rewritesCppmPalette(const ProgramArgs &args) -> bool {
+  return args.steps.size() <= 1 && (args.operation == "maxlevel" || args.operation == "cutfreq") &&
+         args.dither == "none" && has_cppm_extension(args.output_file) && is_cppm_file(args.input_file);
+}
+
+// compress alone with --stream from a P6 file maps the input instead of loading it; a C-PPM input has no P6 samples
+// to map, so --stream is rejected for it rather than falling back to the in-memory path
+auto streamsCompress(const ProgramArgs &args) -> bool {
+  return args.stream && args.steps.size() <= 1 && args.operation == "compress" && !is_cppm_file(args.input_file);
+}
+
+void validateOptions(const ProgramArgs &args) {
+  auto uses = [&args](const std::string &operation) { // Any step of the pipeline
+    for (const PipelineStep &step : args.steps) {
+      if (step.operation == operation) { return true; }
+    }
+    return args.steps.empty() && args.operation == operation;
+  };
+  if (args.tolerance > 0.0 && !uses("cutfreq")) {
+    printErrorAndExit("Option --tolerance is only valid for cutfreq");
+  }
+  if (args.search != "auto" && !uses("cutfreq")) {
+    printErrorAndExit("Option --search is only valid for cutfreq");
+  }
+  // The C-PPM coding options, only where a C-PPM file is written
+  bool const writes_cppm = uses("compress") || rewritesCppmPalette(args);
+  std::string const cppm_paths = " is only valid for compress, and for maxlevel and cutfreq from a C-PPM file to a "
+                                 ".cppm file";
+  if (args.bitpack && !writes_cppm) {
+    printErrorAndExit("Option --bitpack" + cppm_paths);
+  }
+  if (args.entropy && !writes_cppm) {
+    printErrorAndExit("Option --entropy" + cppm_paths);
+  }
+  if (args.chunk_rows > 0 && !writes_cppm) {
+    printErrorAndExit("Option --chunk-rows" + cppm_paths);
+  }
+  if (args.palette_order != "first" && !writes_cppm) {
+    printErrorAndExit("Option --palette-order" + cppm_paths);
+  }
+  if (args.bitpack && args.entropy) {
+    printErrorAndExit("Options --bitpack and --entropy cannot be combined");
+  }
+  if (args.dither != "none" && !uses("maxlevel")) {
+    printErrorAndExit("Option --dither is only valid for maxlevel");
+  }
+  if (args.stream && args.operation != "compress") {
+    printErrorAndExit("Option --stream is only valid for compress");
+  }
+  if (args.stream && !streamsCompress(args)) {
+    printErrorAndExit("Option --stream needs a P6 input");
+  }
+  if (args.stream && args.entropy && args.chunk_rows == 0) {
+    printErrorAndExit("Option --stream needs --chunk-rows with --entropy"); // rANS codes whole streams
+  }
 }
 
 void printErrorAndExit(const std::string &message) {
@@ -125,3 +307,52 @@ void validateCutFreq(const std::vector<std::string> &argv, ProgramArgs &args) {
     printErrorAndExit("Invalid cutfreq: " + argv[MAX_LEVEL_CUT_FREQ_WIDTH_INDEX]); // Catch out of range error
   }
 }
+
+
+// Parses the single factor of gamma or contrast; not a finite number is an error
+static auto parseFactor(const std::vector<std::string> &argv, const std::string &operation) -> double {
+  if (argv.size() != ARGS_REQUIRED_FACTOR) { // Validate args for gamma and contrast
+    OperationData const data = {.operation=operation, .argsvector=argv, .index=MIN_ARGS_REQUIRED};
+    validateArgsCount(data);
+  }
+  double factor = 0.0;
+  try {
+    factor = std::stod(argv[MAX_LEVEL_CUT_FREQ_WIDTH_INDEX]);
+  } catch (const std::exception &) {
+    printErrorAndExit("Invalid " + operation + ": " + argv[MAX_LEVEL_CUT_FREQ_WIDTH_INDEX]); // Not a number or out of range
+  }
+  if (!std::isfinite(factor)) {
+    printErrorAndExit("Invalid " + operation + ": " + argv[MAX_LEVEL_CUT_FREQ_WIDTH_INDEX]);
+  }
+  return factor;
+}
+
+void validateGamma(const std::vector<std::string> &argv, PipelineStep &step) {
+  step.factor = parseFactor(argv, "gamma");
+  if (step.factor <= 0.0) {
+    printErrorAndExit("Invalid gamma: " + argv[MAX_LEVEL_CUT_FREQ_WIDTH_INDEX]); // Exit if gamma is not positive
+  }
+}
+
+void validateContrast(const std::vector<std::string> &argv, PipelineStep &step) {
+  step.factor = parseFactor(argv, "contrast");
+  if (step.factor < 0.0) {
+    printErrorAndExit("Invalid contrast: " + argv[MAX_LEVEL_CUT_FREQ_WIDTH_INDEX]); // Exit if contrast is negative
+  }
+}
+
+void validateLevels(const std::vector<std::string> &argv, PipelineStep &step) {
+  if (argv.size() != ARGS_REQUIRED_LEVELS) { // Validate args for levels
+    OperationData const data = {.operation="levels", .argsvector=argv, .index=MIN_ARGS_REQUIRED};
+    validateArgsCount(data);
+  }
+  try {
+    step.black = std::stoi(argv[MAX_LEVEL_CUT_FREQ_WIDTH_INDEX]); // Parse black point
+    step.white = std::stoi(argv[HEIGHT_INDEX]); // Parse white point
+  } catch (const std::exception &) {
+    printErrorAndExit("Invalid levels: " + argv[MAX_LEVEL_CUT_FREQ_WIDTH_INDEX] + ", " + argv[HEIGHT_INDEX]);
+  }
+  if (step.black < 0 || step.white <= step.black || step.white > MAX_LEVEL_UPPER_LIMIT) {
+    printErrorAndExit("Invalid levels: " + std::to_string(step.black) + ", " + std::to_string(step.white));
+  }
+}
@@ -4,6 +4,17 @@
 #include <vector>
 #include <string>
 
+// One operation of a pipeline with its parameters (-1 when the operation has no such parameter).
+struct PipelineStep {
+    std::string operation;
+    int max_level = -1;
+    int width = -1;
+    int height = -1;
+    double factor = 0.0; // gamma and contrast factor
+    int black = -1; // levels input black point
+    int white = -1; // levels input white point
+};
+
 // Structure to store the parameters for the program.
 struct ProgramArgs {
     std::string input_file;
@@ -12,6 +23,17 @@ struct ProgramArgs {
     int max_level = -1; // -1 by default, meaning not defined yet.
     int width = -1; // Width for the resize.
     int height = -1; // Height for the resize.
+    double tolerance = 0.0; // Squared-distance tolerance for the approximate cutfreq search (0 = exact).
+    std::string search = "auto"; // Nearest-color strategy for cutfreq: auto, linear, kdtree or grid.
+    bool verbose = false; // Print details about how the operation was performed.
+    bool bitpack = false; // Write CPPM pixel indices bit-packed (compress, and CPPM output of maxlevel/cutfreq).
+    bool entropy = false; // Write CPPM pixel indices run-length and rANS coded (same operations as bitpack).
+    int chunk_rows = 0; // Write CPPM pixel indices in row groups of this many rows (0 = one stream; same operations).
+    std::string palette_order = "first"; // CPPM color table order: first (seen), freq or morton (same operations).
+    bool stream = false; // compress a P6 file in two passes over its mapping, without loading the image.
+    std::string dither = "none"; // Dithering of maxlevel when it lowers the level: none, fs or bayer.
+    bool page_placement = true; // Huge pages and per-stripe first touch for large rasters (--no-page-placement).
+    std::vector<PipelineStep> steps; // Operations in order; operation, max_level, width and height are the first.
 };
 
 struct OperationData {
@@ -22,6 +44,21 @@ struct OperationData {
 
 auto parseArgs(const std::vector <std::string> &argsVector) -> ProgramArgs; // Parses and validates the arguments passed to the program.
 
+auto parseStep(const std::vector <std::string> &stageVector) -> PipelineStep; // Validates one operation and its parameters.
+
+auto isOperationName(const std::string &argument) -> bool; // True for the names that start a pipeline step.
+
+auto pipelineSteps(const ProgramArgs &args) -> std::vector<PipelineStep>; // The steps, or the single operation.
+
+auto extractOptions(const std::vector <std::string> &argsVector,
+                    ProgramArgs &args) -> std::vector <std::string>; // Parses "--name=value" options and returns the remaining arguments.
+
+void validateOptions(const ProgramArgs &args); // Checks that the given options are valid for the requested operation.
+
+auto rewritesCppmPalette(const ProgramArgs &args) -> bool; // maxlevel or cutfreq from a C-PPM file to a .cppm file.
+
+auto streamsCompress(const ProgramArgs &args) -> bool; // compress with --stream from a P6 file.
+
 void printErrorAndExit(const std::string &message); // Prints an error message and exits the program.
 
 void printExtraArgumentsError(const OperationData &data); // Prints an error for extra arguments in a specific operation and exits.
@@ -39,5 +76,13 @@ void validateResize(const std::vector <std::string> &argsVector,
 void validateCutFreq(const std::vector <std::string> &argsVector,
                      ProgramArgs &args); // Validates the "cutfreq" operation arguments, ensuring valid max level for frequency cutoff.
 
+void validateGamma(const std::vector <std::string> &argsVector,
+                   PipelineStep &step); // Validates the "gamma" operation arguments, a positive gamma.
+
+void validateContrast(const std::vector <std::string> &argsVector,
+                      PipelineStep &step); // Validates the "contrast" operation arguments, a non-negative factor.
+
+void validateLevels(const std::vector <std::string> &argsVector,
+                    PipelineStep &step); // Validates the "levels" operation arguments, black below white in range.
 
 #endif // PROGARGS_HPP
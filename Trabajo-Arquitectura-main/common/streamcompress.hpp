@@ -0,0 +1,322 @@
+#ifndef STREAMCOMPRESS_HPP
+#define STREAMCOMPRESS_HPP
+
+#include "binaryio.hpp"
+#include "bitpack.hpp"
+#include "cppmformat.hpp"
+#include "densecolortable.hpp"
+#include "mappedfile.hpp"
+#include "paletteorder.hpp"
+#include "parallel.hpp"
+#include <algorithm>
+#include <cctype>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+// Compression of a P6 file straight from a memory mapping, without building the image in memory. Pass 1 scans
+// the pixels for the color table, pass 2 scans them again and writes the indices block by block, releasing the
+// pages already read. Memory is bounded by the color table and one block, not by the image, and the output is
+// the same as write_cppm's for the same options unless the raw fallback is taken.
+// Limits: CPPM_FLAG_ENTROPY needs CPPM_FLAG_CHUNKED (the rANS coder works on a whole stream, so groups bound
+// it); PaletteOrder::frequency adds a pass to count the pixels of each color; when raw_fallback drops the color
+// table the pixels are always copied raw (CPPM_FLAG_RAW), where write_cppm may pick CPPM_FLAG_DELTA: the delta
+// layout is not tried since it codes the whole image at once. Both decode to the same pixels.
+
+const size_t STREAM_BLOCK_PIXELS = size_t{1} << 22; // Pixels read per block
+
+// Where the samples of a mapped P6 file are
+struct P6Layout {
+    int width = 0;
+    int height = 0;
+    int max_color_value = 0;
+    size_t data_offset = 0; // Bytes before the first sample
+};
+
+// Reads "P6 <width> <height> <max>" from the mapped bytes as readImage does: each field after any whitespace,
+// then one whitespace character ends the header. There is no fixed window, a header of any length is found, and
+// one the file ends inside is rejected.
+inline auto parse_p6_header(const MappedFile &file) -> P6Layout {
+  std::string_view const text(reinterpret_cast<const char *>(file.data()), file.size()); // NOLINT(cppcoreguidelines-pro-type-reinterpret-cast)
+  size_t position = 0;
+  auto is_space = [&](size_t index) { return index < text.size() && std::isspace(static_cast<unsigned char>(text[index])) != 0; };
+  auto skip_spaces = [&] { while (is_space(position)) { ++position; } };
+  auto read_number = [&]() -> int {
+    skip_spaces();
+    size_t const start = position;
+    int64_t value = 0;
+    for (; position < text.size() && text[position] >= '0' && text[position] <= '9'; ++position) {
+      value = value * 10 + (text[position] - '0');
+      if (value > std::numeric_limits<int>::max()) { throw std::runtime_error("Invalid image size."); }
+    }
+    if (position == start) {
+      throw std::runtime_error(position == text.size() ? "Truncated PPM file." : "Unsupported PPM format.");
+    }
+    return static_cast<int>(value);
+  };
+  skip_spaces();
+  if (text.substr(position, 2) != "P6" || !is_space(position + 2)) {
+    throw std::runtime_error("Unsupported PPM format.");
+  }
+  position += 2;
+  P6Layout layout;
+  layout.width = read_number();
+  layout.height = read_number();
+  layout.max_color_value = read_number();
+  if (layout.width < 1 || layout.height < 1 || layout.max_color_value < 1 ||
+      layout.max_color_value > CPPM_MAX_COLOR_VALUE) {
+    throw std::runtime_error("Invalid image size.");
+  }
+  if (position == text.size()) { throw std::runtime_error("Truncated PPM file."); }
+  if (!is_space(position)) { throw std::runtime_error("Unsupported PPM format."); }
+  layout.data_offset = position + 1; // One whitespace character ends the header
+  size_t const pixels = static_cast<size_t>(layout.width) * static_cast<size_t>(layout.height);
+  if (file.size() < layout.data_offset + cppm_raw_size(pixels, layout.max_color_value)) {
+    throw std::runtime_error("Truncated PPM file.");
+  }
+  return layout;
+}
+
+// Color of the pixel at 'pixel' as one code: the three samples side by side (8 or 16 bits each)
+template<typename Sample>
+auto stream_color_code(const uint8_t *samples, size_t pixel) -> uint64_t {
+  Sample rgb[CPPM_COMPONENTS]; // NOLINT(cppcoreguidelines-avoid-c-arrays)
+  std::memcpy(rgb, samples + pixel * CPPM_COMPONENTS * sizeof(Sample), sizeof(rgb)); // NOLINT
+  constexpr unsigned bits = sizeof(Sample) * 8;
+  return (static_cast<uint64_t>(rgb[0]) << (2 * bits)) | (static_cast<uint64_t>(rgb[1]) << bits) | rgb[2];
+}
+
+template<typename Sample>
+auto stream_code_component(uint64_t code, size_t component) -> Sample {
+  constexpr unsigned bits = sizeof(Sample) * 8;
+  return static_cast<Sample>(code >> ((CPPM_COMPONENTS - 1 - component) * bits));
+}
+
+// Color table built from the pixels in first-seen order: a dense table for 1-byte samples, a map otherwise
+// (the same structures compress uses)
+template<typename Sample>
+struct StreamPalette {
+    static constexpr bool is_dense = sizeof(Sample) == 1;
+    std::vector<uint64_t> codes; // Table entries, in table order
+    std::conditional_t<is_dense, DenseColorTable, std::map<uint64_t, uint32_t>> table;
+
+    void insert(uint64_t code) {
+      if constexpr (is_dense) {
+        if (insertDenseColor(table, static_cast<uint32_t>(code))) { codes.push_back(code); }
+      } else {
+        if (table.try_emplace(code, static_cast<uint32_t>(codes.size())).second) { codes.push_back(code); }
+      }
+    }
+
+    [[nodiscard]] auto index(uint64_t code) const -> uint32_t {
+      if constexpr (is_dense) { return denseColorIndex(table, static_cast<uint32_t>(code)); }
+      else { return table.at(code); }
+    }
+};
+
+// Set of the colors a stripe has already listed
+template<typename Sample>
+struct StreamSeen {
+    static constexpr bool is_dense = sizeof(Sample) == 1;
+    std::conditional_t<is_dense, DenseColorSet, std::set<uint64_t>> colors;
+
+    StreamSeen() {
+      if constexpr (is_dense) { colors = makeDenseColorSet(); }
+    }
+
+    auto mark(uint64_t code) -> bool {
+      if constexpr (is_dense) { return markDenseColor(colors, static_cast<uint32_t>(code)); }
+      else { return colors.insert(code).second; }
+    }
+};
+
+// A mapped P6 file, read in blocks of 'block_pixels' pixels (a multiple of 64)
+struct StreamSource {
+    MappedFile file;
+    P6Layout layout;
+    size_t block_pixels;
+
+    StreamSource(const std::string &filename, size_t block) : file(filename), layout(parse_p6_header(file)),
+                                                              block_pixels(block) {}
+
+    [[nodiscard]] auto samples() const -> const uint8_t * {
+      return file.data() + layout.data_offset; // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+    }
+
+    [[nodiscard]] auto pixels() const -> size_t {
+      return static_cast<size_t>(layout.width) * static_cast<size_t>(layout.height);
+    }
+
+    // Hands back the pages of pixels [begin, end), which will not be read again in this pass
+    void release(size_t begin, size_t end) const {
+      size_t const pixel_bytes = CPPM_COMPONENTS * cppm_component_bytes(layout.max_color_value);
+      file.release(layout.data_offset + begin * pixel_bytes, layout.data_offset + end * pixel_bytes);
+    }
+};
+
+// Calls block(begin, end) on consecutive pixel ranges of one block each, then releases their pages
+template<typename Block>
+void for_each_stream_block(const StreamSource &source, const Block &block) {
+  for (size_t begin = 0; begin < source.pixels(); begin += source.block_pixels) {
+    size_t const end = std::min(source.pixels(), begin + source.block_pixels);
+    block(begin, end);
+    source.release(begin, end);
+  }
+}
+
+// Pass 1: the color table. Each block is split in stripes that list their new colors in parallel; the lists
+// are merged in stripe order, which keeps first-seen order.
+template<typename Sample>
+void scan_stream_palette(const StreamSource &source, StreamPalette<Sample> &palette) {
+  size_t const stripes = stripeCount(source.block_pixels);
+  std::vector<StreamSeen<Sample>> seen(stripes);
+  std::vector<std::vector<uint64_t>> first_seen(stripes);
+  for_each_stream_block(source, [&](size_t begin, size_t end) {
+    forEachStripe(end - begin, stripes, [&](size_t stripe, size_t stripe_begin, size_t stripe_end) {
+      for (size_t pixel = begin + stripe_begin; pixel < begin + stripe_end; ++pixel) {
+        uint64_t const code = stream_color_code<Sample>(source.samples(), pixel);
+        if (seen[stripe].mark(code)) { first_seen[stripe].push_back(code); }
+      }
+    });
+    for (auto &codes : first_seen) {
+      for (uint64_t const code : codes) { palette.insert(code); }
+      codes.clear();
+    }
+  });
+}
+
+// Table index of every pixel of [begin, end), looked up in parallel stripes
+template<typename Sample>
+auto stream_block_indices(const StreamSource &source, const StreamPalette<Sample> &palette, size_t begin,
+                          size_t end) -> std::vector<uint32_t> {
+  std::vector<uint32_t> indices(end - begin);
+  forEachStripe(indices.size(), stripeCount(indices.size()), [&](size_t /*stripe*/, size_t first, size_t last) {
+    for (size_t i = first; i < last; ++i) {
+      indices[i] = palette.index(stream_color_code<Sample>(source.samples(), begin + i));
+    }
+  });
+  return indices;
+}
+
+// Reorders the table for 'order' and returns the new position of every old entry (empty for first_seen)
+template<typename Sample>
+auto order_stream_palette(const StreamSource &source, StreamPalette<Sample> &palette,
+                          PaletteOrder order) -> std::vector<uint32_t> {
+  if (order == PaletteOrder::first_seen) { return {}; }
+  std::vector<size_t> counts(palette.codes.size(), 0);
+  std::vector<uint64_t> morton;
+  if (order == PaletteOrder::frequency) { // One more pass, counting
+    for_each_stream_block(source, [&](size_t begin, size_t end) {
+      for (uint32_t const index : stream_block_indices(source, palette, begin, end)) { ++counts[index]; }
+    });
+  } else {
+    morton.reserve(palette.codes.size());
+    for (uint64_t const code : palette.codes) {
+      morton.push_back(mortonCode(stream_code_component<Sample>(code, 0), stream_code_component<Sample>(code, 1),
+                                  stream_code_component<Sample>(code, 2)));
+    }
+  }
+  std::vector<size_t> const positions = paletteOrderPositions(order, counts, morton);
+  std::vector<uint64_t> ordered;
+  ordered.reserve(positions.size());
+  for (size_t const position : positions) { ordered.push_back(palette.codes[position]); }
+  palette.codes = std::move(ordered);
+  return paletteRemap(positions);
+}
+
+// Pass 2: the index stream. Plain and bit-packed indices are written one block at a time (blocks hold a
+// multiple of 64 indices, so packed blocks end on a word boundary); row groups are encoded one at a time.
+template<typename Sample>
+void write_stream_indices(std::ostream &output, const StreamSource &source, const StreamPalette<Sample> &palette,
+                          const std::vector<uint32_t> &remap, const CPPMHeader &header) {
+  auto indices_of = [&](size_t begin, size_t end) {
+    std::vector<uint32_t> indices = stream_block_indices(source, palette, begin, end);
+    if (!remap.empty()) { remap_cppm_indices(indices, remap); }
+    return indices;
+  };
+  if ((header.flags & CPPM_FLAG_CHUNKED) == 0) {
+    for_each_stream_block(source, [&](size_t begin, size_t end) {
+      write_cppm_index_stream(output, indices_of(begin, end), header);
+    });
+    return;
+  }
+  size_t const group_pixels = static_cast<size_t>(header.group_rows) * static_cast<size_t>(header.width);
+  std::vector<uint64_t> offsets{0};
+  for (size_t group = 0; group < cppm_group_count(header); ++group) {
+    size_t const begin = group * group_pixels;
+    size_t const end = std::min(source.pixels(), begin + group_pixels);
+    std::ostringstream group_output;
+    write_cppm_index_stream(group_output, indices_of(begin, end), cppm_group_header(header, group));
+    std::string const encoded = std::move(group_output).str();
+    output.write(encoded.data(), static_cast<std::streamsize>(encoded.size()));
+    offsets.push_back(offsets.back() + encoded.size());
+    source.release(begin, end);
+  }
+  write_binary_buffer(output, offsets);
+}
+
+// Copies the samples as they are, for a file stored without a color table
+inline void write_stream_raw(std::ostream &output, const StreamSource &source, CPPMHeader header) {
+  size_t const pixel_bytes = CPPM_COMPONENTS * cppm_component_bytes(header.max_color_value);
+  header.color_table_size = 0;
+  header.flags = CPPM_FLAG_RAW;
+  header.group_rows = 0;
+  write_cppm_header(output, header);
+  for_each_stream_block(source, [&](size_t begin, size_t end) {
+    output.write(reinterpret_cast<const char *>(source.samples() + begin * pixel_bytes), // NOLINT
+                 static_cast<std::streamsize>((end - begin) * pixel_bytes));
+  });
+}
+
+template<typename Sample>
+void stream_compress_samples(std::ostream &output, const StreamSource &source, const CPPMWriteOptions &options) {
+  StreamPalette<Sample> palette;
+  scan_stream_palette(source, palette);
+  CPPMHeader const header{.width=source.layout.width, .height=source.layout.height,
+                          .max_color_value=source.layout.max_color_value, .color_table_size=palette.codes.size(),
+                          .flags=options.flags, .group_rows=options.group_rows};
+  if (options.raw_fallback &&
+      cppm_table_loses(source.pixels(), header.max_color_value, palette.codes.size(), options.flags)) {
+    write_stream_raw(output, source, header);
+    return;
+  }
+  std::vector<uint32_t> const remap = order_stream_palette(source, palette, options.order);
+  write_cppm_header(output, header);
+  for (uint64_t const code : palette.codes) {
+    for (size_t component = 0; component < CPPM_COMPONENTS; ++component) {
+      write_binary(output, stream_code_component<Sample>(code, component));
+    }
+  }
+  write_stream_indices(output, source, palette, remap, header);
+}
+
+// Compresses the P6 file 'input_file' into 'output_file' in two passes over its mapping (block_pixels is
+// rounded up to a multiple of 64)
+inline void stream_compress(const std::string &input_file, const std::string &output_file,
+                            const CPPMWriteOptions &options = {}, size_t block_pixels = STREAM_BLOCK_PIXELS) {
+  if ((options.flags & CPPM_FLAG_ENTROPY) != 0 && (options.flags & CPPM_FLAG_CHUNKED) == 0) {
+    throw std::invalid_argument("Streaming entropy coding needs row groups.");
+  }
+  StreamSource const source(input_file, (std::max(block_pixels, size_t{1}) + BITPACK_WORD_BITS - 1) /
+                                        BITPACK_WORD_BITS * BITPACK_WORD_BITS);
+  std::ofstream output(output_file, std::ios::binary);
+  if (!output) { throw std::runtime_error("Error opening file for writing."); }
+  if (source.layout.max_color_value <= CPPM_MAX_COLOR_VALUE_1B) {
+    stream_compress_samples<uint8_t>(output, source, options);
+  } else {
+    stream_compress_samples<uint16_t>(output, source, options);
+  }
+  if (!output) { throw std::runtime_error("Error writing the CPPM file."); }
+}
+
+#endif // STREAMCOMPRESS_HPP
@@ -0,0 +1,88 @@
+#ifndef STREAMMAXLEVEL_HPP
+#define STREAMMAXLEVEL_HPP
+
+#include "pointops.hpp"
+#include "streamcompress.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Point operations (maxlevel and the intensity curves) from a P6 file to a P6 file in one read-transform-write
+// pass. Each block of samples is read from the mapping, mapped straight into the output sample width and written,
+// so neither image is built in memory and the pages already read are handed back. Samples keep the byte order
+// readImage/writeImage use (binaryio's native order), so the file is the same one the decode, map and encode path
+// writes.
+
+const size_t STREAM_MAXLEVEL_BLOCK_PIXELS = size_t{1} << 18; // Pixels scaled per write
+
+// Maps the samples of one block into 'scaled', with the specialised kernel when 'fast_levels' and there is one
+template<typename From, typename To>
+void stream_scale_block(const uint8_t *samples, size_t count, const std::vector<uint16_t> &table, bool fast_levels,
+                        int old_max, int new_max, std::vector<To> &scaled) {
+  auto const sample = [samples](size_t index) {
+    From value = 0;
+    std::memcpy(&value, samples + (index * sizeof(From)), sizeof(From)); // NOLINT: P6 samples need not be aligned
+    return value;
+  };
+  bool const fast = fast_levels && withFastLevelConversion(old_max, new_max, [&](auto conversion) {
+    for (size_t i = 0; i < count; ++i) {
+      scaled[i] = static_cast<To>(fastScaleLevel<decltype(conversion)::value>(sample(i)));
+    }
+  });
+  if (!fast) {
+    for (size_t i = 0; i < count; ++i) { scaled[i] = static_cast<To>(table[sample(i)]); }
+  }
+}
+
+template<typename From, typename To>
+void stream_point_op_samples(const StreamSource &source, std::ostream &output, const PointOpChain &chain) {
+  int const old_max = source.layout.max_color_value;
+  int const new_max = chain.output_max(old_max);
+  std::vector<uint16_t> const table = chain.table(old_max);
+  std::vector<To> scaled(source.block_pixels * CPPM_COMPONENTS);
+  for_each_stream_block(source, [&](size_t begin, size_t end) {
+    size_t const count = (end - begin) * CPPM_COMPONENTS;
+    const uint8_t *samples = source.samples() + (begin * CPPM_COMPONENTS * sizeof(From)); // NOLINT
+    stream_scale_block<From, To>(samples, count, table, chain.single_maxlevel(), old_max, new_max, scaled);
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+    if (!output.write(reinterpret_cast<const char *>(scaled.data()), static_cast<std::streamsize>(count * sizeof(To)))) {
+      throw std::runtime_error("Failed to write binary data.");
+    }
+  });
+}
+
+// Writes 'output_file' as 'input_file' with a chain of point operations (validated by the caller) applied, for
+// every combination of 1- and 2-byte samples
+inline void stream_point_ops(const std::string &input_file, const std::string &output_file, const PointOpChain &chain,
+                             size_t block_pixels = STREAM_MAXLEVEL_BLOCK_PIXELS) {
+  StreamSource const source(input_file, block_pixels);
+  std::ofstream output(output_file, std::ios::binary);
+  if (!output.is_open()) { throw std::runtime_error("Error writing the PPM file."); }
+  int const new_max = chain.output_max(source.layout.max_color_value);
+  output << "P6\n" << source.layout.width << " " << source.layout.height << " " << new_max << "\n";
+  bool const old_one_byte = source.layout.max_color_value <= POINT_OP_MAX_1B;
+  bool const new_one_byte = new_max <= POINT_OP_MAX_1B;
+  if (old_one_byte && new_one_byte) {
+    stream_point_op_samples<uint8_t, uint8_t>(source, output, chain);
+  } else if (old_one_byte) {
+    stream_point_op_samples<uint8_t, uint16_t>(source, output, chain);
+  } else if (new_one_byte) {
+    stream_point_op_samples<uint16_t, uint8_t>(source, output, chain);
+  } else {
+    stream_point_op_samples<uint16_t, uint16_t>(source, output, chain);
+  }
+}
+
+// Writes 'output_file' as 'input_file' scaled to new_max (validated by the caller)
+inline void stream_maxlevel(const std::string &input_file, const std::string &output_file, int new_max,
+                            size_t block_pixels = STREAM_MAXLEVEL_BLOCK_PIXELS) {
+  PointOpChain chain;
+  chain.add_maxlevel(new_max);
+  stream_point_ops(input_file, output_file, chain, block_pixels);
+}
+
+#endif // STREAMMAXLEVEL_HPP
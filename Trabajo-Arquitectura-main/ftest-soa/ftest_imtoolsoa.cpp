@@ -1,7 +1,13 @@
 #include "gtest/gtest.h"
+#include <cstdio>
+#include <fstream>
 #include <iostream>
+#include <iterator>
 #include <stdexcept>
+#include <string>
 #include "../imgsoa/compresssoa.hpp"
+#include "../imgsoa/imagesoa.hpp"
+#include "../imgsoa/maxlevelsoa.hpp"
 
 // NOLINTBEGIN(cppcoreguidelines-avoid-magic-numbers)
 // NOLINTBEGIN(readability-magic-numbers)
@@ -54,6 +60,20 @@ namespace {
     file.write("\0\0", 2);                                          // Blue Component = 0.
     file.close();
   }
+
+  // Create a 16-bit PPM file whose header is longer than 64 bytes, with the max color value crossing byte 64.
+  void createLongHeaderTestFile(const std::string& filename) {
+    std::ofstream file(filename, std::ios::binary);
+    file << "P6" << std::string(55, ' ') << "\n4 3\n65535\n";
+    for (int i = 0; i < 4 * 3 * 3 * 2; ++i) {
+      file << static_cast<char>(i * 37 + 11);  // Every sample is different.
+    }
+  }
+
+  auto fileContents(const std::string& filename) -> std::string {
+    std::ifstream file(filename, std::ios::binary);
+    return {std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>()};
+  }
 }
 
 
@@ -237,6 +257,38 @@ TEST(ImtoolSOATests, ResizeOperationLargeImage) {
   EXPECT_TRUE(file_exists("output_compressed.ppm"));
 }
 
+
+// Test for an operation whose input is a compressed (CPPM) image.
+TEST(ImtoolSOATests, MaxLevelOperationCompressedInput) {
+  const std::string executable = "./imtool-soa";  // We want to test the imtool-soa executable.
+  for (int const max_value : {255, 65535}) { // Small and large pixels
+    if (max_value == 255) { createTestPPMFile3("input.ppm", max_value); } else { createTestPPMFile6("input.ppm", max_value); }
+    std::remove("input_compressed.cppm");
+    std::remove("output_from_cppm.ppm");
+    EXPECT_EQ(std::system((executable + " input.ppm input_compressed.cppm compress").c_str()), 0);
+    // The compressed file is read directly by maxlevel.
+    EXPECT_EQ(std::system((executable + " input_compressed.cppm output_from_cppm.ppm maxlevel 100").c_str()), 0);
+    EXPECT_TRUE(file_exists("output_from_cppm.ppm"));
+  }
+}
+
+// Test that maxlevel on a P6 file with a long header (the streamed path) matches decode, map and encode.
+TEST(ImtoolSOATests, MaxLevelOperationLongHeader) {
+  const std::string executable = "./imtool-soa";  // We want to test the imtool-soa executable.
+  for (int const new_max_value : {255, 1000}) { // Large to small and large to large pixels
+    createLongHeaderTestFile("input_long_header.ppm");
+    std::remove("output_long_header.ppm");
+    std::string const command = executable + " input_long_header.ppm output_long_header.ppm maxlevel " +
+                                std::to_string(new_max_value);
+    EXPECT_EQ(std::system(command.c_str()), 0);
+    SOAImage image = readImageSOA("input_long_header.ppm");
+    maxLevelInPlaceSOA(image, new_max_value);
+    writeImageSOA("expected_long_header.ppm", image);
+    EXPECT_EQ(fileContents("output_long_header.ppm"), fileContents("expected_long_header.ppm"))
+        << "max value " << new_max_value;
+  }
+}
+
 // NOLINTEND(cppcoreguidelines-pro-type-reinterpret-cast)
 // NOLINTEND(cert-env33-c)
 // NOLINTEND(readability-magic-numbers)
@@ -1,36 +1,62 @@
 #include "compressaos.hpp"
 #include <vector>
 
+auto make_cppm_header(const PPMImageAOS &image, size_t color_table_size, unsigned flags, int group_rows) -> CPPMHeader {
+  return {.width=image.width, .height=image.height, .max_color_value=image.max_color_value,
+          .color_table_size=color_table_size, .flags=flags, .group_rows=group_rows};
+}
+
 // Writes the header of the compressed file, including basic image information
-void write_header(std::ostream &output, const PPMImageAOS &image, size_t color_table_size) {
-  output << "C6 " << image.width << " " << image.height << " "
-         << image.max_color_value << " " << color_table_size << "\n";
+void write_header(std::ostream &output, const PPMImageAOS &image, size_t color_table_size, unsigned flags,
+                  int group_rows) {
+  write_cppm_header(output, make_cppm_header(image, color_table_size, flags, group_rows));
 }
 
 // Processes an image with SmallPixel format, generates color table, and writes compressed data
-void process_small_pixel_image(std::ostream &output, const PPMImageAOS &image) {
+void process_small_pixel_image(std::ostream &output, const PPMImageAOS &image, const CPPMWriteOptions &options) {
   std::vector <SmallPixel> unique_colors;
-  auto color_map = generate_color_table(image.sPixels, unique_colors);
+  DenseColorTable const table = generate_dense_color_table(image.sPixels, unique_colors);
+  if (options.raw_fallback &&
+      cppm_table_loses(image.sPixels.size(), image.max_color_value, unique_colors.size(), options.flags)) {
+    write_cppm_samples(output, make_cppm_header(image, 0), pixel_samples(image.sPixels)); // Table does not pay off
+    return;
+  }
+  if ((options.flags & CPPM_INDEX_LAYOUT_FLAGS) != 0 || options.order != PaletteOrder::first_seen) {
+    std::vector <uint32_t> indices = gather_dense_pixel_indices<uint32_t>(image.sPixels, table);
+    write_indexed_image(output, image, unique_colors, indices, options);
+    return;
+  }
 
-  write_header(output, image, unique_colors.size()); // Write header with color table size
+  write_header(output, image, unique_colors.size(), options.flags, options.group_rows); // Write header with color table size
   write_color_table(output, unique_colors);          // Write color table
 
   // Choose index size based on number of unique colors
   if (unique_colors.size() <= MAX_INDEX_SIZE_1B) {
-    write_pixel_indices<SmallPixel, uint8_t>(output, image.sPixels, color_map);
+    write_dense_pixel_indices<uint8_t>(output, image.sPixels, table);
   } else if (unique_colors.size() <= MAX_INDEX_SIZE_2B) {
-    write_pixel_indices<SmallPixel, uint16_t>(output, image.sPixels, color_map);
+    write_dense_pixel_indices<uint16_t>(output, image.sPixels, table);
   } else {
     throw std::runtime_error("Color table too large for SmallPixel format.");
   }
 }
 
 // Processes an image with LargePixel format, generates color table, and writes compressed data
-void process_large_pixel_image(std::ostream &output, const PPMImageAOS &image) {
+void process_large_pixel_image(std::ostream &output, const PPMImageAOS &image, const CPPMWriteOptions &options,
+                               OperationContext &context) {
   std::vector <LargePixel> unique_colors;
-  auto color_map = generate_color_table(image.lPixels, unique_colors);
+  auto color_map = generate_color_table(image.lPixels, unique_colors, 0, context);
+  if (options.raw_fallback &&
+      cppm_table_loses(image.lPixels.size(), image.max_color_value, unique_colors.size(), options.flags)) {
+    write_cppm_samples(output, make_cppm_header(image, 0), pixel_samples(image.lPixels)); // Table does not pay off
+    return;
+  }
+  if ((options.flags & CPPM_INDEX_LAYOUT_FLAGS) != 0 || options.order != PaletteOrder::first_seen) {
+    std::vector <uint32_t> indices = gather_pixel_indices<LargePixel, uint32_t>(image.lPixels, color_map);
+    write_indexed_image(output, image, unique_colors, indices, options);
+    return;
+  }
 
-  write_header(output, image, unique_colors.size()); // Write header with color table size
+  write_header(output, image, unique_colors.size(), options.flags, options.group_rows); // Write header with color table size
   write_color_table(output, unique_colors);          // Write color table
 
   // Choose index size based on number of unique colors
@@ -46,14 +72,102 @@ void process_large_pixel_image(std::ostream &output, const PPMImageAOS &image) {
 }
 
 // Main function to compress the image and write it in a custom compressed format
-void write_cppm(const std::string &output_file, const PPMImageAOS &image) {
+void write_cppm(const std::string &output_file, const PPMImageAOS &image, const CPPMWriteOptions &options,
+                OperationContext &context) {
   std::ofstream output(output_file, std::ios::binary); // Open file in binary mode
   // Choose processing function based on pixel intensity
   if (image.max_color_value <= MAX_INTENSITY_FOR_1B) {
-    process_small_pixel_image(output, image); // Process as SmallPixel image
+    process_small_pixel_image(output, image, options); // Process as SmallPixel image
   } else {
-    process_large_pixel_image(output, image); // Process as LargePixel image
+    process_large_pixel_image(output, image, options, context); // Process as LargePixel image
   }
 
   output.close(); // Close the output file
-}
\ No newline at end of file
+}
+
+// Decodes a compressed image (the inverse of write_cppm)
+auto read_cppm(std::istream &input) -> PPMImageAOS {
+  CPPMHeader const header = read_cppm_header(input);
+  PPMImageAOS image;
+  image.width = header.width;
+  image.height = header.height;
+  image.max_color_value = header.max_color_value;
+  if (header.max_color_value <= MAX_INTENSITY_FOR_1B) {
+    image.sPixels = read_cppm_pixels<SmallPixel>(input, header); // 1 byte per component
+  } else {
+    image.lPixels = read_cppm_pixels<LargePixel>(input, header); // 2 bytes per component
+  }
+  return image;
+}
+
+auto read_cppm_rows(std::istream &input, int first_row, int rows) -> PPMImageAOS {
+  CPPMHeader const header = read_cppm_header(input);
+  check_cppm_row_range(header, first_row, rows); // Before allocating anything
+  PPMImageAOS image;
+  image.width = header.width;
+  image.height = rows;
+  image.max_color_value = header.max_color_value;
+  size_t const pixels = static_cast<size_t>(header.width) * static_cast<size_t>(rows);
+  bool const samples = (header.flags & CPPM_SAMPLE_LAYOUT_FLAGS) != 0; // No color table
+  if (samples && header.max_color_value <= MAX_INTENSITY_FOR_1B) {
+    image.sPixels = samples_to_pixels<SmallPixel>(read_cppm_row_samples<uint8_t>(input, header, first_row, rows));
+  } else if (samples) {
+    image.lPixels = samples_to_pixels<LargePixel>(read_cppm_row_samples<uint16_t>(input, header, first_row, rows));
+  } else if (header.max_color_value <= MAX_INTENSITY_FOR_1B) {
+    std::vector <SmallPixel> const colors = read_color_table<SmallPixel>(input, header.color_table_size);
+    image.sPixels.resize(pixels);
+    read_cppm_row_indices(input, header, first_row, rows,
+                          [&image, &colors](size_t pixel, size_t index) { image.sPixels[pixel] = colors[index]; });
+  } else {
+    std::vector <LargePixel> const colors = read_color_table<LargePixel>(input, header.color_table_size);
+    image.lPixels.resize(pixels);
+    read_cppm_row_indices(input, header, first_row, rows,
+                          [&image, &colors](size_t pixel, size_t index) { image.lPixels[pixel] = colors[index]; });
+  }
+  return image;
+}
+
+// Color table in first-seen order and the index of every pixel, for a file stored without a table
+template<typename PixelType>
+static auto index_pixels(const PixelBuffer<PixelType> &pixels, std::vector <PixelType> &colors) -> std::vector <uint32_t> {
+  auto const color_map = generate_color_table(pixels, colors);
+  return gather_pixel_indices<PixelType, uint32_t>(pixels, color_map);
+}
+
+auto read_palette_image(std::istream &input) -> PaletteImageAOS {
+  PaletteImageAOS image;
+  image.header = read_cppm_header(input);
+  if ((image.header.flags & CPPM_SAMPLE_LAYOUT_FLAGS) != 0) { // No color table: build one
+    if (image.header.max_color_value <= MAX_INTENSITY_FOR_1B) {
+      image.indices = index_pixels(read_cppm_pixels<SmallPixel>(input, image.header), image.sColors);
+      image.header.color_table_size = image.sColors.size();
+    } else {
+      image.indices = index_pixels(read_cppm_pixels<LargePixel>(input, image.header), image.lColors);
+      image.header.color_table_size = image.lColors.size();
+    }
+    image.header.flags = 0;
+    return image;
+  }
+  if (image.header.max_color_value <= MAX_INTENSITY_FOR_1B) {
+    image.sColors = read_color_table<SmallPixel>(input, image.header.color_table_size);
+  } else {
+    image.lColors = read_color_table<LargePixel>(input, image.header.color_table_size);
+  }
+  image.indices = read_cppm_index_stream(input, image.header);
+  return image;
+}
+
+void write_palette_image(std::ostream &output, PaletteImageAOS &image, PaletteOrder order) {
+  if (image.header.max_color_value <= MAX_INTENSITY_FOR_1B) {
+    order_palette(image.sColors, image.indices, compact_palette(image.sColors, image.indices), order);
+    image.header.color_table_size = image.sColors.size();
+    write_cppm_header(output, image.header);
+    write_color_table(output, image.sColors);
+  } else {
+    order_palette(image.lColors, image.indices, compact_palette(image.lColors, image.indices), order);
+    image.header.color_table_size = image.lColors.size();
+    write_cppm_header(output, image.header);
+    write_color_table(output, image.lColors);
+  }
+  write_cppm_index_stream(output, image.indices, image.header);
+}
@@ -3,8 +3,18 @@
 
 #include "imageaos.hpp"
 #include "../common/binaryio.hpp"
+#include "../common/cppmformat.hpp"
+#include "../common/densecolortable.hpp"
+#include "../common/opcontext.hpp"
+#include "../common/paletteorder.hpp"
+#include "../common/parallel.hpp"
+#include <map>
+#include <memory_resource>
 #include <vector>
+#include <set>
+#include <span>
 #include <cstdint>
+#include <utility>
 
 
 // Constants defining the maximum index sizes for 1, 2, and 4 bytes
@@ -12,8 +22,15 @@ const int MAX_INDEX_SIZE_1B = 256;
 const int MAX_INDEX_SIZE_2B = 65536;
 const long long MAX_INDEX_SIZE_4B = 4294967296;
 
+// Header of the compressed file for an image with the given color table size
+// (flags are CPPM_FLAG_* bits; group_rows is the row group height when CPPM_FLAG_CHUNKED is set)
+auto make_cppm_header(const PPMImageAOS &image, size_t color_table_size, unsigned flags = 0,
+                      int group_rows = 0) -> CPPMHeader;
+
 // Writes the header of the compressed file, including basic image information
-void write_header(std::ostream &output, const PPMImageAOS &image, size_t color_table_size);
+// (flags are CPPM_FLAG_* bits, only written when not 0)
+void write_header(std::ostream &output, const PPMImageAOS &image, size_t color_table_size, unsigned flags = 0,
+                  int group_rows = 0);
 
 // Helper function to write the color table to the output stream
 template<typename PixelType>
@@ -25,38 +42,235 @@ void write_color_table(std::ostream &output, const std::vector <PixelType> &colo
     }
 }
 
-// Generates a color table and assigns unique indices to each color in the image
+// Generates a color table and assigns unique indices to each color in the image.
+// Each stripe lists its own first-seen colors in parallel, the lists are then merged in stripe order, which
+// gives the same table as a single sequential pass (stripes = 0 picks one per hardware thread). The map, the
+// stripes' sets and their lists are in the context's memory.
 template<typename PixelType>
 auto
-generate_color_table(const std::vector <PixelType> &pixels, std::vector <PixelType> &unique_colors) -> std::map<PixelType, typename std::vector<PixelType>::size_type> {
-    std::map<PixelType, typename std::vector<PixelType>::size_type> color_map;
-    for (const auto &pixel: pixels) {
-        if (color_map.find(pixel) == color_map.end()) { // Only add new colors
-            color_map[pixel] = unique_colors.size();
-            unique_colors.push_back(pixel);
+generate_color_table(const PixelBuffer<PixelType> &pixels, std::vector <PixelType> &unique_colors,
+                     size_t stripes = 0, OperationContext &context = OperationContext::heap())
+        -> std::pmr::map<PixelType, typename std::vector<PixelType>::size_type> {
+    if (stripes == 0) { stripes = stripeCount(pixels.size()); }
+    auto first_seen = context.stripe_vectors<PixelType>(stripes);
+    forEachStripe(pixels.size(), stripes, [&pixels, &first_seen, &context](size_t stripe, size_t begin, size_t end) {
+        std::pmr::set<PixelType> seen(context.stripe_memory(stripe));
+        for (size_t i = begin; i < end; ++i) {
+            if (seen.insert(pixels[i]).second) { first_seen[stripe].items.push_back(pixels[i]); }
+        }
+    });
+    std::pmr::map<PixelType, typename std::vector<PixelType>::size_type> color_map(context.memory());
+    for (const auto &colors: first_seen) {
+        for (const auto &color: colors.items) {
+            if (color_map.try_emplace(color, unique_colors.size()).second) { // Only add new colors
+                unique_colors.push_back(color);
+            }
         }
     }
     return color_map;
 }
 
-// Writes pixel indices to the output stream using the appropriate index type based on color map
-template<typename PixelType, typename IndexType>
-void write_pixel_indices(std::ostream &output, const std::vector <PixelType> &pixels,
-                         const std::map<PixelType, typename std::vector<PixelType>::size_type> &color_map) {
-    for (const auto &pixel: pixels) {
-        auto index = static_cast<IndexType>(color_map.at(pixel)); // Convert index to specified type
-        write_binary(output, index); // Write the index to the output
+// Looks up the index of every pixel in the color map (a std or pmr map). The stripes fill one preallocated
+// buffer in parallel.
+template<typename PixelType, typename IndexType, typename ColorMap>
+auto gather_pixel_indices(std::span<const PixelType> pixels, const ColorMap &color_map,
+                          size_t stripes = 0) -> std::vector<IndexType> {
+    std::vector<IndexType> indices(pixels.size());
+    forEachStripe(pixels.size(), stripes == 0 ? stripeCount(pixels.size()) : stripes,
+                  [&pixels, &color_map, &indices](size_t /*stripe*/, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            indices[i] = static_cast<IndexType>(color_map.at(pixels[i])); // Convert index to specified type
+        }
+    });
+    return indices;
+}
+
+// Writes pixel indices to the output stream using the appropriate index type based on color map, at once
+template<typename PixelType, typename IndexType, typename ColorMap>
+void write_pixel_indices(std::ostream &output, std::span<const PixelType> pixels, const ColorMap &color_map,
+                         size_t stripes = 0) {
+    write_binary_buffer(output, gather_pixel_indices<PixelType, IndexType>(pixels, color_map, stripes));
+}
+
+// Same as generate_color_table for SmallPixel images, with a dense table instead of a map
+inline auto generate_dense_color_table(const PixelBuffer<SmallPixel> &pixels,
+                                       std::vector <SmallPixel> &unique_colors, size_t stripes = 0) -> DenseColorTable {
+    if (stripes == 0) { stripes = stripeCount(pixels.size()); }
+    std::vector<std::vector<SmallPixel>> first_seen(stripes);
+    forEachStripe(pixels.size(), stripes, [&pixels, &first_seen](size_t stripe, size_t begin, size_t end) {
+        DenseColorSet seen = makeDenseColorSet();
+        for (size_t i = begin; i < end; ++i) {
+            if (markDenseColor(seen, denseColorCode(pixels[i].red, pixels[i].green, pixels[i].blue))) {
+                first_seen[stripe].push_back(pixels[i]);
+            }
+        }
+    });
+    DenseColorTable table;
+    for (const auto &colors: first_seen) {
+        for (const auto &color: colors) {
+            if (insertDenseColor(table, denseColorCode(color.red, color.green, color.blue))) { // Only add new colors
+                unique_colors.push_back(color);
+            }
+        }
+    }
+    return table;
+}
+
+// Gathers the index of every pixel into one buffer, in parallel stripes
+template<typename IndexType>
+auto gather_dense_pixel_indices(const PixelBuffer<SmallPixel> &pixels, const DenseColorTable &table,
+                                size_t stripes = 0) -> std::vector<IndexType> {
+    std::vector<IndexType> indices(pixels.size());
+    forEachStripe(pixels.size(), stripes == 0 ? stripeCount(pixels.size()) : stripes,
+                  [&pixels, &table, &indices](size_t /*stripe*/, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            indices[i] = static_cast<IndexType>(denseColorIndex(table, denseColorCode(pixels[i].red, pixels[i].green,
+                                                                                      pixels[i].blue)));
+        }
+    });
+    return indices;
+}
+
+// Gathers the index of every pixel and writes them at once
+template<typename IndexType>
+void write_dense_pixel_indices(std::ostream &output, const PixelBuffer<SmallPixel> &pixels,
+                               const DenseColorTable &table, size_t stripes = 0) {
+    write_binary_buffer(output, gather_dense_pixel_indices<IndexType>(pixels, table, stripes));
+}
+
+// Reorders the color table and remaps the indices to match ('counts' are the pixels using each entry)
+template<typename PixelType>
+void order_palette(std::vector <PixelType> &colors, std::vector <uint32_t> &indices, const std::vector <size_t> &counts,
+                   PaletteOrder order) {
+    if (order == PaletteOrder::first_seen) { return; } // Tables are built in first-seen order
+    std::vector <uint64_t> codes;
+    if (order == PaletteOrder::morton) {
+        codes.reserve(colors.size());
+        for (const auto &color: colors) { codes.push_back(mortonCode(color.red, color.green, color.blue)); }
+    }
+    std::vector <size_t> const positions = paletteOrderPositions(order, counts, codes);
+    std::vector <PixelType> ordered;
+    ordered.reserve(colors.size());
+    for (size_t const position: positions) { ordered.push_back(colors[position]); }
+    colors = std::move(ordered);
+    remap_cppm_indices(indices, paletteRemap(positions));
+}
+
+// Writes an image whose indices were gathered into one buffer: any palette order, and bit-packed,
+// entropy-coded or chunked indices
+template<typename PixelType>
+void write_indexed_image(std::ostream &output, const PPMImageAOS &image, std::vector <PixelType> &colors,
+                         std::vector <uint32_t> &indices, const CPPMWriteOptions &options) {
+    if (options.order != PaletteOrder::first_seen) {
+        order_palette(colors, indices, count_cppm_indices(indices, colors.size()), options.order);
+    }
+    CPPMHeader const header = make_cppm_header(image, colors.size(), options.flags, options.group_rows);
+    write_cppm_header(output, header);
+    write_color_table(output, colors);
+    write_cppm_index_stream(output, indices, header);
+}
+
+// Interleaved red, green and blue samples of the pixels, as in P6
+template<typename PixelType>
+auto pixel_samples(const PixelBuffer<PixelType> &pixels) -> std::vector <typename PixelType::ComponentType> {
+    std::vector <typename PixelType::ComponentType> samples(pixels.size() * CPPM_COMPONENTS);
+    for (size_t i = 0; i < pixels.size(); ++i) {
+        samples[i * CPPM_COMPONENTS] = pixels[i].red;
+        samples[i * CPPM_COMPONENTS + 1] = pixels[i].green;
+        samples[i * CPPM_COMPONENTS + 2] = pixels[i].blue;
+    }
+    return samples;
+}
+
+// Inverse of pixel_samples
+template<typename PixelType>
+auto samples_to_pixels(const std::vector <typename PixelType::ComponentType> &samples) -> PixelBuffer<PixelType> {
+    PixelBuffer<PixelType> pixels(samples.size() / CPPM_COMPONENTS);
+    for (size_t i = 0; i < pixels.size(); ++i) {
+        pixels[i].red = samples[i * CPPM_COMPONENTS];
+        pixels[i].green = samples[i * CPPM_COMPONENTS + 1];
+        pixels[i].blue = samples[i * CPPM_COMPONENTS + 2];
     }
+    return pixels;
 }
 
 // Processes an image with SmallPixel format, generates color table, and writes compressed data
-void process_small_pixel_image(std::ostream &output, const PPMImageAOS &image);
+void process_small_pixel_image(std::ostream &output, const PPMImageAOS &image, const CPPMWriteOptions &options = {});
 
 // Processes an image with LargePixel format, generates color table, and writes compressed data
-void process_large_pixel_image(std::ostream &output, const PPMImageAOS &image);
+void process_large_pixel_image(std::ostream &output, const PPMImageAOS &image, const CPPMWriteOptions &options = {},
+                               OperationContext &context = OperationContext::heap());
+
+// Main function to compress the image and write it in a custom compressed format.
+// options may select bit-packed (CPPM_FLAG_BITPACKED) or entropy-coded (CPPM_FLAG_ENTROPY) indices, row groups
+// (CPPM_FLAG_CHUNKED), the order of the color table, and storing the pixels without a table when that is smaller.
+// The color map of LargePixel images is built in the context's memory.
+void write_cppm(const std::string &output_file, const PPMImageAOS &image, const CPPMWriteOptions &options = {},
+                OperationContext &context = OperationContext::heap());
+
+// Reads the color table of a compressed file
+template<typename PixelType>
+auto read_color_table(std::istream &input, size_t table_size) -> std::vector <PixelType> {
+    using ComponentType = typename PixelType::ComponentType;
+    std::vector <PixelType> colors(table_size);
+    for (auto &color: colors) {
+        color.red = read_binary<ComponentType>(input);
+        color.green = read_binary<ComponentType>(input);
+        color.blue = read_binary<ComponentType>(input);
+    }
+    return colors;
+}
+
+// Reads the color table and expands every pixel index through it (or reads the pixels of a file without table)
+template<typename PixelType>
+auto read_cppm_pixels(std::istream &input, const CPPMHeader &header) -> PixelBuffer<PixelType> {
+    if ((header.flags & CPPM_SAMPLE_LAYOUT_FLAGS) != 0) {
+        return samples_to_pixels<PixelType>(read_cppm_samples<typename PixelType::ComponentType>(input, header));
+    }
+    std::vector <PixelType> const colors = read_color_table<PixelType>(input, header.color_table_size);
+    PixelBuffer<PixelType> pixels(cppm_pixel_count(header));
+    read_cppm_indices(input, header, [&pixels, &colors](size_t pixel, size_t index) { pixels[pixel] = colors[index]; });
+    return pixels;
+}
+
+// Decodes a compressed image (the inverse of write_cppm)
+auto read_cppm(std::istream &input) -> PPMImageAOS;
+
+// Decodes rows [first_row, first_row + rows) of a compressed image only, as an image of that height
+auto read_cppm_rows(std::istream &input, int first_row, int rows) -> PPMImageAOS;
+
+// Compressed image kept as its color table plus one index per pixel. Operations that only change colors
+// (maxlevel, cutfreq) rewrite the table and leave the pixels alone.
+struct PaletteImageAOS {
+    CPPMHeader header{};
+    std::vector <SmallPixel> sColors; // Color table when max_color_value fits in 1 byte
+    std::vector <LargePixel> lColors; // Color table otherwise
+    std::vector <uint32_t> indices;
+};
+
+// Reads a compressed file without expanding its pixels (a file without color table gets one built from its pixels)
+auto read_palette_image(std::istream &input) -> PaletteImageAOS;
+
+// Merges table entries that became equal and drops unused ones, keeping table order, so a table in first-seen
+// order stays in first-seen order and the output matches compressing the decoded image.
+// Returns the number of pixels using each entry of the compacted table.
+template<typename PixelType>
+auto compact_palette(std::vector <PixelType> &colors, std::vector <uint32_t> &indices) -> std::vector <size_t> {
+    std::vector <size_t> kept;
+    std::vector <size_t> const counts = count_cppm_indices(indices, colors.size());
+    std::vector <uint32_t> const remap = compact_cppm_table(colors, counts, kept);
+    if (kept.size() == colors.size()) { return counts; } // Nothing merged or dropped
+    std::vector <PixelType> compacted;
+    compacted.reserve(kept.size());
+    for (size_t const position: kept) { compacted.push_back(colors[position]); }
+    colors = std::move(compacted);
+    remap_cppm_indices(indices, remap);
+    return remap_cppm_counts(counts, remap, kept.size());
+}
 
-// Main function to compress the image and write it in a custom compressed format
-void write_cppm(const std::string &output_file, const PPMImageAOS &image);
+// Compacts the color table, puts it in the given order (reusing the counts of the compaction) and writes the
+// image in CPPM format
+void write_palette_image(std::ostream &output, PaletteImageAOS &image, PaletteOrder order = PaletteOrder::first_seen);
 
 
 #endif //COMPRESSAOS_HPP
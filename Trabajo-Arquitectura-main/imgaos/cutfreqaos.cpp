@@ -1,7 +1,8 @@
 #include "cutfreqaos.hpp"
 
 // Main function to remove the least frequent colors from the image
-void removeLeastFrequentColors(PPMImageAOS &image, int num_colors_to_remove) {
+auto removeLeastFrequentColors(PPMImageAOS &image, int num_colors_to_remove, const NearestSearchOptions &options,
+                               OperationContext &context) -> NearestSearchStats {
   size_t const total_pixels = static_cast<size_t>(image.width) * static_cast<size_t>(image.height);
 
   if (static_cast<size_t>(num_colors_to_remove) >= total_pixels) {
@@ -19,12 +20,26 @@ void removeLeastFrequentColors(PPMImageAOS &image, int num_colors_to_remove) {
         pixel.blue = 0;
       }
     }
-  } else {
-    // Optimized processing using KD-Tree without explicit new/delete
-    if (image.max_color_value <= MAX_INTENSITY_FOR_1B) {
-      removeColors<SmallPixel>(num_colors_to_remove, image.sPixels);
-    } else {
-      removeColors<LargePixel>(num_colors_to_remove, image.lPixels);
-    }
+    return {};
+  }
+  // Nearest colors searched with the strategy that suits the palette size (linear scan, KD-Tree or grid)
+  if (image.max_color_value <= MAX_INTENSITY_FOR_1B) {
+    return removeColors<SmallPixel>(num_colors_to_remove, image.sPixels, options, context);
+  }
+  return removeColors<LargePixel>(num_colors_to_remove, image.lPixels, options, context);
+}
+
+// Same operation on a compressed image, on its color table only
+auto removeLeastFrequentColors(PaletteImageAOS &image, int num_colors_to_remove, const NearestSearchOptions &options,
+                               OperationContext &context) -> NearestSearchStats {
+  if (static_cast<size_t>(num_colors_to_remove) >= image.indices.size()) {
+    // Every table entry becomes black (0,0,0), they are merged into one when the image is written
+    std::fill(image.sColors.begin(), image.sColors.end(), SmallPixel{.red=0, .green=0, .blue=0});
+    std::fill(image.lColors.begin(), image.lColors.end(), LargePixel{.red=0, .green=0, .blue=0});
+    return {};
+  }
+  if (image.header.max_color_value <= MAX_INTENSITY_FOR_1B) {
+    return removeTableColors<SmallPixel>(num_colors_to_remove, image.sColors, image.indices, options, context);
   }
+  return removeTableColors<LargePixel>(num_colors_to_remove, image.lColors, image.indices, options, context);
 }
@@ -2,7 +2,11 @@
 #define CUTFREQAOS_HPP
 
 #include "imageaos.hpp"
+#include "compressaos.hpp"
+#include "../common/colorsearch.hpp"
+#include "../common/opcontext.hpp"
 #include <cstddef>
+#include <memory_resource>
 #include <unordered_map>
 #include <unordered_set>
 #include <utility>
@@ -16,20 +20,10 @@
 
 
 // Define constants
-constexpr int KDTREE_DIMENSION = 3;
 constexpr int HASH_VALUE_1 = 8;
 constexpr int HASH_VALUE_2 = 16;
 constexpr int HASH_VALUE_3 = 32;
 
-template<typename PixelType>
-struct KDTreeSearchContext {
-    std::vector<PixelType> tree;
-    PixelType target;
-    double min_dist;
-    [[maybe_unused]] PixelType nearest;
-
-};
-
 // Specializations of std::hash for SmallPixel and LargePixel
 namespace std {
   template<>
@@ -47,105 +41,36 @@ namespace std {
   };
 }
 
-// Function to build the k-d tree recursively
-// NOLINTBEGIN(misc-no-recursion)
-template<typename PixelType>
-void buildKdTree(std::vector<PixelType> &points, size_t left, size_t right, int depth) {
-  if (left >= right) { return;}
-    int const axis = depth % KDTREE_DIMENSION;
-  size_t mid = left + ((right - left) / 2);
-
-  // Partial sort based on the axis
-  std::nth_element(points.begin() + static_cast<typename std::vector<PixelType>::difference_type>(left),
-                   points.begin() + static_cast<typename std::vector<PixelType>::difference_type>(mid),
-                   points.begin() + static_cast<typename std::vector<PixelType>::difference_type>(right),
-                   [axis](const PixelType &pix_a, const PixelType &pix_b) {
-                     if (axis == 0) { return pix_a.red < pix_b.red;}
-                         if (axis == 1) { return pix_a.green < pix_b.green;}
-                         return pix_a.blue < pix_b.blue;
-                   });
-
-  // Recursively build left and right subtrees
-  buildKdTree(points, left, mid, depth + 1);
-  buildKdTree(points, mid + 1, right, depth + 1);
-}
-
-// Helper function to compute squared distance
-template<typename PixelType>
-auto squaredDistance(const PixelType &pix_a, const PixelType &pix_b) -> double {
-  double distr = static_cast<double>(pix_a.red) - static_cast<double>(pix_b.red);
-  double distg = static_cast<double>(pix_a.green) - static_cast<double>(pix_b.green);
-  double distb = static_cast<double>(pix_a.blue) - static_cast<double>(pix_b.blue);
-  return (distr * distr) + (distg * distg) + (distb * distb);
-}
-
-// Function to search nearest neighbor recursively
-template<typename PixelType>
-void kdTreeNearestNeighbor(KDTreeSearchContext<PixelType> &context, size_t left, size_t right, int depth) {
-  if (left >= right) { return; }
-
-  int const axis = depth % KDTREE_DIMENSION;
-  size_t mid = left + ((right - left) / 2);
-
-  const PixelType &pivot = context.tree[mid];
-  double dist = squaredDistance(context.target, pivot);
-  if (dist < context.min_dist) {
-    context.min_dist = dist;
-    context.nearest = pivot;
-  }
-
-  double diff = 0.0;
-  if (axis == 0) { diff = static_cast<double>(context.target.red) - static_cast<double>(pivot.red);
-  } else if (axis == 1) { diff = static_cast<double>(context.target.green) - static_cast<double>(pivot.green);
-  } else { diff = static_cast<double>(context.target.blue) - static_cast<double>(pivot.blue);
-  }
-
-  if (diff <= 0) {
-    // first left subtree
-    kdTreeNearestNeighbor(context, left, mid, depth + 1);
-    if (diff * diff < context.min_dist) {
-      // right subtree if neccessary
-      kdTreeNearestNeighbor(context, mid + 1, right, depth + 1);
-    }
-  } else {
-    // right subtree
-    kdTreeNearestNeighbor(context, mid + 1, right, depth + 1);
-    if (diff * diff < context.min_dist) {
-      // left subtree if neccessary
-      kdTreeNearestNeighbor(context, left, mid, depth + 1);
-    }
-  }
-}
-// NOLINTEND(misc-no-recursion)
-// Function to find nearest colors using k-d tree
-template<typename PixelType>
-void FindNearestColors(const std::unordered_set<PixelType> &colors_to_remove,
-                       std::unordered_map<PixelType, PixelType> &replacement_map,
-                       std::vector<PixelType> &colors_to_keep_vec) {
-  // Build k-d tree from colors_to_keep
-  buildKdTree<PixelType>(colors_to_keep_vec, 0, colors_to_keep_vec.size(), 0);
-
-  // Convert colors_to_keep_vec to const reference for search
-  const std::vector<PixelType> &tree = colors_to_keep_vec;
+// Function to find the nearest kept color of every color to remove.
+// On equal distance the color that comes first in colors_to_keep_vec is chosen. A positive tolerance accepts
+// replacements up to that squared distance worse than the exact nearest color. The set and the map may be std
+// or pmr containers.
+template<typename PixelType, typename RemoveSet, typename ReplacementMap>
+auto FindNearestColors(const RemoveSet &colors_to_remove, ReplacementMap &replacement_map,
+                       const std::vector<PixelType> &colors_to_keep_vec,
+                       const NearestSearchOptions &options = {}) -> NearestSearchStats {
+  // Build the search structure (linear scan, k-d tree or grid) from colors_to_keep
+  ColorIndex<PixelType> const index = buildColorIndex(colors_to_keep_vec, options.strategy, colors_to_remove.size());
 
   // For each color to remove, find the nearest neighbor
+  NearestSearchStats stats{.strategy=index.strategy, .queries=colors_to_remove.size(),
+                           .palette_size=colors_to_keep_vec.size(), .max_error=0.0};
   for (const auto &color_remove : colors_to_remove) {
-    double min_distance = std::numeric_limits<double>::max();
-    PixelType nearest_color = color_remove;
-    auto context = KDTreeSearchContext<PixelType>{tree, color_remove, min_distance, nearest_color};
-    kdTreeNearestNeighbor<PixelType>(context, 0, tree.size(),0);
-
-    replacement_map[color_remove] = nearest_color;
+    NearestColorResult<PixelType> const nearest = nearestColor(index, color_remove, options.tolerance);
+    replacement_map[color_remove] = nearest.color;
+    stats.max_error = std::max(stats.max_error, nearest.error_bound);
   }
+  return stats;
 }
 
-// Function to remove least frequent colors
-template<typename PixelType>
-void removeColors(int num_colors_to_remove, std::vector<PixelType> &pixels) {
-  std::unordered_map<PixelType, size_t> color_frequencies;
-  for (const auto &pixel : pixels) {// Count frequencies
-    ++color_frequencies[pixel];}
-  std::vector<std::pair<PixelType, size_t>> color_freq_vec(color_frequencies.begin(), color_frequencies.end());// Create a vector of colors sorted by frequency
+// Chooses the least frequent colors to remove and maps each of them to its nearest kept color.
+// Returns how the nearest colors were searched. The temporaries are in the context's memory.
+template<typename PixelType, typename Frequencies, typename ReplacementMap>
+auto selectReplacements(int num_colors_to_remove, const Frequencies &color_frequencies,
+                        ReplacementMap &replacement_map, const NearestSearchOptions &options = {},
+                        OperationContext &context = OperationContext::heap()) -> NearestSearchStats {
+  std::pmr::vector<std::pair<PixelType, size_t>> color_freq_vec(color_frequencies.begin(), color_frequencies.end(),
+                                                                context.memory());// Create a vector of colors sorted by frequency
   std::sort(color_freq_vec.begin(), color_freq_vec.end(), [](const std::pair<PixelType, size_t> &pix_a, const std::pair<PixelType, size_t> &pix_b) {
 
     if (pix_a.second != pix_b.second) { return pix_a.second < pix_b.second;} // Sort by frequency
@@ -155,27 +80,70 @@ void removeColors(int num_colors_to_remove, std::vector<PixelType> &pixels) {
 
   size_t total_unique_colors = color_freq_vec.size();
   size_t const num_colors_to_actually_remove = std::min(static_cast<size_t>(num_colors_to_remove), total_unique_colors);
-  std::unordered_set<PixelType> colors_to_remove;// Select colors to remove and keep
-  std::vector<PixelType> colors_to_keep_vec;
+  std::pmr::unordered_set<PixelType> colors_to_remove(context.memory());// Select colors to remove and keep
+  std::vector<PixelType> colors_to_keep_vec; // Moved into the search index
 
   for (size_t i = 0; i < num_colors_to_actually_remove; ++i) {
     colors_to_remove.insert(color_freq_vec[i].first);}
 
-  for (size_t i = num_colors_to_actually_remove; i < total_unique_colors; ++i) {
-    colors_to_keep_vec.push_back(color_freq_vec[i].first);}
+  for (size_t i = total_unique_colors; i > num_colors_to_actually_remove; --i) { // Most frequent first, so it wins ties
+    colors_to_keep_vec.push_back(color_freq_vec[i - 1].first);}
 
-  std::unordered_map<PixelType, PixelType> replacement_map;// Create replacement map
-  FindNearestColors<PixelType>(colors_to_remove, replacement_map, colors_to_keep_vec);
+  return FindNearestColors(colors_to_remove, replacement_map, colors_to_keep_vec, options);
+}
 
-  for (auto &pixel : pixels) {// Replace colors in the image
-    auto iterator = replacement_map.find(pixel);
+// Replaces every color found in replacement_map (in the pixels or in a color table)
+template<typename PixelType, typename Allocator, typename ReplacementMap>
+void replaceColors(std::vector<PixelType, Allocator> &colors, const ReplacementMap &replacement_map) {
+  for (auto &color : colors) {
+    auto iterator = replacement_map.find(color);
     if (iterator != replacement_map.end()) {
-      pixel = iterator->second;
+      color = iterator->second;
     }
   }
 }
 
-// Main function to remove the least frequent colors from the image
-void removeLeastFrequentColors(PPMImageAOS &image, int num_colors_to_remove);
+// Function to remove least frequent colors, returns how the nearest colors were searched
+template<typename PixelType>
+auto removeColors(int num_colors_to_remove, PixelBuffer<PixelType> &pixels, const NearestSearchOptions &options = {},
+                  OperationContext &context = OperationContext::heap()) -> NearestSearchStats {
+  std::pmr::unordered_map<PixelType, size_t> color_frequencies(context.memory());
+  for (const auto &pixel : pixels) {// Count frequencies
+    ++color_frequencies[pixel];}
+
+  std::pmr::unordered_map<PixelType, PixelType> replacement_map(context.memory());// Create replacement map
+  NearestSearchStats const stats = selectReplacements<PixelType>(num_colors_to_remove, color_frequencies,
+                                                                 replacement_map, options, context);
+  replaceColors(pixels, replacement_map);// Replace colors in the image
+  return stats;
+}
+
+// Same as removeColors on a compressed image: frequencies come from the index counts and only the color
+// table is rewritten
+template<typename PixelType>
+auto removeTableColors(int num_colors_to_remove, std::vector<PixelType> &colors, const std::vector<uint32_t> &indices,
+                       const NearestSearchOptions &options = {},
+                       OperationContext &context = OperationContext::heap()) -> NearestSearchStats {
+  std::vector<size_t> const counts = count_cppm_indices(indices, colors.size());
+  std::pmr::unordered_map<PixelType, size_t> color_frequencies(context.memory());
+  for (size_t i = 0; i < colors.size(); ++i) {
+    if (counts[i] > 0) { color_frequencies[colors[i]] += counts[i]; } // Unused entries are not image colors
+  }
+
+  std::pmr::unordered_map<PixelType, PixelType> replacement_map(context.memory());
+  NearestSearchStats const stats = selectReplacements<PixelType>(num_colors_to_remove, color_frequencies,
+                                                                 replacement_map, options, context);
+  replaceColors(colors, replacement_map);
+  return stats;
+}
+
+// Main function to remove the least frequent colors from the image.
+// options.tolerance > 0 enables the approximate nearest-colour search; the returned stats report the strategy
+// used and the largest error bound incurred. The maps and sets are built in the context's memory.
+auto removeLeastFrequentColors(PPMImageAOS &image, int num_colors_to_remove, const NearestSearchOptions &options = {},
+                               OperationContext &context = OperationContext::heap()) -> NearestSearchStats;
+auto removeLeastFrequentColors(PaletteImageAOS &image, int num_colors_to_remove,
+                               const NearestSearchOptions &options = {},
+                               OperationContext &context = OperationContext::heap()) -> NearestSearchStats;
 
 #endif // CUTFREQAOS_HPP
@@ -4,17 +4,23 @@
 #include "maxlevelaos.hpp"
 #include "resizeaos.hpp"
 #include "cutfreqaos.hpp"
+#include "../common/streamcompress.hpp"
+#include "../common/streammaxlevel.hpp"
 #include <fstream>
 #include <iostream>
+#include <utility>
 
 
-// readImageAOS function definition:
+// readImageAOS function definition (accepts both P6 and CPPM files):
 auto readImageAOS(const std::string &filename) -> PPMImageAOS {
   std::ifstream file(filename, std::ios::binary); // Open file in binary mode
   if (!file.is_open()) {
     throw std::runtime_error("Error opening the PPM file.");} // Throw error if file fails to open
   std::string magic_number;
   file >> magic_number; // Read magic number for format validation
+  if (magic_number == CPPM_MAGIC) { // Compressed input, decode it
+    file.seekg(0);
+    return read_cppm(file);}
   if (magic_number != "P6") {
     throw std::runtime_error("Unsupported PPM format.");} // Throw error if format is unsupported
   int width = 0; // NOLINT(misc-const-correctness) we have to do this because clang tidy says they have to be constants, but clearly they can't
@@ -100,22 +106,143 @@ void infoImageAOS(const std::string &filename) {
 }
 
 // run_operation function definition:
+// Index coding of the CPPM files written, from the --bitpack, --entropy and --chunk-rows options
+static auto cppmFlags(const ProgramArgs &args) -> unsigned {
+  unsigned const chunked = args.chunk_rows > 0 ? CPPM_FLAG_CHUNKED : 0;
+  if (args.entropy) { return CPPM_FLAG_ENTROPY | chunked; }
+  return (args.bitpack ? CPPM_FLAG_BITPACKED : 0) | chunked;
+}
+
+// How compress writes the CPPM file; it stores the pixels without a color table when the table would not pay off
+static auto cppmWriteOptions(const ProgramArgs &args) -> CPPMWriteOptions {
+  return {.flags=cppmFlags(args), .group_rows=args.chunk_rows, .order=paletteOrderFromName(args.palette_order),
+          .raw_fallback=true};
+}
+
+// Prints what the cutfreq options ask to report
+static void reportCutfreq(const ProgramArgs &args, const NearestSearchStats &stats) {
+  if (args.verbose) { // Report how the nearest colors were searched
+    std::cout << "cutfreq: " << nearestStrategyName(stats.strategy) << " search of " << stats.queries
+              << " colors among " << stats.palette_size << '\n';
+  }
+  if (args.tolerance > 0.0) { // Report the certified bound on the error of the approximate search
+    std::cout << "Approximate cutfreq: max squared-distance error bound " << stats.max_error
+              << " (tolerance " << args.tolerance << ")" << '\n';
+  }
+}
+
+// Prints, with --verbose, how the large rasters were placed in memory
+static void reportPixelBuffers(const ProgramArgs &args) {
+  PixelBufferStats const stats = pixelBufferStats();
+  if (!args.verbose || stats.large_buffers == 0) { return; }
+  std::cout << "rasters: " << stats.large_buffers << " large buffers, " << stats.large_bytes / MEBIBYTE << " MiB, "
+            << stats.advised_bytes / MEBIBYTE << " MiB advised for huge pages, " << stats.touched_pages
+            << " pages first touched by up to " << stats.touch_stripes << " threads; huge pages per node:";
+  for (size_t node = 0; node < PIXEL_BUFFER_MAX_NODES; ++node) {
+    if (stats.node_samples[node] > 0) { std::cout << " " << node << ":" << stats.node_samples[node]; }
+  }
+  std::cout << " unknown:" << stats.unknown_samples << '\n';
+}
+
+// maxlevel and cutfreq from a CPPM file to a CPPM file only rewrite the color table (and, for cutfreq, remap
+// the indices), the pixels are never expanded. Returns false if the operation needs the decoded image.
+static auto runPaletteOperationAOS(const ProgramArgs &args) -> bool {
+  if (!rewritesCppmPalette(args)) { return false; }
+  std::ifstream input(args.input_file, std::ios::binary);
+  PaletteImageAOS image = read_palette_image(input);
+  image.header.flags = cppmFlags(args); // Same coding as compress
+  image.header.group_rows = args.chunk_rows;
+  if (args.operation == "maxlevel") {
+    maxLevelPaletteAOS(image, args.max_level);
+  } else {
+    NearestSearchOptions const options{.tolerance=args.tolerance, .strategy=nearestStrategyFromName(args.search)};
+    reportCutfreq(args, removeLeastFrequentColors(image, args.max_level, options));
+  }
+  std::ofstream output(args.output_file, std::ios::binary);
+  write_palette_image(output, image, paletteOrderFromName(args.palette_order));
+  return true;
+}
+
+// Records a point operation step in a chain; false for the steps that need the real pixels
+static auto addPointOpAOS(PointOpChain &chain, const PipelineStep &step) -> bool {
+  if (step.operation == "maxlevel") {
+    addMaxLevelAOS(chain, step.max_level); // Adjust max color level
+  } else if (step.operation == "gamma") {
+    chain.add_gamma(step.factor);
+  } else if (step.operation == "levels") {
+    chain.add_levels(step.black, step.white);
+  } else if (step.operation == "contrast") {
+    chain.add_contrast(step.factor);
+  } else {
+    return false;
+  }
+  return true;
+}
+
+// A pipeline of point operations only, from a P6 file, is one read-map-write pass over the file. Returns false
+// if a step needs the decoded image.
+static auto runStreamPointOpsAOS(const ProgramArgs &args) -> bool {
+  if (args.dither != "none") { return false; } // A dithered maxlevel needs the neighbouring pixels
+  PointOpChain chain;
+  for (const PipelineStep &step : pipelineSteps(args)) {
+    if (!addPointOpAOS(chain, step)) { return false; }
+  }
+  if (is_cppm_file(args.input_file)) { return false; }
+  stream_point_ops(args.input_file, args.output_file, chain);
+  return true;
+}
+
+// Runs the operations in order on the decoded image, which the pipeline owns, and nothing touches the disk until
+// the last stage. Consecutive point operations are only recorded, then run together as one table lookup per
+// component in the image's own buffers. resize writes into a scratch image that is swapped in, so its buffers are
+// reused by the next resize. The temporaries of cutfreq and compress are taken from one operation context that
+// is reset after each step, so its arenas are grown once and reused by the next steps.
+static void runPipelineAOS(const ProgramArgs &args) {
+  PPMImageAOS image = readImageAOS(args.input_file);
+  PPMImageAOS scratch;
+  OperationContext context;
+  PointOpChain pending; // Point operations not run yet
+  DitherMethod const dither = ditherMethodFromName(args.dither);
+  auto flush = [&] { // Runs the pending point operations in one pass, in the image's own buffers
+    if (pending.empty()) { return; }
+    applyPointOpsInPlaceAOS(image, pending);
+    pending = PointOpChain();
+  };
+  for (const PipelineStep &step : pipelineSteps(args)) {
+    if (step.operation == "maxlevel" && dither != DitherMethod::none) {
+      flush();
+      ditherMaxLevelAOS(image, step.max_level, dither); // Spreads the rounding error, so not a point operation
+      continue;
+    }
+    if (addPointOpAOS(pending, step)) { continue; } // Folded with its neighbours
+    flush();
+    if (step.operation == "resize") {
+      resizeImageAOS(step.width, image, step.height, scratch); // Resize image
+      std::swap(image, scratch);
+    } else if (step.operation == "cutfreq") {
+      NearestSearchOptions const options{.tolerance=args.tolerance, .strategy=nearestStrategyFromName(args.search)};
+      reportCutfreq(args, removeLeastFrequentColors(image, step.max_level, options, context));
+    } else if (step.operation == "compress") { // Always the last step
+      write_cppm(args.output_file, image, cppmWriteOptions(args), context); // Write compressed image in CPPM format
+      return;
+    }
+    context.reset();
+  }
+  flush();
+  writeImageAOS(args.output_file, image); // Write modified image
+}
+
 void run_operationaos(const ProgramArgs &args) {
+  setPixelBufferPlacement({.huge_pages=args.page_placement, .first_touch=args.page_placement,
+                           .count_nodes=args.verbose});
+  if (args.steps.size() <= 1 && runPaletteOperationAOS(args)) { return; }
+  if (runStreamPointOpsAOS(args)) { return; }
   if (args.operation == "info") {
     infoImageAOS(args.input_file); // Show image info
-  } else if (args.operation == "maxlevel") {
-    PPMImageAOS const new_image = maxLevelImageAOS(args.input_file, args.max_level); // Adjust max color level
-    writeImageAOS(args.output_file, new_image); // Write modified image
-  } else if (args.operation == "compress") {
-    PPMImageAOS const c_image = readImageAOS(args.input_file); // Read image for compression
-    write_cppm(args.output_file, c_image); // Write compressed image in CPPM format
-  } else if (args.operation == "resize") {
-    PPMImageAOS const r_image = readImageAOS(args.input_file); // Read image for resizing
-    auto r_image_f= resizeImageAOS(args.width, r_image, args.height);  // Resize image
-    writeImageAOS(args.output_file, r_image); // Write resized image
-  } else if (args.operation == "cutfreq") {
-    PPMImageAOS f_image = readImageAOS(args.input_file); // Read image for frequency cut
-    removeLeastFrequentColors(f_image, args.max_level);
-    writeImageAOS(args.output_file, f_image);
+  } else if (streamsCompress(args)) {
+    stream_compress(args.input_file, args.output_file, cppmWriteOptions(args)); // Never loads the image
+  } else {
+    runPipelineAOS(args);
+    reportPixelBuffers(args);
   }
-}
\ No newline at end of file
+}
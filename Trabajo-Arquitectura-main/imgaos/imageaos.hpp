@@ -1,6 +1,7 @@
 #ifndef IMAGEAOS_HPP
 #define IMAGEAOS_HPP
 
+#include "../common/pixelbuffer.hpp"
 #include "../common/progargs.hpp"
 #include <map>
 #include <string>
@@ -53,8 +54,8 @@ struct PPMImageAOS {
     int width;
     int height;
     int max_color_value;
-    std::vector <SmallPixel> sPixels;  // Vector of Pixels of 3 bytes (SmallPixel).
-    std::vector <LargePixel> lPixels;  // Vector of Pixels of 6 bytes (LargePixel).
+    PixelBuffer<SmallPixel> sPixels;  // Vector of Pixels of 3 bytes (SmallPixel).
+    PixelBuffer<LargePixel> lPixels;  // Vector of Pixels of 6 bytes (LargePixel).
 };
 
 
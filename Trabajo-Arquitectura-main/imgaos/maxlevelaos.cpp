@@ -1,70 +1,62 @@
 #include "maxlevelaos.hpp"
-#include <cmath>
+#include "../common/streammaxlevel.hpp"
+
+// Maps every component of the pixels through a table of the input component range
+template<typename ToPixel, typename FromPixel>
+static void mapPixels(const PixelBuffer<FromPixel> &pixels, const std::vector<uint16_t> &table,
+                      PixelBuffer<ToPixel> &mapped) {
+  using ComponentType = typename ToPixel::ComponentType;
+  mapped.resize(pixels.size());
+  for (size_t i = 0; i < pixels.size(); ++i) {
+    mapped[i].red = static_cast<ComponentType>(table[pixels[i].red]);
+    mapped[i].green = static_cast<ComponentType>(table[pixels[i].green]);
+    mapped[i].blue = static_cast<ComponentType>(table[pixels[i].blue]);
+  }
+}
+
+// Scales the pixels to the new level, with a specialised kernel for the frequent conversions and a table otherwise
+template<typename ToPixel, typename FromPixel>
+static void scalePixels(const PixelBuffer<FromPixel> &pixels, int oldMaxLevel, int newMaxLevel,
+                        PixelBuffer<ToPixel> &scaled) {
+  using ComponentType = typename ToPixel::ComponentType;
+  bool const fast = withFastLevelConversion(oldMaxLevel, newMaxLevel, [&](auto conversion) {
+    constexpr size_t index = decltype(conversion)::value;
+    scaled.resize(pixels.size());
+    for (size_t i = 0; i < pixels.size(); ++i) {
+      scaled[i].red = static_cast<ComponentType>(fastScaleLevel<index>(pixels[i].red));
+      scaled[i].green = static_cast<ComponentType>(fastScaleLevel<index>(pixels[i].green));
+      scaled[i].blue = static_cast<ComponentType>(fastScaleLevel<index>(pixels[i].blue));
+    }
+  });
+  if (!fast) { mapPixels(pixels, maxLevelTable(oldMaxLevel, newMaxLevel), scaled); }
+}
 
 // Scales an image from SmallPixel to LargePixel format.
 void scaleSmallToLarge(const PPMImageAOS &image, PPMImageAOS &scaled_image, int newMaxLevel) {
-  scaled_image.lPixels.resize(static_cast<size_t>(scaled_image.width) * static_cast<size_t>(scaled_image.height));
-  for (size_t i = 0; i < scaled_image.lPixels.size(); ++i) {
-    SmallPixel const pixel = image.sPixels[i];
-    scaled_image.lPixels[i].red = static_cast<uint16_t>(std::round(
-        (pixel.red * newMaxLevel) / image.max_color_value));
-    scaled_image.lPixels[i].green = static_cast<uint16_t>(std::round(
-        (pixel.green * newMaxLevel) / image.max_color_value));
-    scaled_image.lPixels[i].blue = static_cast<uint16_t>(std::round(
-        (pixel.blue * newMaxLevel) / image.max_color_value));
-  }
+  scalePixels(image.sPixels, image.max_color_value, newMaxLevel, scaled_image.lPixels);
 }
 
 // Scales an image from LargePixel to SmallPixel format.
 void scaleLargeToSmall(const PPMImageAOS &image, PPMImageAOS &scaled_image, int newMaxLevel) {
-  scaled_image.sPixels.resize(static_cast<size_t>(scaled_image.width) * static_cast<size_t>(scaled_image.height));
-  for (size_t i = 0; i < scaled_image.sPixels.size(); ++i) {
-    LargePixel const pixel = image.lPixels[i];
-    scaled_image.sPixels[i].red = static_cast<uint8_t>(std::round(
-        (pixel.red * newMaxLevel) / image.max_color_value));
-    scaled_image.sPixels[i].green = static_cast<uint8_t>(std::round(
-        (pixel.green * newMaxLevel) / image.max_color_value));
-    scaled_image.sPixels[i].blue = static_cast<uint8_t>(std::round(
-        (pixel.blue * newMaxLevel) / image.max_color_value));
-  }
+  scalePixels(image.lPixels, image.max_color_value, newMaxLevel, scaled_image.sPixels);
 }
 
 // Scales an image from SmallPixel to SmallPixel (only changes intensity range).
 void scaleSmallToSmall(const PPMImageAOS &image, PPMImageAOS &scaled_image, int newMaxLevel) {
-  scaled_image.sPixels.resize(static_cast<size_t>(scaled_image.width) * static_cast<size_t>(scaled_image.height));
-  for (size_t i = 0; i < scaled_image.sPixels.size(); ++i) {
-    SmallPixel const pixel = image.sPixels[i];
-    scaled_image.sPixels[i].red = static_cast<uint8_t>(std::round(
-        (pixel.red * newMaxLevel) / image.max_color_value));
-    scaled_image.sPixels[i].green = static_cast<uint8_t>(std::round(
-        (pixel.green * newMaxLevel) / image.max_color_value));
-    scaled_image.sPixels[i].blue = static_cast<uint8_t>(std::round(
-        (pixel.blue * newMaxLevel) / image.max_color_value));
-  }
+  scalePixels(image.sPixels, image.max_color_value, newMaxLevel, scaled_image.sPixels);
 }
 
 // Scales an image from LargePixel to LargePixel (only changes intensity range).
 void scaleLargeToLarge(const PPMImageAOS &image, PPMImageAOS &scaled_image, int newMaxLevel) {
-  scaled_image.lPixels.resize(static_cast<size_t>(scaled_image.width) * static_cast<size_t>(scaled_image.height));
-  for (size_t i = 0; i < scaled_image.lPixels.size(); ++i) {
-    LargePixel const pixel = image.lPixels[i];
-    scaled_image.lPixels[i].red = static_cast<uint16_t>(std::round(
-        (pixel.red * newMaxLevel) / image.max_color_value));
-    scaled_image.lPixels[i].green = static_cast<uint16_t>(std::round(
-        (pixel.green * newMaxLevel) / image.max_color_value));
-    scaled_image.lPixels[i].blue = static_cast<uint16_t>(std::round(
-        (pixel.blue * newMaxLevel) / image.max_color_value));
-  }
+  scalePixels(image.lPixels, image.max_color_value, newMaxLevel, scaled_image.lPixels);
 }
 
-// Adjusts the maximum color level of an image based on the new max level.
-auto maxLevelImageAOS(const std::string &filename, int newMaxLevel) -> PPMImageAOS {
+// Adjusts the maximum color level of an image into an image whose buffers are reused.
+void maxLevelImageAOS(const PPMImageAOS &image, int newMaxLevel, PPMImageAOS &scaled_image) {
   if (newMaxLevel <= 0 || newMaxLevel > MAX_INTENSITY_AOS) { // Validate new max level range
     throw std::invalid_argument("Maximum value not valid.");
   }
 
-  PPMImageAOS const image = readImageAOS(filename); // Read the input image
-  PPMImageAOS scaled_image;
   scaled_image.width = image.width;
   scaled_image.height = image.height;
   scaled_image.max_color_value = newMaxLevel; // Set new max color value for scaled image
@@ -83,6 +75,182 @@ auto maxLevelImageAOS(const std::string &filename, int newMaxLevel) -> PPMImageA
   } else {
     scaleLargeToLarge(image, scaled_image, newMaxLevel);
   }
+  if (isNewSmallPixel) { // Drop what a reused image held in the other pixel size
+    scaled_image.lPixels.clear();
+  } else {
+    scaled_image.sPixels.clear();
+  }
+}
+
+// Adjusts the maximum color level of an image based on the new max level.
+auto maxLevelImageAOS(const std::string &filename, int newMaxLevel) -> PPMImageAOS {
+  if (newMaxLevel <= 0 || newMaxLevel > MAX_INTENSITY_AOS) { // Validate before reading the image
+    throw std::invalid_argument("Maximum value not valid.");
+  }
+  PPMImageAOS image = readImageAOS(filename); // Read the input image
+  maxLevelInPlaceAOS(image, newMaxLevel);
+  return image; // Return the adjusted image
+}
+
+// Adjusts the maximum color level of a P6 file while copying it to another one.
+void maxLevelFileAOS(const std::string &input_file, const std::string &output_file, int newMaxLevel) {
+  if (newMaxLevel <= 0 || newMaxLevel > MAX_INTENSITY_AOS) { // Validate new max level range
+    throw std::invalid_argument("Maximum value not valid.");
+  }
+  stream_maxlevel(input_file, output_file, newMaxLevel);
+}
+
+// Adjusts the maximum color level of an image in its own pixel buffer. Only a change of pixel size needs a new
+// buffer, and the old one is released as soon as it has been read.
+void maxLevelInPlaceAOS(PPMImageAOS &image, int newMaxLevel) {
+  if (newMaxLevel <= 0 || newMaxLevel > MAX_INTENSITY_AOS) { // Validate new max level range
+    throw std::invalid_argument("Maximum value not valid.");
+  }
+  int const oldMaxLevel = image.max_color_value;
+  bool const isNewSmallPixel = (newMaxLevel <= MAX_INTENSITY_FOR_1B);
+  bool const isOldSmallPixel = (oldMaxLevel <= MAX_INTENSITY_FOR_1B);
+  if (isOldSmallPixel && isNewSmallPixel) {
+    scalePixels(image.sPixels, oldMaxLevel, newMaxLevel, image.sPixels); // Each pixel is read before it is written
+  } else if (!isOldSmallPixel && !isNewSmallPixel) {
+    scalePixels(image.lPixels, oldMaxLevel, newMaxLevel, image.lPixels);
+  } else if (isOldSmallPixel) {
+    scalePixels(image.sPixels, oldMaxLevel, newMaxLevel, image.lPixels);
+    image.sPixels = PixelBuffer<SmallPixel>();
+  } else {
+    scalePixels(image.lPixels, oldMaxLevel, newMaxLevel, image.sPixels);
+    image.lPixels = PixelBuffer<LargePixel>();
+  }
+  image.max_color_value = newMaxLevel;
+}
+
+// Component 'channel' (red, green, blue) of a pixel
+template<typename Pixel>
+static auto pixelComponent(Pixel &pixel, size_t channel) -> auto & {
+  if (channel == 0) { return pixel.red; }
+  return channel == 1 ? pixel.green : pixel.blue;
+}
+
+// Dithers the pixels to the new level, into 'dithered' (which may be 'pixels' itself)
+template<typename ToPixel, typename FromPixel>
+static void ditherPixels(const PPMImageAOS &image, const PixelBuffer<FromPixel> &pixels, int newMaxLevel,
+                         DitherMethod method, size_t threads, PixelBuffer<ToPixel> &dithered) {
+  using ComponentType = typename ToPixel::ComponentType;
+  dithered.resize(pixels.size());
+  auto const load = [&pixels](size_t pixel, size_t channel) -> int {
+    return pixelComponent(pixels[pixel], channel);
+  };
+  auto const store = [&dithered](size_t pixel, size_t channel, int level) {
+    pixelComponent(dithered[pixel], channel) = static_cast<ComponentType>(level);
+  };
+  ditherLevels<3>(method, static_cast<size_t>(image.width), static_cast<size_t>(image.height),
+                  image.max_color_value, newMaxLevel, load, store, threads);
+}
+
+// Lowers the maximum color level with dithering, in the image's own pixel buffer when the pixel size is kept.
+// Raising the level loses nothing to rounding, so it is a plain maxlevel.
+void ditherMaxLevelAOS(PPMImageAOS &image, int newMaxLevel, DitherMethod method, size_t threads) {
+  if (newMaxLevel <= 0 || newMaxLevel > MAX_INTENSITY_AOS) { // Validate new max level range
+    throw std::invalid_argument("Maximum value not valid.");
+  }
+  if (method == DitherMethod::none || newMaxLevel >= image.max_color_value) {
+    maxLevelInPlaceAOS(image, newMaxLevel);
+    return;
+  }
+  bool const isNewSmallPixel = (newMaxLevel <= MAX_INTENSITY_FOR_1B);
+  bool const isOldSmallPixel = (image.max_color_value <= MAX_INTENSITY_FOR_1B);
+  if (isOldSmallPixel) { // Then the new level is small too
+    ditherPixels(image, image.sPixels, newMaxLevel, method, threads, image.sPixels);
+  } else if (!isNewSmallPixel) {
+    ditherPixels(image, image.lPixels, newMaxLevel, method, threads, image.lPixels);
+  } else {
+    ditherPixels(image, image.lPixels, newMaxLevel, method, threads, image.sPixels);
+    image.lPixels = PixelBuffer<LargePixel>();
+  }
+  image.max_color_value = newMaxLevel;
+}
+
+// Validates a maxlevel step and records it in a chain of point operations
+void addMaxLevelAOS(PointOpChain &chain, int newMaxLevel) {
+  if (newMaxLevel <= 0 || newMaxLevel > MAX_INTENSITY_AOS) { // Validate new max level range
+    throw std::invalid_argument("Maximum value not valid.");
+  }
+  chain.add_maxlevel(newMaxLevel);
+}
 
-  return scaled_image; // Return the adjusted image
+// Runs a chain of point operations with one table lookup per component
+void applyPointOpsAOS(const PPMImageAOS &image, const PointOpChain &chain, PPMImageAOS &mapped_image) {
+  if (chain.single_maxlevel()) { // A lone maxlevel may have a specialised kernel
+    maxLevelImageAOS(image, chain.output_max(image.max_color_value), mapped_image);
+    return;
+  }
+  std::vector<uint16_t> const table = chain.table(image.max_color_value);
+  int const newMaxLevel = chain.output_max(image.max_color_value);
+  mapped_image.width = image.width;
+  mapped_image.height = image.height;
+  mapped_image.max_color_value = newMaxLevel;
+  bool const isOldSmallPixel = image.max_color_value <= MAX_INTENSITY_FOR_1B;
+  bool const isNewSmallPixel = newMaxLevel <= MAX_INTENSITY_FOR_1B;
+  if (isOldSmallPixel && isNewSmallPixel) {
+    mapPixels(image.sPixels, table, mapped_image.sPixels);
+  } else if (isOldSmallPixel) {
+    mapPixels(image.sPixels, table, mapped_image.lPixels);
+  } else if (isNewSmallPixel) {
+    mapPixels(image.lPixels, table, mapped_image.sPixels);
+  } else {
+    mapPixels(image.lPixels, table, mapped_image.lPixels);
+  }
+  if (isNewSmallPixel) { // Drop what a reused image held in the other pixel size
+    mapped_image.lPixels.clear();
+  } else {
+    mapped_image.sPixels.clear();
+  }
+}
+
+// Runs a chain of point operations in the image's own pixel buffer
+void applyPointOpsInPlaceAOS(PPMImageAOS &image, const PointOpChain &chain) {
+  if (chain.single_maxlevel()) { // A lone maxlevel may have a specialised kernel
+    maxLevelInPlaceAOS(image, chain.output_max(image.max_color_value));
+    return;
+  }
+  std::vector<uint16_t> const table = chain.table(image.max_color_value);
+  int const newMaxLevel = chain.output_max(image.max_color_value);
+  bool const isOldSmallPixel = image.max_color_value <= MAX_INTENSITY_FOR_1B;
+  bool const isNewSmallPixel = newMaxLevel <= MAX_INTENSITY_FOR_1B;
+  if (isOldSmallPixel && isNewSmallPixel) {
+    mapPixels(image.sPixels, table, image.sPixels);
+  } else if (!isOldSmallPixel && !isNewSmallPixel) {
+    mapPixels(image.lPixels, table, image.lPixels);
+  } else if (isOldSmallPixel) {
+    mapPixels(image.sPixels, table, image.lPixels);
+    image.sPixels = PixelBuffer<SmallPixel>();
+  } else {
+    mapPixels(image.lPixels, table, image.sPixels);
+    image.lPixels = PixelBuffer<LargePixel>();
+  }
+  image.max_color_value = newMaxLevel;
+}
+
+// Scales the color table of a compressed image; entries that become equal are merged when it is written
+void maxLevelPaletteAOS(PaletteImageAOS &image, int newMaxLevel) {
+  if (newMaxLevel <= 0 || newMaxLevel > MAX_INTENSITY_AOS) { // Validate new max level range
+    throw std::invalid_argument("Maximum value not valid.");
+  }
+  int const oldMaxLevel = image.header.max_color_value;
+  bool const isNewSmallPixel = (newMaxLevel <= MAX_INTENSITY_FOR_1B);
+  std::vector<SmallPixel> sColors;
+  std::vector<LargePixel> lColors;
+  for (size_t i = 0; i < image.header.color_table_size; ++i) {
+    if (oldMaxLevel <= MAX_INTENSITY_FOR_1B && isNewSmallPixel) {
+      sColors.push_back(scalePixel<SmallPixel>(image.sColors[i], newMaxLevel, oldMaxLevel));
+    } else if (oldMaxLevel <= MAX_INTENSITY_FOR_1B) {
+      lColors.push_back(scalePixel<LargePixel>(image.sColors[i], newMaxLevel, oldMaxLevel));
+    } else if (isNewSmallPixel) {
+      sColors.push_back(scalePixel<SmallPixel>(image.lColors[i], newMaxLevel, oldMaxLevel));
+    } else {
+      lColors.push_back(scalePixel<LargePixel>(image.lColors[i], newMaxLevel, oldMaxLevel));
+    }
+  }
+  image.sColors = std::move(sColors);
+  image.lColors = std::move(lColors);
+  image.header.max_color_value = newMaxLevel;
 }
@@ -2,6 +2,9 @@
 #define MAXLEVELAOS_HPP
 
 #include "imageaos.hpp"
+#include "compressaos.hpp"
+#include "../common/dither.hpp"
+#include "../common/pointops.hpp"
 #include <cmath>
 #include <stdexcept>
 #include <string>
@@ -10,10 +13,37 @@
 
 const int MAX_INTENSITY_AOS = 65536;
 
+// Scales every component of a pixel (or a color table entry) to the new maximum level
+template<typename ToPixel, typename FromPixel>
+auto scalePixel(const FromPixel &pixel, int newMaxLevel, int oldMaxLevel) -> ToPixel {
+  using ComponentType = typename ToPixel::ComponentType;
+  ToPixel scaled{};
+  scaled.red = static_cast<ComponentType>(scaleLevel(pixel.red, newMaxLevel, oldMaxLevel));
+  scaled.green = static_cast<ComponentType>(scaleLevel(pixel.green, newMaxLevel, oldMaxLevel));
+  scaled.blue = static_cast<ComponentType>(scaleLevel(pixel.blue, newMaxLevel, oldMaxLevel));
+  return scaled;
+}
+
 void scaleSmallToLarge(const PPMImageAOS &image, PPMImageAOS &scaled_image, int newMaxLevel);
 void scaleLargeToSmall(const PPMImageAOS &image, PPMImageAOS &scaled_image, int newMaxLevel);
 void scaleSmallToSmall(const PPMImageAOS &image, PPMImageAOS &scaled_image, int newMaxLevel);
 void scaleLargeToLarge(const PPMImageAOS &image, PPMImageAOS &scaled_image, int newMaxLevel);
 auto maxLevelImageAOS(const std::string &filename, int newMaxLevel) -> PPMImageAOS;
+// Same from a P6 file to a P6 file in one pass, without building either image
+void maxLevelFileAOS(const std::string &input_file, const std::string &output_file, int newMaxLevel);
+// Same on an image already read, in its own pixel buffer when the pixel size does not change
+void maxLevelInPlaceAOS(PPMImageAOS &image, int newMaxLevel);
+// Same on an image already read, into an image whose buffers are reused (it must not be image)
+void maxLevelImageAOS(const PPMImageAOS &image, int newMaxLevel, PPMImageAOS &scaled_image);
+// Same lowering the level with dithering (threads = 0 picks them from the image size)
+void ditherMaxLevelAOS(PPMImageAOS &image, int newMaxLevel, DitherMethod method, size_t threads = 0);
+// Validates a maxlevel step and records it in a chain of point operations
+void addMaxLevelAOS(PointOpChain &chain, int newMaxLevel);
+// Runs a chain of point operations in one pass, into an image whose buffers are reused (it must not be image)
+void applyPointOpsAOS(const PPMImageAOS &image, const PointOpChain &chain, PPMImageAOS &mapped_image);
+// Runs a chain of point operations in the image's own pixel buffer when the pixel size does not change
+void applyPointOpsInPlaceAOS(PPMImageAOS &image, const PointOpChain &chain);
+// Same operation on a compressed image: only its color table is scaled
+void maxLevelPaletteAOS(PaletteImageAOS &image, int newMaxLevel);
 
 #endif // MAXLEVELAOS_HPP
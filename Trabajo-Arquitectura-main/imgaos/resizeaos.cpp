@@ -23,37 +23,41 @@ auto calculateCoords(const CoordinateParams &params) -> InterpolationCoords { //
 }
 
 
-// Resizes a PPMImageAOS to a new width and height
-// Resizes a PPMImageAOS to new width and height (main function)
-auto resizeImageAOS(int newWidth, const PPMImageAOS& inputImage, int newHeight) -> PPMImageAOS {
-  PPMImageAOS outputImage;
+// Sizes the output pixels and runs the resize kernel on views of both images, so no pixel buffer is copied
+template<typename PixelType>
+static void resizePixels(const PixelBuffer<PixelType> &inputPixels, const PPMImageAOS &inputImage,
+                         PixelBuffer<PixelType> &outputPixels, const PPMImageAOS &outputImage) {
+  outputPixels.resize(static_cast<size_t>(outputImage.width) * static_cast<size_t>(outputImage.height));
+  ImageData<const PixelType> const inputData{
+      .pixels=inputPixels,
+      .width=inputImage.width,
+      .height=inputImage.height,
+      .max_color_value=inputImage.max_color_value};
+  ImageData<PixelType> const outputData{
+      .pixels=outputPixels,
+      .width=outputImage.width,
+      .height=outputImage.height,
+      .max_color_value=outputImage.max_color_value};
+  resizeImageAOS_impl(inputData, inputData.width, outputData);
+}
+
+// Resizes a PPMImageAOS into an image whose buffers are reused
+void resizeImageAOS(int newWidth, const PPMImageAOS &inputImage, int newHeight, PPMImageAOS &outputImage) {
   outputImage.width = newWidth;
   outputImage.height = newHeight;
   outputImage.max_color_value = inputImage.max_color_value;
   if (inputImage.max_color_value <= MAX_INTENSITY_FOR_1B) {
-    ImageData<SmallPixel> inputData = {
-        .pixels=inputImage.sPixels,
-        .width=inputImage.width,
-        .height=inputImage.height,
-        .max_color_value=inputImage.max_color_value};
-    ImageData<SmallPixel> outputData{
-        .pixels=outputImage.sPixels,
-        .width=outputImage.width,
-        .height=outputImage.height,
-        .max_color_value=outputImage.max_color_value};
-    resizeImageAOS_impl(inputData, inputData.width, outputData);
+    resizePixels(inputImage.sPixels, inputImage, outputImage.sPixels, outputImage);
+    outputImage.lPixels.clear(); // A reused output image may hold the other pixel size
   } else {
-    ImageData<LargePixel> inputData{
-        .pixels=inputImage.lPixels,
-        .width=inputImage.width,
-        .height=inputImage.height,
-        .max_color_value=inputImage.max_color_value};
-    ImageData<LargePixel> outputData{
-        .pixels=outputImage.lPixels,
-        .width=outputImage.width,
-        .height=outputImage.height,
-        .max_color_value=outputImage.max_color_value};
-    resizeImageAOS_impl(inputData, inputData.width, outputData);
+    resizePixels(inputImage.lPixels, inputImage, outputImage.lPixels, outputImage);
+    outputImage.sPixels.clear();
   }
+}
+
+// Resizes a PPMImageAOS to new width and height (main function)
+auto resizeImageAOS(int newWidth, const PPMImageAOS& inputImage, int newHeight) -> PPMImageAOS {
+  PPMImageAOS outputImage;
+  resizeImageAOS(newWidth, inputImage, newHeight, outputImage);
   return outputImage;
-}
\ No newline at end of file
+}
@@ -4,13 +4,15 @@
 #include "imageaos.hpp" // Required for PPMImageAOS, SmallPixel, LargePixel
 #include <cmath>        // Required for std::round
 #include <algorithm>    // Required for std::clamp
+#include <span>         // Required for std::span
 
 
 
-// Template structure to hold image data information
+// Template structure to hold image data information: a non-owning view of the pixels, which the kernel reads
+// (const PixelType) or writes
 template<typename PixelType>
 struct ImageData {
-    std::vector <PixelType> pixels;
+    std::span<PixelType> pixels;
     int width;
     int height;
     int max_color_value;
@@ -71,14 +73,14 @@ auto interpolatePixel(const InterpolationData<PixelType> &data) -> PixelType {
 // Calculates coordinates and weights for interpolation during resizing
 auto calculateCoords(const CoordinateParams &params) -> InterpolationCoords;
 
-// Implementation of image resizing (math formula implementation)
+// Implementation of image resizing (math formula implementation), into output pixels the caller has sized
 template<typename PixelType>
-void resizeImageAOS_impl(ImageData<PixelType> &inputImage, int inputwidth, ImageData<PixelType> &outputImage) {
+void resizeImageAOS_impl(const ImageData<const PixelType> &inputImage, int inputwidth,
+                         const ImageData<PixelType> &outputImage) {
   const ImageDataSize inputSize{inputwidth, inputImage.height};
   const ImageDataSize outputSize{outputImage.width, outputImage.height};
   const auto newWidth = static_cast<size_t>(outputImage.width);
   const auto newHeight = static_cast<size_t>(outputImage.height);
-  outputImage.pixels.resize(newWidth * newHeight);
   const auto inputWidth = static_cast<size_t>(inputImage.width);
   const auto outputWidth = static_cast<size_t>(outputImage.width);
   for (size_t y_prime = 0; y_prime < newHeight; ++y_prime) {
@@ -105,6 +107,9 @@ void resizeImageAOS_impl(ImageData<PixelType> &inputImage, int inputwidth, Image
 // Resizes a PPMImageAOS to a new width and height
 auto resizeImageAOS(int newWidth, const PPMImageAOS& inputImage, int newHeight) -> PPMImageAOS;
 
+// Same, into an image whose buffers are reused (it must not be inputImage)
+void resizeImageAOS(int newWidth, const PPMImageAOS &inputImage, int newHeight, PPMImageAOS &outputImage);
+
 
 
 #endif // RESIZEAOS_HPP
\ No newline at end of file
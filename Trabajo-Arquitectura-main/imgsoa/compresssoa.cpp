@@ -3,46 +3,74 @@
 #include <fstream>
 #include <string>
 #include <stdexcept>
+#include <utility>
+
+// Function to build the header of the file
+auto make_cppm_header(const SOAImage &image, size_t color_table_size, unsigned flags, int group_rows) -> CPPMHeader {
+  return {.width=image.width, .height=image.height, .max_color_value=image.max_color_value,
+          .color_table_size=color_table_size, .flags=flags, .group_rows=group_rows};
+}
 
 // Function to write the header of the file
-void write_header(std::ostream &output, const SOAImage &image, size_t color_table_size) {
-  output << "C6 " << image.width << " " << image.height << " "
-         << image.max_color_value << " " << color_table_size << "\n"; // Write image metadata
+void write_header(std::ostream &output, const SOAImage &image, size_t color_table_size, unsigned flags,
+                  int group_rows) {
+  write_cppm_header(output, make_cppm_header(image, color_table_size, flags, group_rows)); // Write image metadata
 }
 
 // Function to process images with 1 byte per component
-void process_small_pixel_image(std::ostream &output, const SOAImage &image) {
+void process_small_pixel_image(std::ostream &output, const SOAImage &image, const CPPMWriteOptions &options) {
   AuxPixelVects<uint8_t> unique_colors;
-  auto color_map = generate_color_table(image.red1_components, image.green1_components, image.blue1_components,
-                                        unique_colors); // Generate color map
+  DenseColorTable const table = generate_dense_color_table(image.red1_components, image.green1_components,
+                                                           image.blue1_components, unique_colors); // Generate color table
+  if (options.raw_fallback && cppm_table_loses(image.red1_components.size(), image.max_color_value,
+                                               unique_colors.red.size(), options.flags)) {
+    write_cppm_samples(output, make_cppm_header(image, 0), interleave_samples(image.red1_components,
+                       image.green1_components, image.blue1_components)); // Table does not pay off
+    return;
+  }
+  if ((options.flags & CPPM_INDEX_LAYOUT_FLAGS) != 0 || options.order != PaletteOrder::first_seen) {
+    std::vector <uint32_t> indices = gather_dense_pixel_indices<uint32_t>(image.red1_components, image.green1_components,
+                                                                          image.blue1_components, table);
+    write_indexed_image(output, image, unique_colors, indices, options); // Reordered or coded
+    return;
+  }
 
-  write_header(output, image, unique_colors.red.size()); // Write file header
+  write_header(output, image, unique_colors.red.size(), options.flags, options.group_rows); // Write file header
   write_color_table(output, unique_colors); // Write color table
 
-  AuxPixelVects<uint8_t> const pixels_indexes{.red=image.red1_components, .green=image.green1_components,
-                                              .blue=image.blue1_components}; // Initialize pixel indexes
-
   if (unique_colors.red.size() <= MAX_INDEX_SIZE_FOR_1B) {
-    write_pixel_indices<uint8_t, uint8_t>(output, pixels_indexes, color_map); // Write 8-bit indices
+    write_dense_pixel_indices<uint8_t>(output, image.red1_components, image.green1_components,
+                                       image.blue1_components, table); // Write 8-bit indices
   } else if (unique_colors.red.size() <= MAX_INDEX_SIZE_FOR_2B) {
-    write_pixel_indices<uint8_t, uint16_t>(output, pixels_indexes, color_map); // Write 16-bit indices
+    write_dense_pixel_indices<uint16_t>(output, image.red1_components, image.green1_components,
+                                        image.blue1_components, table); // Write 16-bit indices
   } else {
     throw std::runtime_error("Color table too large for 1-byte component format."); // Error if too many colors
   }
 }
 
 // Function to process images with 2 bytes per component
-void process_large_pixel_image(std::ostream &output, const SOAImage &image) {
+void process_large_pixel_image(std::ostream &output, const SOAImage &image, const CPPMWriteOptions &options,
+                               OperationContext &context) {
   AuxPixelVects<uint16_t> unique_colors;
   auto color_map = generate_color_table(image.red2_components, image.green2_components, image.blue2_components,
-                                        unique_colors); // Generate color map
+                                        unique_colors, 0, context); // Generate color map
+  if (options.raw_fallback && cppm_table_loses(image.red2_components.size(), image.max_color_value,
+                                               unique_colors.red.size(), options.flags)) {
+    write_cppm_samples(output, make_cppm_header(image, 0), interleave_samples(image.red2_components,
+                       image.green2_components, image.blue2_components)); // Table does not pay off
+    return;
+  }
+  auto const pixels_indexes = componentViews<uint16_t>(image); // Views of the planes, not copies
+  if ((options.flags & CPPM_INDEX_LAYOUT_FLAGS) != 0 || options.order != PaletteOrder::first_seen) {
+    std::vector <uint32_t> indices = gather_pixel_indices<uint16_t, uint32_t>(pixels_indexes, color_map);
+    write_indexed_image(output, image, unique_colors, indices, options); // Reordered or coded
+    return;
+  }
 
-  write_header(output, image, unique_colors.red.size()); // Write file header
+  write_header(output, image, unique_colors.red.size(), options.flags, options.group_rows); // Write file header
   write_color_table(output, unique_colors); // Write color table
 
-  AuxPixelVects<uint16_t> const pixels_indexes{.red=image.red2_components, .green=image.green2_components,
-                                               .blue=image.blue2_components}; // Initialize pixel indexes
-
   if (unique_colors.red.size() <= MAX_INDEX_SIZE_FOR_1B) {
     write_pixel_indices<uint16_t, uint8_t>(output, pixels_indexes, color_map); // Write 8-bit indices
   } else if (unique_colors.red.size() <= MAX_INDEX_SIZE_FOR_2B) {
@@ -55,17 +83,108 @@ void process_large_pixel_image(std::ostream &output, const SOAImage &image) {
 }
 
 // Main function to write the image in C-PPM format
-void write_cppm(const std::string &output_file, const SOAImage &image) {
+void write_cppm(const std::string &output_file, const SOAImage &image, const CPPMWriteOptions &options,
+                OperationContext &context) {
   std::ofstream output(output_file, std::ios::binary); // Open output file in binary mode
   if (!output) {
     throw std::runtime_error("Error opening file for writing."); // Error if file can't be opened
   }
 
   if (image.max_color_value <= MAX_INSTENSITY_1B) {
-    process_small_pixel_image(output, image); // Process 8-bit images
+    process_small_pixel_image(output, image, options); // Process 8-bit images
   } else {
-    process_large_pixel_image(output, image); // Process 16-bit images
+    process_large_pixel_image(output, image, options, context); // Process 16-bit images
   }
 
   output.close(); // Close the file
-}
\ No newline at end of file
+}
+
+// Function to decode a C-PPM file (the inverse of write_cppm)
+auto read_cppm(std::istream &input) -> SOAImage {
+  CPPMHeader const header = read_cppm_header(input);
+  SOAImage image;
+  image.width = header.width;
+  image.height = header.height;
+  image.max_color_value = header.max_color_value;
+  if (header.max_color_value <= MAX_INSTENSITY_1B) { // 1 byte per component
+    read_cppm_components(input, header, image.red1_components, image.green1_components, image.blue1_components);
+  } else { // 2 bytes per component
+    read_cppm_components(input, header, image.red2_components, image.green2_components, image.blue2_components);
+  }
+  return image;
+}
+
+// Function to decode a range of rows of a C-PPM file
+auto read_cppm_rows(std::istream &input, int first_row, int rows) -> SOAImage {
+  CPPMHeader const header = read_cppm_header(input);
+  check_cppm_row_range(header, first_row, rows); // Before allocating anything
+  SOAImage image;
+  image.width = header.width;
+  image.height = rows;
+  image.max_color_value = header.max_color_value;
+  if (header.max_color_value <= MAX_INSTENSITY_1B) { // 1 byte per component
+    AuxPixelVects<uint8_t> components;
+    read_cppm_row_components(input, header, first_row, rows, components);
+    image.red1_components = std::move(components.red);
+    image.green1_components = std::move(components.green);
+    image.blue1_components = std::move(components.blue);
+  } else { // 2 bytes per component
+    AuxPixelVects<uint16_t> components;
+    read_cppm_row_components(input, header, first_row, rows, components);
+    image.red2_components = std::move(components.red);
+    image.green2_components = std::move(components.green);
+    image.blue2_components = std::move(components.blue);
+  }
+  return image;
+}
+
+// Function to build a color table in first-seen order and the index of every pixel, for a file stored without
+// a table
+template<typename ComponentType>
+static auto index_components(const AuxPixelVects<ComponentType> &pixels,
+                             AuxPixelVects<ComponentType> &colors) -> std::vector <uint32_t> {
+  auto const color_map = generate_color_table(pixels.red, pixels.green, pixels.blue, colors);
+  return gather_pixel_indices<ComponentType, uint32_t>(pixels, color_map);
+}
+
+auto read_palette_image(std::istream &input) -> PaletteImageSOA {
+  PaletteImageSOA image;
+  image.header = read_cppm_header(input);
+  if ((image.header.flags & CPPM_SAMPLE_LAYOUT_FLAGS) != 0) { // No color table: build one
+    if (image.header.max_color_value <= MAX_INSTENSITY_1B) {
+      AuxPixelVects<uint8_t> pixels;
+      read_cppm_components(input, image.header, pixels.red, pixels.green, pixels.blue);
+      image.indices = index_components(pixels, image.colors1);
+      image.header.color_table_size = image.colors1.red.size();
+    } else {
+      AuxPixelVects<uint16_t> pixels;
+      read_cppm_components(input, image.header, pixels.red, pixels.green, pixels.blue);
+      image.indices = index_components(pixels, image.colors2);
+      image.header.color_table_size = image.colors2.red.size();
+    }
+    image.header.flags = 0;
+    return image;
+  }
+  if (image.header.max_color_value <= MAX_INSTENSITY_1B) { // 1 byte per component
+    image.colors1 = read_color_table<uint8_t>(input, image.header.color_table_size);
+  } else { // 2 bytes per component
+    image.colors2 = read_color_table<uint16_t>(input, image.header.color_table_size);
+  }
+  image.indices = read_cppm_index_stream(input, image.header);
+  return image;
+}
+
+void write_palette_image(std::ostream &output, PaletteImageSOA &image, PaletteOrder order) {
+  if (image.header.max_color_value <= MAX_INSTENSITY_1B) {
+    order_palette(image.colors1, image.indices, compact_palette(image.colors1, image.indices), order);
+    image.header.color_table_size = image.colors1.red.size();
+    write_cppm_header(output, image.header);
+    write_color_table(output, image.colors1);
+  } else {
+    order_palette(image.colors2, image.indices, compact_palette(image.colors2, image.indices), order);
+    image.header.color_table_size = image.colors2.red.size();
+    write_cppm_header(output, image.header);
+    write_color_table(output, image.colors2);
+  }
+  write_cppm_index_stream(output, image.indices, image.header); // Write every index at once
+}
@@ -3,14 +3,22 @@
 
 #include "imagesoa.hpp"
 #include "../common/binaryio.hpp"
+#include "../common/cppmformat.hpp"
+#include "../common/densecolortable.hpp"
+#include "../common/opcontext.hpp"
+#include "../common/paletteorder.hpp"
+#include "../common/parallel.hpp"
 #include <vector>
 #include <map>
+#include <memory_resource>
+#include <set>
 #include <tuple>
 #include <ostream>
 #include <fstream>
 #include <string>
 #include <stdexcept>
 #include <cstdint>
+#include <utility>
 
 const int MAX_INDEX_SIZE_FOR_1B = 256;
 const int MAX_INDEX_SIZE_FOR_2B = 65536;
@@ -26,13 +34,25 @@ struct pixelcolors { //clang tidy doesn't allow to pass 3 "same type" values one
 // Structure to store RGB component vectors
 template<typename ComponentType>
 struct AuxPixelVects {
-    std::vector <ComponentType> red; // Vector of red components
-    std::vector <ComponentType> green; // Vector of green components
-    std::vector <ComponentType> blue; // Vector of blue components
+    PixelBuffer<ComponentType> red; // Vector of red components
+    PixelBuffer<ComponentType> green; // Vector of green components
+    PixelBuffer<ComponentType> blue; // Vector of blue components
 };
 
-// Function to write the header of the file
-void write_header(std::ostream &output, const SOAImage &image, size_t color_table_size);
+// Function to view the component vectors without copying them
+template<typename ComponentType>
+auto component_views(const AuxPixelVects<ComponentType> &vects) -> AuxPixelVectsref<const ComponentType> {
+    return {.red=vects.red, .green=vects.green, .blue=vects.blue};
+}
+
+// Function to build the header of the file (flags are CPPM_FLAG_* bits; group_rows is the row group height
+// when CPPM_FLAG_CHUNKED is set)
+auto make_cppm_header(const SOAImage &image, size_t color_table_size, unsigned flags = 0,
+                      int group_rows = 0) -> CPPMHeader;
+
+// Function to write the header of the file (flags are CPPM_FLAG_* bits, only written when not 0)
+void write_header(std::ostream &output, const SOAImage &image, size_t color_table_size, unsigned flags = 0,
+                  int group_rows = 0);
 
 // Function to write a single color in binary format
 template<typename ComponentType>
@@ -55,48 +75,304 @@ void write_color_table(std::ostream &output, const AuxPixelVects<ComponentType>
 // Function to generate an RGB color tuple
 template<typename ComponentType>
 auto get_color_tuple(
-        const std::vector <ComponentType> &red, const std::vector <ComponentType> &green,
-        const std::vector <ComponentType> &blue, size_t index) -> std::tuple <ComponentType, ComponentType, ComponentType> {
+        const PixelBuffer<ComponentType> &red, const PixelBuffer<ComponentType> &green,
+        const PixelBuffer<ComponentType> &blue, size_t index) -> std::tuple <ComponentType, ComponentType, ComponentType> {
     return std::make_tuple(red[index], green[index], blue[index]); // Create RGB tuple
 }
 
-// Function to generate the color table
+// Function to generate the color table. Each stripe lists its own first-seen colors in parallel and the
+// lists are merged in stripe order, which gives the same table as a sequential pass (stripes = 0: automatic).
+// The map, the stripes' sets and their lists are in the context's memory.
 template<typename ComponentType>
 auto
-generate_color_table(const std::vector <ComponentType> &red, const std::vector <ComponentType> &green,
-                     const std::vector <ComponentType> &blue, AuxPixelVects<ComponentType> &unique_colors) -> std::map <std::tuple<ComponentType, ComponentType, ComponentType>, size_t> {
-    std::map <std::tuple<ComponentType, ComponentType, ComponentType>, size_t> color_map;
-    for (size_t i = 0; i < red.size(); ++i) {
-        auto color = get_color_tuple(red, green, blue, i); // Generate RGB tuple
-        if (color_map.find(color) == color_map.end()) { // Check if color is unique
-            color_map[color] = unique_colors.red.size(); // Map color to index
-            unique_colors.red.push_back(red[i]); // Store red component
-            unique_colors.green.push_back(green[i]); // Store green component
-            unique_colors.blue.push_back(blue[i]); // Store blue component
+generate_color_table(const PixelBuffer<ComponentType> &red, const PixelBuffer<ComponentType> &green,
+                     const PixelBuffer<ComponentType> &blue, AuxPixelVects<ComponentType> &unique_colors,
+                     size_t stripes = 0, OperationContext &context = OperationContext::heap())
+        -> std::pmr::map <std::tuple<ComponentType, ComponentType, ComponentType>, size_t> {
+    using ColorTuple = std::tuple<ComponentType, ComponentType, ComponentType>;
+    if (stripes == 0) { stripes = stripeCount(red.size()); }
+    auto first_seen = context.stripe_vectors<ColorTuple>(stripes);
+    forEachStripe(red.size(), stripes, [&](size_t stripe, size_t begin, size_t end) {
+        std::pmr::set<ColorTuple> seen(context.stripe_memory(stripe));
+        for (size_t i = begin; i < end; ++i) {
+            auto color = get_color_tuple(red, green, blue, i); // Generate RGB tuple
+            if (seen.insert(color).second) { first_seen[stripe].items.push_back(color); } // Check if color is new here
+        }
+    });
+    std::pmr::map <ColorTuple, size_t> color_map(context.memory());
+    for (const auto &colors: first_seen) {
+        for (const auto &color: colors.items) {
+            if (color_map.try_emplace(color, unique_colors.red.size()).second) { // Check if color is unique
+                unique_colors.red.push_back(std::get<0>(color)); // Store red component
+                unique_colors.green.push_back(std::get<1>(color)); // Store green component
+                unique_colors.blue.push_back(std::get<2>(color)); // Store blue component
+            }
         }
     }
     return color_map;
 }
 
-// Function to write pixel indices
-template<typename ComponentType, typename IndexType>
+// Function to gather pixel indices by parallel stripes into one buffer (the color map is a std or pmr map)
+template<typename ComponentType, typename IndexType, typename ColorMap>
+auto gather_pixel_indices(const AuxPixelVectsref<const ComponentType> &pixels_indexes, const ColorMap &color_map,
+                          size_t stripes = 0) -> std::vector<IndexType> {
+    std::vector<IndexType> indices(pixels_indexes.red.size());
+    forEachStripe(indices.size(), stripes == 0 ? stripeCount(indices.size()) : stripes,
+                  [&](size_t /*stripe*/, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            auto color = std::make_tuple(pixels_indexes.red[i], pixels_indexes.green[i],
+                                         pixels_indexes.blue[i]); // Get color tuple
+            indices[i] = static_cast<IndexType>(color_map.at(color)); // Get color index
+        }
+    });
+    return indices;
+}
+template<typename ComponentType, typename IndexType, typename ColorMap>
+auto gather_pixel_indices(const AuxPixelVects<ComponentType> &pixels_indexes, const ColorMap &color_map,
+                          size_t stripes = 0) -> std::vector<IndexType> {
+    return gather_pixel_indices<ComponentType, IndexType>(component_views(pixels_indexes), color_map, stripes);
+}
+
+// Function to write pixel indices, gathered into one buffer written at once
+template<typename ComponentType, typename IndexType, typename ColorMap>
+void write_pixel_indices(std::ostream &output, const AuxPixelVectsref<const ComponentType> &pixels_indexes,
+                         const ColorMap &color_map, size_t stripes = 0) {
+    write_binary_buffer(output, gather_pixel_indices<ComponentType, IndexType>(pixels_indexes, color_map,
+                                                                               stripes)); // Write color indices in binary format
+}
+template<typename ComponentType, typename IndexType, typename ColorMap>
 void write_pixel_indices(std::ostream &output, const AuxPixelVects<ComponentType> &pixels_indexes,
-                         const std::map <std::tuple<ComponentType, ComponentType, ComponentType>, size_t> &color_map) {
-    for (size_t i = 0; i < pixels_indexes.red.size(); ++i) {
-        auto color = get_color_tuple(pixels_indexes.red, pixels_indexes.green, pixels_indexes.blue,
-                                     i); // Get color tuple
-        auto index = static_cast<IndexType>(color_map.at(color)); // Get color index
-        write_binary(output, index); // Write color index in binary format
+                         const ColorMap &color_map, size_t stripes = 0) {
+    write_pixel_indices<ComponentType, IndexType>(output, component_views(pixels_indexes), color_map, stripes);
+}
+
+// Function to generate the color table of a 1-byte image, with a dense table instead of a map
+inline auto generate_dense_color_table(const PixelBuffer<uint8_t> &red, const PixelBuffer<uint8_t> &green,
+                                       const PixelBuffer<uint8_t> &blue, AuxPixelVects<uint8_t> &unique_colors,
+                                       size_t stripes = 0) -> DenseColorTable {
+    if (stripes == 0) { stripes = stripeCount(red.size()); }
+    std::vector<std::vector<uint32_t>> first_seen(stripes); // Color codes, in first-seen order per stripe
+    forEachStripe(red.size(), stripes, [&](size_t stripe, size_t begin, size_t end) {
+        DenseColorSet seen = makeDenseColorSet();
+        for (size_t i = begin; i < end; ++i) {
+            uint32_t const code = denseColorCode(red[i], green[i], blue[i]);
+            if (markDenseColor(seen, code)) { first_seen[stripe].push_back(code); }
+        }
+    });
+    DenseColorTable table;
+    for (const auto &codes: first_seen) {
+        for (uint32_t const code: codes) {
+            if (insertDenseColor(table, code)) { // Check if color is unique
+                unique_colors.red.push_back(static_cast<uint8_t>(code >> DENSE_RED_SHIFT)); // Store red component
+                unique_colors.green.push_back(static_cast<uint8_t>(code >> DENSE_GREEN_SHIFT)); // Store green component
+                unique_colors.blue.push_back(static_cast<uint8_t>(code)); // Store blue component
+            }
+        }
+    }
+    return table;
+}
+
+// Function to gather the index of every pixel into one buffer, in parallel stripes
+template<typename IndexType>
+auto gather_dense_pixel_indices(const PixelBuffer<uint8_t> &red, const PixelBuffer<uint8_t> &green,
+                                const PixelBuffer<uint8_t> &blue, const DenseColorTable &table,
+                                size_t stripes = 0) -> std::vector<IndexType> {
+    std::vector<IndexType> indices(red.size());
+    forEachStripe(red.size(), stripes == 0 ? stripeCount(red.size()) : stripes,
+                  [&](size_t /*stripe*/, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            indices[i] = static_cast<IndexType>(denseColorIndex(table, denseColorCode(red[i], green[i], blue[i])));
+        }
+    });
+    return indices;
+}
+
+// Function to gather the index of every pixel and write them at once
+template<typename IndexType>
+void write_dense_pixel_indices(std::ostream &output, const PixelBuffer<uint8_t> &red,
+                               const PixelBuffer<uint8_t> &green, const PixelBuffer<uint8_t> &blue,
+                               const DenseColorTable &table, size_t stripes = 0) {
+    write_binary_buffer(output, gather_dense_pixel_indices<IndexType>(red, green, blue, table,
+                                                                      stripes)); // Write every index in binary format
+}
+
+// Function to reorder the color table and remap the indices to match ('counts' are the pixels using each entry)
+template<typename ComponentType>
+void order_palette(AuxPixelVects<ComponentType> &colors, std::vector <uint32_t> &indices,
+                   const std::vector <size_t> &counts, PaletteOrder order) {
+    if (order == PaletteOrder::first_seen) { return; } // Tables are built in first-seen order
+    std::vector <uint64_t> codes;
+    if (order == PaletteOrder::morton) {
+        codes.reserve(colors.red.size());
+        for (size_t i = 0; i < colors.red.size(); ++i) {
+            codes.push_back(mortonCode(colors.red[i], colors.green[i], colors.blue[i]));
+        }
+    }
+    std::vector <size_t> const positions = paletteOrderPositions(order, counts, codes);
+    AuxPixelVects<ComponentType> ordered;
+    for (size_t const position: positions) {
+        ordered.red.push_back(colors.red[position]);
+        ordered.green.push_back(colors.green[position]);
+        ordered.blue.push_back(colors.blue[position]);
+    }
+    colors = std::move(ordered);
+    remap_cppm_indices(indices, paletteRemap(positions));
+}
+
+// Function to write an image whose indices were gathered into one buffer: any palette order, and bit-packed,
+// entropy-coded or chunked indices
+template<typename ComponentType>
+void write_indexed_image(std::ostream &output, const SOAImage &image, AuxPixelVects<ComponentType> &colors,
+                         std::vector <uint32_t> &indices, const CPPMWriteOptions &options) {
+    if (options.order != PaletteOrder::first_seen) {
+        order_palette(colors, indices, count_cppm_indices(indices, colors.red.size()), options.order);
+    }
+    CPPMHeader const header = make_cppm_header(image, colors.red.size(), options.flags, options.group_rows);
+    write_cppm_header(output, header); // Write file header
+    write_color_table(output, colors); // Write color table
+    write_cppm_index_stream(output, indices, header); // Write every index at once
+}
+
+// Function to interleave the component vectors into red, green and blue samples per pixel, as in P6
+template<typename ComponentType>
+auto interleave_samples(const PixelBuffer<ComponentType> &red, const PixelBuffer<ComponentType> &green,
+                        const PixelBuffer<ComponentType> &blue) -> std::vector <ComponentType> {
+    std::vector <ComponentType> samples(red.size() * CPPM_COMPONENTS);
+    for (size_t i = 0; i < red.size(); ++i) {
+        samples[i * CPPM_COMPONENTS] = red[i];
+        samples[i * CPPM_COMPONENTS + 1] = green[i];
+        samples[i * CPPM_COMPONENTS + 2] = blue[i];
+    }
+    return samples;
+}
+
+// Function to split interleaved samples into the component vectors (inverse of interleave_samples)
+template<typename ComponentType>
+void split_samples(const std::vector <ComponentType> &samples, PixelBuffer<ComponentType> &red,
+                   PixelBuffer<ComponentType> &green, PixelBuffer<ComponentType> &blue) {
+    size_t const pixels = samples.size() / CPPM_COMPONENTS;
+    red.resize(pixels);
+    green.resize(pixels);
+    blue.resize(pixels);
+    for (size_t i = 0; i < pixels; ++i) {
+        red[i] = samples[i * CPPM_COMPONENTS];
+        green[i] = samples[i * CPPM_COMPONENTS + 1];
+        blue[i] = samples[i * CPPM_COMPONENTS + 2];
     }
 }
 
 // Function to process images with 1 byte per component
-void process_small_pixel_image(std::ostream &output, const SOAImage &image);
+void process_small_pixel_image(std::ostream &output, const SOAImage &image, const CPPMWriteOptions &options = {});
 
 // Function to process images with 2 bytes per component
-void process_large_pixel_image(std::ostream &output, const SOAImage &image);
+void process_large_pixel_image(std::ostream &output, const SOAImage &image, const CPPMWriteOptions &options = {},
+                               OperationContext &context = OperationContext::heap());
+
+// Main function to write the image in C-PPM format (options may select bit-packed or entropy-coded indices, row
+// groups, the order of the color table, and storing the pixels without a table when that is smaller). The color
+// map of 16-bit images is built in the context's memory.
+void write_cppm(const std::string &output_file, const SOAImage &image, const CPPMWriteOptions &options = {},
+                OperationContext &context = OperationContext::heap());
+
+// Function to read the color table of a C-PPM file
+template<typename ComponentType>
+auto read_color_table(std::istream &input, size_t table_size) -> AuxPixelVects<ComponentType> {
+    AuxPixelVects<ComponentType> colors;
+    colors.red.resize(table_size);
+    colors.green.resize(table_size);
+    colors.blue.resize(table_size);
+    for (size_t i = 0; i < table_size; ++i) {
+        colors.red[i] = read_binary<ComponentType>(input); // Read red component
+        colors.green[i] = read_binary<ComponentType>(input); // Read green component
+        colors.blue[i] = read_binary<ComponentType>(input); // Read blue component
+    }
+    return colors;
+}
+
+// Function to read the color table and expand every pixel index through it into the component vectors (or to
+// read the samples of a file without color table)
+template<typename ComponentType>
+void read_cppm_components(std::istream &input, const CPPMHeader &header, PixelBuffer<ComponentType> &red,
+                          PixelBuffer<ComponentType> &green, PixelBuffer<ComponentType> &blue) {
+    if ((header.flags & CPPM_SAMPLE_LAYOUT_FLAGS) != 0) {
+        split_samples(read_cppm_samples<ComponentType>(input, header), red, green, blue);
+        return;
+    }
+    AuxPixelVects<ComponentType> const colors = read_color_table<ComponentType>(input, header.color_table_size);
+    red.resize(cppm_pixel_count(header));
+    green.resize(cppm_pixel_count(header));
+    blue.resize(cppm_pixel_count(header));
+    read_cppm_indices(input, header, [&](size_t pixel, size_t index) {
+        red[pixel] = colors.red[index];
+        green[pixel] = colors.green[index];
+        blue[pixel] = colors.blue[index];
+    });
+}
+
+// Function to read the color table and expand the indices of rows [first_row, first_row + rows) only
+template<typename ComponentType>
+void read_cppm_row_components(std::istream &input, const CPPMHeader &header, int first_row, int rows,
+                              AuxPixelVects<ComponentType> &components) {
+    if ((header.flags & CPPM_SAMPLE_LAYOUT_FLAGS) != 0) {
+        split_samples(read_cppm_row_samples<ComponentType>(input, header, first_row, rows), components.red,
+                      components.green, components.blue);
+        return;
+    }
+    AuxPixelVects<ComponentType> const colors = read_color_table<ComponentType>(input, header.color_table_size);
+    size_t const pixels = static_cast<size_t>(header.width) * static_cast<size_t>(rows);
+    components.red.resize(pixels);
+    components.green.resize(pixels);
+    components.blue.resize(pixels);
+    read_cppm_row_indices(input, header, first_row, rows, [&](size_t pixel, size_t index) {
+        components.red[pixel] = colors.red[index];
+        components.green[pixel] = colors.green[index];
+        components.blue[pixel] = colors.blue[index];
+    });
+}
+
+// Function to decode a C-PPM file (the inverse of write_cppm)
+auto read_cppm(std::istream &input) -> SOAImage;
+
+// Function to decode rows [first_row, first_row + rows) of a C-PPM file only, as an image of that height
+auto read_cppm_rows(std::istream &input, int first_row, int rows) -> SOAImage;
+
+// C-PPM image kept as its color table plus one index per pixel. Operations that only change colors
+// (maxlevel, cutfreq) rewrite the table and leave the pixels alone.
+struct PaletteImageSOA {
+    CPPMHeader header{};
+    AuxPixelVects<uint8_t> colors1; // Color table when max_color_value fits in 1 byte
+    AuxPixelVects<uint16_t> colors2; // Color table otherwise
+    std::vector <uint32_t> indices;
+};
+
+// Function to read a C-PPM file without expanding its pixels (a file without color table gets one built from
+// its pixels)
+auto read_palette_image(std::istream &input) -> PaletteImageSOA;
+
+// Function to merge table entries that became equal and drop unused ones, keeping table order (a first-seen
+// table stays first-seen, so the output matches compressing the decoded image). Returns the number of pixels
+// using each entry of the compacted table.
+template<typename ComponentType>
+auto compact_palette(AuxPixelVects<ComponentType> &colors, std::vector <uint32_t> &indices) -> std::vector <size_t> {
+    std::vector <std::tuple<ComponentType, ComponentType, ComponentType>> keys(colors.red.size());
+    for (size_t i = 0; i < keys.size(); ++i) { keys[i] = get_color_tuple(colors.red, colors.green, colors.blue, i); }
+    std::vector <size_t> kept;
+    std::vector <size_t> const counts = count_cppm_indices(indices, keys.size());
+    std::vector <uint32_t> const remap = compact_cppm_table(keys, counts, kept);
+    if (kept.size() == keys.size()) { return counts; } // Nothing merged or dropped
+    AuxPixelVects<ComponentType> compacted;
+    for (size_t const position: kept) {
+        compacted.red.push_back(colors.red[position]);
+        compacted.green.push_back(colors.green[position]);
+        compacted.blue.push_back(colors.blue[position]);
+    }
+    colors = std::move(compacted);
+    remap_cppm_indices(indices, remap);
+    return remap_cppm_counts(counts, remap, kept.size());
+}
 
-// Main function to write the image in C-PPM format
-void write_cppm(const std::string &output_file, const SOAImage &image);
+// Function to compact the color table, put it in the given order (reusing the counts of the compaction) and
+// write the image in C-PPM format
+void write_palette_image(std::ostream &output, PaletteImageSOA &image, PaletteOrder order = PaletteOrder::first_seen);
 
 #endif //COMPRESSSOA_HPP
@@ -1,11 +1,21 @@
 #include "cutfreqsoa.hpp"
 
-void removeLeastFrequentColors(SOAImage &image, int num_colors_to_remove) {
+auto removeLeastFrequentColors(SOAImage &image, int num_colors_to_remove,
+                               const NearestSearchOptions &options, OperationContext &context) -> NearestSearchStats {
   if (image.max_color_value <= MAX_INSTENSITY_1B) { // Process 8-bit colors
-    removeColors<uint8_t, uint32_t>(num_colors_to_remove,
-                                    image.red1_components, image.green1_components, image.blue1_components);
-  } else { // Process 16-bit colors
-    removeColors<uint16_t, uint64_t>(num_colors_to_remove,
-                                     image.red2_components, image.green2_components, image.blue2_components);
+    return removeColors<uint8_t, uint32_t>(num_colors_to_remove, image.red1_components, image.green1_components,
+                                           image.blue1_components, options, context);
   }
-}
\ No newline at end of file
+  // Process 16-bit colors
+  return removeColors<uint16_t, uint64_t>(num_colors_to_remove, image.red2_components, image.green2_components,
+                                          image.blue2_components, options, context);
+}
+
+auto removeLeastFrequentColors(PaletteImageSOA &image, int num_colors_to_remove,
+                               const NearestSearchOptions &options, OperationContext &context) -> NearestSearchStats {
+  if (image.header.max_color_value <= MAX_INSTENSITY_1B) { // Process 8-bit colors
+    return removeTableColors<uint8_t, uint32_t>(num_colors_to_remove, image.colors1, image.indices, options, context);
+  }
+  // Process 16-bit colors
+  return removeTableColors<uint16_t, uint64_t>(num_colors_to_remove, image.colors2, image.indices, options, context);
+}
@@ -2,6 +2,11 @@
 #define CUTFREQSOA_HPP
 
 #include "imagesoa.hpp"
+#include "compresssoa.hpp"
+#include "../common/colorsearch.hpp"
+#include "../common/opcontext.hpp"
+#include <memory_resource>
+#include <span>
 #include <vector>
 #include <unordered_map>
 #include <unordered_set>
@@ -11,10 +16,9 @@
 
 const int BITS_FOR_1B = 8;
 
-template<typename ComponentType, typename ColorCodeType>
+template<typename ComponentType, typename ColorCodeType, typename Frequencies>
 void
-sortColors(std::vector <ColorCodeType> &color_list,
-           const std::unordered_map <ColorCodeType, size_t> &color_frequencies) {
+sortColors(std::span <ColorCodeType> color_list, const Frequencies &color_frequencies) {
     std::sort(color_list.begin(), color_list.end(),
               [&color_frequencies](ColorCodeType color_a, ColorCodeType color_b) {
                   size_t const frequency_a = color_frequencies.at(color_a);
@@ -41,89 +45,162 @@ sortColors(std::vector <ColorCodeType> &color_list,
               });
 }
 
+// Unpacks a color code into its RGB components
+template<typename ComponentType, typename ColorCodeType>
+auto decodeColor(ColorCodeType color_code) -> RGBColor<ComponentType> {
+    auto const mask = (1ULL << (sizeof(ComponentType) * BITS_FOR_1B)) - 1;
+    return RGBColor<ComponentType>{
+            .red=static_cast<ComponentType>((color_code >> (sizeof(ComponentType) * BITS_FOR_1B * 2)) & mask),
+            .green=static_cast<ComponentType>((color_code >> (sizeof(ComponentType) * BITS_FOR_1B)) & mask),
+            .blue=static_cast<ComponentType>(color_code & mask)};
+}
+
+// Packs RGB components into a color code
 template<typename ComponentType, typename ColorCodeType>
-void FindNearestColors(const std::unordered_set <ColorCodeType> &colors_to_remove,
-                       std::unordered_map <ColorCodeType, ColorCodeType> &replacement_map,
-                       const std::unordered_set <ColorCodeType> &colors_to_keep) {
+auto encodeColor(const RGBColor<ComponentType> &color) -> ColorCodeType {
+    return (static_cast<ColorCodeType>(color.red) << (sizeof(ComponentType) * BITS_FOR_1B * 2)) |
+           (static_cast<ColorCodeType>(color.green) << (sizeof(ComponentType) * BITS_FOR_1B)) |
+           static_cast<ColorCodeType>(color.blue);
+}
+
+// Finds the nearest kept color of every color to remove. On equal distance the color that comes first in
+// colors_to_keep wins. The search strategy (linear scan, k-d tree or grid) and tolerance come from options. The
+// set and the map may be std or pmr containers.
+template<typename ComponentType, typename ColorCodeType, typename RemoveSet, typename ReplacementMap>
+auto FindNearestColors(const RemoveSet &colors_to_remove, ReplacementMap &replacement_map,
+                       std::span <const ColorCodeType> colors_to_keep,
+                       const NearestSearchOptions &options = {}) -> NearestSearchStats {
+    std::vector <RGBColor<ComponentType>> palette;
+    palette.reserve(colors_to_keep.size());
+    for (auto color_keep: colors_to_keep) {
+        palette.push_back(decodeColor<ComponentType, ColorCodeType>(color_keep));} // Unpack the kept colors once
+    auto const index = buildColorIndex(std::move(palette), options.strategy, colors_to_remove.size());
+
+    NearestSearchStats stats{.strategy=index.strategy, .queries=colors_to_remove.size(),
+                             .palette_size=colors_to_keep.size(), .max_error=0.0};
     for (auto color_remove: colors_to_remove) {
-        ComponentType red_remove = (color_remove >> (sizeof(ComponentType) * BITS_FOR_1B * 2)) &
-                                   ((1ULL << (sizeof(ComponentType) * BITS_FOR_1B)) -
-                                    1); // Extract red component of color to remove
-        ComponentType green_remove = (color_remove >> (sizeof(ComponentType) * BITS_FOR_1B)) &
-                                     ((1ULL << (sizeof(ComponentType) * BITS_FOR_1B)) -
-                                      1); // Extract green component of color to remove
-        ComponentType blue_remove = color_remove & ((1ULL << (sizeof(ComponentType) * BITS_FOR_1B)) -
-                                                    1); // Extract blue component of color to remove
-
-        double min_distance = std::numeric_limits<double>::max(); // Initialize minimum distance with a large value
-        ColorCodeType closest_color = color_remove; // Initialize the closest color with current color
-
-        for (auto color_keep: colors_to_keep) {
-            ComponentType red_keep = (color_keep >> (sizeof(ComponentType) * BITS_FOR_1B * 2)) &
-                                     ((1ULL << (sizeof(ComponentType) * BITS_FOR_1B)) -
-                                      1); // Extract red component of color to keep
-            ComponentType green_keep = (color_keep >> (sizeof(ComponentType) * BITS_FOR_1B)) &
-                                       ((1ULL << (sizeof(ComponentType) * BITS_FOR_1B)) -
-                                        1); // Extract green component of color to keep
-            ComponentType blue_keep = color_keep & ((1ULL << (sizeof(ComponentType) * BITS_FOR_1B)) -
-                                                    1); // Extract blue component of color to keep
-
-            double const distance = std::pow(red_remove - red_keep, 2) + std::pow(green_remove - green_keep, 2) +
-                              std::pow(blue_remove - blue_keep, 2); // Calculate squared Euclidean distance
-
-            if (distance < min_distance) { // Update minimum distance and closest color if a closer one is found
-                min_distance = distance;
-                closest_color = color_keep;
-            }
+        auto const nearest = nearestColor(index, decodeColor<ComponentType, ColorCodeType>(color_remove), options.tolerance);
+        replacement_map[color_remove] = encodeColor<ComponentType, ColorCodeType>(nearest.color); // Map the color to its closest color (itself if none is kept)
+        stats.max_error = std::max(stats.max_error, nearest.error_bound);
+    }
+    return stats;
+}
+
+// Same search with the kept colors given as a set (iteration order decides ties).
+template<typename ComponentType, typename ColorCodeType, typename RemoveSet, typename ReplacementMap>
+auto FindNearestColors(const RemoveSet &colors_to_remove, ReplacementMap &replacement_map,
+                       const std::unordered_set <ColorCodeType> &colors_to_keep,
+                       const NearestSearchOptions &options = {}) -> NearestSearchStats {
+    std::vector <ColorCodeType> const keep_list(colors_to_keep.begin(), colors_to_keep.end());
+    return FindNearestColors<ComponentType, ColorCodeType>(colors_to_remove, replacement_map,
+                                                           std::span <const ColorCodeType>(keep_list), options);
+}
+
+// Chooses the least frequent colors to remove and maps each of them to its nearest kept color, returns how the
+// nearest colors were searched. The temporaries are in the context's memory.
+template<typename ComponentType, typename ColorCodeType, typename Frequencies, typename ReplacementMap>
+auto selectReplacements(int num_colors_to_remove, const Frequencies &color_frequencies,
+                        ReplacementMap &replacement_map, const NearestSearchOptions &options = {},
+                        OperationContext &context = OperationContext::heap()) -> NearestSearchStats {
+    std::pmr::vector <ColorCodeType> color_list(context.memory());
+    color_list.reserve(color_frequencies.size());
+    for (const auto &entry: color_frequencies) { color_list.push_back(entry.first); }
+
+    sortColors<ComponentType, ColorCodeType>(std::span <ColorCodeType>(color_list), color_frequencies); // Sort colors by frequency and components
+    std::pmr::unordered_set <ColorCodeType> const colors_to_remove(color_list.begin(), color_list.begin() + std::min(num_colors_to_remove, (int) color_list.size()), 0, context.memory()); // Colors to remove
+    std::pmr::vector <ColorCodeType> const colors_to_keep(color_list.rbegin(), color_list.rend() - std::min(num_colors_to_remove, (int) color_list.size()), context.memory()); // Colors to keep, most frequent first so it wins ties
+    return FindNearestColors<ComponentType, ColorCodeType>(colors_to_remove, replacement_map,
+                                                           std::span <const ColorCodeType>(colors_to_keep),
+                                                           options); // Create replacement map
+}
+
+// Replaces every color of the component vectors found in replacement_map
+template<typename ComponentType, typename ColorCodeType, typename ReplacementMap>
+void replaceColors(PixelBuffer<ComponentType> &red, PixelBuffer<ComponentType> &green,
+                   PixelBuffer<ComponentType> &blue, const ReplacementMap &replacement_map) {
+    for (size_t index = 0; index < red.size(); ++index) {
+        auto const iterator = replacement_map.find(
+                encodeColor<ComponentType, ColorCodeType>({.red=red[index], .green=green[index], .blue=blue[index]}));
+        if (iterator != replacement_map.end()) { // Check if color is in the remove set
+            auto const replacement = decodeColor<ComponentType, ColorCodeType>(iterator->second);
+            red[index] = replacement.red; // Replace red component
+            green[index] = replacement.green; // Replace green component
+            blue[index] = replacement.blue; // Replace blue component
         }
-        replacement_map[color_remove] = closest_color; // Map the color to be removed to its closest color
     }
 }
 
+// Removes the least frequent colors, returns how the nearest colors were searched
 template<typename ComponentType, typename ColorCodeType>
-void removeColors(int num_colors_to_remove,
-                  std::vector <ComponentType> &red,
-                  std::vector <ComponentType> &green,
-                  std::vector <ComponentType> &blue) {
+auto removeColors(int num_colors_to_remove,
+                  PixelBuffer<ComponentType> &red,
+                  PixelBuffer<ComponentType> &green,
+                  PixelBuffer<ComponentType> &blue,
+                  const NearestSearchOptions &options = {},
+                  OperationContext &context = OperationContext::heap()) -> NearestSearchStats {
     if (static_cast<size_t>(num_colors_to_remove) > red.size()) {
         // If n is greater than or equal to the total pixel count, set all pixels to black
         std::fill(red.begin(), red.end(), 0);
         std::fill(green.begin(), green.end(), 0);
         std::fill(blue.begin(), blue.end(), 0);
-        return;}
+        return {};}
     size_t const pixel_count = red.size();
-    std::unordered_map <ColorCodeType, size_t> color_frequencies;
-    std::vector <ColorCodeType> color_list;
+    std::pmr::unordered_map <ColorCodeType, size_t> color_frequencies(context.memory());
 
     for (size_t index = 0; index < pixel_count; ++index) {
         ColorCodeType color_code = ((ColorCodeType) red[index] << (sizeof(ComponentType) * BITS_FOR_1B * 2)) |
                                    ((ColorCodeType) green[index] << (sizeof(ComponentType) * BITS_FOR_1B)) |
                                    blue[index]; // Pack RGB components into a color code
-        if (color_frequencies[color_code]++ == 0) {
-            color_list.push_back(color_code);} // Store unique colors
+        ++color_frequencies[color_code];
     }
 
-    sortColors<ComponentType, ColorCodeType>(color_list, color_frequencies); // Sort colors by frequency and components
-    std::unordered_set <ColorCodeType> const colors_to_remove(color_list.begin(), color_list.begin() + std::min(num_colors_to_remove, (int) color_list.size())); // Colors to remove
-    std::unordered_set <ColorCodeType> const colors_to_keep(color_list.begin() + std::min(num_colors_to_remove, (int) color_list.size()), color_list.end()); // Colors to keep
-    std::unordered_map <ColorCodeType, ColorCodeType> replacement_map;
-    FindNearestColors<ComponentType, ColorCodeType>(colors_to_remove, replacement_map, colors_to_keep); // Create replacement map
-    for (size_t index = 0; index < pixel_count; ++index) {
-        ColorCodeType color_code = ((ColorCodeType) red[index] << (sizeof(ComponentType) * BITS_FOR_1B * 2)) |
-                                   ((ColorCodeType) green[index] << (sizeof(ComponentType) * BITS_FOR_1B)) |
-                                   blue[index]; // Pack RGB components into a color code
-        if (colors_to_remove.contains(color_code)) { // Check if color is in the remove set
-            ColorCodeType replacement_color = replacement_map[color_code];
-            red[index] = (replacement_color >> (sizeof(ComponentType) * BITS_FOR_1B * 2)) &
-                         ((1ULL << (sizeof(ComponentType) * BITS_FOR_1B)) - 1); // Replace red component
-            green[index] = (replacement_color >> (sizeof(ComponentType) * BITS_FOR_1B)) &
-                           ((1ULL << (sizeof(ComponentType) * BITS_FOR_1B)) - 1); // Replace green component
-            blue[index] =
-                    replacement_color & ((1ULL << (sizeof(ComponentType) * BITS_FOR_1B)) - 1); // Replace blue component
+    std::pmr::unordered_map <ColorCodeType, ColorCodeType> replacement_map(context.memory());
+    NearestSearchStats const stats = selectReplacements<ComponentType, ColorCodeType>(num_colors_to_remove,
+                                                                                     color_frequencies,
+                                                                                     replacement_map, options,
+                                                                                     context);
+    replaceColors<ComponentType, ColorCodeType>(red, green, blue, replacement_map);
+    return stats;
+}
+
+// Same as removeColors on a C-PPM color table: the frequencies are the index counts, only the table changes
+template<typename ComponentType, typename ColorCodeType>
+auto removeTableColors(int num_colors_to_remove, AuxPixelVects<ComponentType> &colors,
+                       const std::vector <uint32_t> &indices,
+                       const NearestSearchOptions &options = {},
+                       OperationContext &context = OperationContext::heap()) -> NearestSearchStats {
+    if (static_cast<size_t>(num_colors_to_remove) > indices.size()) {
+        // Same rule as removeColors: every entry becomes black, they are merged when the image is written
+        std::fill(colors.red.begin(), colors.red.end(), 0);
+        std::fill(colors.green.begin(), colors.green.end(), 0);
+        std::fill(colors.blue.begin(), colors.blue.end(), 0);
+        return {};}
+    std::vector <size_t> const counts = count_cppm_indices(indices, colors.red.size());
+    std::pmr::unordered_map <ColorCodeType, size_t> color_frequencies(context.memory());
+    for (size_t i = 0; i < counts.size(); ++i) {
+        if (counts[i] > 0) { // Unused entries are not image colors
+            color_frequencies[encodeColor<ComponentType, ColorCodeType>(
+                    {.red=colors.red[i], .green=colors.green[i], .blue=colors.blue[i]})] += counts[i];
         }
     }
+
+    std::pmr::unordered_map <ColorCodeType, ColorCodeType> replacement_map(context.memory());
+    NearestSearchStats const stats = selectReplacements<ComponentType, ColorCodeType>(num_colors_to_remove,
+                                                                                     color_frequencies,
+                                                                                     replacement_map, options,
+                                                                                     context);
+    replaceColors<ComponentType, ColorCodeType>(colors.red, colors.green, colors.blue, replacement_map);
+    return stats;
 }
 
-void removeLeastFrequentColors(SOAImage &image, int num_colors_to_remove);
+// options.tolerance > 0 enables the approximate nearest-color search; the returned stats report the strategy
+// used and the largest error bound incurred. The maps and sets are built in the context's memory.
+auto removeLeastFrequentColors(SOAImage &image, int num_colors_to_remove, const NearestSearchOptions &options = {},
+                               OperationContext &context = OperationContext::heap()) -> NearestSearchStats;
+
+// Same operation on a C-PPM image kept compressed: rewrites its color table only.
+auto removeLeastFrequentColors(PaletteImageSOA &image, int num_colors_to_remove,
+                               const NearestSearchOptions &options = {},
+                               OperationContext &context = OperationContext::heap()) -> NearestSearchStats;
 
 #endif // CUTFREQSOA_HPP
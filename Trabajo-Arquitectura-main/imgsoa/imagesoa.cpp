@@ -4,18 +4,24 @@
 #include "resizesoa.hpp"
 #include "cutfreqsoa.hpp"
 #include "compresssoa.hpp"
+#include "../common/streamcompress.hpp"
+#include "../common/streammaxlevel.hpp"
 #include <fstream>
 #include <string>
 #include <iostream>
 #include <stdexcept>
+#include <utility>
 
-// readImageSOA function definition:
+// readImageSOA function definition (accepts both P6 and C-PPM files):
 auto readImageSOA(const std::string &filename) -> SOAImage {
     std::ifstream file(filename, std::ios::binary);
     if (!file.is_open()) {
         throw std::runtime_error("Error opening the PPM file.");}
     std::string magic_number;
     file >> magic_number; // Extract the magic number for the file and store it in 'magic_number'.
+    if (magic_number == CPPM_MAGIC) { // Compressed file: decode it.
+        file.seekg(0);
+        return read_cppm(file);}
     if (magic_number != "P6") {
         throw std::runtime_error("Unsupported PPM format.");}
     int width = 0;
@@ -104,27 +110,143 @@ void infoImageSOA(const std::string &filename) {
 }
 
 
-void run_operationsoa(const ProgramArgs &args) {
-    SOAImage const image = readImageSOA(args.input_file); // corresponding image in AOS format.
-    if (args.operation == "info") {  // Perform 'info' operation
-        infoImageSOA(args.input_file);
-    } else if (args.operation == "compress") { // Perform 'compress' operation
-        write_cppm(args.output_file, image);
-    } else if (args.operation == "maxlevel") {
-        SOAImage const new_image = maxLevelImageSOA(image, args.max_level); // Perform 'maxlevel' operation
-        writeImageSOA(args.output_file, new_image);
-    } else if (args.operation == "resize") {
-        SOAImage r_image = readImageSOA(args.input_file);
-        SOAImage const r_image_f = resizeImageSOA(r_image, args.width, args.height); // Perform 'resize' operation
-        writeImageSOA(args.output_file, r_image_f);
-    } else if (args.operation == "cutfreq") {
-        SOAImage f_image = readImageSOA(args.input_file);
-        removeLeastFrequentColors(f_image, args.max_level); // Perform 'cutfreq' operation
-        writeImageSOA(args.output_file, f_image);
+// Function to choose the index coding of the C-PPM files written, from the --bitpack, --entropy and --chunk-rows options
+static auto cppmFlags(const ProgramArgs &args) -> unsigned {
+    unsigned const chunked = args.chunk_rows > 0 ? CPPM_FLAG_CHUNKED : 0;
+    if (args.entropy) { return CPPM_FLAG_ENTROPY | chunked; }
+    return (args.bitpack ? CPPM_FLAG_BITPACKED : 0) | chunked;
+}
+
+// Function to choose how compress writes the C-PPM file (without a color table when the table would not pay off)
+static auto cppmWriteOptions(const ProgramArgs &args) -> CPPMWriteOptions {
+    return {.flags=cppmFlags(args), .group_rows=args.chunk_rows, .order=paletteOrderFromName(args.palette_order),
+            .raw_fallback=true};
+}
+
+// Function to print what the cutfreq options ask to report
+static void reportCutfreq(const ProgramArgs &args, const NearestSearchStats &stats) {
+    if (args.verbose) { // Report how the nearest colors were searched
+        std::cout << "cutfreq: " << nearestStrategyName(stats.strategy) << " search of " << stats.queries
+                  << " colors among " << stats.palette_size << '\n';
     }
+    if (args.tolerance > 0.0) { // Report the certified bound on the error of the approximate search
+        std::cout << "Approximate cutfreq: max squared-distance error bound " << stats.max_error
+                  << " (tolerance " << args.tolerance << ")" << '\n';
+    }
+}
+
+// Prints, with --verbose, how the large rasters were placed in memory
+static void reportPixelBuffers(const ProgramArgs &args) {
+    PixelBufferStats const stats = pixelBufferStats();
+    if (!args.verbose || stats.large_buffers == 0) { return; }
+    std::cout << "rasters: " << stats.large_buffers << " large buffers, " << stats.large_bytes / MEBIBYTE << " MiB, "
+              << stats.advised_bytes / MEBIBYTE << " MiB advised for huge pages, " << stats.touched_pages
+              << " pages first touched by up to " << stats.touch_stripes << " threads; huge pages per node:";
+    for (size_t node = 0; node < PIXEL_BUFFER_MAX_NODES; ++node) {
+        if (stats.node_samples[node] > 0) { std::cout << " " << node << ":" << stats.node_samples[node]; }
+    }
+    std::cout << " unknown:" << stats.unknown_samples << '\n';
 }
 
+// Function to run maxlevel and cutfreq from a C-PPM file to a C-PPM file on the color table only (cutfreq also
+// remaps the indices), without expanding the pixels. Returns false if the operation needs the decoded image.
+static auto runPaletteOperationSOA(const ProgramArgs &args) -> bool {
+    if (!rewritesCppmPalette(args)) { return false; }
+    std::ifstream input(args.input_file, std::ios::binary);
+    PaletteImageSOA image = read_palette_image(input);
+    image.header.flags = cppmFlags(args); // Same coding as compress
+    image.header.group_rows = args.chunk_rows;
+    if (args.operation == "maxlevel") {
+        maxLevelPaletteSOA(image, args.max_level);
+    } else {
+        NearestSearchOptions const options{.tolerance=args.tolerance, .strategy=nearestStrategyFromName(args.search)};
+        reportCutfreq(args, removeLeastFrequentColors(image, args.max_level, options));
+    }
+    std::ofstream output(args.output_file, std::ios::binary);
+    write_palette_image(output, image, paletteOrderFromName(args.palette_order));
+    return true;
+}
 
+// Function to record a point operation step in a chain; false for the steps that need the real pixels
+static auto addPointOpSOA(PointOpChain &chain, const PipelineStep &step) -> bool {
+    if (step.operation == "maxlevel") {
+        addMaxLevelSOA(chain, step.max_level); // Perform 'maxlevel' operation
+    } else if (step.operation == "gamma") {
+        chain.add_gamma(step.factor);
+    } else if (step.operation == "levels") {
+        chain.add_levels(step.black, step.white);
+    } else if (step.operation == "contrast") {
+        chain.add_contrast(step.factor);
+    } else {
+        return false;
+    }
+    return true;
+}
 
+// Function to run a pipeline of point operations only, from a P6 file, as one read-map-write pass over the file.
+// Returns false if a step needs the decoded image.
+static auto runStreamPointOpsSOA(const ProgramArgs &args) -> bool {
+    if (args.dither != "none") { return false; } // A dithered maxlevel needs the neighbouring pixels
+    PointOpChain chain;
+    for (const PipelineStep &step : pipelineSteps(args)) {
+        if (!addPointOpSOA(chain, step)) { return false; }
+    }
+    if (is_cppm_file(args.input_file)) { return false; }
+    stream_point_ops(args.input_file, args.output_file, chain);
+    return true;
+}
 
+// Function to run the operations in order on the decoded image, which the pipeline owns; nothing touches the disk
+// until the last stage. Consecutive point operations are only recorded, then run together as one table lookup per
+// component in the image's own vectors. resize writes into a scratch image that is swapped in, so its vectors are
+// reused by the next resize. The temporaries of cutfreq and compress are taken from one operation context that
+// is reset after each step, so its arenas are grown once and reused by the next steps.
+static void runPipelineSOA(const ProgramArgs &args) {
+    SOAImage image = readImageSOA(args.input_file);
+    SOAImage scratch;
+    OperationContext context;
+    PointOpChain pending; // Point operations not run yet
+    DitherMethod const dither = ditherMethodFromName(args.dither);
+    auto flush = [&] { // Runs the pending point operations in one pass, in the image's own buffers
+        if (pending.empty()) { return; }
+        applyPointOpsInPlaceSOA(image, pending);
+        pending = PointOpChain();
+    };
+    for (const PipelineStep &step : pipelineSteps(args)) {
+        if (step.operation == "maxlevel" && dither != DitherMethod::none) {
+            flush();
+            ditherMaxLevelSOA(image, step.max_level, dither); // Spreads the rounding error, so not a point operation
+            continue;
+        }
+        if (addPointOpSOA(pending, step)) { continue; } // Folded with its neighbours
+        flush();
+        if (step.operation == "resize") {
+            resizeImageSOA(image, step.width, step.height, scratch); // Perform 'resize' operation
+            std::swap(image, scratch);
+        } else if (step.operation == "cutfreq") {
+            NearestSearchOptions const options{.tolerance=args.tolerance, .strategy=nearestStrategyFromName(args.search)};
+            reportCutfreq(args, removeLeastFrequentColors(image, step.max_level, options, context)); // Perform 'cutfreq' operation
+        } else if (step.operation == "compress") { // Always the last step
+            write_cppm(args.output_file, image, cppmWriteOptions(args), context);
+            return;
+        }
+        context.reset();
+    }
+    flush();
+    writeImageSOA(args.output_file, image);
+}
 
+void run_operationsoa(const ProgramArgs &args) {
+    setPixelBufferPlacement({.huge_pages=args.page_placement, .first_touch=args.page_placement,
+                             .count_nodes=args.verbose});
+    if (args.steps.size() <= 1 && runPaletteOperationSOA(args)) { return; }
+    if (runStreamPointOpsSOA(args)) { return; }
+    if (args.operation == "info") {  // Perform 'info' operation
+        infoImageSOA(args.input_file);
+    } else if (streamsCompress(args)) {
+        stream_compress(args.input_file, args.output_file, cppmWriteOptions(args)); // Never loads the image
+    } else {
+        runPipelineSOA(args);
+        reportPixelBuffers(args);
+    }
+}
@@ -1,6 +1,7 @@
 #ifndef IMAGESOA_HPP
 #define IMAGESOA_HPP
 
+#include "../common/pixelbuffer.hpp"
 #include "../common/progargs.hpp"
 #include <string>
 #include <vector>
@@ -12,6 +13,7 @@
 #include <algorithm>
 #include <limits>
 #include <cmath>
+#include <span>
 
 const int MAX_INSTENSITY_1B = 255;
 const int MAX_INSTENSITY = 65535;
@@ -26,15 +28,41 @@ struct SOAImage {
     int height;
     int max_color_value;
     // Vectors if Image with pixels of 3 bytes (1 byte per color component):
-    std::vector <uint8_t> red1_components; // vector to store values of the red components (each of 1 byte).
-    std::vector <uint8_t> green1_components; // vector to store values of the green components (each of 1 byte).
-    std::vector <uint8_t> blue1_components; // vector to store values of the blue components (each of 1 byte).
+    PixelBuffer<uint8_t> red1_components; // vector to store values of the red components (each of 1 byte).
+    PixelBuffer<uint8_t> green1_components; // vector to store values of the green components (each of 1 byte).
+    PixelBuffer<uint8_t> blue1_components; // vector to store values of the blue components (each of 1 byte).
     // Vectors if Image with pixels of 6 bytes (2 bytes per color component):
-    std::vector <uint16_t> red2_components; // vector to store values of the red components (each of 2 bytes).
-    std::vector <uint16_t> green2_components; // vector to store values of the green components (each of 2 bytes).
-    std::vector <uint16_t> blue2_components; // vector to store values of the blue components (each of 2 bytes).
+    PixelBuffer<uint16_t> red2_components; // vector to store values of the red components (each of 2 bytes).
+    PixelBuffer<uint16_t> green2_components; // vector to store values of the green components (each of 2 bytes).
+    PixelBuffer<uint16_t> blue2_components; // vector to store values of the blue components (each of 2 bytes).
 };
 
+// Non-owning view of the three component planes of one bit depth. Kernels read through views of const components
+// and write through views of planes the caller has sized, so no plane is copied between layers.
+template<typename ComponentType>
+struct AuxPixelVectsref {
+    std::span<ComponentType> red; // View of the red components
+    std::span<ComponentType> green; // View of the green components
+    std::span<ComponentType> blue; // View of the blue components
+};
+
+// Views of the planes of an image with ComponentType components (uint8_t: 1 byte, uint16_t: 2 bytes)
+template<typename ComponentType>
+auto componentViews(const SOAImage &image) -> AuxPixelVectsref<const ComponentType> {
+    if constexpr (sizeof(ComponentType) == 1) {
+        return {.red=image.red1_components, .green=image.green1_components, .blue=image.blue1_components};
+    } else {
+        return {.red=image.red2_components, .green=image.green2_components, .blue=image.blue2_components};
+    }
+}
+template<typename ComponentType>
+auto componentViews(SOAImage &image) -> AuxPixelVectsref<ComponentType> {
+    if constexpr (sizeof(ComponentType) == 1) {
+        return {.red=image.red1_components, .green=image.green1_components, .blue=image.blue1_components};
+    } else {
+        return {.red=image.red2_components, .green=image.green2_components, .blue=image.blue2_components};
+    }
+}
 
 // Function to read a PPM image from a file into SOA format:
 auto readImageSOA(const std::string &filename) -> SOAImage;
@@ -1,65 +1,68 @@
 #include "maxlevelsoa.hpp"
-#include <cmath>
+#include "../common/streammaxlevel.hpp"
 #include <stdexcept>
+#include <type_traits>
+
+// Function to map one component vector through a table of the input component range
+template<typename FromType, typename ToType>
+static void mapComponents(const PixelBuffer<FromType> &components, const std::vector<uint16_t> &table,
+                          PixelBuffer<ToType> &mapped) {
+  mapped.resize(components.size());
+  for (size_t i = 0; i < components.size(); ++i) {
+    mapped[i] = static_cast<ToType>(table[components[i]]);
+  }
+}
+
+// Function to scale one component vector, with a specialised kernel for the frequent conversions and a table
+// otherwise
+template<typename FromType, typename ToType>
+static void scaleComponents(const PixelBuffer<FromType> &components, int oldMaxLevel, int newMaxLevel,
+                            PixelBuffer<ToType> &scaled) {
+  bool const fast = withFastLevelConversion(oldMaxLevel, newMaxLevel, [&](auto conversion) {
+    constexpr size_t index = decltype(conversion)::value;
+    scaled.resize(components.size());
+    for (size_t i = 0; i < components.size(); ++i) {
+      scaled[i] = static_cast<ToType>(fastScaleLevel<index>(components[i]));
+    }
+  });
+  if (!fast) { mapComponents(components, maxLevelTable(oldMaxLevel, newMaxLevel), scaled); }
+}
 
 // Function to resize and recalculate components to 1 byte per component (3 bytes per pixel).
 void resizeAndRecalculateToOneByte(SOAImage &newImage, int current_bytes_per_component, const SOAImage &image, int newMaxLevel) {
-  newImage.red1_components.resize(static_cast<size_t>(newImage.width) * static_cast<size_t>(newImage.height));
-  newImage.green1_components.resize(static_cast<size_t>(newImage.width) * static_cast<size_t>(newImage.height));
-  newImage.blue1_components.resize(static_cast<size_t>(newImage.width) * static_cast<size_t>(newImage.height));
-
-  for (size_t i = 0; i < static_cast<size_t>(newImage.width) * static_cast<size_t>(newImage.height); ++i) {
-    if (current_bytes_per_component == 1) {
-      newImage.red1_components[i] = static_cast<uint8_t>(std::round(
-          (image.red1_components[i] * newMaxLevel) / image.max_color_value));
-      newImage.green1_components[i] = static_cast<uint8_t>(std::round(
-          (image.green1_components[i] * newMaxLevel) / image.max_color_value));
-      newImage.blue1_components[i] = static_cast<uint8_t>(std::round(
-          (image.blue1_components[i] * newMaxLevel) / image.max_color_value));
-    } else {
-      newImage.red1_components[i] = static_cast<uint8_t>(std::round(
-          (image.red2_components[i] * newMaxLevel) / image.max_color_value));
-      newImage.green1_components[i] = static_cast<uint8_t>(std::round(
-          (image.green2_components[i] * newMaxLevel) / image.max_color_value));
-      newImage.blue1_components[i] = static_cast<uint8_t>(std::round(
-          (image.blue2_components[i] * newMaxLevel) / image.max_color_value));
-    }
+  int const oldMaxLevel = image.max_color_value;
+  if (current_bytes_per_component == 1) {
+    scaleComponents(image.red1_components, oldMaxLevel, newMaxLevel, newImage.red1_components);
+    scaleComponents(image.green1_components, oldMaxLevel, newMaxLevel, newImage.green1_components);
+    scaleComponents(image.blue1_components, oldMaxLevel, newMaxLevel, newImage.blue1_components);
+  } else {
+    scaleComponents(image.red2_components, oldMaxLevel, newMaxLevel, newImage.red1_components);
+    scaleComponents(image.green2_components, oldMaxLevel, newMaxLevel, newImage.green1_components);
+    scaleComponents(image.blue2_components, oldMaxLevel, newMaxLevel, newImage.blue1_components);
   }
 }
 
 // Function to resize and recalculate components to 2 bytes per component (6 bytes per pixel).
 void resizeAndRecalculateToTwoBytes(SOAImage &newImage, int current_bytes_per_component, const SOAImage &image,
                                     int newMaxLevel) {
-  newImage.red2_components.resize(static_cast<size_t>(newImage.width) * static_cast<size_t>(newImage.height));
-  newImage.green2_components.resize(static_cast<size_t>(newImage.width) * static_cast<size_t>(newImage.height));
-  newImage.blue2_components.resize(static_cast<size_t>(newImage.width) * static_cast<size_t>(newImage.height));
-
-  for (size_t i = 0; i < static_cast<size_t>(newImage.width) * static_cast<size_t>(newImage.height); ++i) {
-    if (current_bytes_per_component == 1) {
-      newImage.red2_components[i] = static_cast<uint16_t>(std::round(
-          (image.red1_components[i] * newMaxLevel) / image.max_color_value));
-      newImage.green2_components[i] = static_cast<uint16_t>(std::round(
-          (image.green1_components[i] * newMaxLevel) / image.max_color_value));
-      newImage.blue2_components[i] = static_cast<uint16_t>(std::round(
-          (image.blue1_components[i] * newMaxLevel) / image.max_color_value));
-    } else {
-      newImage.red2_components[i] = static_cast<uint16_t>(std::round(
-          (image.red2_components[i] * newMaxLevel) / image.max_color_value));
-      newImage.green2_components[i] = static_cast<uint16_t>(std::round(
-          (image.green2_components[i] * newMaxLevel) / image.max_color_value));
-      newImage.blue2_components[i] = static_cast<uint16_t>(std::round(
-          (image.blue2_components[i] * newMaxLevel) / image.max_color_value));
-    }
+  int const oldMaxLevel = image.max_color_value;
+  if (current_bytes_per_component == 1) {
+    scaleComponents(image.red1_components, oldMaxLevel, newMaxLevel, newImage.red2_components);
+    scaleComponents(image.green1_components, oldMaxLevel, newMaxLevel, newImage.green2_components);
+    scaleComponents(image.blue1_components, oldMaxLevel, newMaxLevel, newImage.blue2_components);
+  } else {
+    scaleComponents(image.red2_components, oldMaxLevel, newMaxLevel, newImage.red2_components);
+    scaleComponents(image.green2_components, oldMaxLevel, newMaxLevel, newImage.green2_components);
+    scaleComponents(image.blue2_components, oldMaxLevel, newMaxLevel, newImage.blue2_components);
   }
 }
 
 // Main function that handles input validation and format change logic.
-auto maxLevelImageSOA(const SOAImage &image, int newMaxLevel) -> SOAImage {
+void maxLevelImageSOA(const SOAImage &image, int newMaxLevel, SOAImage &newImage) {
   if (newMaxLevel <= 0 || newMaxLevel > MAX_INSTENSITY) { // Validate maximum value.
     throw std::invalid_argument("Maximum value not valid.");
   }
 
-  SOAImage newImage; // Create new image in SOA format.
   newImage.width = image.width;
   newImage.height = image.height;
   newImage.max_color_value = newMaxLevel;
@@ -68,12 +71,192 @@ auto maxLevelImageSOA(const SOAImage &image, int newMaxLevel) -> SOAImage {
   int const current_bytes_per_component = (image.max_color_value > MAX_INSTENSITY_1B) ? 2 : 1;
   int const new_bytes_per_component = (newMaxLevel > MAX_INSTENSITY_1B) ? 2 : 1;
 
-  // Change format according to the new bytes per component size.
+  // Change format according to the new bytes per component size; a reused image may hold the other one.
   if (new_bytes_per_component == 1) {
     resizeAndRecalculateToOneByte(newImage, current_bytes_per_component, image,  newMaxLevel);
+    newImage.red2_components.clear();
+    newImage.green2_components.clear();
+    newImage.blue2_components.clear();
   } else {
     resizeAndRecalculateToTwoBytes(newImage,current_bytes_per_component, image, newMaxLevel);
+    newImage.red1_components.clear();
+    newImage.green1_components.clear();
+    newImage.blue1_components.clear();
   }
+}
 
+auto maxLevelImageSOA(const SOAImage &image, int newMaxLevel) -> SOAImage {
+  SOAImage newImage; // Create new image in SOA format.
+  maxLevelImageSOA(image, newMaxLevel, newImage);
   return newImage;
-}
\ No newline at end of file
+}
+
+// Function to validate a maxlevel step and record it in a chain of point operations
+void addMaxLevelSOA(PointOpChain &chain, int newMaxLevel) {
+  if (newMaxLevel <= 0 || newMaxLevel > MAX_INSTENSITY) { // Validate maximum value.
+    throw std::invalid_argument("Maximum value not valid.");
+  }
+  chain.add_maxlevel(newMaxLevel);
+}
+
+// Function to run a chain of point operations with one table lookup per component
+void applyPointOpsSOA(const SOAImage &image, const PointOpChain &chain, SOAImage &newImage) {
+  if (chain.single_maxlevel()) { // A lone maxlevel may have a specialised kernel
+    maxLevelImageSOA(image, chain.output_max(image.max_color_value), newImage);
+    return;
+  }
+  std::vector<uint16_t> const table = chain.table(image.max_color_value);
+  int const newMaxLevel = chain.output_max(image.max_color_value);
+  newImage.width = image.width;
+  newImage.height = image.height;
+  newImage.max_color_value = newMaxLevel;
+  bool const oldOneByte = image.max_color_value <= MAX_INSTENSITY_1B;
+  bool const newOneByte = newMaxLevel <= MAX_INSTENSITY_1B;
+  if (oldOneByte && newOneByte) {
+    mapComponents(image.red1_components, table, newImage.red1_components);
+    mapComponents(image.green1_components, table, newImage.green1_components);
+    mapComponents(image.blue1_components, table, newImage.blue1_components);
+  } else if (oldOneByte) {
+    mapComponents(image.red1_components, table, newImage.red2_components);
+    mapComponents(image.green1_components, table, newImage.green2_components);
+    mapComponents(image.blue1_components, table, newImage.blue2_components);
+  } else if (newOneByte) {
+    mapComponents(image.red2_components, table, newImage.red1_components);
+    mapComponents(image.green2_components, table, newImage.green1_components);
+    mapComponents(image.blue2_components, table, newImage.blue1_components);
+  } else {
+    mapComponents(image.red2_components, table, newImage.red2_components);
+    mapComponents(image.green2_components, table, newImage.green2_components);
+    mapComponents(image.blue2_components, table, newImage.blue2_components);
+  }
+  if (newOneByte) { // A reused image may hold the other bit depth.
+    newImage.red2_components.clear();
+    newImage.green2_components.clear();
+    newImage.blue2_components.clear();
+  } else {
+    newImage.red1_components.clear();
+    newImage.green1_components.clear();
+    newImage.blue1_components.clear();
+  }
+}
+
+// Function to adjust the maximum color level of a P6 file while copying it to another one
+void maxLevelFileSOA(const std::string &input_file, const std::string &output_file, int newMaxLevel) {
+  if (newMaxLevel <= 0 || newMaxLevel > MAX_INSTENSITY) { // Validate maximum value.
+    throw std::invalid_argument("Maximum value not valid.");
+  }
+  stream_maxlevel(input_file, output_file, newMaxLevel);
+}
+
+// Function to rescale one component in its own vector, or into the vector of the other width releasing the old one
+template<typename Scale>
+static void rescaleComponent(PixelBuffer<uint8_t> &one_byte, PixelBuffer<uint16_t> &two_bytes, bool oldOneByte,
+                             bool newOneByte, const Scale &scale) {
+  if (oldOneByte && newOneByte) {
+    scale(one_byte, one_byte); // Each value is read before it is written
+  } else if (!oldOneByte && !newOneByte) {
+    scale(two_bytes, two_bytes);
+  } else if (oldOneByte) {
+    scale(one_byte, two_bytes);
+    one_byte = PixelBuffer<uint8_t>();
+  } else {
+    scale(two_bytes, one_byte);
+    two_bytes = PixelBuffer<uint16_t>();
+  }
+}
+
+// Function to adjust the maximum color level in the image's own component vectors. Only a change of bytes per
+// component needs new vectors, one component at a time.
+void maxLevelInPlaceSOA(SOAImage &image, int newMaxLevel) {
+  if (newMaxLevel <= 0 || newMaxLevel > MAX_INSTENSITY) { // Validate maximum value.
+    throw std::invalid_argument("Maximum value not valid.");
+  }
+  int const oldMaxLevel = image.max_color_value;
+  bool const oldOneByte = oldMaxLevel <= MAX_INSTENSITY_1B;
+  bool const newOneByte = newMaxLevel <= MAX_INSTENSITY_1B;
+  auto const scale = [&](const auto &components, auto &scaled) {
+    scaleComponents(components, oldMaxLevel, newMaxLevel, scaled);
+  };
+  rescaleComponent(image.red1_components, image.red2_components, oldOneByte, newOneByte, scale);
+  rescaleComponent(image.green1_components, image.green2_components, oldOneByte, newOneByte, scale);
+  rescaleComponent(image.blue1_components, image.blue2_components, oldOneByte, newOneByte, scale);
+  image.max_color_value = newMaxLevel;
+}
+
+// Function to lower the maximum color level with dithering, one component at a time in its own vector when its
+// width is kept. Raising the level loses nothing to rounding, so it is a plain maxlevel.
+void ditherMaxLevelSOA(SOAImage &image, int newMaxLevel, DitherMethod method, size_t threads) {
+  if (newMaxLevel <= 0 || newMaxLevel > MAX_INSTENSITY) { // Validate maximum value.
+    throw std::invalid_argument("Maximum value not valid.");
+  }
+  if (method == DitherMethod::none || newMaxLevel >= image.max_color_value) {
+    maxLevelInPlaceSOA(image, newMaxLevel);
+    return;
+  }
+  int const oldMaxLevel = image.max_color_value;
+  bool const oldOneByte = oldMaxLevel <= MAX_INSTENSITY_1B;
+  bool const newOneByte = newMaxLevel <= MAX_INSTENSITY_1B;
+  auto const dither = [&](const auto &components, auto &dithered) {
+    using Component = typename std::remove_reference_t<decltype(dithered)>::value_type;
+    dithered.resize(components.size()); // Nothing to do when it is the same vector
+    auto const load = [&components](size_t pixel, size_t /*channel*/) -> int { return components[pixel]; };
+    auto const store = [&dithered](size_t pixel, size_t /*channel*/, int level) {
+      dithered[pixel] = static_cast<Component>(level);
+    };
+    ditherLevels<1>(method, static_cast<size_t>(image.width), static_cast<size_t>(image.height), oldMaxLevel,
+                    newMaxLevel, load, store, threads);
+  };
+  rescaleComponent(image.red1_components, image.red2_components, oldOneByte, newOneByte, dither);
+  rescaleComponent(image.green1_components, image.green2_components, oldOneByte, newOneByte, dither);
+  rescaleComponent(image.blue1_components, image.blue2_components, oldOneByte, newOneByte, dither);
+  image.max_color_value = newMaxLevel;
+}
+
+// Function to run a chain of point operations in the image's own component vectors
+void applyPointOpsInPlaceSOA(SOAImage &image, const PointOpChain &chain) {
+  if (chain.single_maxlevel()) { // A lone maxlevel may have a specialised kernel
+    maxLevelInPlaceSOA(image, chain.output_max(image.max_color_value));
+    return;
+  }
+  std::vector<uint16_t> const table = chain.table(image.max_color_value);
+  int const newMaxLevel = chain.output_max(image.max_color_value);
+  bool const oldOneByte = image.max_color_value <= MAX_INSTENSITY_1B;
+  bool const newOneByte = newMaxLevel <= MAX_INSTENSITY_1B;
+  auto const map = [&table](const auto &components, auto &mapped) { mapComponents(components, table, mapped); };
+  rescaleComponent(image.red1_components, image.red2_components, oldOneByte, newOneByte, map);
+  rescaleComponent(image.green1_components, image.green2_components, oldOneByte, newOneByte, map);
+  rescaleComponent(image.blue1_components, image.blue2_components, oldOneByte, newOneByte, map);
+  image.max_color_value = newMaxLevel;
+}
+
+// Function to scale every entry of a component table into another one
+template<typename FromType, typename ToType>
+void scaleTable(const AuxPixelVects<FromType> &colors, AuxPixelVects<ToType> &scaled, int newMaxLevel, int oldMaxLevel) {
+  for (size_t i = 0; i < colors.red.size(); ++i) {
+    scaled.red.push_back(static_cast<ToType>(scaleLevel(colors.red[i], newMaxLevel, oldMaxLevel)));
+    scaled.green.push_back(static_cast<ToType>(scaleLevel(colors.green[i], newMaxLevel, oldMaxLevel)));
+    scaled.blue.push_back(static_cast<ToType>(scaleLevel(colors.blue[i], newMaxLevel, oldMaxLevel)));
+  }
+}
+
+// Same operation on a C-PPM image: only its color table is scaled, equal entries are merged when it is written
+void maxLevelPaletteSOA(PaletteImageSOA &image, int newMaxLevel) {
+  if (newMaxLevel <= 0 || newMaxLevel > MAX_INSTENSITY) { // Validate maximum value.
+    throw std::invalid_argument("Maximum value not valid.");
+  }
+  int const oldMaxLevel = image.header.max_color_value;
+  AuxPixelVects<uint8_t> colors1;
+  AuxPixelVects<uint16_t> colors2;
+  if (oldMaxLevel <= MAX_INSTENSITY_1B && newMaxLevel <= MAX_INSTENSITY_1B) {
+    scaleTable(image.colors1, colors1, newMaxLevel, oldMaxLevel);
+  } else if (oldMaxLevel <= MAX_INSTENSITY_1B) {
+    scaleTable(image.colors1, colors2, newMaxLevel, oldMaxLevel);
+  } else if (newMaxLevel <= MAX_INSTENSITY_1B) {
+    scaleTable(image.colors2, colors1, newMaxLevel, oldMaxLevel);
+  } else {
+    scaleTable(image.colors2, colors2, newMaxLevel, oldMaxLevel);
+  }
+  image.colors1 = std::move(colors1);
+  image.colors2 = std::move(colors2);
+  image.header.max_color_value = newMaxLevel;
+}
@@ -2,8 +2,13 @@
 #define MAXLEVELSOA_HPP
 
 #include "imagesoa.hpp"
+#include "compresssoa.hpp"
+#include "../common/dither.hpp"
+#include "../common/pointops.hpp"
 #include <cmath>
 #include <stdexcept>
+#include <cstdint>
+#include <string>
 
 // Function to resize and recalculate components to 1 byte per component (3 bytes per pixel).
 void resizeAndRecalculateToOneByte(SOAImage &newImage, int current_bytes_per_component, const SOAImage &image, int newMaxLevel);
@@ -14,4 +19,28 @@ void resizeAndRecalculateToTwoBytes(SOAImage &newImage, int current_bytes_per_co
 // Main function that handles input validation and format change logic.
 auto maxLevelImageSOA(const SOAImage &image, int newMaxLevel) -> SOAImage;
 
+// Same, into an image whose buffers are reused (it must not be image).
+void maxLevelImageSOA(const SOAImage &image, int newMaxLevel, SOAImage &newImage);
+
+// Same from a P6 file to a P6 file in one pass, without building either image.
+void maxLevelFileSOA(const std::string &input_file, const std::string &output_file, int newMaxLevel);
+
+// Same, in the image's own component vectors when the bytes per component do not change.
+void maxLevelInPlaceSOA(SOAImage &image, int newMaxLevel);
+
+// Same lowering the level with dithering (threads = 0 picks them from the image size).
+void ditherMaxLevelSOA(SOAImage &image, int newMaxLevel, DitherMethod method, size_t threads = 0);
+
+// Function to validate a maxlevel step and record it in a chain of point operations.
+void addMaxLevelSOA(PointOpChain &chain, int newMaxLevel);
+
+// Function to run a chain of point operations in one pass, into an image whose buffers are reused (not image).
+void applyPointOpsSOA(const SOAImage &image, const PointOpChain &chain, SOAImage &newImage);
+
+// Function to run a chain of point operations in the image's own vectors when their width does not change.
+void applyPointOpsInPlaceSOA(SOAImage &image, const PointOpChain &chain);
+
+// Same operation on a C-PPM image kept compressed: only its color table is scaled.
+void maxLevelPaletteSOA(PaletteImageSOA &image, int newMaxLevel);
+
 #endif //MAXLEVELSOA_HPP
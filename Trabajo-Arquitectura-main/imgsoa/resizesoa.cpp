@@ -24,41 +24,54 @@ auto calculateCoords(const ResizeParams &params, const SOAImage &inputImage) ->
 }
 
 
-auto resizeImageSOA(SOAImage &inputImage, int newWidth, int newHeight) -> SOAImage {
-  SOAImage outputImage;
+// Function to resize one bit depth, from views of the input planes into views of the (already sized) output planes
+template<typename T>
+static void resizeComponents(const SOAImage &inputImage, const AuxPixelVectsref<const T> &inputComponents,
+                             const AuxPixelVectsref<T> &outputComponents, const SOAImage &outputImage,
+                             int maxColorValue) {
+  size_t const newWidth = static_cast<size_t>(outputImage.width);
+  size_t const newHeight = static_cast<size_t>(outputImage.height);
+  for (size_t y_prime = 0; y_prime < newHeight; ++y_prime) {
+    for (size_t x_prime = 0; x_prime < newWidth; ++x_prime) {
+      ResizeParams const resizeParams{.x_prime=x_prime, .y_prime=y_prime, .newWidth=outputImage.width,
+                                      .newHeight=outputImage.height}; // Initialize ResizeParams struct
+      InterpolationCoords const coords = calculateCoords(resizeParams, inputImage); // Calculate interpolation coordinates
+      auto data = fetchData(inputImage, coords, inputComponents); // Fetch pixel data for interpolation
+      InterpolationParams const interpParams{.index=((y_prime * newWidth) + x_prime),
+                                             .max_color_value=maxColorValue}; // Set interpolation parameters
+      interpolate<T>(data, coords, outputComponents, interpParams); // Perform interpolation
+    }
+  }
+}
+
+void resizeImageSOA(const SOAImage &inputImage, int newWidth, int newHeight, SOAImage &outputImage) {
   outputImage.width = newWidth;
   outputImage.height = newHeight;
   outputImage.max_color_value = inputImage.max_color_value;
+  size_t const pixels = static_cast<size_t>(newWidth) * static_cast<size_t>(newHeight);
   if (inputImage.max_color_value <= MAX_INSTENSITY_1B) { // Process 8-bit images
-    outputImage.red1_components.resize(static_cast<size_t>(newWidth) * static_cast<size_t>(newHeight));
-    outputImage.green1_components.resize(static_cast<size_t>(newWidth) * static_cast<size_t>(newHeight));
-    outputImage.blue1_components.resize(static_cast<size_t>(newWidth) * static_cast<size_t>(newHeight));
-    AuxPixelVectsref<uint8_t> const inputComponents{.red=inputImage.red1_components, .green=inputImage.green1_components,.blue=inputImage.blue1_components};
-    AuxPixelVectsref<uint8_t> outputComponents{.red=outputImage.red1_components, .green=outputImage.green1_components,.blue=outputImage.blue1_components};
-    for (size_t y_prime = 0; y_prime < static_cast<size_t>(newHeight); ++y_prime) {
-      for (size_t x_prime = 0; x_prime < static_cast<size_t>(newWidth); ++x_prime) {
-        ResizeParams const resizeParams{.x_prime=x_prime, .y_prime=y_prime, .newWidth=newWidth, .newHeight=newHeight}; // Initialize ResizeParams struct
-        InterpolationCoords const coords = calculateCoords(resizeParams,inputImage); // Calculate interpolation coordinates
-        auto data = fetchData<uint8_t>(inputImage, coords,inputComponents); // Fetch pixel data for interpolation
-        InterpolationParams const interpParams{.index=((y_prime * static_cast<size_t>(newWidth)) + x_prime),.max_color_value=MAX_INSTENSITY_1B}; // Set interpolation parameters
-        interpolate<uint8_t>(data, coords, outputComponents, interpParams); // Perform interpolation
-      }
-    }
+    outputImage.red1_components.resize(pixels); // Reuses the capacity of a reused output image
+    outputImage.green1_components.resize(pixels);
+    outputImage.blue1_components.resize(pixels);
+    resizeComponents(inputImage, componentViews<uint8_t>(inputImage), componentViews<uint8_t>(outputImage),
+                     outputImage, MAX_INSTENSITY_1B);
+    outputImage.red2_components.clear(); // A reused output image may hold the other bit depth
+    outputImage.green2_components.clear();
+    outputImage.blue2_components.clear();
   } else {
-    outputImage.red2_components.resize(static_cast<size_t>(newWidth) * static_cast<size_t>(newHeight));
-    outputImage.green2_components.resize(static_cast<size_t>(newWidth) * static_cast<size_t>(newHeight));
-    outputImage.blue2_components.resize(static_cast<size_t>(newWidth) * static_cast<size_t>(newHeight));
-    AuxPixelVectsref<uint16_t> const inputComponents{.red=inputImage.red2_components, .green=inputImage.green2_components,.blue=inputImage.blue2_components};
-    AuxPixelVectsref<uint16_t> outputComponents{.red=outputImage.red2_components, .green=outputImage.green2_components,.blue=outputImage.blue2_components};
-    for (size_t y_prime = 0; y_prime < static_cast<size_t>(newHeight); ++y_prime) {
-      for (size_t x_prime = 0; x_prime < static_cast<size_t>(newWidth); ++x_prime) {
-        ResizeParams const resizeParams{.x_prime=x_prime, .y_prime=y_prime, .newWidth=newWidth, .newHeight=newHeight};
-        InterpolationCoords const coords = calculateCoords(resizeParams, inputImage);
-        auto data = fetchData<uint16_t>(inputImage, coords, inputComponents);
-        InterpolationParams const interpParams{.index=((y_prime * static_cast<size_t>(newWidth)) + x_prime), .max_color_value=inputImage.max_color_value};
-        interpolate<uint16_t>(data, coords, outputComponents, interpParams);
-      }
-    }
+    outputImage.red2_components.resize(pixels);
+    outputImage.green2_components.resize(pixels);
+    outputImage.blue2_components.resize(pixels);
+    resizeComponents(inputImage, componentViews<uint16_t>(inputImage), componentViews<uint16_t>(outputImage),
+                     outputImage, inputImage.max_color_value);
+    outputImage.red1_components.clear();
+    outputImage.green1_components.clear();
+    outputImage.blue1_components.clear();
   }
+}
+
+auto resizeImageSOA(const SOAImage &inputImage, int newWidth, int newHeight) -> SOAImage {
+  SOAImage outputImage;
+  resizeImageSOA(inputImage, newWidth, newHeight, outputImage);
   return outputImage;
-}
\ No newline at end of file
+}
@@ -6,19 +6,13 @@
 #include <queue>
 #include <cmath>
 #include <algorithm>
+#include <type_traits>
 
 struct InterpolationCoords {
     int x_l, x_h, y_l, y_h; // Lower and upper bounds for x and y
     double x_weight, y_weight; // Interpolation weights for x and y
 };
 
-template<typename ComponentType>
-struct AuxPixelVectsref {
-    std::vector <ComponentType> red; // Reference to red component vector
-    std::vector <ComponentType> green; // Reference to green component vector
-    std::vector <ComponentType> blue; // Reference to blue component vector
-};
-
 template<typename T>
 struct SOAPixelData {
     T r00, r10, r01, r11; // Red component values at 4 neighboring pixels
@@ -38,10 +32,11 @@ struct ResizeParams {
     int newHeight; // Height of the resized image
 };
 
-template<typename T>
-auto
-fetchData(const SOAImage &inputImage, const InterpolationCoords &coords, const AuxPixelVectsref<T> &components) -> SOAPixelData<T> {
-    SOAPixelData<T> data{};
+// Reads the four neighbours of every component through views of the input planes (const or not)
+template<typename Component>
+auto fetchData(const SOAImage &inputImage, const InterpolationCoords &coords,
+               const AuxPixelVectsref<Component> &components) -> SOAPixelData<std::remove_const_t<Component>> {
+    SOAPixelData<std::remove_const_t<Component>> data{};
     auto width = static_cast<size_t>(inputImage.width);
     auto x_l = static_cast<size_t>(coords.x_l);
     auto x_h = static_cast<size_t>(coords.x_h);
@@ -67,8 +62,9 @@ fetchData(const SOAImage &inputImage, const InterpolationCoords &coords, const A
 }
 
 
+// Writes one interpolated pixel through views of the output planes
 template<typename T>
-void interpolate(const SOAPixelData<T> &data, const InterpolationCoords &coords, AuxPixelVectsref<T> &outputComponents, const InterpolationParams &params) {
+void interpolate(const SOAPixelData<T> &data, const InterpolationCoords &coords, const AuxPixelVectsref<T> &outputComponents, const InterpolationParams &params) {
     double const red0 = (data.r00 * (1 - coords.x_weight)) + (data.r10 * coords.x_weight); // Interpolated red for top row
     double const red1 = (data.r01 * (1 - coords.x_weight)) + (data.r11 * coords.x_weight); // Interpolated red for bottom row
     outputComponents.red[params.index] = static_cast<T>(std::clamp(
@@ -90,6 +86,9 @@ void interpolate(const SOAPixelData<T> &data, const InterpolationCoords &coords,
 
 auto calculateCoords(const ResizeParams &params, const SOAImage &inputImage) -> InterpolationCoords;
 
-auto resizeImageSOA(SOAImage &inputImage, int newWidth, int newHeight) -> SOAImage;
+auto resizeImageSOA(const SOAImage &inputImage, int newWidth, int newHeight) -> SOAImage;
+
+// Same, into an image whose buffers are reused (it must not be inputImage)
+void resizeImageSOA(const SOAImage &inputImage, int newWidth, int newHeight, SOAImage &outputImage);
 
 #endif //RESIZESOA_HPP
@@ -0,0 +1,47 @@
+#include "gtest/gtest.h"
+#include <cstdint>
+#include <vector>
+#include "../common/bitpack.hpp"
+
+// NOLINTBEGIN(cppcoreguidelines-avoid-magic-numbers)
+// NOLINTBEGIN(readability-magic-numbers)
+
+// Smallest width that holds every index of the table.
+TEST(BitPackTest, BitWidthFor) {
+  EXPECT_EQ(bitWidthFor(1), 0);
+  EXPECT_EQ(bitWidthFor(2), 1);
+  EXPECT_EQ(bitWidthFor(256), 8);
+  EXPECT_EQ(bitWidthFor(257), 9);
+  EXPECT_EQ(bitWidthFor(300), 9);
+  EXPECT_EQ(bitWidthFor(65536), 16);
+  EXPECT_EQ(bitWidthFor(size_t{1} << 32), 32);
+}
+
+// Every width packs and unpacks back to the same values, also for counts that are not whole vectors.
+TEST(BitPackTest, RoundTripAllWidths) {
+  for (unsigned bits = 0; bits <= BITPACK_MAX_BITS; ++bits) {
+    for (size_t const count : {0UL, 1UL, 7UL, 8UL, 63UL, 1001UL}) {
+      std::vector<uint32_t> values(count);
+      uint64_t const mask = (uint64_t{1} << bits) - 1;
+      for (size_t i = 0; i < count; ++i) { values[i] = static_cast<uint32_t>((i * 2654435761U + i / 3) & mask); }
+      if (count > 0) { values[count - 1] = static_cast<uint32_t>(mask); } // Highest value fits too
+      std::vector<uint64_t> words = packBits(values, bits);
+      EXPECT_EQ(words.size(), packedWordCount(count, bits));
+      EXPECT_EQ(unpackBits(words, bits, count), values) << bits << " bits, " << count << " values";
+      EXPECT_EQ(words.size(), packedWordCount(count, bits)); // Padding is removed again
+    }
+  }
+}
+
+// Values are laid out lowest bits first, crossing word boundaries.
+TEST(BitPackTest, Layout) {
+  std::vector<uint32_t> const values = {1, 2, 3, 4, 5, 6, 7, 0, 1, 2, 3, 4, 5, 6, 7, 0, 1, 2, 3, 4, 5, 6};
+  std::vector<uint64_t> const words = packBits(values, 3);
+  ASSERT_EQ(words.size(), 2);
+  EXPECT_EQ(words[0] & 0777, 0321);
+  EXPECT_EQ(words[1], 0b11U); // Value 21 (6 = 0b110) straddles the words: bit 63 of word 0, bits 0-1 of word 1
+  EXPECT_EQ(words[0] >> 63, 0U);
+}
+
+// NOLINTEND(readability-magic-numbers)
+// NOLINTEND(cppcoreguidelines-avoid-magic-numbers)
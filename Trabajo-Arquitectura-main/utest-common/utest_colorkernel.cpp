@@ -0,0 +1,77 @@
+#include "gtest/gtest.h"
+#include <random>
+#include <cstdint>
+#include "../common/colorkernel.hpp"
+#include "../common/colorsearch.hpp"
+
+// NOLINTBEGIN(cppcoreguidelines-avoid-magic-numbers)
+// NOLINTBEGIN(readability-magic-numbers)
+
+namespace {
+  // Pseudo-random palette with few distinct values per component, so many candidates tie.
+  template<typename C>
+  auto tiedPalette(size_t size, unsigned int seed, unsigned int levels) -> std::vector<RGBColor<C>> {
+    std::mt19937 generator(seed);
+    std::uniform_int_distribution<unsigned int> level(0, levels - 1);
+    unsigned int const step = std::numeric_limits<C>::max() / (levels - 1);
+    std::vector<RGBColor<C>> palette(size);
+    for (auto &color : palette) {
+      color = {.red=static_cast<C>(level(generator) * step), .green=static_cast<C>(level(generator) * step),
+               .blue=static_cast<C>(level(generator) * step)};
+    }
+    return palette;
+  }
+
+  // Checks the kernel against a brute-force scan (first one on ties) for every query.
+  template<typename C>
+  void expectMatchesBruteForce(size_t size) {
+    using Lane = PlaneLane<RGBColor<C>>;
+    auto const palette = tiedPalette<C>(size, 1, 5);
+    auto const queries = tiedPalette<C>(200, 2, 9);
+    auto const planes = makePalettePlanes<Lane>(palette);
+    for (const auto &query : queries) {
+      size_t best = 0;
+      for (size_t i = 1; i < palette.size(); ++i) {
+        if (squaredDistance(palette[i], query) < squaredDistance(palette[best], query)) { best = i; }
+      }
+      PlaneMatch const match = nearestInPlanes(planes, static_cast<Lane>(query.red), static_cast<Lane>(query.green),
+                                               static_cast<Lane>(query.blue), 0);
+      EXPECT_EQ(match.position, best);
+      EXPECT_EQ(static_cast<double>(match.distance), squaredDistance(palette[best], query));
+    }
+  }
+}
+
+// 8-bit palettes, including sizes that are not a whole number of vectors or blocks.
+TEST(ColorKernelTest, Matches8Bit) {
+  for (size_t const size : {1UL, 7UL, 64UL, 100UL, 1000UL}) { expectMatchesBruteForce<uint8_t>(size); }
+}
+
+// 16-bit palettes, whose squared distances do not fit in 32 bits.
+TEST(ColorKernelTest, Matches16Bit) {
+  for (size_t const size : {1UL, 3UL, 64UL, 129UL, 1000UL}) { expectMatchesBruteForce<uint16_t>(size); }
+}
+
+// Farthest possible 16-bit colours.
+TEST(ColorKernelTest, LargestDistance16Bit) {
+  std::vector<RGBColor<uint16_t>> const palette = {{.red=65535, .green=65535, .blue=65535}};
+  auto const planes = makePalettePlanes<int64_t>(palette);
+  PlaneMatch const match = nearestInPlanes<int64_t>(planes, 0, 0, 0, 0);
+  EXPECT_EQ(match.position, 0);
+  EXPECT_EQ(match.distance, 3ULL * 65535 * 65535);
+}
+
+// The scan stops after the block holding an exact match.
+TEST(ColorKernelTest, StopsOnMatch) {
+  std::vector<RGBColor<uint8_t>> palette(1000, {.red=200, .green=200, .blue=200});
+  palette[10] = {.red=1, .green=2, .blue=3};
+  auto const planes = makePalettePlanes<int32_t>(palette);
+  PlaneMatch const match = nearestInPlanes<int32_t>(planes, 1, 2, 3, 0);
+  EXPECT_EQ(match.position, 10);
+  EXPECT_EQ(match.distance, 0);
+  EXPECT_EQ(match.scanned, PLANE_BLOCK);
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(planes.red.data()) % PLANE_ALIGNMENT, 0); // NOLINT(cppcoreguidelines-pro-type-reinterpret-cast)
+}
+
+// NOLINTEND(readability-magic-numbers)
+// NOLINTEND(cppcoreguidelines-avoid-magic-numbers)
@@ -0,0 +1,79 @@
+#include "gtest/gtest.h"
+#include <random>
+#include <cstdint>
+#include "../common/colorsearch.hpp"
+
+// NOLINTBEGIN(cppcoreguidelines-avoid-magic-numbers)
+// NOLINTBEGIN(readability-magic-numbers)
+
+namespace {
+  // Creates a palette of pseudo-random 8-bit colors (fixed seed so the tests are repeatable).
+  auto randomPalette(size_t size, unsigned int seed) -> std::vector<RGBColor<uint8_t>> {
+    std::mt19937 generator(seed);
+    std::uniform_int_distribution<int> component(0, 255);
+    std::vector<RGBColor<uint8_t>> palette(size);
+    for (auto &color : palette) {
+      color = {.red=static_cast<uint8_t>(component(generator)), .green=static_cast<uint8_t>(component(generator)),
+               .blue=static_cast<uint8_t>(component(generator))};
+    }
+    return palette;
+  }
+
+  // Exact nearest color by brute force (first one on ties), used as reference.
+  auto bruteForceNearest(const std::vector<RGBColor<uint8_t>> &palette, const RGBColor<uint8_t> &target) -> size_t {
+    size_t best = 0;
+    for (size_t i = 1; i < palette.size(); ++i) {
+      if (squaredDistance(palette[i], target) < squaredDistance(palette[best], target)) { best = i; }
+    }
+    return best;
+  }
+
+  const std::vector<NearestStrategy> ALL_STRATEGIES = {NearestStrategy::linear, NearestStrategy::kdtree,
+                                                       NearestStrategy::grid};
+}
+
+// Every exact strategy finds the same color as a brute-force scan, ties included.
+TEST(ColorSearchTest, ExactSearchMatchesBruteForce) {
+  auto palette = randomPalette(500, 1);
+  for (size_t i = 0; i < 100; ++i) { palette.push_back(palette[i * 3]); } // Duplicates force ties
+  auto const queries = randomPalette(300, 2);
+  for (NearestStrategy const strategy : ALL_STRATEGIES) {
+    auto const index = buildColorIndex(palette, strategy, queries.size());
+    for (const auto &query : queries) {
+      auto const result = nearestColor(index, query, 0.0);
+      EXPECT_EQ(result.position, bruteForceNearest(palette, query)) << nearestStrategyName(strategy);
+      EXPECT_EQ(result.error_bound, 0.0);
+    }
+  }
+}
+
+// The approximate search never exceeds the tolerance and its reported bound covers the real error.
+TEST(ColorSearchTest, ApproximateSearchIsBounded) {
+  auto const palette = randomPalette(2000, 3);
+  auto const queries = randomPalette(500, 4);
+  double const tolerance = 300.0;
+  for (NearestStrategy const strategy : ALL_STRATEGIES) {
+    auto const index = buildColorIndex(palette, strategy, queries.size());
+    for (const auto &query : queries) {
+      auto const result = nearestColor(index, query, tolerance);
+      double const real_error = result.distance - squaredDistance(palette[bruteForceNearest(palette, query)], query);
+      EXPECT_EQ(result.distance, squaredDistance(result.color, query));
+      EXPECT_LE(real_error, result.error_bound);
+      EXPECT_LE(result.error_bound, tolerance);
+    }
+  }
+}
+
+// Small problems are scanned, large ones use the grid.
+TEST(ColorSearchTest, StrategySelection) {
+  EXPECT_EQ(chooseNearestStrategy(1000000, 10, 8), NearestStrategy::linear);
+  EXPECT_EQ(chooseNearestStrategy(2, 5000, 16), NearestStrategy::linear);
+  EXPECT_EQ(chooseNearestStrategy(100000, 100000, 8), NearestStrategy::grid);
+  EXPECT_EQ(chooseNearestStrategy(100000, 100000, 16), NearestStrategy::grid);
+  EXPECT_EQ(chooseNearestStrategy(100000, 100000, 32), NearestStrategy::kdtree);
+  EXPECT_EQ(nearestStrategyFromName("grid"), NearestStrategy::grid);
+  EXPECT_THROW(nearestStrategyFromName("octree"), std::invalid_argument);
+}
+
+// NOLINTEND(readability-magic-numbers)
+// NOLINTEND(cppcoreguidelines-avoid-magic-numbers)
@@ -0,0 +1,66 @@
+#include "gtest/gtest.h"
+#include <cstdint>
+#include <vector>
+#include "../common/dither.hpp"
+
+// NOLINTBEGIN(cppcoreguidelines-avoid-magic-numbers)
+// NOLINTBEGIN(readability-magic-numbers)
+
+namespace {
+
+// A smooth 16-bit ramp over a 1-channel width x height image, dithered down to new_max
+auto ditherRamp(DitherMethod method, size_t width, size_t height, int new_max, size_t threads) -> std::vector<int> {
+  std::vector<int> levels(width * height);
+  for (size_t pixel = 0; pixel < levels.size(); ++pixel) {
+    levels[pixel] = static_cast<int>(((pixel % width) * 65535) / (width - 1));
+  }
+  ditherLevels<1>(method, width, height, 65535, new_max,
+                  [&levels](size_t pixel, size_t /*channel*/) { return levels[pixel]; },
+                  [&levels](size_t pixel, size_t /*channel*/, int level) { levels[pixel] = level; }, threads);
+  return levels;
+}
+
+} // namespace
+
+TEST(DitherTest, MethodNames) {
+  EXPECT_EQ(ditherMethodFromName("none"), DitherMethod::none);
+  EXPECT_EQ(ditherMethodFromName("fs"), DitherMethod::floyd_steinberg);
+  EXPECT_EQ(ditherMethodFromName("bayer"), DitherMethod::bayer);
+  EXPECT_THROW(ditherMethodFromName("random"), std::invalid_argument);
+}
+
+// The wavefront keeps the order of the sequential scan, so any number of threads gives the same image
+TEST(DitherTest, FloydSteinbergIndependentOfThreads) {
+  std::vector<int> const sequential = ditherRamp(DitherMethod::floyd_steinberg, 300, 40, 3, 1);
+  for (size_t const threads : {2UL, 3UL, 8UL, 64UL}) {
+    EXPECT_EQ(ditherRamp(DitherMethod::floyd_steinberg, 300, 40, 3, threads), sequential) << threads << " threads";
+  }
+  EXPECT_EQ(ditherRamp(DitherMethod::bayer, 300, 40, 3, 7), ditherRamp(DitherMethod::bayer, 300, 40, 3, 1));
+}
+
+// Both methods stay in range and keep the average level of every column group, where rounding would band
+TEST(DitherTest, KeepsAverageLevel) {
+  size_t const width = 256;
+  size_t const height = 64;
+  for (DitherMethod const method : {DitherMethod::floyd_steinberg, DitherMethod::bayer}) {
+    std::vector<int> const levels = ditherRamp(method, width, height, 3, 0);
+    for (size_t first = 0; first < width; first += 32) {
+      double sum = 0.0;
+      double expected = 0.0;
+      for (size_t row = 0; row < height; ++row) {
+        for (size_t column = first; column < first + 32; ++column) {
+          int const level = levels[(row * width) + column];
+          ASSERT_GE(level, 0);
+          ASSERT_LE(level, 3);
+          sum += level;
+          expected += static_cast<double>((column * 65535) / (width - 1)) * 3 / 65535;
+        }
+      }
+      double const count = static_cast<double>(height) * 32;
+      EXPECT_NEAR(sum / count, expected / count, 0.05) << "columns from " << first;
+    }
+  }
+}
+
+// NOLINTEND(readability-magic-numbers)
+// NOLINTEND(cppcoreguidelines-avoid-magic-numbers)
@@ -0,0 +1,85 @@
+#include "gtest/gtest.h"
+#include <cstdint>
+#include <random>
+#include <stdexcept>
+#include <vector>
+#include "../common/entropycoder.hpp"
+
+// NOLINTBEGIN(cppcoreguidelines-avoid-magic-numbers)
+// NOLINTBEGIN(readability-magic-numbers)
+
+namespace {
+  auto ransRoundTrip(const std::vector<uint8_t> &bytes) -> std::vector<uint8_t> {
+    RansFrequencies const frequencies = normalizeFrequencies(bytes);
+    return ransDecode(ransEncode(bytes, frequencies), frequencies, bytes.size());
+  }
+}
+
+// Runs cover the indices exactly, for every index width and for runs longer than one varint byte.
+TEST(EntropyCoderTest, RunsRoundTrip) {
+  std::vector<uint32_t> indices;
+  for (uint32_t run = 0; run < 40; ++run) { indices.insert(indices.end(), (run * run * 7) % 300 + 1, run * 97); }
+  indices.insert(indices.end(), 100000, 5);
+  for (unsigned const index_bytes : {2U, 4U}) {
+    EXPECT_EQ(decodeRuns(encodeRuns(indices, index_bytes), index_bytes, indices.size()), indices);
+  }
+  std::vector<uint32_t> const small = {1, 1, 2, 3, 3, 3, 255};
+  std::vector<uint8_t> const runs = encodeRuns(small, 1);
+  EXPECT_EQ(runs, (std::vector<uint8_t>{1, 1, 2, 0, 3, 2, 255, 0}));
+  EXPECT_EQ(decodeRuns(runs, 1, small.size()), small);
+  EXPECT_THROW(decodeRuns(runs, 1, small.size() - 1), std::runtime_error); // Too many pixels
+  EXPECT_THROW(decodeRuns(runs, 1, small.size() + 1), std::runtime_error); // Too few
+}
+
+// Frequencies always sum to the probability scale and keep every byte that occurs.
+TEST(EntropyCoderTest, NormalizeFrequencies) {
+  std::vector<uint8_t> bytes(100000, 7);
+  for (int i = 0; i < 256; ++i) { bytes.push_back(static_cast<uint8_t>(i)); }
+  RansFrequencies const frequencies = normalizeFrequencies(bytes);
+  EXPECT_TRUE(validFrequencies(frequencies));
+  for (uint32_t const frequency : frequencies) { EXPECT_GE(frequency, 1U); }
+  EXPECT_EQ(normalizeFrequencies(std::vector<uint8_t>(10, 3))[3], RANS_PROB_SCALE);
+  EXPECT_TRUE(validFrequencies(normalizeFrequencies({}))); // Empty input still gets a valid table
+}
+
+// The decoder refuses a table that does not sum to the scale before building its slots, whatever the count.
+TEST(EntropyCoderTest, RansDecodeBogusTable) {
+  RansFrequencies oversized{};
+  oversized.fill(4000);
+  std::vector<uint8_t> const coded(16, 0xAB);
+  EXPECT_THROW(ransDecode(coded, oversized, 0), std::runtime_error);
+  EXPECT_THROW(ransDecode(coded, oversized, 4), std::runtime_error);
+  RansFrequencies const empty{};
+  EXPECT_THROW(ransDecode(coded, empty, 0), std::runtime_error);
+}
+
+// rANS gives the bytes back for uniform, skewed, single-symbol and empty inputs, and shrinks skewed data.
+TEST(EntropyCoderTest, RansRoundTrip) {
+  std::mt19937 generator(42);
+  std::vector<uint8_t> uniform(50001);
+  for (auto &byte : uniform) { byte = static_cast<uint8_t>(generator()); }
+  EXPECT_EQ(ransRoundTrip(uniform), uniform);
+
+  std::geometric_distribution<int> geometric(0.3);
+  std::vector<uint8_t> skewed(50000);
+  for (auto &byte : skewed) { byte = static_cast<uint8_t>(std::min(geometric(generator), 255)); }
+  EXPECT_EQ(ransRoundTrip(skewed), skewed);
+  EXPECT_LT(ransEncode(skewed, normalizeFrequencies(skewed)).size(), skewed.size() / 2);
+
+  std::vector<uint8_t> const single(1000, 9);
+  EXPECT_EQ(ransRoundTrip(single), single);
+  EXPECT_EQ(ransRoundTrip({}), std::vector<uint8_t>{});
+}
+
+// Truncated coded data is reported, not read past.
+TEST(EntropyCoderTest, RansTruncated) {
+  std::vector<uint8_t> bytes(1000);
+  for (size_t i = 0; i < bytes.size(); ++i) { bytes[i] = static_cast<uint8_t>(i * i); }
+  RansFrequencies const frequencies = normalizeFrequencies(bytes);
+  std::vector<uint8_t> coded = ransEncode(bytes, frequencies);
+  coded.resize(coded.size() / 2);
+  EXPECT_THROW(ransDecode(coded, frequencies, bytes.size()), std::runtime_error);
+}
+
+// NOLINTEND(readability-magic-numbers)
+// NOLINTEND(cppcoreguidelines-avoid-magic-numbers)
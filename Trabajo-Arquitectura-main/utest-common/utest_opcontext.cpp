@@ -0,0 +1,90 @@
+#include "gtest/gtest.h"
+#include <cstdint>
+#include <map>
+#include <memory_resource>
+#include <vector>
+#include "../common/opcontext.hpp"
+#include "../common/parallel.hpp"
+
+// NOLINTBEGIN(cppcoreguidelines-avoid-magic-numbers)
+// NOLINTBEGIN(readability-magic-numbers)
+// NOLINTBEGIN(cppcoreguidelines-pro-type-reinterpret-cast)
+
+namespace {
+  // The temporaries of a typical operation: a map that grows node by node and a vector that doubles
+  void scratchWorkload(OperationContext &context, int items) {
+    std::pmr::map<int, int> counts(context.memory());
+    std::pmr::vector<int> order(context.memory());
+    for (int i = 0; i < items; ++i) {
+      ++counts[(i * 7919) % (items / 2)];
+      order.push_back(i);
+    }
+    EXPECT_EQ(order.size(), static_cast<size_t>(items));
+  }
+}
+
+// After a reset the same workload runs in the blocks already taken: nothing more comes from the global heap
+TEST(OperationContextTest, ResetReusesBlocks) {
+  OperationContext context;
+  scratchWorkload(context, 20000);
+  size_t const blocks = context.heap_blocks();
+  size_t const bytes = context.reserved_bytes();
+  EXPECT_GT(blocks, 1U);
+  EXPECT_GE(bytes, SCRATCH_FIRST_BLOCK);
+  for (int image = 0; image < 3; ++image) {
+    context.reset();
+    scratchWorkload(context, 20000);
+    EXPECT_EQ(context.heap_blocks(), blocks);
+    EXPECT_EQ(context.reserved_bytes(), bytes);
+  }
+}
+
+// The arena honours the alignment asked for, also when it has to open a new block
+TEST(OperationContextTest, Alignment) {
+  ScratchArena arena;
+  for (size_t const alignment : std::vector<size_t>{1, 2, 8, 16, 64, 4096}) {
+    void *odd = arena.allocate(3, 1);
+    void *aligned = arena.allocate(SCRATCH_FIRST_BLOCK / 3, alignment);
+    EXPECT_NE(odd, nullptr);
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(aligned) % alignment, 0);
+  }
+  arena.reset();
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(arena.allocate(8, 64)) % 64, 0);
+}
+
+// Every stripe fills a list in its own arena; the lists keep their contents and the stripes' arenas are reused
+TEST(OperationContextTest, StripeArenas) {
+  OperationContext context;
+  size_t const stripes = 4;
+  size_t const items = 100000;
+  size_t blocks = 0;
+  for (int image = 0; image < 2; ++image) {
+    auto lists = context.stripe_vectors<uint32_t>(stripes);
+    forEachStripe(items, stripes, [&lists](size_t stripe, size_t begin, size_t end) {
+      for (size_t i = begin; i < end; ++i) { lists[stripe].items.push_back(static_cast<uint32_t>(i)); }
+    });
+    size_t next = 0;
+    for (const auto &list : lists) {
+      for (uint32_t const item : list.items) { EXPECT_EQ(item, next++); }
+    }
+    EXPECT_EQ(next, items);
+    if (image == 0) { blocks = context.heap_blocks(); }
+    EXPECT_EQ(context.heap_blocks(), blocks);
+    lists.clear();
+    context.reset();
+  }
+}
+
+// The shared context hands out the global heap and keeps no blocks
+TEST(OperationContextTest, HeapContext) {
+  OperationContext &context = OperationContext::heap();
+  EXPECT_EQ(context.memory(), std::pmr::new_delete_resource());
+  EXPECT_EQ(context.stripe_memory(3), std::pmr::new_delete_resource());
+  scratchWorkload(context, 1000);
+  EXPECT_EQ(context.heap_blocks(), 0U);
+  EXPECT_EQ(&OperationContext::heap(), &context);
+}
+
+// NOLINTEND(cppcoreguidelines-pro-type-reinterpret-cast)
+// NOLINTEND(readability-magic-numbers)
+// NOLINTEND(cppcoreguidelines-avoid-magic-numbers)
@@ -0,0 +1,44 @@
+#include "gtest/gtest.h"
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+#include "../common/paletteorder.hpp"
+
+// NOLINTBEGIN(cppcoreguidelines-avoid-magic-numbers)
+// NOLINTBEGIN(readability-magic-numbers)
+
+// Morton codes interleave the components, red highest, from the most significant bit down.
+TEST(PaletteOrderTest, MortonCode) {
+  EXPECT_EQ(mortonCode(0, 0, 0), 0U);
+  EXPECT_EQ(mortonCode(1, 0, 0), 0b100U);
+  EXPECT_EQ(mortonCode(0, 1, 0), 0b010U);
+  EXPECT_EQ(mortonCode(0, 0, 1), 0b001U);
+  EXPECT_EQ(mortonCode(2, 3, 1), 0b110'011U);
+  EXPECT_EQ(mortonCode(65535, 65535, 65535), (uint64_t{1} << 48) - 1);
+  EXPECT_LT(mortonCode(127, 127, 127), mortonCode(128, 0, 0)); // Z-order: the top bit decides first
+}
+
+// Frequency order puts the most used entries first and keeps first-seen order among ties.
+TEST(PaletteOrderTest, FrequencyPositions) {
+  std::vector<size_t> const counts = {3, 10, 3, 0, 10};
+  std::vector<size_t> const positions = paletteOrderPositions(PaletteOrder::frequency, counts, {});
+  EXPECT_EQ(positions, (std::vector<size_t>{1, 4, 0, 2, 3}));
+  EXPECT_EQ(paletteRemap(positions), (std::vector<uint32_t>{2, 0, 3, 4, 1}));
+  EXPECT_EQ(paletteOrderPositions(PaletteOrder::first_seen, counts, {}), (std::vector<size_t>{0, 1, 2, 3, 4}));
+}
+
+// Morton order sorts by code.
+TEST(PaletteOrderTest, MortonPositions) {
+  std::vector<uint64_t> const codes = {mortonCode(200, 0, 0), mortonCode(0, 0, 5), mortonCode(0, 0, 4)};
+  EXPECT_EQ(paletteOrderPositions(PaletteOrder::morton, {1, 1, 1}, codes), (std::vector<size_t>{2, 1, 0}));
+}
+
+TEST(PaletteOrderTest, Names) {
+  for (PaletteOrder const order : {PaletteOrder::first_seen, PaletteOrder::frequency, PaletteOrder::morton}) {
+    EXPECT_EQ(paletteOrderFromName(paletteOrderName(order)), order);
+  }
+  EXPECT_THROW(paletteOrderFromName("hilbert"), std::invalid_argument);
+}
+
+// NOLINTEND(readability-magic-numbers)
+// NOLINTEND(cppcoreguidelines-avoid-magic-numbers)
@@ -0,0 +1,33 @@
+#include "gtest/gtest.h"
+#include <vector>
+#include "../common/parallel.hpp"
+
+// NOLINTBEGIN(cppcoreguidelines-avoid-magic-numbers)
+// NOLINTBEGIN(readability-magic-numbers)
+
+// Every item belongs to exactly one stripe, and stripes follow each other in order.
+TEST(ParallelTest, StripesCoverRange) {
+  for (size_t const stripes : {1UL, 2UL, 7UL, 16UL}) {
+    std::vector<int> visits(1000, 0);
+    std::vector<size_t> begins(stripes);
+    std::vector<size_t> ends(stripes);
+    forEachStripe(visits.size(), stripes, [&](size_t stripe, size_t begin, size_t end) {
+      begins[stripe] = begin;
+      ends[stripe] = end;
+      for (size_t i = begin; i < end; ++i) { ++visits[i]; }
+    });
+    EXPECT_EQ(visits, std::vector<int>(1000, 1));
+    EXPECT_EQ(begins[0], 0);
+    for (size_t stripe = 1; stripe < stripes; ++stripe) { EXPECT_EQ(begins[stripe], ends[stripe - 1]); }
+  }
+}
+
+// Small inputs are not split.
+TEST(ParallelTest, StripeCount) {
+  EXPECT_EQ(stripeCount(10), 1);
+  EXPECT_GE(stripeCount(MIN_ITEMS_PER_STRIPE * 64), 1);
+  EXPECT_LE(stripeCount(MIN_ITEMS_PER_STRIPE * 64), 64);
+}
+
+// NOLINTEND(readability-magic-numbers)
+// NOLINTEND(cppcoreguidelines-avoid-magic-numbers)
@@ -0,0 +1,73 @@
+#include "gtest/gtest.h"
+#include <array>
+#include <cstdint>
+#include <utility>
+#include "../common/pixelbuffer.hpp"
+
+// NOLINTBEGIN(cppcoreguidelines-avoid-magic-numbers)
+// NOLINTBEGIN(readability-magic-numbers)
+// NOLINTBEGIN(cppcoreguidelines-pro-type-reinterpret-cast)
+
+// Every plane starts on a cache line, whatever its element type and size
+TEST(PixelBufferTest, Alignment) {
+  for (size_t const size : std::array<size_t, 6>{1, 3, 63, 64, 65, 1000}) {
+    PixelBuffer<uint8_t> const bytes(size);
+    PixelBuffer<uint16_t> const words(size);
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(bytes.data()) % PIXEL_BUFFER_ALIGNMENT, 0);
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(words.data()) % PIXEL_BUFFER_ALIGNMENT, 0);
+  }
+}
+
+// The buffer still behaves as a vector: values given are kept, copies and moves keep the contents
+TEST(PixelBufferTest, VectorSemantics) {
+  PixelBuffer<uint16_t> buffer(5, 7);
+  for (uint16_t const value : buffer) { EXPECT_EQ(value, 7); }
+  buffer.resize(8, 9);
+  EXPECT_EQ(buffer[4], 7);
+  EXPECT_EQ(buffer[7], 9);
+  PixelBuffer<uint16_t> const copy = buffer;
+  EXPECT_EQ(copy, buffer);
+  PixelBuffer<uint16_t> const moved = std::move(buffer);
+  EXPECT_EQ(moved, copy);
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(moved.data()) % PIXEL_BUFFER_ALIGNMENT, 0);
+}
+
+// A large buffer starts on a huge page, is counted, and has every page first touched; small ones are not placed
+TEST(PixelBufferTest, LargeBufferPlacement) {
+  setPixelBufferPlacement({.huge_pages=true, .first_touch=true, .count_nodes=true});
+  PixelBufferStats const before = pixelBufferStats();
+  PixelBuffer<uint16_t> const small(1000);
+  EXPECT_EQ(pixelBufferStats().large_buffers, before.large_buffers);
+  size_t const count = (PIXEL_BUFFER_LARGE / sizeof(uint16_t)) + 3;
+  PixelBuffer<uint16_t> const large(count);
+  PixelBufferStats const after = pixelBufferStats();
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(large.data()) % PIXEL_BUFFER_HUGE_PAGE, 0);
+  EXPECT_EQ(after.large_buffers, before.large_buffers + 1);
+  size_t const bytes = PIXEL_BUFFER_LARGE + PIXEL_BUFFER_HUGE_PAGE; // Rounded up to whole huge pages
+  EXPECT_EQ(after.large_bytes - before.large_bytes, bytes);
+  EXPECT_EQ(after.touched_pages - before.touched_pages, bytes / PIXEL_BUFFER_PAGE);
+  EXPECT_GE(after.touch_stripes, 1U);
+  size_t sampled = after.unknown_samples - before.unknown_samples;
+  for (size_t node = 0; node < PIXEL_BUFFER_MAX_NODES; ++node) {
+    sampled += after.node_samples[node] - before.node_samples[node];
+  }
+  EXPECT_EQ(sampled, bytes / PIXEL_BUFFER_HUGE_PAGE); // Every huge page is either on a node or unknown
+  setPixelBufferPlacement({});
+}
+
+// With placement off, large buffers are still counted and aligned but neither advised nor touched
+TEST(PixelBufferTest, PlacementOff) {
+  setPixelBufferPlacement({.huge_pages=false, .first_touch=false, .count_nodes=false});
+  PixelBufferStats const before = pixelBufferStats();
+  PixelBuffer<uint8_t> large(PIXEL_BUFFER_LARGE, 5);
+  PixelBufferStats const after = pixelBufferStats();
+  EXPECT_EQ(after.large_buffers, before.large_buffers + 1);
+  EXPECT_EQ(after.advised_bytes, before.advised_bytes);
+  EXPECT_EQ(after.touched_pages, before.touched_pages);
+  EXPECT_EQ(large.back(), 5);
+  setPixelBufferPlacement({});
+}
+
+// NOLINTEND(cppcoreguidelines-pro-type-reinterpret-cast)
+// NOLINTEND(readability-magic-numbers)
+// NOLINTEND(cppcoreguidelines-avoid-magic-numbers)
@@ -0,0 +1,118 @@
+#include "gtest/gtest.h"
+#include <cmath>
+#include "../common/pointops.hpp"
+
+// NOLINTBEGIN(cppcoreguidelines-avoid-magic-numbers)
+// NOLINTBEGIN(readability-magic-numbers)
+
+// maxlevel rounds to the nearest level, halves up, also where the product needs more than 32 bits
+TEST(PointOpsTest, ScaleLevelRounds) {
+  EXPECT_EQ(scaleLevel(1, 1, 2), 1);
+  EXPECT_EQ(scaleLevel(100, 255, 1000), 26);
+  EXPECT_EQ(scaleLevel(65535, 65535, 65535), 65535);
+  for (int const oldMax : {3, 255, 1000, 65535}) {
+    for (int const newMax : {1, 7, 255, 256, 40000, 65535}) {
+      std::vector<uint16_t> const table = maxLevelTable(oldMax, newMax);
+      for (int value = 0; value <= oldMax; ++value) {
+        auto const expected = static_cast<uint16_t>(std::floor((static_cast<double>(value) * newMax / oldMax) + 0.5));
+        ASSERT_EQ(table[static_cast<size_t>(value)], expected) << value << " " << oldMax << " -> " << newMax;
+      }
+    }
+  }
+}
+
+// An empty chain maps every value to itself
+TEST(PointOpsTest, EmptyChainIsIdentity) {
+  PointOpChain const chain;
+  EXPECT_TRUE(chain.empty());
+  EXPECT_EQ(chain.output_max(255), 255);
+  std::vector<uint16_t> const table = chain.table(255);
+  ASSERT_EQ(table.size(), 256U);
+  for (size_t value = 0; value < table.size(); ++value) { EXPECT_EQ(table[value], value); }
+}
+
+// The table of a chain is the composition of its steps, over the whole input component range
+TEST(PointOpsTest, TableComposesSteps) {
+  PointOpChain chain;
+  chain.add_maxlevel(40000);
+  chain.add_maxlevel(17);
+  chain.add_maxlevel(255);
+  EXPECT_FALSE(chain.single_maxlevel());
+  EXPECT_EQ(chain.output_max(1000), 255);
+  std::vector<uint16_t> const table = chain.table(1000);
+  ASSERT_EQ(table.size(), 65536U);
+  for (int value = 0; value <= 1000; ++value) {
+    int const expected = scaleLevel(scaleLevel(scaleLevel(value, 40000, 1000), 17, 40000), 255, 17);
+    EXPECT_EQ(table[static_cast<size_t>(value)], expected) << "value " << value;
+  }
+}
+
+// The intensity curves keep the end points and clip to the maximum level
+TEST(PointOpsTest, CurveLevels) {
+  EXPECT_EQ(gammaLevel(0, 2.2, 255), 0);
+  EXPECT_EQ(gammaLevel(255, 2.2, 255), 255);
+  EXPECT_EQ(gammaLevel(64, 2.0, 255), 128);
+  EXPECT_EQ(gammaLevel(128, 1.0, 255), 128);
+  EXPECT_EQ(levelsLevel(10, 16, 235, 255), 0);
+  EXPECT_EQ(levelsLevel(240, 16, 235, 255), 255);
+  EXPECT_EQ(levelsLevel(125, 16, 234, 255), 128);
+  EXPECT_EQ(contrastLevel(0, 2.0, 255), 0);
+  EXPECT_EQ(contrastLevel(200, 2.0, 255), 255);
+  EXPECT_EQ(contrastLevel(100, 0.0, 255), 128);
+  EXPECT_EQ(contrastLevel(100, 2.0, 1000), 0);
+}
+
+// A chain mixing every kind of operation folds into the steps applied one after the other, each at the maximum
+// level left by the previous maxlevel
+TEST(PointOpsTest, TableComposesCurves) {
+  PointOpChain chain;
+  chain.add_gamma(2.2);
+  chain.add_maxlevel(1000);
+  chain.add_levels(50, 900);
+  chain.add_contrast(1.3);
+  chain.add_maxlevel(255);
+  chain.add_gamma(0.8);
+  EXPECT_EQ(chain.size(), 6U);
+  EXPECT_EQ(chain.output_max(255), 255);
+  std::vector<uint16_t> const table = chain.table(255);
+  ASSERT_EQ(table.size(), 256U);
+  for (int value = 0; value <= 255; ++value) {
+    int level = gammaLevel(value, 2.2, 255);
+    level = scaleLevel(level, 1000, 255);
+    level = contrastLevel(levelsLevel(level, 50, 900, 1000), 1.3, 1000);
+    level = gammaLevel(scaleLevel(level, 255, 1000), 0.8, 255);
+    EXPECT_EQ(table[static_cast<size_t>(value)], level) << "value " << value;
+  }
+  PointOpChain lone;
+  lone.add_maxlevel(100);
+  EXPECT_TRUE(lone.single_maxlevel());
+  lone.add_gamma(1.5);
+  EXPECT_FALSE(lone.single_maxlevel());
+}
+
+// Every specialised conversion gives scaleLevel for every input value, and only its own levels are dispatched
+template<size_t Index>
+void checkFastLevelConversion() {
+  constexpr FastLevelConversion conversion = FAST_LEVEL_CONVERSIONS[Index];
+  for (int value = 0; value <= conversion.from; ++value) {
+    ASSERT_EQ(fastScaleLevel<Index>(static_cast<uint32_t>(value)),
+              static_cast<uint32_t>(scaleLevel(value, conversion.to, conversion.from)))
+        << conversion.from << " -> " << conversion.to << " at " << value;
+  }
+  size_t dispatched = FAST_LEVEL_CONVERSIONS.size();
+  EXPECT_TRUE(withFastLevelConversion(conversion.from, conversion.to,
+                                      [&](auto index) { dispatched = decltype(index)::value; }));
+  EXPECT_EQ(dispatched, Index);
+}
+
+TEST(PointOpsTest, FastLevelConversionsMatchScaleLevel) {
+  checkFastLevelConversion<0>();
+  checkFastLevelConversion<1>();
+  checkFastLevelConversion<2>();
+  checkFastLevelConversion<3>();
+  static_assert(FAST_LEVEL_CONVERSIONS.size() == 4);
+  EXPECT_FALSE(withFastLevelConversion(255, 100, [](auto /*index*/) {}));
+}
+
+// NOLINTEND(readability-magic-numbers)
+// NOLINTEND(cppcoreguidelines-avoid-magic-numbers)
@@ -1,5 +1,7 @@
 #include "gtest/gtest.h"
 #include "../common/progargs.hpp"
+#include <cstdio>
+#include <fstream>
 
 // NOLINTBEGIN(cppcoreguidelines-avoid-magic-numbers)
 // NOLINTBEGIN(readability-magic-numbers)
@@ -138,6 +140,187 @@ TEST(ProgArgsTest, InvalidCutFreq) {
   EXPECT_EXIT(parseArgs(args), ::testing::ExitedWithCode(255),"Invalid cutfreq: -1");
 }
 
+// Cutfreq operation with approximate search tolerance
+TEST(ProgArgsTest, CutFreqTolerance) {
+  std::vector<std::string> const args = {"program", "input.ppm", "output.ppm", "cutfreq", "50", "--tolerance=12.5"};
+  ProgramArgs const parsedArgs = parseArgs(args);
+  EXPECT_EQ(parsedArgs.max_level, 50);
+  EXPECT_DOUBLE_EQ(parsedArgs.tolerance, 12.5);
+}
+
+// Tolerance must be a non negative number
+TEST(ProgArgsTest, InvalidTolerance) {
+  std::vector<std::string> const args = {"program", "input.ppm", "output.ppm", "cutfreq", "50", "--tolerance=-3"};
+  EXPECT_EXIT(parseArgs(args), ::testing::ExitedWithCode(255), "Invalid tolerance: -3");
+}
+
+// Tolerance is only accepted by cutfreq
+TEST(ProgArgsTest, ToleranceWrongOperation) {
+  std::vector<std::string> const args = {"program", "input.ppm", "output.ppm", "maxlevel", "255", "--tolerance=3"};
+  EXPECT_EXIT(parseArgs(args), ::testing::ExitedWithCode(255), "Option --tolerance is only valid for cutfreq");
+}
+
+// Forced search strategy and verbose output
+TEST(ProgArgsTest, CutFreqSearchVerbose) {
+  std::vector<std::string> const args = {"program", "input.ppm", "output.ppm", "cutfreq", "50", "--search=grid", "--verbose"};
+  ProgramArgs const parsedArgs = parseArgs(args);
+  EXPECT_EQ(parsedArgs.search, "grid");
+  EXPECT_TRUE(parsedArgs.verbose);
+}
+
+// Unknown search strategy
+TEST(ProgArgsTest, InvalidSearch) {
+  std::vector<std::string> const args = {"program", "input.ppm", "output.ppm", "cutfreq", "50", "--search=octree"};
+  EXPECT_EXIT(parseArgs(args), ::testing::ExitedWithCode(255), "Invalid search strategy: octree");
+}
+
+// Bit-packed CPPM output
+TEST(ProgArgsTest, CompressBitpack) {
+  std::vector<std::string> const args = {"program", "input.ppm", "output.cppm", "compress", "--bitpack"};
+  EXPECT_TRUE(parseArgs(args).bitpack);
+  std::vector<std::string> const info = {"program", "input.ppm", "output.ppm", "info", "--bitpack"};
+  EXPECT_EXIT(parseArgs(info), ::testing::ExitedWithCode(255), "Option --bitpack is only valid for");
+}
+
+// Entropy-coded CPPM output, which excludes bit packing
+TEST(ProgArgsTest, CompressEntropy) {
+  std::vector<std::string> const args = {"program", "input.ppm", "output.cppm", "compress", "--entropy"};
+  EXPECT_TRUE(parseArgs(args).entropy);
+  std::vector<std::string> const both = {"program", "input.ppm", "output.cppm", "compress", "--entropy", "--bitpack"};
+  EXPECT_EXIT(parseArgs(both), ::testing::ExitedWithCode(255), "cannot be combined");
+}
+
+// Test for --chunk-rows: a positive row count, only for operations that write CPPM files.
+TEST(ProgArgsTest, CompressChunkRows) {
+  std::vector<std::string> const args = {"program", "input.ppm", "output.cppm", "compress", "--chunk-rows=64"};
+  EXPECT_EQ(parseArgs(args).chunk_rows, 64);
+  std::vector<std::string> const zero = {"program", "input.ppm", "output.cppm", "compress", "--chunk-rows=0"};
+  EXPECT_EXIT(parseArgs(zero), ::testing::ExitedWithCode(255), "Invalid chunk rows");
+  std::vector<std::string> const info = {"program", "input.ppm", "output.ppm", "info", "--chunk-rows=8"};
+  EXPECT_EXIT(parseArgs(info), ::testing::ExitedWithCode(255), "only valid for compress");
+}
+
+// Test for --palette-order: one of the known orders, only for operations that write CPPM files.
+TEST(ProgArgsTest, CompressPaletteOrder) {
+  std::vector<std::string> const args = {"program", "input.ppm", "output.cppm", "compress", "--palette-order=freq"};
+  EXPECT_EQ(parseArgs(args).palette_order, "freq");
+  std::vector<std::string> const unknown = {"program", "input.ppm", "output.cppm", "compress", "--palette-order=x"};
+  EXPECT_EXIT(parseArgs(unknown), ::testing::ExitedWithCode(255), "Invalid palette order");
+}
+
+// The coding options on maxlevel and cutfreq only where they write C-PPM: from a C-PPM file to a .cppm file
+TEST(ProgArgsTest, CodingOptionsNeedCppmOutput) {
+  std::string const cppm_input = "progargs_palette_input.cppm";
+  std::ofstream(cppm_input) << "C6 1 1 255 1\n";
+  for (std::string const option : {"--bitpack", "--entropy", "--chunk-rows=4", "--palette-order=freq"}) {
+    std::vector<std::string> const palette = {"program", cppm_input, "output.cppm", "cutfreq", "5", option};
+    EXPECT_EQ(parseArgs(palette).operation, "cutfreq");
+    std::vector<std::string> const p6_input = {"program", "input.ppm", "output.cppm", "maxlevel", "100", option};
+    EXPECT_EXIT(parseArgs(p6_input), ::testing::ExitedWithCode(255), "only valid for compress");
+    std::vector<std::string> const p6_output = {"program", cppm_input, "output.ppm", "maxlevel", "100", option};
+    EXPECT_EXIT(parseArgs(p6_output), ::testing::ExitedWithCode(255), "only valid for compress");
+    std::vector<std::string> const chained = {"program", cppm_input, "output.cppm", "maxlevel", "100", "cutfreq", "5",
+                                              option};
+    EXPECT_EXIT(parseArgs(chained), ::testing::ExitedWithCode(255), "only valid for compress");
+    std::vector<std::string> const compressed = {"program", "input.ppm", "output.cppm", "maxlevel", "100", "compress",
+                                                 option};
+    EXPECT_EQ(parseArgs(compressed).steps.size(), 2U);
+  }
+  std::vector<std::string> const dithered = {"program", cppm_input, "output.cppm", "maxlevel", "100", "--dither=fs",
+                                             "--bitpack"};
+  EXPECT_EXIT(parseArgs(dithered), ::testing::ExitedWithCode(255), "only valid for compress");
+  std::remove(cppm_input.c_str());
+}
+
+TEST(ProgArgsTest, CompressStream) {
+  std::vector<std::string> const args = {"program", "input.ppm", "output.cppm", "compress", "--stream"};
+  EXPECT_TRUE(parseArgs(args).stream);
+  std::vector<std::string> const maxlevel = {"program", "input.ppm", "output.ppm", "maxlevel", "255", "--stream"};
+  EXPECT_EXIT(parseArgs(maxlevel), ::testing::ExitedWithCode(255), "only valid for compress");
+  std::vector<std::string> const entropy = {"program", "input.ppm", "output.cppm", "compress", "--stream", "--entropy"};
+  EXPECT_EXIT(parseArgs(entropy), ::testing::ExitedWithCode(255), "needs --chunk-rows");
+  std::string const cppm_input = "progargs_stream_input.cppm";
+  std::ofstream(cppm_input) << "C6 1 1 255 1\n";
+  std::vector<std::string> const compressed = {"program", cppm_input, "output.cppm", "compress", "--stream"};
+  EXPECT_EXIT(parseArgs(compressed), ::testing::ExitedWithCode(255), "needs a P6 input");
+  std::vector<std::string> const plain = {"program", cppm_input, "output.cppm", "compress"};
+  EXPECT_FALSE(streamsCompress(parseArgs(plain)));
+  std::remove(cppm_input.c_str());
+}
+
+// Several operations in one invocation, each with its own parameters
+TEST(ProgArgsTest, Pipeline) {
+  std::vector<std::string> const args = {"program", "input.ppm", "output.cppm", "resize", "300", "200",
+                                         "maxlevel", "100", "cutfreq", "5", "compress"};
+  ProgramArgs const parsedArgs = parseArgs(args);
+  ASSERT_EQ(parsedArgs.steps.size(), 4U);
+  EXPECT_EQ(parsedArgs.operation, "resize");
+  EXPECT_EQ(parsedArgs.width, 300);
+  EXPECT_EQ(parsedArgs.height, 200);
+  EXPECT_EQ(parsedArgs.steps[1].operation, "maxlevel");
+  EXPECT_EQ(parsedArgs.steps[1].max_level, 100);
+  EXPECT_EQ(parsedArgs.steps[2].max_level, 5);
+  EXPECT_EQ(parsedArgs.steps[3].operation, "compress");
+  std::vector<std::string> const single = {"program", "input.ppm", "output.ppm", "maxlevel", "255"};
+  EXPECT_EQ(parseArgs(single).steps.size(), 1U);
+}
+
+// Each step is validated as a single operation, info cannot be chained and compress must be last
+TEST(ProgArgsTest, PipelineInvalid) {
+  std::vector<std::string> const extra = {"program", "input.ppm", "output.ppm", "maxlevel", "255", "1", "resize", "2", "2"};
+  EXPECT_EXIT(parseArgs(extra), ::testing::ExitedWithCode(255), "Invalid number of extra arguments for maxlevel: 2");
+  std::vector<std::string> const info = {"program", "input.ppm", "output.ppm", "maxlevel", "255", "info"};
+  EXPECT_EXIT(parseArgs(info), ::testing::ExitedWithCode(255), "Operation info cannot be chained");
+  std::vector<std::string> const compress = {"program", "input.ppm", "output.ppm", "compress", "maxlevel", "255"};
+  EXPECT_EXIT(parseArgs(compress), ::testing::ExitedWithCode(255), "Operation compress must be the last one");
+  std::vector<std::string> const tolerance = {"program", "input.ppm", "output.ppm", "maxlevel", "255", "cutfreq", "5",
+                                              "--tolerance=1"};
+  EXPECT_EQ(parseArgs(tolerance).tolerance, 1.0);
+}
+
+// gamma, levels and contrast are steps like the others, with their own parameters
+TEST(ProgArgsTest, IntensityCurves) {
+  std::vector<std::string> const args = {"program", "input.ppm", "output.ppm", "gamma", "2.2", "levels", "16",
+                                         "235", "contrast", "1.5", "maxlevel", "255"};
+  ProgramArgs const parsedArgs = parseArgs(args);
+  ASSERT_EQ(parsedArgs.steps.size(), 4U);
+  EXPECT_EQ(parsedArgs.operation, "gamma");
+  EXPECT_DOUBLE_EQ(parsedArgs.steps[0].factor, 2.2);
+  EXPECT_EQ(parsedArgs.steps[1].black, 16);
+  EXPECT_EQ(parsedArgs.steps[1].white, 235);
+  EXPECT_DOUBLE_EQ(parsedArgs.steps[2].factor, 1.5);
+  EXPECT_EQ(parsedArgs.steps[3].max_level, 255);
+}
+
+TEST(ProgArgsTest, IntensityCurvesInvalid) {
+  std::vector<std::string> const gamma = {"program", "input.ppm", "output.ppm", "gamma", "0"};
+  EXPECT_EXIT(parseArgs(gamma), ::testing::ExitedWithCode(255), "Invalid gamma: 0");
+  std::vector<std::string> const contrast = {"program", "input.ppm", "output.ppm", "contrast", "abc"};
+  EXPECT_EXIT(parseArgs(contrast), ::testing::ExitedWithCode(255), "Invalid contrast: abc");
+  std::vector<std::string> const levels = {"program", "input.ppm", "output.ppm", "levels", "200", "100"};
+  EXPECT_EXIT(parseArgs(levels), ::testing::ExitedWithCode(255), "Invalid levels: 200, 100");
+  std::vector<std::string> const missing = {"program", "input.ppm", "output.ppm", "levels", "16"};
+  EXPECT_EXIT(parseArgs(missing), ::testing::ExitedWithCode(255), "Invalid number of extra arguments for levels: 1");
+}
+
+// --dither picks how maxlevel lowers the level, and needs a maxlevel step
+TEST(ProgArgsTest, DitherOption) {
+  std::vector<std::string> const args = {"program", "input.ppm", "output.ppm", "maxlevel", "15", "--dither=fs"};
+  EXPECT_EQ(parseArgs(args).dither, "fs");
+  std::vector<std::string> const unknown = {"program", "input.ppm", "output.ppm", "maxlevel", "15", "--dither=x"};
+  EXPECT_EXIT(parseArgs(unknown), ::testing::ExitedWithCode(255), "Invalid dither method: x");
+  std::vector<std::string> const resize = {"program", "input.ppm", "output.ppm", "resize", "2", "2", "--dither=bayer"};
+  EXPECT_EXIT(parseArgs(resize), ::testing::ExitedWithCode(255), "Option --dither is only valid for maxlevel");
+}
+
+// --no-page-placement turns off huge pages and first touch for every operation
+TEST(ProgArgsTest, NoPagePlacement) {
+  std::vector<std::string> const args = {"program", "input.ppm", "output.ppm", "resize", "2", "2"};
+  EXPECT_TRUE(parseArgs(args).page_placement);
+  std::vector<std::string> const off = {"program", "input.ppm", "output.ppm", "resize", "2", "2", "--no-page-placement"};
+  EXPECT_FALSE(parseArgs(off).page_placement);
+}
+
 // NOLINTEND(cppcoreguidelines-pro-type-reinterpret-cast)
 // NOLINTEND(readability-magic-numbers)
 // NOLINTEND(cppcoreguidelines-avoid-magic-numbers)
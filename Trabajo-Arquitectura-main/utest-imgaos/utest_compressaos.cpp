@@ -1,6 +1,10 @@
 #include "gtest/gtest.h"
+#include <fstream>
+#include <iterator>
 #include <sstream>
+#include <string>
 #include "../imgaos/compressaos.hpp"
+#include "../common/streamcompress.hpp"
 
 // NOLINTBEGIN(cppcoreguidelines-avoid-magic-numbers)
 // NOLINTBEGIN(readability-magic-numbers)
@@ -164,6 +168,404 @@ TEST(CompressAOSTest, ProcessLargePixelImage) {
   size_t const expected_size = 15 + 24 + 4; // 15 bytes for the header, 24 bytes for color table + 4 indices (4 colors/pixels).
   EXPECT_EQ(output.str().size(), expected_size); // Compare actual and expected output.
 }
+
+// Test for the dense color table: same first-seen order and same index bytes as the map version.
+TEST(CompressAOSTest, DenseColorTableMatchesMap) {
+  PixelBuffer<SmallPixel> pixels;
+  for (int i = 0; i < 3000; ++i) { // More than 256 colors, so indices take 2 bytes
+    pixels.push_back({.red=static_cast<uint8_t>((i * 7) % 256), .green=static_cast<uint8_t>((i * 13) % 256),
+                      .blue=static_cast<uint8_t>(i % 5)});
+  }
+  std::vector<SmallPixel> map_colors;
+  auto const color_map = generate_color_table(pixels, map_colors);
+  std::vector<SmallPixel> dense_colors;
+  DenseColorTable const table = generate_dense_color_table(pixels, dense_colors);
+  EXPECT_EQ(dense_colors, map_colors);
+  EXPECT_EQ(table.size, map_colors.size());
+  std::ostringstream map_output;
+  std::ostringstream dense_output;
+  write_pixel_indices<SmallPixel, uint16_t>(map_output, pixels, color_map);
+  write_dense_pixel_indices<uint16_t>(dense_output, pixels, table);
+  EXPECT_EQ(dense_output.str(), map_output.str());
+}
+
+// Test for the parallel encoder: any number of stripes gives the same table and index bytes as one stripe.
+TEST(CompressAOSTest, StripesMatchSequential) {
+  PixelBuffer<SmallPixel> small;
+  PixelBuffer<LargePixel> large;
+  for (int i = 0; i < 5000; ++i) {
+    small.push_back({.red=static_cast<uint8_t>((i * i) % 251), .green=static_cast<uint8_t>(i % 7), .blue=0});
+    large.push_back({.red=static_cast<uint16_t>((i * i) % 4001), .green=static_cast<uint16_t>(i % 3), .blue=1});
+  }
+  std::vector<SmallPixel> small_colors;
+  DenseColorTable const small_table = generate_dense_color_table(small, small_colors, 1);
+  std::ostringstream small_expected;
+  write_dense_pixel_indices<uint16_t>(small_expected, small, small_table, 1);
+  std::vector<LargePixel> large_colors;
+  auto const large_map = generate_color_table(large, large_colors, 1);
+  std::ostringstream large_expected;
+  write_pixel_indices<LargePixel, uint16_t>(large_expected, large, large_map, 1);
+  for (size_t const stripes : {2UL, 3UL, 8UL}) {
+    std::vector<SmallPixel> colors;
+    DenseColorTable const table = generate_dense_color_table(small, colors, stripes);
+    EXPECT_EQ(colors, small_colors);
+    std::ostringstream output;
+    write_dense_pixel_indices<uint16_t>(output, small, table, stripes);
+    EXPECT_EQ(output.str(), small_expected.str());
+    std::vector<LargePixel> large_stripe_colors;
+    auto const color_map = generate_color_table(large, large_stripe_colors, stripes);
+    EXPECT_EQ(large_stripe_colors, large_colors);
+    std::ostringstream large_output;
+    write_pixel_indices<LargePixel, uint16_t>(large_output, large, color_map, stripes);
+    EXPECT_EQ(large_output.str(), large_expected.str());
+  }
+}
+
+// Test for read_cppm: decoding a compressed image gives back the original pixels.
+TEST(CompressAOSTest, ReadCppmRoundTrip) {
+  PPMImageAOS small = createAOSSmallImage();
+  for (int i = 0; i < 300; ++i) { // More than 256 colors, so indices take 2 bytes
+    small.sPixels.push_back({.red=static_cast<uint8_t>(i % 256), .green=static_cast<uint8_t>(i / 256), .blue=7});
+  }
+  small.height = static_cast<int>(small.sPixels.size()) / small.width;
+  std::stringstream small_file;
+  process_small_pixel_image(small_file, small);
+  PPMImageAOS const small_read = read_cppm(small_file);
+  EXPECT_EQ(small_read.width, small.width);
+  EXPECT_EQ(small_read.height, small.height);
+  EXPECT_EQ(small_read.max_color_value, small.max_color_value);
+  EXPECT_EQ(small_read.sPixels, small.sPixels);
+
+  PPMImageAOS const large = createAOSLargeImage();
+  std::stringstream large_file;
+  process_large_pixel_image(large_file, large);
+  EXPECT_EQ(read_cppm(large_file).lPixels, large.lPixels);
+}
+
+// Test for read_cppm: an index outside the color table is rejected.
+TEST(CompressAOSTest, ReadCppmInvalidIndex) {
+  std::stringstream file;
+  file << "C6 2 1 255 1\n";
+  file.write("\1\2\3\0\1", 5); // One color, then indices 0 and 1
+  EXPECT_THROW(read_cppm(file), std::runtime_error);
+  std::stringstream header("C6 0 1 255 1\n");
+  EXPECT_THROW(read_cppm(header), std::runtime_error);
+}
+
+// Test for bit-packed indices: 300 colors take 9 bits per pixel instead of 16, and decode the same.
+TEST(CompressAOSTest, BitPackedRoundTrip) {
+  PPMImageAOS small = createAOSSmallImage();
+  for (int i = 0; i < 300; ++i) {
+    small.sPixels.push_back({.red=static_cast<uint8_t>(i % 256), .green=static_cast<uint8_t>(i / 256), .blue=7});
+  }
+  small.height = static_cast<int>(small.sPixels.size()) / small.width;
+  std::stringstream plain;
+  process_small_pixel_image(plain, small);
+  std::stringstream packed;
+  process_small_pixel_image(packed, small, {.flags=CPPM_FLAG_BITPACKED});
+  EXPECT_LT(packed.str().size(), plain.str().size());
+  std::string header;
+  std::getline(packed, header);
+  EXPECT_EQ(header, "C6 " + std::to_string(small.width) + " " + std::to_string(small.height) + " 255 304 1"); // 4 + 300 colors, flags
+  packed.seekg(0);
+  EXPECT_EQ(read_cppm(packed).sPixels, small.sPixels);
+
+  PPMImageAOS const large = createAOSLargeImage();
+  std::stringstream large_file;
+  process_large_pixel_image(large_file, large, {.flags=CPPM_FLAG_BITPACKED});
+  EXPECT_EQ(read_cppm(large_file).lPixels, large.lPixels);
+}
+
+// Test for read_cppm: flags this reader does not know are rejected.
+TEST(CompressAOSTest, ReadCppmUnknownFlags) {
+  std::stringstream file;
+  file << "C6 2 1 255 1 6\n";
+  file.write("\1\2\3", 3);
+  EXPECT_THROW(read_cppm(file), std::runtime_error);
+}
+
+// Test for entropy-coded indices: a flat image shrinks to a few bytes of indices and decodes the same.
+TEST(CompressAOSTest, EntropyRoundTrip) {
+  PPMImageAOS image;
+  image.width = 100;
+  image.height = 100;
+  image.max_color_value = 255;
+  for (int i = 0; i < 10000; ++i) { // Wide bands of 300 colors
+    image.sPixels.push_back({.red=static_cast<uint8_t>(i / 40), .green=static_cast<uint8_t>(i / 2560), .blue=1});
+  }
+  std::stringstream plain;
+  process_small_pixel_image(plain, image);
+  std::stringstream coded;
+  process_small_pixel_image(coded, image, {.flags=CPPM_FLAG_ENTROPY});
+  EXPECT_LT(coded.str().size() * 4, plain.str().size());
+  EXPECT_EQ(read_cppm(coded).sPixels, image.sPixels);
+
+  PPMImageAOS const large = createAOSLargeImage();
+  std::stringstream large_file;
+  process_large_pixel_image(large_file, large, {.flags=CPPM_FLAG_ENTROPY});
+  EXPECT_EQ(read_cppm(large_file).lPixels, large.lPixels);
+
+  std::stringstream both("C6 2 1 255 1 3\n"); // Bit packing and entropy coding exclude each other
+  EXPECT_THROW(read_cppm(both), std::runtime_error);
+}
+
+// An entropy-coded block must carry a table summing to the probability scale, even when it codes no byte: a
+// crafted one with oversized frequencies is rejected instead of overflowing the decoder's slot table.
+TEST(CompressAOSTest, EntropyEmptyBlockBogusTable) {
+  std::stringstream bogus;
+  write_binary(bogus, uint64_t{0}); // No byte coded
+  write_binary_buffer(bogus, std::vector<uint16_t>(RANS_SYMBOLS, 4000));
+  write_binary(bogus, uint64_t{16});
+  write_binary_buffer(bogus, std::vector<uint8_t>(16, 0xAB));
+  EXPECT_THROW(read_rans_block(bogus, 100), std::runtime_error);
+
+  std::stringstream empty; // The encoder's own empty block still reads back
+  write_rans_block(empty, encode_rans_block({}));
+  EXPECT_TRUE(read_rans_block(empty, 100).empty());
+}
+
+// Test for row groups: every coding decodes whole and by row range, from any group boundary.
+TEST(CompressAOSTest, ChunkedRoundTrip) {
+  PPMImageAOS image;
+  image.width = 7;
+  image.height = 10;
+  image.max_color_value = 255;
+  for (int i = 0; i < 70; ++i) {
+    image.sPixels.push_back({.red=static_cast<uint8_t>(i / 3), .green=static_cast<uint8_t>(i % 5), .blue=9});
+  }
+  for (unsigned const coding : {0U, CPPM_FLAG_BITPACKED, CPPM_FLAG_ENTROPY}) {
+    std::stringstream file;
+    process_small_pixel_image(file, image, {.flags=CPPM_FLAG_CHUNKED | coding, .group_rows=3}); // Groups of 3, 3, 3 and 1 rows
+    std::string header;
+    std::getline(file, header);
+    EXPECT_EQ(header, "C6 7 10 255 70 " + std::to_string(CPPM_FLAG_CHUNKED | coding) + " 3");
+    file.seekg(0);
+    EXPECT_EQ(read_cppm(file).sPixels, image.sPixels);
+    for (auto const &[first_row, rows] : {std::pair{0, 10}, std::pair{2, 5}, std::pair{3, 3}, std::pair{9, 1}}) {
+      file.clear();
+      file.seekg(0);
+      PPMImageAOS const range = read_cppm_rows(file, first_row, rows);
+      EXPECT_EQ(range.height, rows);
+      EXPECT_EQ(range.sPixels, PixelBuffer<SmallPixel>(image.sPixels.begin() + first_row * 7,
+                                                       image.sPixels.begin() + (first_row + rows) * 7));
+    }
+  }
+
+  std::stringstream plain; // Row ranges of files without groups
+  process_small_pixel_image(plain, image);
+  EXPECT_EQ(read_cppm_rows(plain, 4, 2).sPixels, PixelBuffer<SmallPixel>(image.sPixels.begin() + 28,
+                                                                         image.sPixels.begin() + 42));
+  plain.seekg(0);
+  EXPECT_THROW(read_cppm_rows(plain, 8, 3), std::runtime_error);
+
+  PPMImageAOS const large = createAOSLargeImage();
+  std::stringstream large_file;
+  process_large_pixel_image(large_file, large, {.flags=CPPM_FLAG_CHUNKED, .group_rows=1});
+  EXPECT_EQ(read_cppm(large_file).lPixels, large.lPixels);
+
+  std::stringstream truncated; // Offset index cut short
+  process_small_pixel_image(truncated, image, {.flags=CPPM_FLAG_CHUNKED, .group_rows=3});
+  std::string bytes = truncated.str();
+  bytes.resize(bytes.size() - 8);
+  std::stringstream broken(bytes);
+  EXPECT_THROW(read_cppm(broken), std::runtime_error);
+}
+
+// Test for palette orders: the most used color comes first in frequency order, and every order decodes the same.
+TEST(CompressAOSTest, PaletteOrderRoundTrip) {
+  PPMImageAOS image;
+  image.width = 10;
+  image.height = 10;
+  image.max_color_value = 255;
+  for (int i = 0; i < 100; ++i) { // Color 7 on most pixels
+    uint8_t const value = i % 4 == 0 ? static_cast<uint8_t>(i) : 7;
+    image.sPixels.push_back({.red=value, .green=value, .blue=value});
+  }
+  for (PaletteOrder const order : {PaletteOrder::frequency, PaletteOrder::morton}) {
+    for (unsigned const flags : {0U, CPPM_FLAG_ENTROPY}) {
+      std::stringstream file;
+      process_small_pixel_image(file, image, {.flags=flags, .order=order});
+      PaletteImageAOS const palette = read_palette_image(file);
+      EXPECT_EQ(palette.sColors.size(), 26U);
+      if (order == PaletteOrder::frequency) { EXPECT_EQ(palette.sColors[0].red, 7); }
+      if (order == PaletteOrder::morton) { EXPECT_EQ(palette.sColors[0].red, 0); } // Black has the lowest code
+      file.seekg(0);
+      EXPECT_EQ(read_cppm(file).sPixels, image.sPixels);
+    }
+  }
+  PPMImageAOS const large = createAOSLargeImage();
+  std::stringstream large_file;
+  process_large_pixel_image(large_file, large, {.order=PaletteOrder::morton});
+  EXPECT_EQ(read_cppm(large_file).lPixels, large.lPixels);
+}
+
+// Test for the raw fallback: a table with one color per pixel loses to the pixels themselves, so they are stored
+// without it, delta coded when smooth and raw when noisy; every reader accepts both.
+TEST(CompressAOSTest, RawFallbackRoundTrip) {
+  PPMImageAOS smooth;
+  smooth.width = 16;
+  smooth.height = 16;
+  smooth.max_color_value = 255;
+  PPMImageAOS noisy = smooth;
+  uint32_t seed = 12345;
+  for (int i = 0; i < 256; ++i) { // Every pixel a different color
+    auto const value = static_cast<uint8_t>(i);
+    smooth.sPixels.push_back({.red=value, .green=value, .blue=static_cast<uint8_t>(255 - i)});
+    seed = seed * 1103515245U + 12345U;
+    noisy.sPixels.push_back({.red=value, .green=static_cast<uint8_t>(seed >> 24), .blue=static_cast<uint8_t>(seed >> 16)});
+  }
+  for (auto const &[image, flags] : {std::pair{smooth, CPPM_FLAG_DELTA}, std::pair{noisy, CPPM_FLAG_RAW}}) {
+    std::stringstream file;
+    process_small_pixel_image(file, image, {.raw_fallback=true});
+    std::string header;
+    std::getline(file, header);
+    EXPECT_EQ(header, "C6 16 16 255 0 " + std::to_string(flags));
+    file.seekg(0);
+    EXPECT_EQ(read_cppm(file).sPixels, image.sPixels);
+    file.clear();
+    file.seekg(0);
+    EXPECT_EQ(read_cppm_rows(file, 5, 3).sPixels, PixelBuffer<SmallPixel>(image.sPixels.begin() + 80,
+                                                                          image.sPixels.begin() + 128));
+    file.clear();
+    file.seekg(0);
+    PaletteImageAOS const palette = read_palette_image(file); // Gets a table back
+    EXPECT_EQ(palette.header.color_table_size, 256U);
+    EXPECT_EQ(palette.header.flags, 0U);
+  }
+
+  std::stringstream table; // Without the option the table is kept
+  process_small_pixel_image(table, smooth);
+  std::string header;
+  std::getline(table, header);
+  EXPECT_EQ(header, "C6 16 16 255 256");
+
+  PPMImageAOS flat = smooth; // One color: the table pays off
+  flat.sPixels.assign(256, {.red=1, .green=2, .blue=3});
+  std::stringstream flat_file;
+  process_small_pixel_image(flat_file, flat, {.raw_fallback=true});
+  EXPECT_EQ(read_palette_image(flat_file).header.color_table_size, 1U);
+
+  for (std::string const bad : {"C6 2 1 255 0\n", "C6 2 1 255 3 8\n", "C6 2 1 255 0 9\n", "C6 2 1 255 0 24\n"}) {
+    std::stringstream file(bad); // No table without a sample layout, and sample layouts exclude every other flag
+    EXPECT_THROW(read_cppm(file), std::runtime_error);
+  }
+}
+
+// Test for the streaming compressor: same bytes as write_cppm for every option it supports, with blocks small
+// enough that the image spans several.
+TEST(CompressAOSTest, StreamCompressMatchesWriteCppm) {
+  PPMImageAOS image;
+  image.width = 37;
+  image.height = 23;
+  image.max_color_value = 255;
+  for (int i = 0; i < 37 * 23; ++i) {
+    image.sPixels.push_back({.red=static_cast<uint8_t>(i % 11 * 20), .green=static_cast<uint8_t>(i / 100),
+                             .blue=static_cast<uint8_t>(i % 3)});
+  }
+  PPMImageAOS large = image;
+  large.max_color_value = 65535;
+  for (const SmallPixel &pixel : image.sPixels) {
+    large.lPixels.push_back({.red=static_cast<uint16_t>(pixel.red * 257), .green=pixel.green, .blue=1000});
+  }
+  large.sPixels.clear();
+  auto contents = [](const std::string &filename) {
+    std::ifstream file(filename, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+  };
+  for (PPMImageAOS const &source : {image, large}) {
+    writeImageAOS("stream_test.ppm", source);
+    for (CPPMWriteOptions const &options : {CPPMWriteOptions{}, CPPMWriteOptions{.flags=CPPM_FLAG_BITPACKED},
+                                            CPPMWriteOptions{.flags=CPPM_FLAG_CHUNKED, .group_rows=5},
+                                            CPPMWriteOptions{.flags=CPPM_FLAG_CHUNKED | CPPM_FLAG_ENTROPY, .group_rows=4},
+                                            CPPMWriteOptions{.flags=CPPM_FLAG_BITPACKED, .order=PaletteOrder::frequency},
+                                            CPPMWriteOptions{.order=PaletteOrder::morton}}) {
+      stream_compress("stream_test.ppm", "stream_test.cppm", options, 100); // Rounded up to 128 pixels
+      write_cppm("stream_test_memory.cppm", source, options);
+      EXPECT_EQ(contents("stream_test.cppm"), contents("stream_test_memory.cppm")) << "flags " << options.flags;
+    }
+  }
+  EXPECT_THROW(stream_compress("stream_test.ppm", "stream_test.cppm", {.flags=CPPM_FLAG_ENTROPY}),
+               std::invalid_argument);
+
+  PPMImageAOS noisy = image; // One color per pixel: stored raw
+  for (size_t i = 0; i < noisy.sPixels.size(); ++i) {
+    noisy.sPixels[i] = {.red=static_cast<uint8_t>(i), .green=static_cast<uint8_t>(i >> 8), .blue=static_cast<uint8_t>(i * 7)};
+  }
+  writeImageAOS("stream_test.ppm", noisy);
+  stream_compress("stream_test.ppm", "stream_test.cppm", {.raw_fallback=true}, 64);
+  std::ifstream compressed("stream_test.cppm", std::ios::binary);
+  EXPECT_EQ(read_cppm(compressed).sPixels, noisy.sPixels);
+  EXPECT_EQ(contents("stream_test.cppm").substr(0, 16), "C6 37 23 255 0 8");
+
+  PPMImageAOS random = image; // Nothing to predict: raw in memory too, and the same bytes
+  uint32_t seed = 12345;
+  for (SmallPixel &pixel : random.sPixels) {
+    seed = seed * 1103515245U + 12345U;
+    pixel = {.red=static_cast<uint8_t>(seed >> 24), .green=static_cast<uint8_t>(seed >> 16), .blue=static_cast<uint8_t>(seed >> 8)};
+  }
+  writeImageAOS("stream_test.ppm", random);
+  stream_compress("stream_test.ppm", "stream_test.cppm", {.raw_fallback=true}, 64);
+  write_cppm("stream_test_memory.cppm", random, {.raw_fallback=true});
+  EXPECT_EQ(contents("stream_test.cppm"), contents("stream_test_memory.cppm"));
+
+  PPMImageAOS smooth = image; // One color per pixel, but predictable: in memory the delta layout is smaller
+  for (size_t i = 0; i < smooth.sPixels.size(); ++i) {
+    auto const value = static_cast<uint8_t>(i);
+    smooth.sPixels[i] = {.red=value, .green=static_cast<uint8_t>(i / 4), .blue=static_cast<uint8_t>(255 - value)};
+  }
+  writeImageAOS("stream_test.ppm", smooth);
+  stream_compress("stream_test.ppm", "stream_test.cppm", {.raw_fallback=true}, 64);
+  write_cppm("stream_test_memory.cppm", smooth, {.raw_fallback=true});
+  EXPECT_EQ(contents("stream_test.cppm").substr(0, 17), "C6 37 23 255 0 8\n"); // The stream never tries delta
+  EXPECT_EQ(contents("stream_test_memory.cppm").substr(0, 18), "C6 37 23 255 0 16\n");
+  std::ifstream streamed("stream_test.cppm", std::ios::binary);
+  std::ifstream in_memory("stream_test_memory.cppm", std::ios::binary);
+  EXPECT_EQ(read_cppm(streamed).sPixels, smooth.sPixels);
+  EXPECT_EQ(read_cppm(in_memory).sPixels, smooth.sPixels);
+
+  std::ofstream truncated("stream_test.ppm", std::ios::binary);
+  truncated << "P6 37 23 255\n" << std::string(100, 'x');
+  truncated.close();
+  EXPECT_THROW(stream_compress("stream_test.ppm", "stream_test.cppm"), std::runtime_error);
+}
+
+// Headers of any length, including one ending at byte 64 and a maximum value crossing it
+TEST(CompressAOSTest, StreamHeaderOfAnyLength) {
+  PPMImageAOS image;
+  image.width = 5;
+  image.height = 3;
+  image.max_color_value = 65535;
+  for (int i = 0; i < 5 * 3; ++i) {
+    image.lPixels.push_back({.red=static_cast<uint16_t>(i * 4000), .green=static_cast<uint16_t>(i % 2), .blue=300});
+  }
+  auto contents = [](const std::string &filename) {
+    std::ifstream file(filename, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+  };
+  writeImageAOS("stream_header.ppm", image);
+  std::string const samples = contents("stream_header.ppm").substr(std::string("P6\n5 3 65535\n").size());
+  write_cppm("stream_header_memory.cppm", image, {});
+  for (size_t const padding : {size_t{0}, size_t{50}, size_t{53}, size_t{200}}) {
+    std::string const header = "P6" + std::string(padding, ' ') + " 5\t3\r\n65535\n"; // 64 bytes with 50 spaces
+    std::ofstream("stream_header.ppm", std::ios::binary) << header << samples;
+    {
+      MappedFile const file("stream_header.ppm");
+      P6Layout const layout = parse_p6_header(file);
+      EXPECT_EQ(layout.max_color_value, 65535) << "padding " << padding;
+      EXPECT_EQ(layout.data_offset, header.size()) << "padding " << padding;
+    }
+    stream_compress("stream_header.ppm", "stream_header.cppm", {});
+    EXPECT_EQ(contents("stream_header.cppm"), contents("stream_header_memory.cppm")) << "padding " << padding;
+  }
+  for (std::string const &header : {"P6" + std::string(70, ' '), "P6 5 3" + std::string(70, '\n'),
+                                    std::string("P6 5 3 65535"), std::string("P6 5 3 65535x"),
+                                    std::string("P6 5 3 99999999999\n"), std::string("P65 3 65535\n")}) {
+    std::ofstream("stream_header.ppm", std::ios::binary) << header;
+    MappedFile const file("stream_header.ppm");
+    EXPECT_THROW(parse_p6_header(file), std::runtime_error) << header;
+  }
+}
+
 // NOLINTEND(cppcoreguidelines-avoid-adjacent-parameters)
 // NOLINTEND(cppcoreguidelines-pro-type-reinterpret-cast)
 // NOLINTEND(readability-magic-numbers)
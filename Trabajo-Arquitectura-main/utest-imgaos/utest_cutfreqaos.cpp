@@ -1,6 +1,7 @@
 #include "gtest/gtest.h"
 #include "../imgaos/cutfreqaos.hpp"
 #include "../common/binaryio.hpp"
+#include <sstream>
 
 // NOLINTBEGIN(cppcoreguidelines-avoid-magic-numbers)
 // NOLINTBEGIN(readability-magic-numbers)
@@ -8,13 +9,13 @@
 
 namespace {
   // We create a function to create PPMImageAOS structures for 3 bytes pixel to be able to perform the tests.
-  void createAOSSmallImg(PPMImageAOS & image, std::vector<SmallPixel>& smallPix) {
+  void createAOSSmallImg(PPMImageAOS & image, PixelBuffer<SmallPixel>& smallPix) {
     image.sPixels         = smallPix;
     image.max_color_value = 255;
   }
 
   // We create a function to create PPMImageAOS structures for 6 bytes pixel to be able to perform the tests.
-  void createAOSLargeImg(PPMImageAOS & image, std::vector<LargePixel>& largePix) {
+  void createAOSLargeImg(PPMImageAOS & image, PixelBuffer<LargePixel>& largePix) {
     image.lPixels         = largePix;
     image.max_color_value = 65535;
   }
@@ -22,7 +23,7 @@ namespace {
 // Test FindNearestColors function for images with small pixels.
 TEST(CutFreqAOSTest, TestFindNearestColorsSmall) {
   std::unordered_set<SmallPixel> const to_remove = {{.red=255, .green=0, .blue=0}, {.red=0, .green=0, .blue=255}}; // Remove Red and Blue colors.
-  std::unordered_set<SmallPixel> const to_keep = {{.red=0, .green=255, .blue=0}, {.red=255, .green=255, .blue=0}, {.red=255, .green=255, .blue=255}}; // Keep Green, Cyan and White colors.
+  std::vector<SmallPixel> to_keep = {{.red=0, .green=255, .blue=0}, {.red=255, .green=255, .blue=0}, {.red=255, .green=255, .blue=255}}; // Keep Green, Cyan and White colors.
   std::unordered_map<SmallPixel, SmallPixel> replacement_map;
   FindNearestColors(to_remove, replacement_map, to_keep);
   // Red (255,0,0) color should be replaced by cyan (255,255,0)
@@ -34,7 +35,7 @@ TEST(CutFreqAOSTest, TestFindNearestColorsSmall) {
 // Test FindNearestColors function for images with large pixels.
 TEST(CutFreqAOSTest, TestFindNearestColorsLarge) {
   std::unordered_set<LargePixel> const to_remove = {{.red=65535, .green=0, .blue=0}, {.red=0, .green=0, .blue=65535}}; // Remove Red and Blue colors.
-  std::unordered_set<LargePixel> const to_keep = {{.red=0, .green=65535, .blue=0}, {.red=65535, .green=65535, .blue=0}, {.red=65535, .green=65535, .blue=65535}}; // Keep Green, Cyan and White colors.
+  std::vector<LargePixel> to_keep = {{.red=0, .green=65535, .blue=0}, {.red=65535, .green=65535, .blue=0}, {.red=65535, .green=65535, .blue=65535}}; // Keep Green, Cyan and White colors.
   std::unordered_map<LargePixel, LargePixel> replacement_map;
   FindNearestColors(to_remove, replacement_map, to_keep);
   // Red (65535,0,0) color should be replaced by cyan (65535,65535,0)
@@ -46,7 +47,7 @@ TEST(CutFreqAOSTest, TestFindNearestColorsLarge) {
 
 // Test removeColors for n = 1 and images of Small Pixels.
 TEST(RemoveColorsTest, Remove1ColorSmall) {
-  std::vector<SmallPixel> pixels = {
+  PixelBuffer<SmallPixel> pixels = {
     {.red=255, .green=0, .blue=0},  // Red
     {.red=0, .green=255, .blue=0},  // Green
     {.red=0, .green=0, .blue=255},  // Blue
@@ -79,7 +80,7 @@ TEST(RemoveColorsTest, Remove1ColorSmall) {
 
 // Test removeColors for n = 2 and images of Small Pixels.
 TEST(RemoveColorsTest, Remove2ColorSmall) {
-  std::vector<SmallPixel> pixels = {
+  PixelBuffer<SmallPixel> pixels = {
     {.red=255, .green=0, .blue=0},  // Red
     {.red=0, .green=255, .blue=0},  // Green
     {.red=0, .green=0, .blue=255},  // Blue
@@ -113,7 +114,7 @@ TEST(RemoveColorsTest, Remove2ColorSmall) {
 
 // Test removeColors for n = 1 and images of Large Pixels.
 TEST(RemoveColorsTest, Remove1ColorLarge) {
-  std::vector<LargePixel> pixels = {
+  PixelBuffer<LargePixel> pixels = {
     {.red=65535, .green=0, .blue=0},  // Red
     {.red=0, .green=65535, .blue=0},  // Green
     {.red=0, .green=0, .blue=65535},  // Blue
@@ -147,7 +148,7 @@ TEST(RemoveColorsTest, Remove1ColorLarge) {
 
 // Test removeColors for n = 2 and images of Large Pixels.
 TEST(RemoveColorsTest, Remove2ColorLarge) {
-  std::vector<LargePixel> pixels = {
+  PixelBuffer<LargePixel> pixels = {
     {.red=65535, .green=0, .blue=0},  // Red
     {.red=0, .green=65535, .blue=0},  // Green
     {.red=0, .green=0, .blue=65535},  // Blue
@@ -181,7 +182,7 @@ TEST(RemoveColorsTest, Remove2ColorLarge) {
 
 // Test removeColors when frequency is the same for all colors and images of Small Pixels.
 TEST(RemoveColorsTest, RemoveColorSmall) {
-  std::vector<SmallPixel> pixels = {
+  PixelBuffer<SmallPixel> pixels = {
     {.red=255, .green=0, .blue=0},  // Red
     {.red=0, .green=255, .blue=0},  // Green
     {.red=0, .green=0, .blue=255},  // Blue
@@ -206,6 +207,103 @@ TEST(RemoveColorsTest, RemoveColorSmall) {
   EXPECT_EQ(image.sPixels[1].blue, 0);
 }
 
+// Test the approximate mode: replacements may be at most the tolerance worse than the exact ones.
+TEST(RemoveColorsTest, ApproximateRemoveSmall) {
+  PixelBuffer<SmallPixel> original;
+  for (int i = 0; i < 64; ++i) { // 64 colors, color i appears i + 1 times
+    for (int j = 0; j <= i; ++j) {
+      original.push_back({.red=static_cast<uint8_t>(i * 4), .green=static_cast<uint8_t>(i * 3), .blue=static_cast<uint8_t>(255 - (i * 2))});
+    }
+  }
+  PixelBuffer<SmallPixel> exact = original;
+  PixelBuffer<SmallPixel> approximate = original;
+  removeColors<SmallPixel>(20, exact);
+  double const tolerance = 100.0;
+  double const max_error = removeColors<SmallPixel>(20, approximate, {.tolerance=tolerance}).max_error;
+  EXPECT_LE(max_error, tolerance);
+  for (size_t i = 0; i < original.size(); ++i) {
+    EXPECT_LE(squaredDistance(original[i], approximate[i]), squaredDistance(original[i], exact[i]) + max_error);
+  }
+}
+
+// Exact mode reports no error.
+TEST(RemoveColorsTest, ExactRemoveReportsNoError) {
+  PixelBuffer<SmallPixel> pixels = {
+    {.red=255, .green=0, .blue=0},
+    {.red=0, .green=255, .blue=0},
+    {.red=0, .green=0, .blue=255},
+    {.red=255, .green=0, .blue=0},
+  };
+  EXPECT_EQ(removeColors<SmallPixel>(1, pixels).max_error, 0.0);
+}
+
+// Every search strategy gives the same image.
+TEST(RemoveColorsTest, StrategiesAgreeSmall) {
+  PixelBuffer<SmallPixel> original;
+  for (int i = 0; i < 400; ++i) {
+    original.push_back({.red=static_cast<uint8_t>((i * 37) % 256), .green=static_cast<uint8_t>((i * 91) % 256),
+                        .blue=static_cast<uint8_t>((i * i) % 256)});
+  }
+  PixelBuffer<SmallPixel> linear = original;
+  NearestSearchStats const stats = removeColors<SmallPixel>(150, linear, {.strategy=NearestStrategy::linear});
+  EXPECT_EQ(stats.strategy, NearestStrategy::linear);
+  for (NearestStrategy const strategy : {NearestStrategy::kdtree, NearestStrategy::grid}) {
+    PixelBuffer<SmallPixel> pixels = original;
+    EXPECT_EQ(removeColors<SmallPixel>(150, pixels, {.strategy=strategy}).strategy, strategy);
+    EXPECT_EQ(pixels, linear);
+  }
+}
+
+// Test removeLeastFrequentColors on a compressed image: same file as decoding, removing and compressing.
+TEST(RemoveColorsTest, PaletteMatchesDecoded) {
+  PPMImageAOS image;
+  image.width = 40;
+  image.height = 10;
+  image.max_color_value = 255;
+  for (int i = 0; i < 400; ++i) {
+    image.sPixels.push_back({.red=static_cast<uint8_t>((i * 37) % 256), .green=static_cast<uint8_t>((i * 91) % 64),
+                             .blue=static_cast<uint8_t>((i * i) % 16)});
+  }
+  std::stringstream compressed;
+  process_small_pixel_image(compressed, image);
+  for (int const num_colors : {1, 50, 200, 399, 400}) {
+    compressed.seekg(0);
+    PaletteImageAOS palette = read_palette_image(compressed);
+    removeLeastFrequentColors(palette, num_colors);
+    std::stringstream palette_file;
+    write_palette_image(palette_file, palette);
+
+    PPMImageAOS decoded = image;
+    removeLeastFrequentColors(decoded, num_colors);
+    std::stringstream decoded_file;
+    process_small_pixel_image(decoded_file, decoded);
+    EXPECT_EQ(palette_file.str(), decoded_file.str()) << num_colors << " colors";
+  }
+}
+
+// One operation context serves image after image: the result is the one of the global heap, and once the first
+// image has grown the arenas the next ones of the same size take nothing more from the heap.
+TEST(RemoveColorsTest, ContextReusedLarge) {
+  OperationContext context;
+  size_t blocks = 0;
+  for (int image = 0; image < 3; ++image) {
+    PixelBuffer<LargePixel> original;
+    for (int i = 0; i < 3000; ++i) {
+      original.push_back({.red=static_cast<uint16_t>((i * (image + 37)) % 4096), .green=static_cast<uint16_t>((i * 91) % 512),
+                          .blue=static_cast<uint16_t>((i * i) % 64)});
+    }
+    PixelBuffer<LargePixel> expected = original;
+    removeColors<LargePixel>(500, expected);
+    PixelBuffer<LargePixel> pixels = original;
+    removeColors<LargePixel>(500, pixels, {}, context);
+    EXPECT_EQ(pixels, expected);
+    if (image == 0) { blocks = context.heap_blocks(); }
+    EXPECT_GT(context.heap_blocks(), 0U);
+    EXPECT_EQ(context.heap_blocks(), blocks);
+    context.reset();
+  }
+}
+
 // NOLINTEND(cppcoreguidelines-pro-type-reinterpret-cast)
 // NOLINTEND(readability-magic-numbers)
 // NOLINTEND(cppcoreguidelines-avoid-magic-numbers)
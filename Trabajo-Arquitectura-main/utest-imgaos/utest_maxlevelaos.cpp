@@ -1,6 +1,9 @@
 #include "gtest/gtest.h"
 #include "../imgaos/maxlevelaos.hpp"
 #include "../common/binaryio.hpp"
+#include "../common/streammaxlevel.hpp"
+#include <fstream>
+#include <sstream>
 
 // NOLINTBEGIN(cppcoreguidelines-avoid-magic-numbers)
 // NOLINTBEGIN(readability-magic-numbers)
@@ -110,6 +113,196 @@ TEST(PPMImageTest, ScaleLargePixelToLarge) {
     EXPECT_EQ(scaledImage.lPixels[3].blue, 0);
 }
 
+// Test maxLevelPaletteAOS: scaling the color table gives the same file as decoding, scaling and compressing.
+TEST(PPMImageTest, PaletteMaxLevelMatchesDecoded) {
+  PPMImageAOS image;
+  image.width = 30;
+  image.height = 20;
+  image.max_color_value = 255;
+  for (int i = 0; i < 600; ++i) { // Many colors that merge at low levels
+    image.sPixels.push_back({.red=static_cast<uint8_t>((i * 7) % 256), .green=static_cast<uint8_t>(i % 256),
+                             .blue=static_cast<uint8_t>((i * i) % 256)});
+  }
+  std::string const filename = "palette_maxlevel_test.cppm";
+  write_cppm(filename, image);
+  for (int const level : {3, 100, 1000, 65535}) {
+    std::ifstream input(filename, std::ios::binary);
+    PaletteImageAOS palette = read_palette_image(input);
+    maxLevelPaletteAOS(palette, level);
+    std::stringstream palette_file;
+    write_palette_image(palette_file, palette);
+
+    PPMImageAOS const scaled = maxLevelImageAOS(filename, level);
+    std::stringstream decoded_file;
+    if (level <= 255) { process_small_pixel_image(decoded_file, scaled); } else { process_large_pixel_image(decoded_file, scaled); }
+    EXPECT_EQ(palette_file.str(), decoded_file.str()) << "level " << level;
+  }
+}
+
+// Test applyPointOpsAOS: a chain of maxlevel steps run in one pass gives the image of the steps run one by one.
+TEST(PPMImageTest, PointOpChainMatchesSteps) {
+  PPMImageAOS image;
+  image.width = 30;
+  image.height = 20;
+  image.max_color_value = 255;
+  for (int i = 0; i < 600; ++i) {
+    image.sPixels.push_back({.red=static_cast<uint8_t>((i * 7) % 256), .green=static_cast<uint8_t>(i % 256),
+                             .blue=static_cast<uint8_t>((i * i) % 256)});
+  }
+  PPMImageAOS stepwise;
+  PPMImageAOS scratch;
+  maxLevelImageAOS(image, 40000, stepwise);
+  maxLevelImageAOS(stepwise, 1000, scratch);
+  maxLevelImageAOS(scratch, 100, stepwise);
+  PointOpChain chain;
+  for (int const level : {40000, 1000, 100}) { addMaxLevelAOS(chain, level); }
+  PPMImageAOS fused;
+  fused.lPixels.resize(7); // Stale buffer of the other pixel size, as in a reused image
+  applyPointOpsAOS(image, chain, fused);
+  EXPECT_EQ(fused.max_color_value, 100);
+  EXPECT_TRUE(fused.lPixels.empty());
+  ASSERT_EQ(fused.sPixels.size(), stepwise.sPixels.size());
+  for (size_t i = 0; i < fused.sPixels.size(); ++i) {
+    EXPECT_EQ(fused.sPixels[i].red, stepwise.sPixels[i].red);
+    EXPECT_EQ(fused.sPixels[i].green, stepwise.sPixels[i].green);
+    EXPECT_EQ(fused.sPixels[i].blue, stepwise.sPixels[i].blue);
+  }
+  EXPECT_THROW(addMaxLevelAOS(chain, 0), std::invalid_argument);
+}
+
+// Test maxLevelInPlaceAOS: same image as the copying version, in the same buffer when the pixel size is kept.
+TEST(PPMImageTest, MaxLevelInPlace) {
+  PPMImageAOS image;
+  image.width = 30;
+  image.height = 20;
+  image.max_color_value = 255;
+  for (int i = 0; i < 600; ++i) {
+    image.sPixels.push_back({.red=static_cast<uint8_t>((i * 7) % 256), .green=static_cast<uint8_t>(i % 256),
+                             .blue=static_cast<uint8_t>((i * i) % 256)});
+  }
+  for (int const level : {100, 1000, 65535, 40000, 3}) {
+    PPMImageAOS expected;
+    maxLevelImageAOS(image, level, expected);
+    SmallPixel const *small = image.sPixels.data();
+    LargePixel const *large = image.lPixels.data();
+    bool const samePixelSize = (image.max_color_value <= 255) == (level <= 255);
+    maxLevelInPlaceAOS(image, level);
+    EXPECT_EQ(image.max_color_value, level);
+    if (samePixelSize) { EXPECT_TRUE(image.sPixels.data() == small && image.lPixels.data() == large); }
+    ASSERT_EQ(image.sPixels.size(), expected.sPixels.size());
+    ASSERT_EQ(image.lPixels.size(), expected.lPixels.size());
+    for (size_t i = 0; i < image.sPixels.size(); ++i) { EXPECT_EQ(image.sPixels[i].green, expected.sPixels[i].green); }
+    for (size_t i = 0; i < image.lPixels.size(); ++i) { EXPECT_EQ(image.lPixels[i].blue, expected.lPixels[i].blue); }
+  }
+}
+
+// Test maxLevelFileAOS: the one-pass file to file maxlevel writes the same file as reading, scaling and writing,
+// for the four sample width combinations, with and without specialised kernels, across several blocks.
+TEST(PPMImageTest, MaxLevelFileMatchesDecoded) {
+  auto const readFile = [](const std::string &filename) {
+    std::ifstream file(filename, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+  };
+  for (auto const &[from, to] : {std::pair{255, 100}, std::pair{255, 65535}, std::pair{255, 1023}, std::pair{65535, 255},
+                                std::pair{4095, 65535}, std::pair{1000, 40000}, std::pair{1000, 7}}) {
+    PPMImageAOS image;
+    image.width = 37;
+    image.height = 11;
+    image.max_color_value = from;
+    for (int i = 0; i < 37 * 11; ++i) {
+      auto const red = static_cast<uint16_t>((i * 7919) % (from + 1));
+      auto const green = static_cast<uint16_t>((i * 31) % (from + 1));
+      auto const blue = static_cast<uint16_t>(from - (i % (from + 1)));
+      if (from <= 255) {
+        image.sPixels.push_back({.red=static_cast<uint8_t>(red), .green=static_cast<uint8_t>(green),
+                                 .blue=static_cast<uint8_t>(blue)});
+      } else {
+        image.lPixels.push_back({.red=red, .green=green, .blue=blue});
+      }
+    }
+    writeImageAOS("maxlevel_file_in.ppm", image);
+    writeImageAOS("maxlevel_file_expected.ppm", maxLevelImageAOS("maxlevel_file_in.ppm", to));
+    maxLevelFileAOS("maxlevel_file_in.ppm", "maxlevel_file_out.ppm", to);
+    EXPECT_EQ(readFile("maxlevel_file_out.ppm"), readFile("maxlevel_file_expected.ppm")) << from << " -> " << to;
+    stream_maxlevel("maxlevel_file_in.ppm", "maxlevel_file_out.ppm", to, 50); // Many blocks, the last one partial
+    EXPECT_EQ(readFile("maxlevel_file_out.ppm"), readFile("maxlevel_file_expected.ppm")) << from << " -> " << to;
+  }
+  EXPECT_THROW(maxLevelFileAOS("maxlevel_file_in.ppm", "maxlevel_file_out.ppm", 0), std::invalid_argument);
+}
+
+// Test the specialised maxlevel kernels: same pixels as the table of the generic path, in every direction.
+TEST(PPMImageTest, FastLevelConversionsMatchTable) {
+  for (const FastLevelConversion &conversion : FAST_LEVEL_CONVERSIONS) {
+    PPMImageAOS image;
+    image.width = 64;
+    image.height = 64;
+    image.max_color_value = conversion.from;
+    std::vector<uint16_t> const table = maxLevelTable(conversion.from, conversion.to);
+    for (int i = 0; i < 64 * 64; ++i) {
+      auto const red = static_cast<uint16_t>((i * 7919) % (conversion.from + 1));
+      auto const green = static_cast<uint16_t>((i * 31) % (conversion.from + 1));
+      auto const blue = static_cast<uint16_t>(conversion.from - (i % (conversion.from + 1)));
+      if (conversion.from <= 255) {
+        image.sPixels.push_back({.red=static_cast<uint8_t>(red), .green=static_cast<uint8_t>(green),
+                                 .blue=static_cast<uint8_t>(blue)});
+      } else {
+        image.lPixels.push_back({.red=red, .green=green, .blue=blue});
+      }
+    }
+    PPMImageAOS scaled;
+    maxLevelImageAOS(image, conversion.to, scaled);
+    for (size_t i = 0; i < 64 * 64; ++i) {
+      LargePixel const source = conversion.from <= 255
+          ? LargePixel{.red=image.sPixels[i].red, .green=image.sPixels[i].green, .blue=image.sPixels[i].blue}
+          : image.lPixels[i];
+      LargePixel const result = conversion.to <= 255
+          ? LargePixel{.red=scaled.sPixels[i].red, .green=scaled.sPixels[i].green, .blue=scaled.sPixels[i].blue}
+          : scaled.lPixels[i];
+      ASSERT_EQ(result.red, table[source.red]) << conversion.from << " -> " << conversion.to;
+      ASSERT_EQ(result.green, table[source.green]);
+      ASSERT_EQ(result.blue, table[source.blue]);
+    }
+  }
+}
+
+// Test ditherMaxLevelAOS: lowering 16-bit pixels to one byte keeps the average of each component, gives the same
+// pixels on any number of threads, and raising the level is a plain maxlevel.
+TEST(PPMImageTest, DitherMaxLevel) {
+  PPMImageAOS image;
+  image.width = 64;
+  image.height = 32;
+  image.max_color_value = 65535;
+  double sum = 0.0;
+  for (int i = 0; i < 64 * 32; ++i) {
+    auto const red = static_cast<uint16_t>((i % 64) * 1040);
+    image.lPixels.push_back({.red=red, .green=static_cast<uint16_t>(65535 - red), .blue=30000});
+    sum += red;
+  }
+  for (DitherMethod const method : {DitherMethod::floyd_steinberg, DitherMethod::bayer}) {
+    PPMImageAOS single = image;
+    ditherMaxLevelAOS(single, 2, method, 1);
+    PPMImageAOS threaded = image;
+    ditherMaxLevelAOS(threaded, 2, method, 5);
+    EXPECT_EQ(single.max_color_value, 2);
+    EXPECT_TRUE(single.lPixels.empty());
+    ASSERT_EQ(single.sPixels.size(), image.lPixels.size());
+    double dithered = 0.0;
+    for (size_t i = 0; i < single.sPixels.size(); ++i) {
+      EXPECT_EQ(single.sPixels[i].red, threaded.sPixels[i].red);
+      EXPECT_EQ(single.sPixels[i].blue, threaded.sPixels[i].blue);
+      ASSERT_LE(single.sPixels[i].green, 2);
+      dithered += single.sPixels[i].red;
+    }
+    EXPECT_NEAR(dithered / 2, sum / 65535, 0.02 * static_cast<double>(single.sPixels.size()));
+  }
+  PPMImageAOS raised = image;
+  PPMImageAOS plain = image;
+  ditherMaxLevelAOS(raised, 65535, DitherMethod::floyd_steinberg);
+  maxLevelInPlaceAOS(plain, 65535);
+  EXPECT_EQ(raised.lPixels.size(), plain.lPixels.size());
+  EXPECT_THROW(ditherMaxLevelAOS(raised, 0, DitherMethod::bayer), std::invalid_argument);
+}
+
 // NOLINTEND(cppcoreguidelines-pro-type-reinterpret-cast)
 // NOLINTEND(readability-magic-numbers)
 // NOLINTEND(cppcoreguidelines-avoid-magic-numbers)
@@ -50,7 +50,7 @@ TEST(ResizeTestsAOS, ResizeSmallToLargeSmallPixel) {
         {.red=255, .green=255, .blue=0}  // Pixel 4
     };
     // Call resize function to increase size of the image from 2x2 to 4x4
-    resizeImageAOS(4, image, 4); // Actual Output.
+    image = resizeImageAOS(4, image, 4); // Actual Output.
     // Check the size of the output image after calling the resize function.
     EXPECT_EQ(image.width, 4);
     EXPECT_EQ(image.height, 4);
@@ -87,7 +87,7 @@ TEST(ResizeTestsAOS, ResizeSmallToLargeLargePixel) {
         {.red=65535, .green=65535, .blue=0} // Pixel 4
     };
     // Call resize function to increase size of the image from 2x2 to 4x4
-    resizeImageAOS(4, image, 4); // Actual output.
+    image = resizeImageAOS(4, image, 4); // Actual output.
     // Check the size of the output image
     EXPECT_EQ(image.width, 4);
     EXPECT_EQ(image.height, 4);
@@ -137,7 +137,7 @@ TEST(ResizeTestsAOS, ResizeLargeToSmallSmallPixel) {
     {.red=128, .green=0, .blue=255}   // Pixel 16
   };
   // Call resize function to reduce size of the image from 4x4 to 2x2.
-  resizeImageAOS(2, image, 2); // Actual Output.
+  image = resizeImageAOS(2, image, 2); // Actual Output.
   // Compare actual with expected results.
   EXPECT_EQ(image.width, 2);
   EXPECT_EQ(image.height, 2);
@@ -177,7 +177,7 @@ TEST(ResizeTestsAOS, ResizeLargeToSmallLargePixel) {
     };
 
   // Call resize function to reduce size of the image from 4x4 to 2x2
-    resizeImageAOS(2, image, 2); // Actual Output.
+    image = resizeImageAOS(2, image, 2); // Actual Output.
     // Check the resized image parameters
     EXPECT_EQ(image.width, 2);
     EXPECT_EQ(image.height, 2);
@@ -195,6 +195,29 @@ TEST(ResizeTestsAOS, ResizeLargeToSmallLargePixel) {
     EXPECT_EQ(image.lPixels[1].blue, 0);
 }
 
+// Resize reads the input through a view: the only full-image allocation is the output, and none at all when the
+// output image is reused with enough capacity, as the pipeline does.
+TEST(ResizeTestsAOS, AllocatesOnlyTheOutput) {
+  PPMImageAOS image{.width=64, .height=48, .max_color_value=255, .sPixels={}, .lPixels={}};
+  for (int i = 0; i < 64 * 48; ++i) {
+    image.sPixels.push_back({.red=static_cast<uint8_t>(i), .green=static_cast<uint8_t>(i / 3), .blue=7});
+  }
+  PPMImageAOS const &input = image;
+  PixelBufferStats const before = pixelBufferStats();
+  PPMImageAOS const resized = resizeImageAOS(32, input, 24);
+  PixelBufferStats const after = pixelBufferStats();
+  EXPECT_EQ(after.allocations - before.allocations, 1U);
+  EXPECT_EQ(after.allocated_bytes - before.allocated_bytes, 32 * 24 * sizeof(SmallPixel));
+  EXPECT_EQ(resized.sPixels.size(), 32U * 24U);
+
+  PPMImageAOS scratch;
+  resizeImageAOS(40, input, 30, scratch);
+  PixelBufferStats const reused_before = pixelBufferStats();
+  resizeImageAOS(32, input, 24, scratch);
+  EXPECT_EQ(pixelBufferStats().allocations, reused_before.allocations);
+  EXPECT_EQ(scratch.sPixels, resized.sPixels);
+}
+
 // NOLINTEND(cppcoreguidelines-pro-type-reinterpret-cast)
 // NOLINTEND(readability-magic-numbers)
 // NOLINTEND(cppcoreguidelines-avoid-magic-numbers)
@@ -1,6 +1,9 @@
 #include "gtest/gtest.h"
+#include <fstream>
+#include <iterator>
 #include <sstream>
 #include "../imgsoa/compresssoa.hpp"
+#include "../common/streamcompress.hpp"
 
 // NOLINTBEGIN(cppcoreguidelines-avoid-magic-numbers)
 // NOLINTBEGIN(readability-magic-numbers)
@@ -107,6 +110,318 @@ TEST(CompressSOATests, ProcessLargePixelImage) {
   EXPECT_EQ(output.str().size(), expected_output_size);
 }
 
+// Test for the dense color table: same first-seen order and same index bytes as the map version.
+TEST(CompressSOATests, DenseColorTableMatchesMap) {
+  AuxPixelVects<uint8_t> pixels;
+  for (int i = 0; i < 3000; ++i) { // More than 256 colors, so indices take 2 bytes
+    pixels.red.push_back(static_cast<uint8_t>((i * 7) % 256));
+    pixels.green.push_back(static_cast<uint8_t>((i * 13) % 256));
+    pixels.blue.push_back(static_cast<uint8_t>(i % 5));
+  }
+  AuxPixelVects<uint8_t> map_colors;
+  auto const color_map = generate_color_table(pixels.red, pixels.green, pixels.blue, map_colors);
+  AuxPixelVects<uint8_t> dense_colors;
+  DenseColorTable const table = generate_dense_color_table(pixels.red, pixels.green, pixels.blue, dense_colors);
+  EXPECT_EQ(dense_colors.red, map_colors.red);
+  EXPECT_EQ(dense_colors.green, map_colors.green);
+  EXPECT_EQ(dense_colors.blue, map_colors.blue);
+  std::ostringstream map_output;
+  std::ostringstream dense_output;
+  write_pixel_indices<uint8_t, uint16_t>(map_output, pixels, color_map);
+  write_dense_pixel_indices<uint16_t>(dense_output, pixels.red, pixels.green, pixels.blue, table);
+  EXPECT_EQ(dense_output.str(), map_output.str());
+}
+
+// Test for the parallel encoder: any number of stripes gives the same table and index bytes as one stripe.
+TEST(CompressSOATests, StripesMatchSequential) {
+  AuxPixelVects<uint8_t> small;
+  AuxPixelVects<uint16_t> large;
+  for (int i = 0; i < 5000; ++i) {
+    small.red.push_back(static_cast<uint8_t>((i * i) % 251));
+    small.green.push_back(static_cast<uint8_t>(i % 7));
+    small.blue.push_back(0);
+    large.red.push_back(static_cast<uint16_t>((i * i) % 4001));
+    large.green.push_back(static_cast<uint16_t>(i % 3));
+    large.blue.push_back(1);
+  }
+  AuxPixelVects<uint8_t> small_colors;
+  DenseColorTable const small_table = generate_dense_color_table(small.red, small.green, small.blue, small_colors, 1);
+  std::ostringstream small_expected;
+  write_dense_pixel_indices<uint16_t>(small_expected, small.red, small.green, small.blue, small_table, 1);
+  AuxPixelVects<uint16_t> large_colors;
+  auto const large_map = generate_color_table(large.red, large.green, large.blue, large_colors, 1);
+  std::ostringstream large_expected;
+  write_pixel_indices<uint16_t, uint16_t>(large_expected, large, large_map, 1);
+  for (size_t const stripes : {2UL, 3UL, 8UL}) {
+    AuxPixelVects<uint8_t> colors;
+    DenseColorTable const table = generate_dense_color_table(small.red, small.green, small.blue, colors, stripes);
+    EXPECT_EQ(colors.red, small_colors.red);
+    EXPECT_EQ(colors.green, small_colors.green);
+    std::ostringstream output;
+    write_dense_pixel_indices<uint16_t>(output, small.red, small.green, small.blue, table, stripes);
+    EXPECT_EQ(output.str(), small_expected.str());
+    AuxPixelVects<uint16_t> large_stripe_colors;
+    auto const color_map = generate_color_table(large.red, large.green, large.blue, large_stripe_colors, stripes);
+    EXPECT_EQ(large_stripe_colors.red, large_colors.red);
+    std::ostringstream large_output;
+    write_pixel_indices<uint16_t, uint16_t>(large_output, large, color_map, stripes);
+    EXPECT_EQ(large_output.str(), large_expected.str());
+  }
+}
+
+// Test for read_cppm: decoding a compressed image gives back the original components.
+TEST(CompressSOATests, ReadCppmRoundTrip) {
+  SOAImage small = createSOAImage3();
+  for (int i = 0; i < 300; ++i) { // More than 256 colors, so indices take 2 bytes
+    small.red1_components.push_back(static_cast<uint8_t>(i % 256));
+    small.green1_components.push_back(static_cast<uint8_t>(i / 256));
+    small.blue1_components.push_back(7);
+  }
+  small.height = static_cast<int>(small.red1_components.size()) / small.width;
+  std::stringstream small_file;
+  process_small_pixel_image(small_file, small);
+  SOAImage const small_read = read_cppm(small_file);
+  EXPECT_EQ(small_read.width, small.width);
+  EXPECT_EQ(small_read.height, small.height);
+  EXPECT_EQ(small_read.red1_components, small.red1_components);
+  EXPECT_EQ(small_read.green1_components, small.green1_components);
+  EXPECT_EQ(small_read.blue1_components, small.blue1_components);
+
+  SOAImage const large = createSOAImage6();
+  std::stringstream large_file;
+  process_large_pixel_image(large_file, large);
+  SOAImage const large_read = read_cppm(large_file);
+  EXPECT_EQ(large_read.red2_components, large.red2_components);
+  EXPECT_EQ(large_read.green2_components, large.green2_components);
+  EXPECT_EQ(large_read.blue2_components, large.blue2_components);
+}
+
+// Test for read_cppm: an index outside the color table is rejected.
+TEST(CompressSOATests, ReadCppmInvalidIndex) {
+  std::stringstream file;
+  file << "C6 2 1 255 1\n";
+  file.write("\1\2\3\0\1", 5); // One color, then indices 0 and 1
+  EXPECT_THROW(read_cppm(file), std::runtime_error);
+}
+
+// Bit-packed indices: 300 colors take 9 bits per pixel instead of 16, and decode the same.
+TEST(CompressSOATests, BitPackedRoundTrip) {
+  SOAImage small = createSOAImage3();
+  for (int i = 0; i < 300; ++i) {
+    small.red1_components.push_back(static_cast<uint8_t>(i % 256));
+    small.green1_components.push_back(static_cast<uint8_t>(i / 256));
+    small.blue1_components.push_back(7);
+  }
+  small.height = static_cast<int>(small.red1_components.size()) / small.width;
+  std::stringstream plain;
+  process_small_pixel_image(plain, small);
+  std::stringstream packed;
+  process_small_pixel_image(packed, small, {.flags=CPPM_FLAG_BITPACKED});
+  EXPECT_LT(packed.str().size(), plain.str().size());
+  SOAImage const small_read = read_cppm(packed);
+  EXPECT_EQ(small_read.red1_components, small.red1_components);
+  EXPECT_EQ(small_read.green1_components, small.green1_components);
+  EXPECT_EQ(small_read.blue1_components, small.blue1_components);
+
+  SOAImage const large = createSOAImage6();
+  std::stringstream large_file;
+  process_large_pixel_image(large_file, large, {.flags=CPPM_FLAG_BITPACKED});
+  SOAImage const large_read = read_cppm(large_file);
+  EXPECT_EQ(large_read.red2_components, large.red2_components);
+  EXPECT_EQ(large_read.green2_components, large.green2_components);
+  EXPECT_EQ(large_read.blue2_components, large.blue2_components);
+}
+
+// Entropy-coded indices: a flat image shrinks to a few bytes of indices and decodes the same.
+TEST(CompressSOATests, EntropyRoundTrip) {
+  SOAImage image;
+  image.width = 100;
+  image.height = 100;
+  image.max_color_value = 65535;
+  for (int i = 0; i < 10000; ++i) { // Wide bands of 300 colors
+    image.red2_components.push_back(static_cast<uint16_t>(i / 40 * 200));
+    image.green2_components.push_back(static_cast<uint16_t>(i / 2560));
+    image.blue2_components.push_back(1);
+  }
+  std::stringstream plain;
+  process_large_pixel_image(plain, image);
+  std::stringstream coded;
+  process_large_pixel_image(coded, image, {.flags=CPPM_FLAG_ENTROPY});
+  EXPECT_LT(coded.str().size() * 2, plain.str().size());
+  SOAImage const read = read_cppm(coded);
+  EXPECT_EQ(read.red2_components, image.red2_components);
+  EXPECT_EQ(read.green2_components, image.green2_components);
+  EXPECT_EQ(read.blue2_components, image.blue2_components);
+}
+
+// An entropy-coded block must carry a table summing to the probability scale, even when it codes no byte: a
+// crafted one with oversized frequencies is rejected instead of overflowing the decoder's slot table.
+TEST(CompressSOATests, EntropyEmptyBlockBogusTable) {
+  std::stringstream bogus;
+  write_binary(bogus, uint64_t{0}); // No byte coded
+  write_binary_buffer(bogus, std::vector<uint16_t>(RANS_SYMBOLS, 4000));
+  write_binary(bogus, uint64_t{16});
+  write_binary_buffer(bogus, std::vector<uint8_t>(16, 0xAB));
+  EXPECT_THROW(read_rans_block(bogus, 100), std::runtime_error);
+
+  std::stringstream empty; // The encoder's own empty block still reads back
+  write_rans_block(empty, encode_rans_block({}));
+  EXPECT_TRUE(read_rans_block(empty, 100).empty());
+}
+
+// Row groups: every coding decodes whole and by row range, from any group boundary.
+TEST(CompressSOATests, ChunkedRoundTrip) {
+  SOAImage image;
+  image.width = 7;
+  image.height = 10;
+  image.max_color_value = 65535;
+  for (int i = 0; i < 70; ++i) {
+    image.red2_components.push_back(static_cast<uint16_t>(i / 3 * 1000));
+    image.green2_components.push_back(static_cast<uint16_t>(i % 5));
+    image.blue2_components.push_back(9);
+  }
+  for (unsigned const coding : {0U, CPPM_FLAG_BITPACKED, CPPM_FLAG_ENTROPY}) {
+    std::stringstream file;
+    process_large_pixel_image(file, image, {.flags=CPPM_FLAG_CHUNKED | coding, .group_rows=4}); // Groups of 4, 4 and 2 rows
+    SOAImage const read = read_cppm(file);
+    EXPECT_EQ(read.red2_components, image.red2_components);
+    EXPECT_EQ(read.green2_components, image.green2_components);
+    for (auto const &[first_row, rows] : {std::pair{0, 10}, std::pair{3, 6}, std::pair{8, 2}}) {
+      file.clear();
+      file.seekg(0);
+      SOAImage const range = read_cppm_rows(file, first_row, rows);
+      EXPECT_EQ(range.height, rows);
+      EXPECT_EQ(range.red2_components, PixelBuffer<uint16_t>(image.red2_components.begin() + first_row * 7,
+                                                             image.red2_components.begin() + (first_row + rows) * 7));
+      EXPECT_EQ(range.blue2_components, PixelBuffer<uint16_t>(static_cast<size_t>(rows) * 7, 9));
+    }
+  }
+
+  SOAImage const small = createSOAImage3();
+  std::stringstream small_file;
+  process_small_pixel_image(small_file, small, {.flags=CPPM_FLAG_CHUNKED, .group_rows=1});
+  EXPECT_EQ(read_cppm(small_file).red1_components, small.red1_components);
+}
+
+// Palette orders: the most used color comes first in frequency order, and every order decodes the same.
+TEST(CompressSOATests, PaletteOrderRoundTrip) {
+  SOAImage image;
+  image.width = 10;
+  image.height = 10;
+  image.max_color_value = 65535;
+  for (int i = 0; i < 100; ++i) { // Color 7 on most pixels
+    auto const value = static_cast<uint16_t>(i % 4 == 0 ? i * 300 : 7);
+    image.red2_components.push_back(value);
+    image.green2_components.push_back(value);
+    image.blue2_components.push_back(value);
+  }
+  for (PaletteOrder const order : {PaletteOrder::frequency, PaletteOrder::morton}) {
+    std::stringstream file;
+    process_large_pixel_image(file, image, {.flags=CPPM_FLAG_BITPACKED, .order=order});
+    PaletteImageSOA const palette = read_palette_image(file);
+    EXPECT_EQ(palette.colors2.red.front(), order == PaletteOrder::frequency ? 7 : 0);
+    file.seekg(0);
+    SOAImage const read = read_cppm(file);
+    EXPECT_EQ(read.red2_components, image.red2_components);
+    EXPECT_EQ(read.blue2_components, image.blue2_components);
+  }
+}
+
+// Raw fallback: a 16-bit table with one color per pixel loses to the samples, which are stored delta coded
+// when smooth and raw when noisy.
+TEST(CompressSOATests, RawFallbackRoundTrip) {
+  SOAImage smooth;
+  smooth.width = 8;
+  smooth.height = 16;
+  smooth.max_color_value = 65535;
+  SOAImage noisy = smooth;
+  uint32_t seed = 12345;
+  for (int i = 0; i < 128; ++i) { // Every pixel a different color
+    auto const value = static_cast<uint16_t>(i * 500);
+    smooth.red2_components.push_back(value);
+    smooth.green2_components.push_back(static_cast<uint16_t>(value + 1));
+    smooth.blue2_components.push_back(7);
+    seed = seed * 1103515245U + 12345U;
+    noisy.red2_components.push_back(value);
+    noisy.green2_components.push_back(static_cast<uint16_t>(seed >> 16));
+    noisy.blue2_components.push_back(static_cast<uint16_t>(seed));
+  }
+  for (auto const &[image, flags] : {std::pair{smooth, CPPM_FLAG_DELTA}, std::pair{noisy, CPPM_FLAG_RAW}}) {
+    std::stringstream file;
+    process_large_pixel_image(file, image, {.raw_fallback=true});
+    std::string header;
+    std::getline(file, header);
+    EXPECT_EQ(header, "C6 8 16 65535 0 " + std::to_string(flags));
+    file.seekg(0);
+    SOAImage const read = read_cppm(file);
+    EXPECT_EQ(read.green2_components, image.green2_components);
+    EXPECT_EQ(read.blue2_components, image.blue2_components);
+    file.clear();
+    file.seekg(0);
+    SOAImage const range = read_cppm_rows(file, 10, 6);
+    EXPECT_EQ(range.red2_components, PixelBuffer<uint16_t>(image.red2_components.begin() + 80,
+                                                           image.red2_components.end()));
+    file.clear();
+    file.seekg(0);
+    EXPECT_EQ(read_palette_image(file).colors2.red.size(), 128U); // Gets a table back
+  }
+
+  SOAImage flat = smooth; // One color: the table pays off
+  flat.red2_components.assign(128, 1);
+  flat.green2_components.assign(128, 2);
+  std::stringstream flat_file;
+  process_large_pixel_image(flat_file, flat, {.raw_fallback=true});
+  EXPECT_EQ(read_palette_image(flat_file).header.color_table_size, 1U);
+}
+
+// Streaming compress gives the same bytes as write_cppm, with blocks smaller than the image.
+TEST(CompressSOATests, StreamCompressMatchesWriteCppm) {
+  SOAImage image;
+  image.width = 29;
+  image.height = 17;
+  image.max_color_value = 4000;
+  for (int i = 0; i < 29 * 17; ++i) {
+    image.red2_components.push_back(static_cast<uint16_t>(i % 13 * 300));
+    image.green2_components.push_back(static_cast<uint16_t>(i / 50));
+    image.blue2_components.push_back(static_cast<uint16_t>(i % 2));
+  }
+  auto contents = [](const std::string &filename) {
+    std::ifstream file(filename, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+  };
+  writeImageSOA("stream_test_soa.ppm", image);
+  for (CPPMWriteOptions const &options : {CPPMWriteOptions{.flags=CPPM_FLAG_BITPACKED},
+                                          CPPMWriteOptions{.flags=CPPM_FLAG_CHUNKED | CPPM_FLAG_ENTROPY, .group_rows=3},
+                                          CPPMWriteOptions{.order=PaletteOrder::frequency}}) {
+    stream_compress("stream_test_soa.ppm", "stream_test_soa.cppm", options, 64);
+    write_cppm("stream_test_soa_memory.cppm", image, options);
+    EXPECT_EQ(contents("stream_test_soa.cppm"), contents("stream_test_soa_memory.cppm")) << "flags " << options.flags;
+  }
+}
+
+// Compressing a 16-bit image indexes its planes through views: no pixel buffer as large as a plane is allocated,
+// only the few colors of the table.
+TEST(CompressSOATests, LargePixelIndexesWithoutCopies) {
+  SOAImage image;
+  image.width = 64;
+  image.height = 64;
+  image.max_color_value = 65535;
+  for (int i = 0; i < 64 * 64; ++i) { // 4 colors
+    image.red2_components.push_back(static_cast<uint16_t>((i % 4) * 1000));
+    image.green2_components.push_back(static_cast<uint16_t>((i % 2) * 2000));
+    image.blue2_components.push_back(300);
+  }
+  std::ostringstream output;
+  PixelBufferStats const before = pixelBufferStats();
+  process_large_pixel_image(output, image);
+  PixelBufferStats const after = pixelBufferStats();
+  EXPECT_LT(after.allocated_bytes - before.allocated_bytes, 64 * 64 * sizeof(uint16_t));
+  std::istringstream input(output.str());
+  SOAImage const decoded = read_cppm(input);
+  EXPECT_EQ(decoded.red2_components, image.red2_components);
+  EXPECT_EQ(decoded.blue2_components, image.blue2_components);
+}
+
 // NOLINTEND(cppcoreguidelines-avoid-adjacent-parameters)
 // NOLINTEND(cppcoreguidelines-pro-type-reinterpret-cast)
 // NOLINTEND(readability-magic-numbers)
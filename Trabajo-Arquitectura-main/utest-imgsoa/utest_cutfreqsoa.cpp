@@ -1,5 +1,6 @@
 #include "gtest/gtest.h"
 #include "../imgsoa/cutfreqsoa.hpp"
+#include <sstream>
 
 // NOLINTBEGIN(cppcoreguidelines-avoid-magic-numbers)
 // NOLINTBEGIN(readability-magic-numbers)
@@ -7,20 +8,20 @@
 
 namespace {
   // Function to initialize a 3-byte image for testing:
-  void Image3SOA(SOAImage & image, std::vector<uint8_t>& reds,
-                 std::vector<uint8_t>& greens, std::vector<uint8_t>& blues) {
-    image.red1_components   = reds;
-    image.green1_components = greens;
-    image.blue1_components  = blues;
+  void Image3SOA(SOAImage & image, const std::vector<uint8_t>& reds,
+                 const std::vector<uint8_t>& greens, const std::vector<uint8_t>& blues) {
+    image.red1_components.assign(reds.begin(), reds.end());
+    image.green1_components.assign(greens.begin(), greens.end());
+    image.blue1_components.assign(blues.begin(), blues.end());
     image.max_color_value   = 255;
   }
 
   // Function to initialize a 6-byte image for testing:
-  void Image6SOA(SOAImage & image, std::vector<uint16_t>& reds,
-                 std::vector<uint16_t>& greens, std::vector<uint16_t>& blues) {
-    image.red2_components   = reds;
-    image.green2_components = greens;
-    image.blue2_components  = blues;
+  void Image6SOA(SOAImage & image, const std::vector<uint16_t>& reds,
+                 const std::vector<uint16_t>& greens, const std::vector<uint16_t>& blues) {
+    image.red2_components.assign(reds.begin(), reds.end());
+    image.green2_components.assign(greens.begin(), greens.end());
+    image.blue2_components.assign(blues.begin(), blues.end());
     image.max_color_value   = 65535;
   }
 }
@@ -159,6 +160,122 @@ TEST(RemoveColorsTest, Remove1Color6Byte) {
   ASSERT_EQ(image.blue2_components[3], 0);
 }
 
+// Test the approximate mode with 6-byte pixels: error bound reported and never above the tolerance.
+TEST(RemoveColorsTest, ApproximateRemove6Byte) {
+  std::vector<uint16_t> reds;
+  std::vector<uint16_t> greens;
+  std::vector<uint16_t> blues;
+  for (uint16_t i = 0; i < 50; ++i) { // 50 colors, color i appears i + 1 times
+    for (uint16_t j = 0; j <= i; ++j) {
+      reds.push_back(static_cast<uint16_t>(i * 1000));
+      greens.push_back(static_cast<uint16_t>(65535 - (i * 700)));
+      blues.push_back(static_cast<uint16_t>(i * 13));
+    }
+  }
+  SOAImage exact;
+  Image6SOA(exact, reds, greens, blues);
+  SOAImage approximate;
+  Image6SOA(approximate, reds, greens, blues);
+  double const tolerance = 1.0e6;
+  double const exact_error = removeColors<uint16_t, uint64_t>(15, exact.red2_components, exact.green2_components,
+                                                              exact.blue2_components).max_error;
+  EXPECT_EQ(exact_error, 0.0);
+  double const max_error = removeColors<uint16_t, uint64_t>(15, approximate.red2_components, approximate.green2_components,
+                                                            approximate.blue2_components, {.tolerance=tolerance}).max_error;
+  EXPECT_LE(max_error, tolerance);
+  for (size_t i = 0; i < reds.size(); ++i) {
+    RGBColor<uint16_t> const source{.red=reds[i], .green=greens[i], .blue=blues[i]};
+    RGBColor<uint16_t> const exact_color{.red=exact.red2_components[i], .green=exact.green2_components[i], .blue=exact.blue2_components[i]};
+    RGBColor<uint16_t> const approx_color{.red=approximate.red2_components[i], .green=approximate.green2_components[i], .blue=approximate.blue2_components[i]};
+    EXPECT_LE(squaredDistance(source, approx_color), squaredDistance(source, exact_color) + max_error);
+  }
+}
+
+// Every search strategy gives the same image.
+TEST(RemoveColorsTest, StrategiesAgree3Byte) {
+  std::vector<uint8_t> reds;
+  std::vector<uint8_t> greens;
+  std::vector<uint8_t> blues;
+  for (int i = 0; i < 400; ++i) {
+    reds.push_back(static_cast<uint8_t>((i * 37) % 256));
+    greens.push_back(static_cast<uint8_t>((i * 91) % 256));
+    blues.push_back(static_cast<uint8_t>((i * i) % 256));
+  }
+  SOAImage linear;
+  Image3SOA(linear, reds, greens, blues);
+  removeColors<uint8_t, uint32_t>(150, linear.red1_components, linear.green1_components, linear.blue1_components,
+                                  {.strategy=NearestStrategy::linear});
+  for (NearestStrategy const strategy : {NearestStrategy::kdtree, NearestStrategy::grid}) {
+    SOAImage image;
+    Image3SOA(image, reds, greens, blues);
+    removeColors<uint8_t, uint32_t>(150, image.red1_components, image.green1_components, image.blue1_components,
+                                    {.strategy=strategy});
+    EXPECT_EQ(image.red1_components, linear.red1_components);
+    EXPECT_EQ(image.green1_components, linear.green1_components);
+    EXPECT_EQ(image.blue1_components, linear.blue1_components);
+  }
+}
+
+// removeLeastFrequentColors on a C-PPM image gives the same file as decoding, removing and compressing
+TEST(RemoveColorsTest, PaletteMatchesDecoded6Byte) {
+  SOAImage image;
+  image.width = 40;
+  image.height = 10;
+  image.max_color_value = 65535;
+  for (int i = 0; i < 400; ++i) {
+    image.red2_components.push_back(static_cast<uint16_t>((i * 3701) % 65536));
+    image.green2_components.push_back(static_cast<uint16_t>((i * 91) % 64));
+    image.blue2_components.push_back(static_cast<uint16_t>((i * i) % 16));
+  }
+  std::stringstream compressed;
+  process_large_pixel_image(compressed, image);
+  for (int const num_colors : {1, 50, 200, 400, 401}) {
+    compressed.seekg(0);
+    PaletteImageSOA palette = read_palette_image(compressed);
+    removeLeastFrequentColors(palette, num_colors);
+    std::stringstream palette_file;
+    write_palette_image(palette_file, palette);
+
+    SOAImage decoded = image;
+    removeLeastFrequentColors(decoded, num_colors);
+    std::stringstream decoded_file;
+    process_large_pixel_image(decoded_file, decoded);
+    EXPECT_EQ(palette_file.str(), decoded_file.str()) << num_colors << " colors";
+  }
+}
+
+// One operation context serves image after image: same planes as with the global heap, and the arenas grown by
+// the first image are enough for the next ones of the same size.
+TEST(RemoveColorsTest, ContextReused6Byte) {
+  OperationContext context;
+  size_t blocks = 0;
+  for (int image = 0; image < 3; ++image) {
+    std::vector<uint16_t> reds;
+    std::vector<uint16_t> greens;
+    std::vector<uint16_t> blues;
+    for (int i = 0; i < 3000; ++i) {
+      reds.push_back(static_cast<uint16_t>((i * (image + 37)) % 4096));
+      greens.push_back(static_cast<uint16_t>((i * 91) % 512));
+      blues.push_back(static_cast<uint16_t>((i * i) % 64));
+    }
+    SOAImage expected;
+    Image6SOA(expected, reds, greens, blues);
+    removeColors<uint16_t, uint64_t>(500, expected.red2_components, expected.green2_components,
+                                     expected.blue2_components);
+    SOAImage pixels;
+    Image6SOA(pixels, reds, greens, blues);
+    removeColors<uint16_t, uint64_t>(500, pixels.red2_components, pixels.green2_components, pixels.blue2_components,
+                                     {}, context);
+    EXPECT_EQ(pixels.red2_components, expected.red2_components);
+    EXPECT_EQ(pixels.green2_components, expected.green2_components);
+    EXPECT_EQ(pixels.blue2_components, expected.blue2_components);
+    if (image == 0) { blocks = context.heap_blocks(); }
+    EXPECT_GT(context.heap_blocks(), 0U);
+    EXPECT_EQ(context.heap_blocks(), blocks);
+    context.reset();
+  }
+}
+
 // NOLINTEND(cppcoreguidelines-pro-type-reinterpret-cast)
 // NOLINTEND(readability-magic-numbers)
 // NOLINTEND(cppcoreguidelines-avoid-magic-numbers)
@@ -51,9 +51,9 @@ TEST(SOATests, ReadSmallPixelImage) {
   EXPECT_EQ(image.height, 2);
   EXPECT_EQ(image.max_color_value, 255);
   // Check the red, green, and blue components are correctly loaded
-  std::vector<uint8_t> const expected_red = {255, 0, 0, 255};
-  std::vector<uint8_t> const expected_green = {0, 255, 0, 255};
-  std::vector<uint8_t> const expected_blue = {0, 0, 255, 0};
+  PixelBuffer<uint8_t> const expected_red = {255, 0, 0, 255};
+  PixelBuffer<uint8_t> const expected_green = {0, 255, 0, 255};
+  PixelBuffer<uint8_t> const expected_blue = {0, 0, 255, 0};
   EXPECT_EQ(image.red1_components, expected_red);
   EXPECT_EQ(image.green1_components, expected_green);
   EXPECT_EQ(image.blue1_components, expected_blue);
@@ -69,9 +69,9 @@ TEST(SOATests, ReadLargePixelImage) {
   EXPECT_EQ(image.height, 2);
   EXPECT_EQ(image.max_color_value, 65535);
   // Check the red, green, and blue components are correctly loaded
-  std::vector<uint16_t> const expected_red = {65535, 0, 0,65535};
-  std::vector<uint16_t> const expected_green = {0, 65535, 0,65535};
-  std::vector<uint16_t> const expected_blue = {0, 0, 65535,0};
+  PixelBuffer<uint16_t> const expected_red = {65535, 0, 0,65535};
+  PixelBuffer<uint16_t> const expected_green = {0, 65535, 0,65535};
+  PixelBuffer<uint16_t> const expected_blue = {0, 0, 65535,0};
   EXPECT_EQ(image.red2_components, expected_red);
   EXPECT_EQ(image.green2_components, expected_green);
   EXPECT_EQ(image.blue2_components, expected_blue);
@@ -1,6 +1,8 @@
 #include "gtest/gtest.h"
 #include <fstream>
+#include <sstream>
 #include "../imgsoa/maxlevelsoa.hpp"
+#include "../common/streammaxlevel.hpp"
 
 // NOLINTBEGIN(cppcoreguidelines-avoid-magic-numbers)
 // NOLINTBEGIN(readability-magic-numbers)
@@ -137,6 +139,183 @@ TEST(SOATests, ToLowerMaxLevel6) {
   EXPECT_EQ(newImage.green2_components[1], 32767);
 }
 
+// maxLevelPaletteSOA test: scaling the color table gives the same file as decoding, scaling and compressing
+TEST(MaxLevelImageSOATests, PaletteMatchesDecoded) {
+  SOAImage image;
+  image.width = 30;
+  image.height = 20;
+  image.max_color_value = 255;
+  for (int i = 0; i < 600; ++i) { // Many colors that merge at low levels
+    image.red1_components.push_back(static_cast<uint8_t>((i * 7) % 256));
+    image.green1_components.push_back(static_cast<uint8_t>(i % 256));
+    image.blue1_components.push_back(static_cast<uint8_t>((i * i) % 256));
+  }
+  std::stringstream compressed;
+  process_small_pixel_image(compressed, image);
+  for (int const level : {3, 100, 1000, 65535}) {
+    compressed.seekg(0);
+    PaletteImageSOA palette = read_palette_image(compressed);
+    maxLevelPaletteSOA(palette, level);
+    std::stringstream palette_file;
+    write_palette_image(palette_file, palette);
+
+    SOAImage const scaled = maxLevelImageSOA(image, level);
+    std::stringstream decoded_file;
+    if (level <= 255) { process_small_pixel_image(decoded_file, scaled); } else { process_large_pixel_image(decoded_file, scaled); }
+    EXPECT_EQ(palette_file.str(), decoded_file.str()) << "level " << level;
+  }
+}
+
+// applyPointOpsSOA test: a chain of maxlevel steps run in one pass gives the image of the steps run one by one
+TEST(MaxLevelImageSOATests, PointOpChainMatchesSteps) {
+  SOAImage image;
+  image.width = 30;
+  image.height = 20;
+  image.max_color_value = 255;
+  for (int i = 0; i < 600; ++i) {
+    image.red1_components.push_back(static_cast<uint8_t>((i * 7) % 256));
+    image.green1_components.push_back(static_cast<uint8_t>(i % 256));
+    image.blue1_components.push_back(static_cast<uint8_t>((i * i) % 256));
+  }
+  SOAImage const stepwise = maxLevelImageSOA(maxLevelImageSOA(maxLevelImageSOA(image, 40000), 1000), 100);
+  PointOpChain chain;
+  for (int const level : {40000, 1000, 100}) { addMaxLevelSOA(chain, level); }
+  SOAImage fused;
+  fused.red2_components.resize(7); // Stale buffer of the other bit depth, as in a reused image
+  applyPointOpsSOA(image, chain, fused);
+  EXPECT_EQ(fused.max_color_value, 100);
+  EXPECT_TRUE(fused.red2_components.empty());
+  EXPECT_EQ(fused.red1_components, stepwise.red1_components);
+  EXPECT_EQ(fused.green1_components, stepwise.green1_components);
+  EXPECT_EQ(fused.blue1_components, stepwise.blue1_components);
+  EXPECT_THROW(addMaxLevelSOA(chain, 65536), std::invalid_argument);
+}
+
+// maxLevelInPlaceSOA test: same image as the copying version, in the same vectors when their width is kept
+TEST(MaxLevelImageSOATests, InPlace) {
+  SOAImage image;
+  image.width = 30;
+  image.height = 20;
+  image.max_color_value = 255;
+  for (int i = 0; i < 600; ++i) {
+    image.red1_components.push_back(static_cast<uint8_t>((i * 7) % 256));
+    image.green1_components.push_back(static_cast<uint8_t>(i % 256));
+    image.blue1_components.push_back(static_cast<uint8_t>((i * i) % 256));
+  }
+  for (int const level : {100, 1000, 65535, 40000, 3}) {
+    SOAImage const expected = maxLevelImageSOA(image, level);
+    uint8_t const *red1 = image.red1_components.data();
+    uint16_t const *red2 = image.red2_components.data();
+    bool const sameWidth = (image.max_color_value <= 255) == (level <= 255);
+    maxLevelInPlaceSOA(image, level);
+    EXPECT_EQ(image.max_color_value, level);
+    if (sameWidth) { EXPECT_TRUE(image.red1_components.data() == red1 && image.red2_components.data() == red2); }
+    EXPECT_EQ(image.red1_components, expected.red1_components);
+    EXPECT_EQ(image.green2_components, expected.green2_components);
+    EXPECT_EQ(image.blue1_components, expected.blue1_components);
+    EXPECT_EQ(image.blue2_components, expected.blue2_components);
+  }
+}
+
+// maxLevelFileSOA test: the one-pass file to file maxlevel writes the same file as reading, scaling and writing,
+// for the four sample width combinations, with and without specialised kernels, across several blocks
+TEST(MaxLevelImageSOATests, FileMatchesDecoded) {
+  auto const readFile = [](const std::string &filename) {
+    std::ifstream file(filename, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+  };
+  for (auto const &[from, to] : {std::pair{255, 100}, std::pair{255, 65535}, std::pair{255, 1023}, std::pair{65535, 255},
+                                std::pair{4095, 65535}, std::pair{1000, 40000}, std::pair{1000, 7}}) {
+    SOAImage image;
+    image.width = 37;
+    image.height = 11;
+    image.max_color_value = from;
+    for (int i = 0; i < 37 * 11; ++i) {
+      auto const component = static_cast<uint16_t>((i * 7919) % (from + 1));
+      if (from <= 255) {
+        image.red1_components.push_back(static_cast<uint8_t>(component));
+        image.green1_components.push_back(static_cast<uint8_t>(from - component));
+        image.blue1_components.push_back(static_cast<uint8_t>(i % (from + 1)));
+      } else {
+        image.red2_components.push_back(component);
+        image.green2_components.push_back(static_cast<uint16_t>(from - component));
+        image.blue2_components.push_back(static_cast<uint16_t>(i % (from + 1)));
+      }
+    }
+    writeImageSOA("maxlevel_file_in_soa.ppm", image);
+    writeImageSOA("maxlevel_file_expected_soa.ppm", maxLevelImageSOA(image, to));
+    maxLevelFileSOA("maxlevel_file_in_soa.ppm", "maxlevel_file_out_soa.ppm", to);
+    EXPECT_EQ(readFile("maxlevel_file_out_soa.ppm"), readFile("maxlevel_file_expected_soa.ppm")) << from << " -> " << to;
+    stream_maxlevel("maxlevel_file_in_soa.ppm", "maxlevel_file_out_soa.ppm", to, 50); // Many blocks, the last one partial
+    EXPECT_EQ(readFile("maxlevel_file_out_soa.ppm"), readFile("maxlevel_file_expected_soa.ppm")) << from << " -> " << to;
+  }
+  EXPECT_THROW(maxLevelFileSOA("maxlevel_file_in_soa.ppm", "maxlevel_file_out_soa.ppm", 65536), std::invalid_argument);
+}
+
+// Specialised maxlevel kernels test: same components as the table of the generic path, in every direction
+TEST(MaxLevelImageSOATests, FastLevelConversionsMatchTable) {
+  for (const FastLevelConversion &conversion : FAST_LEVEL_CONVERSIONS) {
+    SOAImage image;
+    image.width = 64;
+    image.height = 64;
+    image.max_color_value = conversion.from;
+    std::vector<uint16_t> const table = maxLevelTable(conversion.from, conversion.to);
+    std::vector<uint16_t> components;
+    for (int i = 0; i < 64 * 64; ++i) { components.push_back(static_cast<uint16_t>((i * 7919) % (conversion.from + 1))); }
+    for (uint16_t const component : components) {
+      if (conversion.from <= 255) {
+        image.red1_components.push_back(static_cast<uint8_t>(component));
+      } else {
+        image.red2_components.push_back(component);
+      }
+    }
+    image.green1_components = image.red1_components;
+    image.blue1_components = image.red1_components;
+    image.green2_components = image.red2_components;
+    image.blue2_components = image.red2_components;
+    SOAImage const scaled = maxLevelImageSOA(image, conversion.to);
+    for (size_t i = 0; i < components.size(); ++i) {
+      int const result = conversion.to <= 255 ? scaled.blue1_components[i] : scaled.blue2_components[i];
+      ASSERT_EQ(result, table[components[i]]) << conversion.from << " -> " << conversion.to << " at " << i;
+    }
+  }
+}
+
+// ditherMaxLevelSOA test: lowering 16-bit components to one byte keeps their average, gives the same components
+// on any number of threads, and raising the level is a plain maxlevel
+TEST(MaxLevelImageSOATests, Dither) {
+  SOAImage image;
+  image.width = 64;
+  image.height = 32;
+  image.max_color_value = 65535;
+  double sum = 0.0;
+  for (int i = 0; i < 64 * 32; ++i) {
+    auto const red = static_cast<uint16_t>((i % 64) * 1040);
+    image.red2_components.push_back(red);
+    image.green2_components.push_back(static_cast<uint16_t>(65535 - red));
+    image.blue2_components.push_back(30000);
+    sum += red;
+  }
+  for (DitherMethod const method : {DitherMethod::floyd_steinberg, DitherMethod::bayer}) {
+    SOAImage single = image;
+    ditherMaxLevelSOA(single, 2, method, 1);
+    SOAImage threaded = image;
+    ditherMaxLevelSOA(threaded, 2, method, 5);
+    EXPECT_EQ(single.max_color_value, 2);
+    EXPECT_TRUE(single.red2_components.empty());
+    EXPECT_EQ(single.red1_components, threaded.red1_components);
+    EXPECT_EQ(single.blue1_components, threaded.blue1_components);
+    ASSERT_EQ(single.green1_components.size(), image.green2_components.size());
+    double dithered = 0.0;
+    for (uint8_t const level : single.red1_components) { dithered += level; }
+    EXPECT_NEAR(dithered / 2, sum / 65535, 0.02 * static_cast<double>(single.red1_components.size()));
+  }
+  SOAImage raised = image;
+  ditherMaxLevelSOA(raised, 65535, DitherMethod::floyd_steinberg);
+  EXPECT_EQ(raised.red2_components, maxLevelImageSOA(image, 65535).red2_components);
+  EXPECT_THROW(ditherMaxLevelSOA(raised, 65536, DitherMethod::bayer), std::invalid_argument);
+}
+
 // NOLINTEND(cppcoreguidelines-pro-type-reinterpret-cast)
 // NOLINTEND(readability-magic-numbers)
 // NOLINTEND(cppcoreguidelines-avoid-magic-numbers)
\ No newline at end of file
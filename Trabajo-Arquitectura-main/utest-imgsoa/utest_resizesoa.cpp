@@ -9,18 +9,18 @@ namespace {
   // Function to initialize a 3-byte image for testing:
   void ImageSOA3(SOAImage & image, std::vector<uint8_t>& reds,
                  std::vector<uint8_t>& greens, std::vector<uint8_t>& blues) {
-    image.red1_components   = reds;
-    image.green1_components = greens;
-    image.blue1_components  = blues;
+    image.red1_components.assign(reds.begin(), reds.end());
+    image.green1_components.assign(greens.begin(), greens.end());
+    image.blue1_components.assign(blues.begin(), blues.end());
     image.max_color_value   = 255;
   }
 
   // Function to initialize a 6-byte image for testing:
   void ImageSOA6(SOAImage & image, std::vector<uint16_t>& reds,
                  std::vector<uint16_t>& greens, std::vector<uint16_t>& blues) {
-    image.red2_components   = reds;
-    image.green2_components = greens;
-    image.blue2_components  = blues;
+    image.red2_components.assign(reds.begin(), reds.end());
+    image.green2_components.assign(greens.begin(), greens.end());
+    image.blue2_components.assign(blues.begin(), blues.end());
     image.max_color_value   = 65535;
   }
 }
@@ -74,9 +74,9 @@ TEST(ResizeSOATests, Interpolate8Bit) {
 };
   InterpolationCoords const coords{.x_l=0, .x_h=1, .y_l=0, .y_h=1, .x_weight=0.6, .y_weight=0.4}; // x_weight = 0.6, y_weight = 0.4
   // Define output vectors to store interpolated color values of a pixel:
-  std::vector<uint8_t> const red_output(1);
-  std::vector<uint8_t> const green_output(1);
-  std::vector<uint8_t> const blue_output(1);
+  PixelBuffer<uint8_t> red_output(1);
+  PixelBuffer<uint8_t> green_output(1);
+  PixelBuffer<uint8_t> blue_output(1);
   AuxPixelVectsref<uint8_t> outputComponents {.red=red_output, .green=green_output, .blue=blue_output};
 
   InterpolationParams const params{.index=0, .max_color_value=255}; // index = 0, max_color_value = 255
@@ -99,9 +99,9 @@ TEST(ResizeSOATests, Interpolate16Bit) {
 
   InterpolationCoords const coords{.x_l=0, .x_h=1, .y_l=0, .y_h=1, .x_weight=0.25, .y_weight=0.75}; // x_weight = 0.25, y_weight = 0.75
   // Define output vectors to store interpolated color values of a pixel:
-  std::vector<uint16_t> const red_output(1);
-  std::vector<uint16_t> const green_output(1);
-  std::vector<uint16_t> const blue_output(1);
+  PixelBuffer<uint16_t> red_output(1);
+  PixelBuffer<uint16_t> green_output(1);
+  PixelBuffer<uint16_t> blue_output(1);
   AuxPixelVectsref<uint16_t> outputComponents{.red=red_output, .green=green_output, .blue=blue_output};
 
   InterpolationParams const params{.index=0, .max_color_value=65535}; // index = 0, max_color_value = 65535
@@ -142,6 +142,8 @@ TEST(ResizeSOATests, ResizeLargeToSmall3) {
   std::vector<uint8_t> green = {0, 255, 0, 255, 255, 0, 255, 0, 0, 255, 0, 0, 255, 0, 0, 255};
   std::vector<uint8_t> blue = {0, 0, 255, 0, 255, 0, 255, 0, 0, 0, 255, 255, 0, 255, 0, 255};
   SOAImage inputImage; // Initialize testing image as an 8-bit SOA image.
+  inputImage.width = 4;
+  inputImage.height = 4;
   ImageSOA3(inputImage, red, green, blue);
   // Call the function we want to test.
   SOAImage outputImage = resizeImageSOA(inputImage, 2, 2);
@@ -149,9 +151,9 @@ TEST(ResizeSOATests, ResizeLargeToSmall3) {
   EXPECT_EQ(outputImage.width, 2);
   EXPECT_EQ(outputImage.height, 2);
   EXPECT_EQ(outputImage.max_color_value, 255);
-  // Check second pixel values, it should be (255, 0, 0)
+  // Check second pixel values: it falls on input pixel (3, 0), so it should be (255, 255, 0)
   EXPECT_EQ(outputImage.red1_components[1], 255);  // Expected interpolated values.
-  EXPECT_EQ(outputImage.green1_components[1], 0);
+  EXPECT_EQ(outputImage.green1_components[1], 255);
   EXPECT_EQ(outputImage.blue1_components[1], 0);
 }
 
@@ -247,6 +249,38 @@ TEST(ResizeSOATests, ResizeSmallToLarge6) {
     EXPECT_EQ(outputImage.blue2_components[15], 65535);
 }
 
+// Resize reads the input planes through views: the only full-image allocations are the three output planes, and
+// none at all when the output image is reused with enough capacity, as the pipeline does.
+TEST(ResizeSOATests, AllocatesOnlyTheOutput) {
+  std::vector<uint16_t> reds;
+  std::vector<uint16_t> greens;
+  std::vector<uint16_t> blues;
+  for (int i = 0; i < 64 * 48; ++i) {
+    reds.push_back(static_cast<uint16_t>(i * 13));
+    greens.push_back(static_cast<uint16_t>(i / 3));
+    blues.push_back(700);
+  }
+  SOAImage image;
+  image.width = 64;
+  image.height = 48;
+  ImageSOA6(image, reds, greens, blues);
+  SOAImage const &input = image;
+  PixelBufferStats const before = pixelBufferStats();
+  SOAImage const resized = resizeImageSOA(input, 32, 24);
+  PixelBufferStats const after = pixelBufferStats();
+  EXPECT_EQ(after.allocations - before.allocations, 3U);
+  EXPECT_EQ(after.allocated_bytes - before.allocated_bytes, 3 * 32 * 24 * sizeof(uint16_t));
+
+  SOAImage scratch;
+  resizeImageSOA(input, 40, 30, scratch);
+  PixelBufferStats const reused_before = pixelBufferStats();
+  resizeImageSOA(input, 32, 24, scratch);
+  EXPECT_EQ(pixelBufferStats().allocations, reused_before.allocations);
+  EXPECT_EQ(scratch.red2_components, resized.red2_components);
+  EXPECT_EQ(scratch.green2_components, resized.green2_components);
+  EXPECT_EQ(scratch.blue2_components, resized.blue2_components);
+}
+
 // NOLINTEND(cppcoreguidelines-pro-type-reinterpret-cast)
 // NOLINTEND(readability-magic-numbers)
 // NOLINTEND(cppcoreguidelines-avoid-magic-numbers)
\ No newline at end of file